@@ -0,0 +1,492 @@
+#include "image.h"
+
+/* Fixed inputs shared by all microbenchmarks */
+typedef struct
+{
+	Image* img;		/* noisy synthetic image */
+	int* packed;		/* IMG packed as 0xRRGGBB */
+	int width;
+	int num_pixels;
+	int num_calls;		/* elements of the per-call arrays below */
+	int alpha;
+	float sigma;		/* 2 * sigma^2, as passed to the weight kernel */
+	int* pos;		/* center of the 3x3 patch */
+	float* color;		/* r, g, b of the pixel being weighted */
+	float* central;		/* current estimate of the center pixel */
+	float* dists;		/* the 9 patch distances, as in the weight kernel */
+	float* exp_args;	/* arguments of expf in the weight kernel */
+} MicroInput;
+
+typedef void (*MicroFunc)(const MicroInput* in, float* out);
+
+typedef struct
+{
+	const char* group;	/* function under test; the first entry is the reference */
+	const char* name;
+	int per_pixel;		/* one element per pixel instead of per call */
+	MicroFunc func;
+} MicroBench;
+
+/* ---- alpha selection ---------------------------------------------------- */
+
+static void select_scan(const MicroInput* in, float* out)
+{
+	for (int k = 0; k < in->num_calls; k++)
+	{
+		float w[9];
+
+		memcpy(w, in->dists + 9 * k, sizeof(w));
+		out[k] = sum_smallest_rlsf(w, in->alpha);
+	}
+}
+
+/* Keeps the ALPHA smallest in a sorted buffer; sums them in the same order as the scan */
+static float sum_smallest_insertion(const float* w, const int alpha)
+{
+	float best[9];
+	float sum = 0;
+	int n = 0;
+
+	for (int j = 0; j < 9; j++)
+	{
+		int i = n < alpha ? n++ : alpha;
+
+		if (i == alpha && !(w[j] < best[alpha - 1]))
+			continue;
+		if (i == alpha)
+			i--;
+		while (i > 0 && w[j] < best[i - 1])
+		{
+			best[i] = best[i - 1];
+			i--;
+		}
+		best[i] = w[j];
+	}
+
+	for (int i = 0; i < n; i++)
+		sum += best[i];
+	return sum;
+}
+
+static void select_insertion(const MicroInput* in, float* out)
+{
+	for (int k = 0; k < in->num_calls; k++)
+		out[k] = sum_smallest_insertion(in->dists + 9 * k, in->alpha);
+}
+
+/* ---- exp ---------------------------------------------------------------- */
+
+static void exp_libm(const MicroInput* in, float* out)
+{
+	for (int k = 0; k < in->num_calls; k++)
+		out[k] = expf(in->exp_args[k]);
+}
+
+/* 2^n from the exponent bits times a degree-5 polynomial for 2^f */
+static float exp_poly(const float x)
+{
+	float t, fi, f, p, scale;
+	int bits;
+
+	if (x < -87.0f)
+		return 0.0f;
+
+	t = x * 1.44269504f;
+	fi = floorf(t);
+	f = t - fi;
+	p = 1.0f + f * (0.69314718f + f * (0.24022651f + f * (0.05550411f + f * (0.00961813f + f * 0.00133336f))));
+	bits = ((int)fi + 127) << 23;
+	memcpy(&scale, &bits, sizeof(scale));
+	return p * scale;
+}
+
+static void exp_polynomial(const MicroInput* in, float* out)
+{
+	for (int k = 0; k < in->num_calls; k++)
+		out[k] = exp_poly(in->exp_args[k]);
+}
+
+/* Schraudolph (1999): the scaled argument written straight into the float bits */
+static void exp_schraudolph(const MicroInput* in, float* out)
+{
+	for (int k = 0; k < in->num_calls; k++)
+	{
+		float x = in->exp_args[k];
+		int bits = x < -87.0f ? 0 : (int)(12102203.0f * x + 1065353216.0f);
+
+		memcpy(out + k, &bits, sizeof(float));
+	}
+}
+
+/* ---- weight ------------------------------------------------------------- */
+
+static void weight_ref(const MicroInput* in, float* out)
+{
+	for (int k = 0; k < in->num_calls; k++)
+	{
+		float central[3];
+
+		memcpy(central, in->central + 3 * k, sizeof(central));
+		out[k] = compute_weight_ms_rlsf(in->packed, in->width, in->color[3 * k], in->color[3 * k + 1],
+			in->color[3 * k + 2], in->pos[k], in->alpha, in->sigma, central);
+	}
+}
+
+/* The reference kernel with the insertion selection */
+static void weight_insertion(const MicroInput* in, float* out)
+{
+	for (int k = 0; k < in->num_calls; k++)
+	{
+		float w[9];
+		float r = in->color[3 * k], g = in->color[3 * k + 1], b = in->color[3 * k + 2];
+		int a = 0;
+
+		for (int i = -1; i <= 1; i++)
+			for (int j = -1; j <= 1; j++)
+			{
+				float r1, g1, b1;
+
+				if (i == 0 && j == 0)
+				{
+					r1 = in->central[3 * k];
+					g1 = in->central[3 * k + 1];
+					b1 = in->central[3 * k + 2];
+				}
+				else
+				{
+					int v = in->packed[in->pos[k] + i * in->width + j];
+
+					r1 = (v & 0XFF0000) >> 16;
+					g1 = (v & 0XFF00) >> 8;
+					b1 = (v & 0XFF);
+				}
+				w[a++] = (r - r1) * (r - r1) + (g - g1) * (g - g1) + (b - b1) * (b - b1);
+			}
+
+		out[k] = expf(-(sum_smallest_insertion(w, in->alpha) / (float)in->alpha / in->sigma));
+	}
+}
+
+/* ---- pack / unpack ------------------------------------------------------ */
+
+static int* pack_buf;
+static Image* unpack_img;
+
+static void pack_nd(const MicroInput* in, float* out)
+{
+	pack_img_rlsf(in->img, pack_buf);
+	for (int k = 0; k < in->num_pixels; k++)
+		out[k] = (float)pack_buf[k];
+}
+
+static void pack_flat(const MicroInput* in, float* out)
+{
+	const byte* data = (const byte*)get_img_data_1d(in->img);
+
+	for (int k = 0; k < in->num_pixels; k++)
+		pack_buf[k] = (data[3 * k] << 16) | (data[3 * k + 1] << 8) | data[3 * k + 2];
+	for (int k = 0; k < in->num_pixels; k++)
+		out[k] = (float)pack_buf[k];
+}
+
+static void unpack_nd(const MicroInput* in, float* out)
+{
+	const byte* data = (const byte*)get_img_data_1d(unpack_img);
+
+	unpack_img_rlsf(in->packed, unpack_img);
+	for (int k = 0; k < in->num_pixels; k++)
+		out[k] = (float)((data[3 * k] << 16) | (data[3 * k + 1] << 8) | data[3 * k + 2]);
+}
+
+static void unpack_flat(const MicroInput* in, float* out)
+{
+	byte* data = (byte*)get_img_data_1d(unpack_img);
+
+	for (int k = 0; k < in->num_pixels; k++)
+	{
+		int v = in->packed[k];
+
+		data[3 * k] = (v >> 16) & 0xFF;
+		data[3 * k + 1] = (v >> 8) & 0xFF;
+		data[3 * k + 2] = v & 0xFF;
+	}
+	for (int k = 0; k < in->num_pixels; k++)
+		out[k] = (float)((data[3 * k] << 16) | (data[3 * k + 1] << 8) | data[3 * k + 2]);
+}
+
+/* Alternatives of a function are listed together, the reference first */
+static const MicroBench benches[] = {
+	{ "weight", "ref", 0, weight_ref },
+	{ "weight", "insertion", 0, weight_insertion },
+	{ "select_alpha", "scan", 0, select_scan },
+	{ "select_alpha", "insertion", 0, select_insertion },
+	{ "exp", "expf", 0, exp_libm },
+	{ "exp", "poly5", 0, exp_polynomial },
+	{ "exp", "schraudolph", 0, exp_schraudolph },
+	{ "pack", "nd", 1, pack_nd },
+	{ "pack", "flat", 1, pack_flat },
+	{ "unpack", "nd", 1, unpack_nd },
+	{ "unpack", "flat", 1, unpack_flat }
+};
+
+#define NUM_BENCHES ((int) (sizeof(benches) / sizeof(benches[0])))
+
+static void usage(const char* prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -s size        side of the test image (default 256)\n"
+		"  -N calls       inputs per call-level benchmark (default 16384)\n"
+		"  -a alpha       alpha of the weight kernel (default 3)\n"
+		"  -g sigma       sigma of the filter (default 50)\n"
+		"  -k runs        timed runs per benchmark (default 11)\n"
+		"  -r reps        calls of the benchmark per run (default 20)\n"
+		"  -S seed        seed of the inputs (default 1)\n"
+		"  -f group       run only this group (weight, select_alpha, exp, pack, unpack)\n"
+		"  -o file        write the JSON results to FILE instead of stdout\n"
+		"  -b file        compare with a baseline written by -o\n"
+		"  -T tolerance   allowed relative slowdown of the median (default 0.05)\n",
+		prog);
+	exit(EXIT_FAILURE);
+}
+
+/* Next value of a 32-bit LCG, in [ 0, 1 ) */
+static double next_unit(unsigned int* state)
+{
+	*state = *state * 1664525U + 1013904223U;
+	return *state / 4294967296.0;
+}
+
+/* Draws the call-level inputs the way the filter produces them */
+static int init_input(MicroInput* in, const int size, const int num_calls, const int alpha, const float sigma, const unsigned long seed)
+{
+	unsigned int state = (unsigned int)seed;
+	Image* clean_img = make_synthetic_img(size, size, seed);
+
+	if (clean_img == NULL)
+		return E_FAILURE;
+	set_noise_seed(seed);
+	in->img = add_saltpepper_noise(clean_img, 0.2);
+	free_img(clean_img);
+	free(clean_img);
+	if (in->img == NULL)
+		return E_FAILURE;
+
+	in->width = size;
+	in->num_pixels = size * size;
+	in->num_calls = num_calls;
+	in->alpha = alpha;
+	in->sigma = 2 * sigma * sigma;
+	in->packed = (int*)malloc(in->num_pixels * sizeof(int));
+	in->pos = (int*)malloc(num_calls * sizeof(int));
+	in->color = (float*)malloc(3 * num_calls * sizeof(float));
+	in->central = (float*)malloc(3 * num_calls * sizeof(float));
+	in->dists = (float*)malloc(9 * num_calls * sizeof(float));
+	in->exp_args = (float*)malloc(num_calls * sizeof(float));
+	if (in->packed == NULL || in->pos == NULL || in->color == NULL || in->central == NULL ||
+	    in->dists == NULL || in->exp_args == NULL)
+		return E_NOMEM;
+
+	pack_img_rlsf(in->img, in->packed);
+
+	for (int k = 0; k < num_calls; k++)
+	{
+		/* a patch center and a pixel of the block around it, both off the frame */
+		int ir = 1 + (int)((size - 2) * next_unit(&state));
+		int ic = 1 + (int)((size - 2) * next_unit(&state));
+		int qr = MIN_2(MAX_2(ir - 2 + (int)(5 * next_unit(&state)), 1), size - 2);
+		int qc = MIN_2(MAX_2(ic - 2 + (int)(5 * next_unit(&state)), 1), size - 2);
+		int q = in->packed[qr * size + qc];
+		int c = in->packed[ir * size + ic];
+		float w[9];
+		int a = 0;
+
+		in->pos[k] = ir * size + ic;
+		in->color[3 * k] = (q >> 16) & 0xFF;
+		in->color[3 * k + 1] = (q >> 8) & 0xFF;
+		in->color[3 * k + 2] = q & 0xFF;
+		/* after the first pass the center is a non-integer estimate */
+		in->central[3 * k] = ((c >> 16) & 0xFF) + (float)next_unit(&state) - 0.5f;
+		in->central[3 * k + 1] = ((c >> 8) & 0xFF) + (float)next_unit(&state) - 0.5f;
+		in->central[3 * k + 2] = (c & 0xFF) + (float)next_unit(&state) - 0.5f;
+
+		for (int i = -1; i <= 1; i++)
+			for (int j = -1; j <= 1; j++)
+			{
+				float r1, g1, b1;
+				float* d = in->color + 3 * k;
+
+				if (i == 0 && j == 0)
+				{
+					r1 = in->central[3 * k];
+					g1 = in->central[3 * k + 1];
+					b1 = in->central[3 * k + 2];
+				}
+				else
+				{
+					int v = in->packed[in->pos[k] + i * size + j];
+
+					r1 = (v & 0XFF0000) >> 16;
+					g1 = (v & 0XFF00) >> 8;
+					b1 = (v & 0XFF);
+				}
+				in->dists[9 * k + a++] = (d[0] - r1) * (d[0] - r1) + (d[1] - g1) * (d[1] - g1) + (d[2] - b1) * (d[2] - b1);
+			}
+
+		memcpy(w, in->dists + 9 * k, sizeof(w));
+		in->exp_args[k] = -(sum_smallest_rlsf(w, alpha) / (float)alpha / in->sigma);
+	}
+
+	return E_SUCCESS;
+}
+
+int main(int argc, char** argv)
+{
+	MicroInput in;
+	int size = 256;
+	int num_calls = 16384;
+	int alpha = 3;
+	float sigma = 50;
+	int num_runs = 11;
+	int num_reps = 20;
+	unsigned long seed = 1;
+	const char* group = NULL;
+	const char* out_file = NULL;
+	const char* baseline_file = NULL;
+	double tolerance = 0.05;
+	int num_results = 0;
+	int ref = 0;
+	int status = EXIT_SUCCESS;
+	double* times;
+	double* cycles;
+	float* ref_out;
+	float* out;
+	BenchResult* results;
+	FILE* fp;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0' || i + 1 >= argc)
+			usage(argv[0]);
+
+		switch (argv[i][1])
+		{
+			case 's': size = atoi(argv[++i]); break;
+			case 'N': num_calls = atoi(argv[++i]); break;
+			case 'a': alpha = atoi(argv[++i]); break;
+			case 'g': sigma = atof(argv[++i]); break;
+			case 'k': num_runs = atoi(argv[++i]); break;
+			case 'r': num_reps = atoi(argv[++i]); break;
+			case 'S': seed = strtoul(argv[++i], NULL, 10); break;
+			case 'f': group = argv[++i]; break;
+			case 'o': out_file = argv[++i]; break;
+			case 'b': baseline_file = argv[++i]; break;
+			case 'T': tolerance = atof(argv[++i]); break;
+			default: usage(argv[0]);
+		}
+	}
+
+	if (size < 3 || num_calls <= 0 || alpha < 1 || alpha > 9 || sigma <= 0 || num_runs <= 0 || num_reps <= 0)
+		usage(argv[0]);
+
+	memset(&in, 0, sizeof(in));
+	if (init_input(&in, size, num_calls, alpha, sigma, seed) != E_SUCCESS)
+	{
+		fprintf(stderr, "Cannot set up the inputs !\n");
+		exit(EXIT_FAILURE);
+	}
+
+	pack_buf = (int*)malloc(in.num_pixels * sizeof(int));
+	unpack_img = alloc_img(PIX_RGB, size, size);
+	times = (double*)malloc(num_runs * sizeof(double));
+	cycles = (double*)malloc(num_runs * sizeof(double));
+	ref_out = (float*)malloc(MAX_2(num_calls, in.num_pixels) * sizeof(float));
+	out = (float*)malloc(MAX_2(num_calls, in.num_pixels) * sizeof(float));
+	results = (BenchResult*)calloc(NUM_BENCHES, sizeof(BenchResult));
+	if (pack_buf == NULL || unpack_img == NULL || times == NULL || cycles == NULL ||
+	    ref_out == NULL || out == NULL || results == NULL)
+	{
+		fprintf(stderr, "Insufficient memory !\n");
+		exit(EXIT_FAILURE);
+	}
+
+	fprintf(stderr, "%-13s %-12s %10s %12s %8s %12s %12s\n", "group", "name", "ns/elem", "cycles/elem", "speedup", "max abs err", "max rel err");
+	for (int ib = 0; ib < NUM_BENCHES; ib++)
+	{
+		const MicroBench* b = benches + ib;
+		BenchResult* res;
+		BenchStats cycle_stats;
+		int num_elems = b->per_pixel ? in.num_pixels : num_calls;
+		int is_ref = ib == 0 || strcmp(b->group, benches[ib - 1].group) != 0;
+		double max_abs = 0.0, max_rel = 0.0;
+
+		if (group != NULL && strcmp(group, b->group) != 0)
+			continue;
+
+		/* warm-up run, also the output compared with the reference */
+		b->func(&in, out);
+		if (is_ref)
+		{
+			memcpy(ref_out, out, num_elems * sizeof(float));
+			ref = num_results;
+		}
+		for (int k = 0; k < num_elems; k++)
+		{
+			double err = fabs((double)out[k] - ref_out[k]);
+
+			max_abs = MAX_2(max_abs, err);
+			if (ref_out[k] != 0)
+				max_rel = MAX_2(max_rel, err / fabs((double)ref_out[k]));
+		}
+
+		for (int ir = 0; ir < num_runs; ir++)
+		{
+			double start_cycles = get_cycle_count();
+			double start = get_wall_time();
+
+			for (int it = 0; it < num_reps; it++)
+				b->func(&in, out);
+			times[ir] = get_wall_time() - start;
+			cycles[ir] = get_cycle_count() - start_cycles;
+		}
+
+		res = results + num_results++;
+		snprintf(res->name, BENCH_NAME_LEN, "%s/%s", b->group, b->name);
+		res->num_threads = 1;
+		res->num_pixels = num_elems;
+		res->num_iters = num_reps;
+		calc_bench_stats(num_runs, times, &res->stats);
+		calc_bench_stats(num_runs, cycles, &cycle_stats);
+		res->cycles = cycle_stats.median;
+
+		fprintf(stderr, "%-13s %-12s %10.3f %12.2f %7.2fx %12.4g %12.4g\n", b->group, b->name,
+			1e9 * res->stats.median / ((double)num_elems * num_reps), res->cycles / ((double)num_elems * num_reps),
+			results[ref].stats.median / res->stats.median, max_abs, max_rel);
+	}
+
+	fp = out_file != NULL ? fopen(out_file, "w") : stdout;
+	if (fp == NULL)
+	{
+		fprintf(stderr, "Cannot open %s !\n", out_file);
+		exit(EXIT_FAILURE);
+	}
+	if (write_bench_json(fp, "micro_rlsf", results, num_results) != E_SUCCESS)
+		status = EXIT_FAILURE;
+	if (fp != stdout)
+		fclose(fp);
+
+	if (baseline_file != NULL)
+	{
+		int num_regressions = compare_bench_results(baseline_file, results, num_results, tolerance, stderr);
+
+		if (num_regressions < 0)
+			status = EXIT_FAILURE;
+		else if (num_regressions > 0)
+		{
+			fprintf(stderr, "%d regression(s) beyond %.1f%%\n", num_regressions, 100.0 * tolerance);
+			status = 2;
+		}
+	}
+
+	return status;
+}
@@ -0,0 +1,301 @@
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "image.h"
+
+#define MAX_LIST_LEN 32
+
+typedef Image* (*FilterFunc)(const Image*, const int, int, const float, const int);
+
+typedef struct
+{
+	const char* name;
+	FilterFunc func;
+} Kernel;
+
+/* Kernels under test; alternatives are added here */
+#ifdef CUDA
+static const Kernel kernels[] = { { "cuda_ms_rlsf", CUDA_filter_ms_rlsf } };
+#else
+static const Kernel kernels[] = { { "ms_rlsf", filter_ms_rlsf } };
+#endif
+
+#define NUM_KERNELS ((int) (sizeof(kernels) / sizeof(kernels[0])))
+
+static void usage(const char* prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -s sizes       image sizes, N or RxC, comma separated (default 256,512)\n"
+		"  -n probs       salt & pepper noise probabilities in [0,1] (default 0.1,0.3)\n"
+		"  -p params      r:alpha:sigma:iter sets, comma separated (default 2:3:50:10)\n"
+		"  -t threads     thread counts (default 1 and the maximum)\n"
+		"  -k runs        timed runs per configuration (default 5)\n"
+		"  -w runs        untimed warm-up runs (default 1)\n"
+		"  -S seed        seed of the images and the noise (default 1)\n"
+		"  -o file        write the JSON results to FILE instead of stdout\n"
+		"  -b file        compare with a baseline written by -o\n"
+		"  -T tolerance   allowed relative slowdown of the median (default 0.05)\n"
+		"  -P             print hardware counter statistics per stage to stderr\n"
+		"  -L file        write a Chrome trace timeline of the threads to FILE\n",
+		prog);
+	exit(EXIT_FAILURE);
+}
+
+/* Parses N or RxC; returns 0 unless the whole item is a positive size */
+static int parse_size(const char* item, int* size)
+{
+	char* end;
+
+	size[0] = (int)strtol(item, &end, 10);
+	size[1] = size[0];
+	if (end != item && *end == 'x')
+	{
+		const char* cols = end + 1;
+
+		size[1] = (int)strtol(cols, &end, 10);
+		if (end == cols)
+			return 0;
+	}
+	return end != item && *end == '\0' && size[0] > 0 && size[1] > 0;
+}
+
+/* Parses a probability; returns 0 unless the whole item is a number in [0,1] */
+static int parse_prob(const char* item, double* prob)
+{
+	char* end;
+
+	*prob = strtod(item, &end);
+	return end != item && *end == '\0' && *prob >= 0.0 && *prob <= 1.0;
+}
+
+/* Splits a comma separated list; returns the number of items */
+static int split_list(char* str, char** items)
+{
+	int num_items = 0;
+	char* item;
+
+	for (item = strtok(str, ","); item != NULL && num_items < MAX_LIST_LEN; item = strtok(NULL, ","))
+		items[num_items++] = item;
+
+	return num_items;
+}
+
+int main(int argc, char** argv)
+{
+	char* items[MAX_LIST_LEN];
+	char default_sizes[] = "256,512";
+	char default_noise[] = "0.1,0.3";
+	char default_params[] = "2:3:50:10";
+	char* size_list = default_sizes;
+	char* noise_list = default_noise;
+	char* param_list = default_params;
+	char* thread_list = NULL;
+	const char* out_file = NULL;
+	const char* baseline_file = NULL;
+	const char* timeline_file = NULL;
+	unsigned long seed = 1;
+	double tolerance = 0.05;
+	int num_runs = 5;
+	int num_warmup = 1;
+	int sizes[MAX_LIST_LEN][2];
+	double noise[MAX_LIST_LEN];
+	int params_i[MAX_LIST_LEN][3];	/* r, alpha, iter */
+	float params_sigma[MAX_LIST_LEN];
+	int threads[MAX_LIST_LEN];
+	int num_sizes, num_noise, num_params, num_threads;
+	int max_results, num_results = 0;
+	int status = EXIT_SUCCESS;
+	int perf_stats = 0;
+	double* times;
+	BenchResult* results;
+	FILE* out;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-P"))
+		{
+			perf_stats = 1;
+			continue;
+		}
+		if (argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0' || i + 1 >= argc)
+			usage(argv[0]);
+
+		switch (argv[i][1])
+		{
+			case 's': size_list = argv[++i]; break;
+			case 'n': noise_list = argv[++i]; break;
+			case 'p': param_list = argv[++i]; break;
+			case 't': thread_list = argv[++i]; break;
+			case 'k': num_runs = atoi(argv[++i]); break;
+			case 'w': num_warmup = atoi(argv[++i]); break;
+			case 'S': seed = strtoul(argv[++i], NULL, 10); break;
+			case 'o': out_file = argv[++i]; break;
+			case 'b': baseline_file = argv[++i]; break;
+			case 'T': tolerance = atof(argv[++i]); break;
+			case 'L': timeline_file = argv[++i]; break;
+			default: usage(argv[0]);
+		}
+	}
+
+	num_sizes = split_list(size_list, items);
+	for (int i = 0; i < num_sizes; i++)
+		if (!parse_size(items[i], sizes[i]))
+			usage(argv[0]);
+
+	num_noise = split_list(noise_list, items);
+	for (int i = 0; i < num_noise; i++)
+		if (!parse_prob(items[i], &noise[i]))
+			usage(argv[0]);
+
+	num_params = split_list(param_list, items);
+	for (int i = 0; i < num_params; i++)
+	{
+		if (sscanf(items[i], "%d:%d:%f:%d", &params_i[i][0], &params_i[i][1], &params_sigma[i], &params_i[i][2]) != 4)
+			usage(argv[0]);
+	}
+
+	if (thread_list != NULL)
+	{
+		num_threads = split_list(thread_list, items);
+		for (int i = 0; i < num_threads; i++)
+			threads[i] = MAX_2(atoi(items[i]), 1);
+	}
+	else
+	{
+		threads[0] = 1;
+		num_threads = 1;
+#ifdef _OPENMP
+		if (omp_get_max_threads() > 1)
+			threads[num_threads++] = omp_get_max_threads();
+#endif
+	}
+
+	if (num_sizes == 0 || num_noise == 0 || num_params == 0 || num_threads == 0 || num_runs <= 0 || num_warmup < 0)
+		usage(argv[0]);
+
+	max_results = num_sizes * num_noise * num_params * NUM_KERNELS * num_threads;
+	results = (BenchResult*) calloc(max_results, sizeof(BenchResult));
+	times = (double*) malloc(num_runs * sizeof(double));
+	if (results == NULL || times == NULL)
+	{
+		fprintf(stderr, "Insufficient memory !\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (perf_stats)
+		enable_perf_stats();
+	if (timeline_file != NULL)
+		enable_timeline(1 << 20);
+
+	for (int is = 0; is < num_sizes; is++)
+	{
+		Image* clean_img = make_synthetic_img(sizes[is][0], sizes[is][1], seed);
+
+		if (clean_img == NULL)
+			exit(EXIT_FAILURE);
+
+		for (int in = 0; in < num_noise; in++)
+		{
+			Image* noisy_img;
+
+			/* the same seed gives the same noisy image in every run of the bench */
+			set_noise_seed(seed);
+			noisy_img = add_saltpepper_noise(clean_img, noise[in]);
+			if (noisy_img == NULL)
+				exit(EXIT_FAILURE);
+
+			for (int ip = 0; ip < num_params; ip++)
+			{
+				for (int ik = 0; ik < NUM_KERNELS; ik++)
+				{
+					int first = num_results;
+
+					for (int it = 0; it < num_threads; it++)
+					{
+						BenchResult* res = results + num_results++;
+
+#ifdef _OPENMP
+						omp_set_num_threads(threads[it]);
+#endif
+						for (int ir = 0; ir < num_warmup + num_runs; ir++)
+						{
+							double start = get_wall_time();
+							Image* out_img = kernels[ik].func(noisy_img, params_i[ip][0], params_i[ip][1], params_sigma[ip], params_i[ip][2]);
+							double elapsed = get_wall_time() - start;
+
+							if (out_img == NULL)
+								exit(EXIT_FAILURE);
+							free_img(out_img);
+							free(out_img);
+							if (ir >= num_warmup)
+								times[ir - num_warmup] = elapsed;
+						}
+
+						snprintf(res->name, BENCH_NAME_LEN, "%s/%dx%d/p%.2f/r%d_a%d_s%g_i%d/t%d",
+							kernels[ik].name, sizes[is][0], sizes[is][1], noise[in], params_i[ip][0],
+							params_i[ip][1], params_sigma[ip], params_i[ip][2], threads[it]);
+						res->num_threads = threads[it];
+						res->num_pixels = (double) sizes[is][0] * sizes[is][1];
+						res->num_iters = params_i[ip][2];
+						calc_bench_stats(num_runs, times, &res->stats);
+
+						/* speedup over the first thread count, per added thread */
+						res->efficiency = res->stats.median > 0.0 ?
+							results[first].stats.median * results[first].num_threads / (res->stats.median * res->num_threads) : 0.0;
+
+						fprintf(stderr, "%-48s median %10.3f ms  p95 %10.3f ms  %8.2f Mpix/s\n", res->name,
+							1e3 * res->stats.median, 1e3 * res->stats.p95, 1e-6 * res->num_pixels / res->stats.median);
+					}
+				}
+			}
+
+			free_img(noisy_img);
+			free(noisy_img);
+		}
+
+		free_img(clean_img);
+		free(clean_img);
+	}
+
+	out = out_file != NULL ? fopen(out_file, "w") : stdout;
+	if (out == NULL)
+	{
+		fprintf(stderr, "Cannot open %s !\n", out_file);
+		exit(EXIT_FAILURE);
+	}
+	if (write_bench_json(out, "ms_rlsf", results, num_results) != E_SUCCESS)
+		status = EXIT_FAILURE;
+	if (out != stdout)
+		fclose(out);
+
+	if (baseline_file != NULL)
+	{
+		int num_regressions = compare_bench_results(baseline_file, results, num_results, tolerance, stderr);
+
+		if (num_regressions < 0)
+			status = EXIT_FAILURE;
+		else if (num_regressions > 0)
+		{
+			fprintf(stderr, "%d regression(s) beyond %.1f%%\n", num_regressions, 100.0 * tolerance);
+			status = 2;
+		}
+	}
+
+	if (perf_stats)
+	{
+		/* covers the warm-up runs too */
+		print_perf_stats(stderr);
+		disable_perf_stats();
+	}
+	if (timeline_file != NULL)
+	{
+		if (write_timeline_json(timeline_file) != E_SUCCESS)
+			status = EXIT_FAILURE;
+		disable_timeline();
+	}
+
+	free(times);
+	free(results);
+	return status;
+}
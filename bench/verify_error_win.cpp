@@ -0,0 +1,226 @@
+#include <omp.h>
+#include "image.h"
+
+/*
+ * Checks calc_error_win against a naive loop that sums every window from
+ * scratch, with one thread and with all of them. The test images have a
+ * black half, whose windows have zero original energy and must be skipped
+ * by NMSE and NCD however the running sums were accumulated.
+ */
+
+static const char* meas_names[] = { "", "MAE", "MSE", "RMSE", "PSNR", "NMSE", "NCD" };
+
+/* sRGB (D65) to CIELAB, computed directly for every pixel */
+static void naive_lab(int red, int green, int blue, double* lab)
+{
+	static const double rgb_to_xyz[3][3] = {
+		{ 0.4124564, 0.3575761, 0.1804375 },
+		{ 0.2126729, 0.7151522, 0.0721750 },
+		{ 0.0193339, 0.1191920, 0.9503041 }
+	};
+	static const double white[3] = { 0.95047, 1.0, 1.08883 };
+	int rgb[3] = { red, green, blue };
+	double lin[3], f[3];
+
+	for (int b = 0; b < 3; b++)
+	{
+		double c = rgb[b] / 255.0;
+		lin[b] = c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+	}
+	for (int c = 0; c < 3; c++)
+	{
+		double t = (rgb_to_xyz[c][0] * lin[0] + rgb_to_xyz[c][1] * lin[1] + rgb_to_xyz[c][2] * lin[2]) / white[c];
+		f[c] = t > 216.0 / 24389.0 ? pow(t, 1.0 / 3.0) : (24389.0 / 27.0 * t + 16.0) / 116.0;
+	}
+	lab[0] = 116.0 * f[1] - 16.0;
+	lab[1] = 500.0 * (f[0] - f[1]);
+	lab[2] = 200.0 * (f[1] - f[2]);
+}
+
+static double naive_error_win(ErrorMeasure err_meas, const Image* orig_img, const Image* est_img, int win_size)
+{
+	const byte* o = (const byte*)get_img_data_1d(orig_img);
+	const byte* e = (const byte*)get_img_data_1d(est_img);
+	int num_rows = get_num_rows(orig_img);
+	int num_cols = get_num_cols(orig_img);
+	int num_bands = get_num_bands(orig_img);
+	double win_samples = (double)win_size * win_size * num_bands;
+	double sum_err = 0.0;
+	long num_valid = 0;
+
+	for (int y = 0; y + win_size <= num_rows; y++)
+		for (int x = 0; x + win_size <= num_cols; x++)
+		{
+			double num = 0.0, den = 0.0, err;
+
+			for (int wy = y; wy < y + win_size; wy++)
+				for (int wx = x; wx < x + win_size; wx++)
+				{
+					const byte* op = o + ((size_t)wy * num_cols + wx) * num_bands;
+					const byte* ep = e + ((size_t)wy * num_cols + wx) * num_bands;
+
+					if (err_meas == EM_NCD)
+					{
+						int g = num_bands == 3 ? 1 : 0, b = num_bands == 3 ? 2 : 0;
+						double lab_o[3], lab_e[3];
+
+						naive_lab(op[0], op[g], op[b], lab_o);
+						naive_lab(ep[0], ep[g], ep[b], lab_e);
+						num += sqrt((lab_o[0] - lab_e[0]) * (lab_o[0] - lab_e[0]) + (lab_o[1] - lab_e[1]) * (lab_o[1] - lab_e[1]) +
+							(lab_o[2] - lab_e[2]) * (lab_o[2] - lab_e[2]));
+						/* black comes out as a rounding residue, not 0 */
+						if (op[0] != 0 || op[g] != 0 || op[b] != 0)
+							den += sqrt(lab_o[0] * lab_o[0] + lab_o[1] * lab_o[1] + lab_o[2] * lab_o[2]);
+						continue;
+					}
+					for (int b = 0; b < num_bands; b++)
+					{
+						int diff = op[b] - ep[b];
+
+						num += err_meas == EM_MAE ? abs(diff) : diff * diff;
+						den += op[b] * op[b];
+					}
+				}
+
+			if ((err_meas == EM_PSNR && num == 0.0) || ((err_meas == EM_NMSE || err_meas == EM_NCD) && den == 0.0))
+				continue;
+			switch (err_meas)
+			{
+				case EM_MAE: case EM_MSE: err = num / win_samples; break;
+				case EM_RMSE: err = sqrt(num / win_samples); break;
+				case EM_PSNR: err = 10.0 * log10(255.0 * 255.0 / (num / win_samples)); break;
+				default: err = num / den;
+			}
+			sum_err += err;
+			num_valid++;
+		}
+
+	if (num_valid == 0)
+		return err_meas == EM_PSNR ? HUGE_VAL : 0.0;
+	return sum_err / num_valid;
+}
+
+/* An image of NUM_ROWS x NUM_COLS whose lower half is black */
+static Image* make_half_black_img(PixelType pix_type, int num_rows, int num_cols, unsigned long seed)
+{
+	Image* img = alloc_img(pix_type, num_rows, num_cols);
+	int num_bands = pix_type == PIX_RGB ? 3 : 1;
+
+	if (img == NULL)
+		return NULL;
+	byte* data = (byte*)get_img_data_1d(img);
+	for (int y = 0; y < num_rows; y++)
+		for (int k = 0; k < num_cols * num_bands; k++)
+		{
+			seed = seed * 1103515245UL + 12345UL;
+			data[(size_t)y * num_cols * num_bands + k] = y < num_rows / 2 ? (byte)(32 + (seed >> 16) % 192) : 0;
+		}
+	return img;
+}
+
+static void usage(const char* prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -s sizes       image sizes, N or RxC, comma separated (default 64,37x53)\n"
+		"  -w windows     window sizes, comma separated (default 1,5,9)\n"
+		"  -t threads     thread count of the parallel run (default all)\n"
+		"  -S seed        seed of the images and the noise (default 1)\n",
+		prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv)
+{
+	char default_sizes[] = "64,37x53";
+	char default_wins[] = "1,5,9";
+	char* size_list = default_sizes;
+	char* win_list = default_wins;
+	int num_threads = omp_get_max_threads();
+	unsigned long seed = 1;
+	int sizes[32][2], wins[32];
+	int num_sizes = 0, num_wins = 0;
+	int num_cases = 0, num_failed = 0;
+	char* item;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0' || i + 1 >= argc)
+			usage(argv[0]);
+		switch (argv[i][1])
+		{
+			case 's': size_list = argv[++i]; break;
+			case 'w': win_list = argv[++i]; break;
+			case 't': num_threads = atoi(argv[++i]); break;
+			case 'S': seed = strtoul(argv[++i], NULL, 10); break;
+			default: usage(argv[0]);
+		}
+	}
+
+	for (item = strtok(size_list, ","); item != NULL && num_sizes < 32; item = strtok(NULL, ","))
+	{
+		int n = sscanf(item, "%dx%d", &sizes[num_sizes][0], &sizes[num_sizes][1]);
+
+		if (n < 1)
+			usage(argv[0]);
+		if (n == 1)
+			sizes[num_sizes][1] = sizes[num_sizes][0];
+		if (sizes[num_sizes][0] < 2 || sizes[num_sizes][1] < 1)
+			usage(argv[0]);
+		num_sizes++;
+	}
+	for (item = strtok(win_list, ","); item != NULL && num_wins < 32; item = strtok(NULL, ","))
+		if (sscanf(item, "%d", &wins[num_wins++]) != 1)
+			usage(argv[0]);
+	if (num_sizes == 0 || num_wins == 0 || num_threads < 1)
+		usage(argv[0]);
+
+	for (int is = 0; is < num_sizes; is++)
+		for (int ip = 0; ip < 2; ip++)
+		{
+			PixelType pix_type = ip == 0 ? PIX_GRAY : PIX_RGB;
+			Image* orig_img = make_half_black_img(pix_type, sizes[is][0], sizes[is][1], seed);
+			Image* est_img;
+
+			if (orig_img == NULL)
+				exit(EXIT_FAILURE);
+			set_noise_seed(seed);
+			est_img = add_gaussian_noise(orig_img, 0.0, 10.0);
+			if (est_img == NULL)
+				exit(EXIT_FAILURE);
+
+			for (int iw = 0; iw < num_wins; iw++)
+			{
+				if (wins[iw] > MIN_2(sizes[is][0], sizes[is][1]))
+					continue;
+				for (int im = EM_MAE; im <= EM_NCD; im++)
+				{
+					ErrorMeasure err_meas = (ErrorMeasure)im;
+					double ref = naive_error_win(err_meas, orig_img, est_img, wins[iw]);
+					double one, many, rel;
+					int pass;
+
+					omp_set_num_threads(1);
+					one = calc_error_win(err_meas, orig_img, est_img, wins[iw]);
+					omp_set_num_threads(num_threads);
+					many = calc_error_win(err_meas, orig_img, est_img, wins[iw]);
+
+					/* the NCD terms are rounded to 2^-24 */
+					rel = ref == one ? 0.0 : fabs(one - ref) / MAX_2(fabs(ref), 1e-300);
+					pass = rel <= 1e-6 && one == many;
+					printf("%-4s %dx%d %-4s win %-3d %-5s naive %-14.8g 1 thread %-14.8g %d threads %-14.8g\n",
+						pass ? "ok" : "FAIL", sizes[is][0], sizes[is][1], ip == 0 ? "gray" : "rgb", wins[iw],
+						meas_names[im], ref, one, num_threads, many);
+					num_cases++;
+					num_failed += !pass;
+				}
+			}
+			free_img(orig_img);
+			free(orig_img);
+			free_img(est_img);
+			free(est_img);
+		}
+
+	printf("\n%d of %d checks failed\n", num_failed, num_cases);
+	return num_failed > 0 || num_cases == 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
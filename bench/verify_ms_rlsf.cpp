@@ -0,0 +1,402 @@
+#include "image.h"
+
+/*
+ * Frozen copy of the scalar RMS filter as of the introduction of this tool.
+ * It is the oracle every engine is checked against, so it must not be
+ * optimized or otherwise changed along with the library.
+ */
+
+static float oracle_weight(const int* in_data, int width, float r, float g, float b, int pos, int alpha, float sigma, const float* central_pix)
+{
+	float w, weights[9], r1, g1, b1;
+	int a = 0;
+
+	for (int i = -1; i <= 1; i++)
+		for (int j = -1; j <= 1; j++)
+		{
+			if (i == 0 && j == 0)
+			{
+				r1 = central_pix[0];
+				g1 = central_pix[1];
+				b1 = central_pix[2];
+			}
+			else
+			{
+				r1 = (in_data[pos + i * width + j] & 0XFF0000) >> 16;
+				g1 = (in_data[pos + i * width + j] & 0XFF00) >> 8;
+				b1 = (in_data[pos + i * width + j] & 0XFF);
+			}
+			weights[a] = (r - r1) * (r - r1) + (g - g1) * (g - g1) + (b - b1) * (b - b1);
+			a++;
+		}
+
+	w = 0;
+	for (int i = 0; (i < alpha) && (i < 9); i++)
+	{
+		float min = weights[0];
+		int tmp = 0;
+		for (int j = 1; j < 9; j++)
+		{
+			if (weights[j] < min)
+			{
+				min = weights[j];
+				tmp = j;
+			}
+		}
+		w += min;
+		weights[tmp] = +INFINITY;
+	}
+	w /= (float)(alpha);
+	return expf(-(w / sigma));
+}
+
+static int oracle_pixel(const int* in_data, const int width, const int height, const int radius, const int alpha, const float sigma, const int iter, const int ir0, const int ic0)
+{
+	int pos = ir0 * width + ic0;
+	float ir = ir0, ic = ic0;
+	float r = (in_data[pos] & 0XFF0000) >> 16;
+	float g = (in_data[pos] & 0XFF00) >> 8;
+	float b = (in_data[pos] & 0XFF);
+	int iter_count = 0;
+	float diff;
+
+	do {
+		float central_pix[3] = { r, g, b };
+		float wsum = 0, mx = 0, my = 0, nr = 0, ng = 0, nb = 0;
+		int istart = MAX_2((int)round(ir) - radius - 1, 1);
+		int iend = MIN_2((int)round(ir) + radius + 1, height - 2);
+		int jstart = MAX_2((int)round(ic) - radius - 1, 1);
+		int jend = MIN_2((int)round(ic) + radius + 1, width - 2);
+		int center = (int)round(ir) * width + (int)round(ic);
+
+		for (int i = istart; i <= iend; i++)
+			for (int j = jstart; j <= jend; j++)
+			{
+				int q = i * width + j;
+				float w = oracle_weight(in_data, width, (in_data[q] & 0XFF0000) >> 16, (in_data[q] & 0XFF00) >> 8,
+					(in_data[q] & 0XFF), center, alpha, sigma, central_pix);
+
+				nr += ((in_data[q] & 0XFF0000) >> 16) * w;
+				ng += ((in_data[q] & 0XFF00) >> 8) * w;
+				nb += (in_data[q] & 0XFF) * w;
+				wsum += w;
+				mx += i * w;
+				my += j * w;
+			}
+
+		nr = nr / wsum;
+		ng = ng / wsum;
+		nb = nb / wsum;
+		mx = mx / wsum;
+		my = my / wsum;
+		if (mx < 0)
+			mx = 0;
+		if (my < 0)
+			my = 0;
+
+		diff = (r - nr) * (r - nr) + (g - ng) * (g - ng) + (b - nb) * (b - nb) + (ir - mx) * (ir - mx) + (ic - my) * (ic - my);
+		r = nr;
+		g = ng;
+		b = nb;
+		ir = mx;
+		ic = my;
+		iter_count++;
+	} while (iter_count < iter && diff > 0);
+
+	return ((int)r << 16) | ((int)g << 8) | (int)b;
+}
+
+static Image* oracle_ms_rlsf(const Image* in_img, const int r, int alpha, const float sigma, const int iter)
+{
+	int num_rows = get_num_rows(in_img);
+	int num_cols = get_num_cols(in_img);
+	Image* out_img = clone_img(in_img);
+	int* int_data = (int*)malloc((size_t)num_rows * num_cols * sizeof(int));
+	byte*** in_data = (byte***)get_img_data_nd(in_img);
+	byte*** out_data;
+
+	if (out_img == NULL || int_data == NULL)
+	{
+		free(int_data);
+		return NULL;
+	}
+	if (alpha > 9)
+		alpha = 9;
+
+	for (int i = 0; i < num_rows; i++)
+		for (int j = 0; j < num_cols; j++)
+			int_data[i * num_cols + j] = (in_data[i][j][0] << 16) | (in_data[i][j][1] << 8) | in_data[i][j][2];
+
+	/* the one-pixel frame keeps the input values */
+	out_data = (byte***)get_img_data_nd(out_img);
+	for (int i = 1; i < num_rows - 1; i++)
+		for (int j = 1; j < num_cols - 1; j++)
+		{
+			int v = oracle_pixel(int_data, num_cols, num_rows, r, alpha, 2 * sigma * sigma, iter, i, j);
+
+			out_data[i][j][0] = (v >> 16) & 0xFF;
+			out_data[i][j][1] = (v >> 8) & 0xFF;
+			out_data[i][j][2] = v & 0xFF;
+		}
+
+	free(int_data);
+	return out_img;
+}
+
+/* ---- engines under test ------------------------------------------------- */
+
+typedef Image* (*FilterFunc)(const Image*, const int, int, const float, const int);
+
+typedef struct
+{
+	const char* name;
+	FilterFunc func;
+	int max_abs_diff;	/* largest allowed difference of a band value, 0 for bit-exact */
+	double max_diff_frac;	/* largest allowed fraction of differing pixels */
+} Engine;
+
+#ifndef CUDA
+static Image* track_engine(const Image* in_img, const int r, int alpha, const float sigma, const int iter)
+{
+	QualityCurve curve;
+	Image* out_img = filter_ms_rlsf_track(in_img, r, alpha, sigma, iter, in_img, 0, &curve);
+
+	if (out_img != NULL)
+		free_quality_curve(&curve);
+	return out_img;
+}
+#endif
+
+/* New engines are registered here with their tolerance */
+static const Engine engines[] = {
+#ifdef CUDA
+	{ "cuda_ms_rlsf", CUDA_filter_ms_rlsf, 1, 0.01 },
+#else
+	{ "ms_rlsf", filter_ms_rlsf, 0, 0.0 },
+	{ "ms_rlsf_track", track_engine, 0, 0.0 },
+#endif
+};
+
+#define NUM_ENGINES ((int) (sizeof(engines) / sizeof(engines[0])))
+
+static void usage(const char* prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options] [image { rgb } ...]\n"
+		"  -s sizes       generated image sizes, N or RxC, comma separated (default 3x3,17x29,64)\n"
+		"  -n probs       salt & pepper noise probabilities in [0,1] (default 0,0.2)\n"
+		"  -p params      r:alpha:sigma:iter sets (default 1:3:30:3,2:9:50:5,3:1:10:2)\n"
+		"  -e engine      check only this engine\n"
+		"  -S seed        seed of the images and the noise (default 1)\n",
+		prog);
+	exit(EXIT_FAILURE);
+}
+
+/* Parses N or RxC; returns 0 unless the whole item is a positive size */
+static int parse_size(const char* item, int* size)
+{
+	char* end;
+
+	size[0] = (int)strtol(item, &end, 10);
+	size[1] = size[0];
+	if (end != item && *end == 'x')
+	{
+		const char* cols = end + 1;
+
+		size[1] = (int)strtol(cols, &end, 10);
+		if (end == cols)
+			return 0;
+	}
+	return end != item && *end == '\0' && size[0] > 0 && size[1] > 0;
+}
+
+/* Parses a probability; returns 0 unless the whole item is a number in [0,1] */
+static int parse_prob(const char* item, double* prob)
+{
+	char* end;
+
+	*prob = strtod(item, &end);
+	return end != item && *end == '\0' && *prob >= 0.0 && *prob <= 1.0;
+}
+
+/* Compares an engine output with the oracle; returns nonzero if within tolerance */
+static int check_output(const Engine* engine, const char* case_name, const Image* ref_img, const Image* out_img)
+{
+	const byte* ref_data = (const byte*)get_img_data_1d(ref_img);
+	const byte* out_data = (const byte*)get_img_data_1d(out_img);
+	int num_pixels = get_num_rows(ref_img) * get_num_cols(ref_img);
+	int max_abs = 0;
+	int num_diff = 0;
+	double psnr;
+	char psnr_str[32];
+	int pass;
+
+	for (int k = 0; k < num_pixels; k++)
+	{
+		int pix_diff = 0;
+
+		for (int b = 0; b < 3; b++)
+			pix_diff = MAX_2(pix_diff, abs(ref_data[3 * k + b] - out_data[3 * k + b]));
+		max_abs = MAX_2(max_abs, pix_diff);
+		num_diff += pix_diff > 0;
+	}
+
+	psnr = calc_error(EM_PSNR, ref_img, out_img);
+	if (psnr == HUGE_VAL)
+		snprintf(psnr_str, sizeof(psnr_str), "inf");
+	else
+		snprintf(psnr_str, sizeof(psnr_str), "%.2f", psnr);
+	pass = max_abs <= engine->max_abs_diff && num_diff <= engine->max_diff_frac * num_pixels;
+	printf("%-4s %-16s %-40s max abs %3d  differing %7d / %-7d  PSNR %s\n", pass ? "ok" : "FAIL",
+		engine->name, case_name, max_abs, num_diff, num_pixels, psnr_str);
+
+	return pass;
+}
+
+int main(int argc, char** argv)
+{
+	char default_sizes[] = "3x3,17x29,64";
+	char default_noise[] = "0,0.2";
+	char default_params[] = "1:3:30:3,2:9:50:5,3:1:10:2";
+	char* size_list = default_sizes;
+	char* noise_list = default_noise;
+	char* param_list = default_params;
+	const char* engine_name = NULL;
+	unsigned long seed = 1;
+	Image* inputs[64];
+	char input_names[64][64];
+	int num_inputs = 0;
+	int params_i[32][3];
+	float params_sigma[32];
+	int num_params = 0;
+	int num_cases = 0, num_failed = 0;
+	int first_file = argc;
+	char* item;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (argv[i][0] != '-')
+		{
+			first_file = i;
+			break;
+		}
+		if (argv[i][1] == '\0' || argv[i][2] != '\0' || i + 1 >= argc)
+			usage(argv[0]);
+
+		switch (argv[i][1])
+		{
+			case 's': size_list = argv[++i]; break;
+			case 'n': noise_list = argv[++i]; break;
+			case 'p': param_list = argv[++i]; break;
+			case 'e': engine_name = argv[++i]; break;
+			case 'S': seed = strtoul(argv[++i], NULL, 10); break;
+			default: usage(argv[0]);
+		}
+	}
+
+	for (item = strtok(param_list, ","); item != NULL && num_params < 32; item = strtok(NULL, ","))
+	{
+		if (sscanf(item, "%d:%d:%f:%d", &params_i[num_params][0], &params_i[num_params][1], &params_sigma[num_params], &params_i[num_params][2]) != 4)
+			usage(argv[0]);
+		num_params++;
+	}
+
+	/* the corpus: every generated size with every noise level, then the given files */
+	{
+		int num_sizes = 0, num_noise = 0;
+		int sizes[32][2];
+		double noise[32];
+
+		for (item = strtok(size_list, ","); item != NULL && num_sizes < 32; item = strtok(NULL, ","))
+		{
+			if (!parse_size(item, sizes[num_sizes]))
+				usage(argv[0]);
+			num_sizes++;
+		}
+		for (item = strtok(noise_list, ","); item != NULL && num_noise < 32; item = strtok(NULL, ","))
+			if (!parse_prob(item, &noise[num_noise++]))
+				usage(argv[0]);
+
+		for (int is = 0; is < num_sizes; is++)
+		{
+			Image* clean_img = make_synthetic_img(sizes[is][0], sizes[is][1], seed);
+
+			if (clean_img == NULL)
+				exit(EXIT_FAILURE);
+			for (int in = 0; in < num_noise && num_inputs < 64; in++)
+			{
+				set_noise_seed(seed);
+				inputs[num_inputs] = add_saltpepper_noise(clean_img, noise[in]);
+				if (inputs[num_inputs] == NULL)
+					exit(EXIT_FAILURE);
+				snprintf(input_names[num_inputs++], 64, "%dx%d/p%.2f", sizes[is][0], sizes[is][1], noise[in]);
+			}
+			free_img(clean_img);
+			free(clean_img);
+		}
+	}
+
+	for (int i = first_file; i < argc && num_inputs < 64; i++)
+	{
+		inputs[num_inputs] = read_img(argv[i]);
+		if (inputs[num_inputs] == NULL || !is_rgb_img(inputs[num_inputs]))
+		{
+			fprintf(stderr, "Cannot read color image %s !\n", argv[i]);
+			exit(EXIT_FAILURE);
+		}
+		snprintf(input_names[num_inputs++], 64, "%s", argv[i]);
+	}
+
+	if (num_inputs == 0 || num_params == 0)
+		usage(argv[0]);
+
+	for (int ii = 0; ii < num_inputs; ii++)
+	{
+		for (int ip = 0; ip < num_params; ip++)
+		{
+			char case_name[BENCH_NAME_LEN];
+			Image* ref_img = oracle_ms_rlsf(inputs[ii], params_i[ip][0], params_i[ip][1], params_sigma[ip], params_i[ip][2]);
+
+			if (ref_img == NULL)
+			{
+				fprintf(stderr, "Insufficient memory !\n");
+				exit(EXIT_FAILURE);
+			}
+			snprintf(case_name, sizeof(case_name), "%s/r%d_a%d_s%g_i%d", input_names[ii], params_i[ip][0],
+				params_i[ip][1], params_sigma[ip], params_i[ip][2]);
+
+			for (int ie = 0; ie < NUM_ENGINES; ie++)
+			{
+				Image* out_img;
+
+				if (engine_name != NULL && strcmp(engine_name, engines[ie].name) != 0)
+					continue;
+
+				out_img = engines[ie].func(inputs[ii], params_i[ip][0], params_i[ip][1], params_sigma[ip], params_i[ip][2]);
+				num_cases++;
+				if (out_img == NULL)
+				{
+					printf("%-4s %-16s %-40s no output\n", "FAIL", engines[ie].name, case_name);
+					num_failed++;
+					continue;
+				}
+				num_failed += !check_output(engines + ie, case_name, ref_img, out_img);
+				free_img(out_img);
+				free(out_img);
+			}
+
+			free_img(ref_img);
+			free(ref_img);
+		}
+	}
+
+	printf("\n%d of %d checks failed\n", num_failed, num_cases);
+
+	for (int ii = 0; ii < num_inputs; ii++)
+	{
+		free_img(inputs[ii]);
+		free(inputs[ii]);
+	}
+
+	return num_failed > 0 || num_cases == 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,227 @@
+#include <zlib.h>
+#include "image.h"
+
+/*
+ * Feeds read_png_file_parallel hand-built PNG files: valid ones, whose
+ * zlib stream is split so that its Adler-32 arrives in an IDAT chunk of its
+ * own, and broken ones (bad dimensions, truncated data, corrupt checksum),
+ * which must be rejected without crashing. Images too large for alloc_img
+ * come with a small IDAT, so only the header check stands between them and
+ * the allocator; they are also fed to the libpng reader, read_png_file.
+ */
+
+static void put_uint(byte* buf, unsigned long value)
+{
+	buf[0] = (byte)(value >> 24);
+	buf[1] = (byte)(value >> 16);
+	buf[2] = (byte)(value >> 8);
+	buf[3] = (byte)value;
+}
+
+static void write_chunk(FILE* fp, const char* type, const byte* data, unsigned long length)
+{
+	byte buf[4];
+	unsigned long crc = crc32(0L, (const Bytef*)type, 4);
+
+	crc = crc32(crc, data, (uInt)length);
+	put_uint(buf, length);
+	fwrite(buf, 1, 4, fp);
+	fwrite(type, 1, 4, fp);
+	fwrite(data, 1, length, fp);
+	put_uint(buf, crc);
+	fwrite(buf, 1, 4, fp);
+}
+
+typedef struct
+{
+	const char* name;
+	unsigned long width, height;	/* written to IHDR */
+	int color_type, bit_depth;
+	int num_rows, num_cols;		/* of the pixel data actually written */
+	int idat_size;			/* max. bytes per IDAT chunk, 0 for a separate Adler-32 chunk */
+	int truncate;			/* # bytes of the zlib stream dropped at the end */
+	int corrupt_adler;
+	int expect_ok;
+} PngCase;
+
+static const PngCase cases[] = {
+	{ "valid rgb, split adler", 23, 17, 2, 8, 17, 23, 0, 0, 0, 1 },
+	{ "valid rgba16, 7-byte idats", 9, 11, 6, 16, 11, 9, 7, 0, 0, 1 },
+	{ "corrupt split adler", 23, 17, 2, 8, 17, 23, 0, 0, 1, 0 },
+	{ "missing adler", 23, 17, 2, 8, 17, 23, 0, 4, 0, 0 },
+	{ "truncated data", 23, 17, 2, 8, 17, 23, 64, 100, 0, 0 },
+	{ "zero width", 0, 17, 2, 8, 17, 23, 64, 0, 0, 0 },
+	{ "zero height", 23, 0, 2, 8, 17, 23, 64, 0, 0, 0 },
+	{ "width above 2^31-1", 0x80000000UL, 1, 2, 8, 1, 23, 64, 0, 0, 0 },
+	{ "max width rgba16", 0x7FFFFFFFUL, 1, 6, 16, 1, 23, 64, 0, 0, 0 },
+	{ "row bytes past 2^32", 0x20000001UL, 1, 6, 16, 1, 23, 64, 0, 0, 0 },
+	{ "height above 2^31-1", 23, 0xFFFFFFFFUL, 2, 8, 17, 23, 64, 0, 0, 0 },
+	{ "40000x40000 rgb", 40000, 40000, 2, 8, 17, 23, 64, 0, 0, 0 },
+	{ "40000x20000 gray+alpha", 40000, 20000, 4, 8, 17, 23, 64, 0, 0, 0 },
+};
+
+#define NUM_CASES ((int) (sizeof(cases) / sizeof(cases[0])))
+
+/* Writes the case to FP; fills REF with the expected image when it is valid */
+static int write_case(const PngCase* pc, FILE* fp, Image* ref_img)
+{
+	static const byte signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+	int channels = pc->color_type == 2 ? 3 : pc->color_type == 4 ? 2 : 4;
+	int step = pc->bit_depth / 8;
+	size_t row_bytes = (size_t)pc->num_cols * channels * step;
+	size_t raw_size = pc->num_rows * (row_bytes + 1);
+	uLongf zsize = compressBound(raw_size);
+	byte* raw = (byte*)malloc(raw_size);
+	byte* zdata = (byte*)malloc(zsize);
+	byte ihdr[13];
+	unsigned long seed = 12345;
+
+	if (raw == NULL || zdata == NULL)
+		return 0;
+	for (int y = 0; y < pc->num_rows; y++)
+	{
+		byte* row = raw + y * (row_bytes + 1);
+
+		row[0] = (byte)(y % 5);	/* every filter type */
+		for (size_t k = 1; k <= row_bytes; k++)
+		{
+			seed = seed * 1103515245UL + 12345UL;
+			row[k] = (byte)(seed >> 16);
+		}
+	}
+	if (compress2(zdata, &zsize, raw, raw_size, 6) != Z_OK)
+		return 0;
+
+	/* the expected image: defilter, keep the high bytes, drop alpha */
+	if (ref_img != NULL)
+	{
+		byte* prev = (byte*)calloc(row_bytes, 1);
+		byte* cur = (byte*)malloc(row_bytes);
+		byte* out = (byte*)get_img_data_1d(ref_img);
+		int bpp = channels * step;
+
+		for (int y = 0; y < pc->num_rows; y++)
+		{
+			const byte* src = raw + y * (row_bytes + 1);
+
+			for (size_t k = 0; k < row_bytes; k++)
+			{
+				int a = k >= (size_t)bpp ? cur[k - bpp] : 0, b = prev[k], c = k >= (size_t)bpp ? prev[k - bpp] : 0;
+				int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc_ = abs(p - c);
+				int pred[5] = { 0, a, b, (a + b) >> 1, pa <= pb && pa <= pc_ ? a : pb <= pc_ ? b : c };
+
+				cur[k] = (byte)(src[1 + k] + pred[src[0]]);
+			}
+			for (int x = 0; x < pc->num_cols; x++)
+				for (int ib = 0; ib < 3; ib++)
+					out[((size_t)y * pc->num_cols + x) * 3 + ib] = cur[(x * channels + ib) * step];
+			memcpy(prev, cur, row_bytes);
+		}
+		free(prev);
+		free(cur);
+	}
+
+	if (pc->corrupt_adler)
+		zdata[zsize - 1] ^= 0x5A;
+	zsize -= pc->truncate;
+
+	put_uint(ihdr, pc->width);
+	put_uint(ihdr + 4, pc->height);
+	ihdr[8] = (byte)pc->bit_depth;
+	ihdr[9] = (byte)pc->color_type;
+	ihdr[10] = ihdr[11] = ihdr[12] = 0;
+	fwrite(signature, 1, 8, fp);
+	write_chunk(fp, "IHDR", ihdr, 13);
+	if (pc->idat_size == 0)
+	{
+		/* everything but the Adler-32 in one chunk, then the Adler-32 */
+		size_t head = zsize >= 4 ? zsize - 4 : zsize;
+
+		write_chunk(fp, "IDAT", zdata, head);
+		if (zsize > head)
+			write_chunk(fp, "IDAT", zdata + head, zsize - head);
+	}
+	else
+		for (size_t k = 0; k < zsize; k += pc->idat_size)
+			write_chunk(fp, "IDAT", zdata + k, MIN_2((size_t)pc->idat_size, zsize - k));
+	write_chunk(fp, "IEND", NULL, 0);
+
+	free(raw);
+	free(zdata);
+	return 1;
+}
+
+int main(void)
+{
+	int num_failed = 0, num_checks = 0;
+
+	/* errors are expected; report them instead of aborting */
+	set_err_mode(0);
+
+	for (int ic = 0; ic < NUM_CASES; ic++)
+	{
+		const PngCase* pc = cases + ic;
+		Image* ref_img = pc->expect_ok ? alloc_img(PIX_RGB, pc->num_rows, pc->num_cols) : NULL;
+		FILE* fp = tmpfile();
+		Image* out_img;
+		int pass;
+
+		if (fp == NULL || (pc->expect_ok && ref_img == NULL) || !write_case(pc, fp, ref_img))
+		{
+			fprintf(stderr, "Cannot build case %s !\n", pc->name);
+			exit(EXIT_FAILURE);
+		}
+		rewind(fp);
+		out_img = read_png_file_parallel(fp);
+		fclose(fp);
+
+		if (pc->expect_ok)
+			pass = out_img != NULL && get_num_rows(out_img) == pc->num_rows && get_num_cols(out_img) == pc->num_cols &&
+				!memcmp(get_img_data_1d(out_img), get_img_data_1d(ref_img), (size_t)pc->num_rows * pc->num_cols * 3);
+		else
+			pass = out_img == NULL;
+		printf("%-4s %-28s %s\n", pass ? "ok" : "FAIL", pc->name,
+			out_img == NULL ? "rejected" : "decoded");
+		num_failed += !pass;
+		num_checks++;
+
+		/* the libpng reader must reject images too large for alloc_img as well */
+		if ((double)pc->width * pc->height * 3 > INT_MAX)
+		{
+			Image* lib_img;
+
+			fp = tmpfile();
+			if (fp == NULL || !write_case(pc, fp, NULL))
+			{
+				fprintf(stderr, "Cannot build case %s !\n", pc->name);
+				exit(EXIT_FAILURE);
+			}
+			rewind(fp);
+			lib_img = read_png_file(fp);
+			fclose(fp);
+			printf("%-4s %-28s %s (libpng)\n", lib_img == NULL ? "ok" : "FAIL", pc->name,
+				lib_img == NULL ? "rejected" : "decoded");
+			num_failed += lib_img != NULL;
+			num_checks++;
+			if (lib_img != NULL)
+			{
+				free_img(lib_img);
+				free(lib_img);
+			}
+		}
+
+		if (out_img != NULL)
+		{
+			free_img(out_img);
+			free(out_img);
+		}
+		if (ref_img != NULL)
+		{
+			free_img(ref_img);
+			free(ref_img);
+		}
+	}
+
+	printf("\n%d of %d checks failed\n", num_failed, num_checks);
+	return num_failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -5,6 +5,7 @@
 #include <limits.h>
 #include <math.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -20,6 +21,10 @@
 
 #define MAX_GRAY 255	    /**< Max. gray level in an 8-bit gray-scale image */
 
+#define RTI_TILE_SIZE 256    /**< Default tile width and height of RTI files */
+
+#define ENC_THREADS_ALL ( -1 ) /**< EncodeParams.num_threads value selecting all threads */
+
 #define OBJECT 1
 
 #define BACKGROUND 0
@@ -291,6 +296,8 @@ typedef enum
 
  FMT_RAS,	     /**< RAS */
 
+ FMT_RTI,	     /**< RTI (tiled container) */
+
  FMT_TGA,	     /**< TGA */
 
  FMT_TIFF	     /**< TIFF */
@@ -449,6 +456,40 @@ typedef enum
 
 } ColorMap; /**< Color Map Enumeration */
 
+typedef enum
+{
+
+ PERF_STAGE_PACK = 0,	      /**< conversion to the filter's pixel format */
+
+ PERF_STAGE_FILTER,	      /**< filter loops */
+
+ PERF_STAGE_UNPACK,	      /**< conversion back to an image */
+
+ PERF_STAGE_METRICS,	      /**< quality measures */
+
+ PERF_STAGE_IO,		      /**< image file reading and writing */
+
+ PERF_NUM_STAGES
+
+} PerfStage; /**< Instrumented Pipeline Stage Enumeration */
+
+typedef enum
+{
+
+ PERF_CYCLES = 0,
+
+ PERF_INSTRUCTIONS,
+
+ PERF_LLC_MISSES,
+
+ PERF_BRANCH_MISSES,
+
+ PERF_STALLED_CYCLES,	      /**< backend stall cycles */
+
+ PERF_NUM_EVENTS
+
+} PerfEvent; /**< Hardware Counter Enumeration */
+
 typedef struct
 {
  double row;
@@ -619,6 +660,251 @@ typedef enum
  GAUSSIAN_DERICHE = 2		/* gaussian approximation (Deriche's coefficients) */
 } recursiveFilterType;
 
+typedef enum
+{
+
+ ENC_FILTER_DEFAULT = 0,      /**< let the encoder choose */
+
+ ENC_FILTER_NONE = 0x08,      /**< PNG filter type 0 */
+
+ ENC_FILTER_SUB = 0x10,	      /**< PNG filter type 1 */
+
+ ENC_FILTER_UP = 0x20,	      /**< PNG filter type 2 */
+
+ ENC_FILTER_AVG = 0x40,	      /**< PNG filter type 3 */
+
+ ENC_FILTER_PAETH = 0x80,     /**< PNG filter type 4 */
+
+ ENC_FILTER_ALL = 0xF8	      /**< adaptive choice among all filters */
+
+} EncodeFilter; /**< PNG Row Filter Flags (same bits as libpng) */
+
+typedef enum
+{
+
+ ENC_STRATEGY_DEFAULT = 0,    /**< encoder's choice */
+
+ ENC_STRATEGY_FILTERED = 1,   /**< Z_FILTERED */
+
+ ENC_STRATEGY_HUFFMAN = 2,    /**< Z_HUFFMAN_ONLY */
+
+ ENC_STRATEGY_RLE = 3,	      /**< Z_RLE */
+
+ ENC_STRATEGY_FIXED = 4	      /**< Z_FIXED */
+
+} EncodeStrategy; /**< Deflate Strategy (same values as zlib) */
+
+typedef enum
+{
+
+ ENC_PRESET_DEFAULT = 0,      /**< libpng defaults */
+
+ ENC_PRESET_FAST,	      /**< fastest encode, somewhat larger files */
+
+ ENC_PRESET_SMALL	      /**< smallest files, slowest encode */
+
+} EncodePreset; /**< Encoder Preset Enumeration */
+
+typedef struct
+{
+
+ int level;		      /**< zlib compression level { -1 (default), 0..9 } */
+
+ int filters;		      /**< OR-ed EncodeFilter flags */
+
+ int strategy;		      /**< EncodeStrategy */
+
+ int num_threads;	      /**< 0 or 1: serial libpng encoder, ENC_THREADS_ALL: all threads, n > 1: n threads */
+
+} EncodeParams; /**< Compression Parameters for writing compressed images */
+
+typedef struct
+{
+
+ byte *data;		      /**< file contents */
+
+ size_t size;		      /**< number of bytes in DATA */
+
+ int is_mapped;		      /**< 1: DATA is memory mapped, 0: DATA is a heap buffer */
+
+} FileMap; /**< Read-only In-memory View of a File */
+
+typedef enum
+{
+
+ TILE_RAW = 0,		      /**< uncompressed */
+
+ TILE_DEFLATE		      /**< row-predicted deflate */
+
+} TileCodec; /**< RTI Tile Codec Enumeration */
+
+typedef struct
+{
+
+ FILE *file_ptr;	      /**< open file */
+
+ FileMap map;		      /**< file contents (read-only files) */
+
+ int is_writable;	      /**< 1: tiles may be written */
+
+ PixelType pix_type;	      /**< pixel type of the image */
+
+ int num_rows;		      /**< number of image rows */
+
+ int num_cols;		      /**< number of image columns */
+
+ int tile_size;		      /**< tile width and height */
+
+ int num_tile_rows;	      /**< number of tile rows */
+
+ int num_tile_cols;	      /**< number of tile columns */
+
+ int codec;		      /**< TileCodec used for newly written tiles */
+
+ int level;		      /**< zlib level used for newly written tiles */
+
+ size_t end_offset;	      /**< end of the tile data */
+
+ size_t *tile_offsets;	      /**< file offset of each tile (0: not written) */
+
+ size_t *tile_sizes;	      /**< stored size of each tile */
+
+ int *tile_codecs;	      /**< TileCodec of each tile */
+
+} TiledImage; /**< Tiled RTI Image File */
+
+typedef struct
+{
+
+ double num_pixels;	      /**< number of pixels compared */
+
+ double mse;		      /**< mean squared error per sample */
+
+ double rmse;		      /**< root mean squared error */
+
+ double mae;		      /**< mean absolute error per sample */
+
+ double snr;		      /**< signal-to-noise ratio (dB) */
+
+ double psnr;		      /**< peak signal-to-noise ratio (dB) */
+
+ double iri;		      /**< IRI (dB) */
+
+} QualityMetrics; /**< Full-reference Quality Measures */
+
+typedef struct
+{
+
+ double ssim;		      /**< SSIM of the luma */
+
+ double ms_ssim;	      /**< MS-SSIM of the luma */
+
+ double ms_ssim_band[3];      /**< MS-SSIM of each color band */
+
+ double ms_ssim_avg;	      /**< mean of MS_SSIM_BAND */
+
+} SsimMetrics; /**< Structural Similarity Measures */
+
+typedef struct
+{
+
+ int tile_size;		      /**< tile width and height */
+
+ Image *psnr_map;	      /**< PSNR of each tile (dB) { double } */
+
+ Image *ssim_map;	      /**< SSIM of each tile { double } */
+
+ Image *iri_map;	      /**< IRI of each tile (dB) { double } */
+
+} QualityMaps; /**< Per-tile Full-reference Quality Measures */
+
+typedef struct
+{
+
+ int num_iters;		      /**< number of passes recorded */
+
+ double *mse;		      /**< MSE after each pass */
+
+ double *psnr;		      /**< PSNR after each pass (dB) */
+
+ double *ssim;		      /**< mean tile SSIM after each pass, or NULL */
+
+ int *num_active;	      /**< number of pixels that moved in each pass */
+
+} QualityCurve; /**< Quality of an Iterative Filter after Each Pass */
+
+typedef struct PrefetchReader PrefetchReader; /**< Background Reader of an Image File List */
+
+typedef struct SsimReference SsimReference; /**< Precomputed SSIM Statistics of a Reference Image */
+
+typedef struct
+{
+
+ const Image *ref_img;	      /**< reference image (not owned) */
+
+ int border;		      /**< pixels ignored along each edge by the SNR measures */
+
+ double sum_sq_ref;	      /**< sum of the squared reference samples inside BORDER */
+
+ SsimReference *ssim;	      /**< SSIM window statistics of the reference */
+
+ Image *edge_img;	      /**< thresholded VR edges of the cropped reference */
+
+ int num_edges;		      /**< number of edge pixels in EDGE_IMG */
+
+} ReferenceStats; /**< Precomputed Statistics of a Reference Image */
+
+typedef struct
+{
+
+ int num_rows;		      /**< number of rows of the image */
+
+ int num_cols;		      /**< number of columns of the image */
+
+ int num_bands;		      /**< number of bands of the image */
+
+ int64_t *sum;		      /**< sums of the samples above and to the left, ( NUM_ROWS + 1 ) x ( NUM_COLS + 1 ) x NUM_BANDS */
+
+ int64_t *sum_sq;	      /**< same for the squared samples, or NULL */
+
+} IntegralImage; /**< Summed-area Tables of an Image */
+
+#define BENCH_NAME_LEN 128
+
+typedef struct
+{
+
+ int num_runs;		      /**< number of timed runs */
+
+ double min;		      /**< fastest run (s) */
+
+ double median;		      /**< median run (s) */
+
+ double p95;		      /**< 95th percentile run (s) */
+
+ double mean;		      /**< mean run (s) */
+
+} BenchStats; /**< Run Time Statistics */
+
+typedef struct
+{
+
+ char name[BENCH_NAME_LEN];   /**< kernel and configuration, incl. threads */
+
+ int num_threads;	      /**< number of threads */
+
+ double num_pixels;	      /**< pixels processed per run */
+
+ int num_iters;		      /**< passes over the pixels per run */
+
+ double efficiency;	      /**< parallel efficiency, or 0 if unknown */
+
+ double cycles;		      /**< median cycles per run, or 0 if not counted */
+
+ BenchStats stats;	      /**< run times */
+
+} BenchResult; /**< Result of One Benchmark Configuration */
+
 /* FUNCTION PROTOTYPES */
 
 /* add_noise.c */
@@ -631,6 +917,7 @@ double calc_error ( const ErrorMeasure err_meas, const Image * orig_img,
 
 double calc_error_win ( const ErrorMeasure err_meas, const Image * orig_img,
 		    const Image * est_img, int win_size );
+void set_noise_seed ( const unsigned long seed );
 
 /* alloc_nd.c */
 void *alloc_nd ( const size_t elem_size, const int dim_count, ... );
@@ -669,6 +956,21 @@ RadialDistFeatures *calc_radial_dist_feats ( const Image * img, const int label,
 ChordLenStats *calc_chord_len_stats ( const PointList * cont );
 
 
+/* bench.c */
+void calc_bench_stats ( const int num_runs, const double *times,
+			BenchStats * stats );
+int compare_bench_results ( const char *baseline_file,
+			    const BenchResult * results, const int num_results,
+			    const double tolerance, FILE * report );
+Image *make_synthetic_img ( const int num_rows, const int num_cols,
+			    const unsigned long seed );
+int write_bench_json ( FILE * fp, const char *suite,
+		       const BenchResult * results, const int num_results );
+
+/* bmp_io.c */
+Image *read_bmp ( FILE * file_ptr );
+int write_bmp ( const Image * img, FILE * file_ptr );
+
 /* ccv_enhance.c */
 Image *ccv_enhance ( const Image * in_img, const double sharp_factor );
 
@@ -740,6 +1042,10 @@ const char *error_str ( const int err_no );
 /* expand_histo.c */
 Image *expand_histo ( const Image * in_img, const double percent_clip );
 
+/* file_map.c */
+int map_file ( FILE * file_ptr, FileMap * map );
+void unmap_file ( FileMap * map );
+
 /* fill_region.c */
 int calc_box_area ( const Box * box );
 int get_box_height ( const Box * box );
@@ -816,6 +1122,8 @@ Image *filter_avmf ( const Image * in_img, const int win_size,
 /* filter_bilateral.c */
 Image *filter_bilateral ( const Image * in_img, const double range_sigma,
 			  const double spatial_sigma );
+Image *filter_bilateral_ref ( const Image * in_img, const double range_sigma,
+			      const double spatial_sigma );
 
 /* filter_bvdf.c */
 Image *filter_bvdf ( const Image * in_img, const int win_size );
@@ -1018,6 +1326,10 @@ Image *filter_svmf_mean ( const Image * in_img, const int win_size,
 Image *filter_svmf_rank ( const Image * in_img, const int win_size,
 			  const double lambda );
 
+/* filter_vector_order.c */
+Image *filter_vector_order ( const Image * in_img, const int win_size,
+			     const double p_value );
+
 /* filter_vmf.c */
 Image *filter_vmf ( const Image * in_img, const int win_size );
 
@@ -1091,8 +1403,20 @@ const char *img_format_str ( const ImageFormat img_format );
 
 /* image_io.c */
 Image *read_img ( const char *file_name );
+int read_img_batch ( const char **file_names, const int num_files,
+		     Image ** imgs );
 int write_img ( const Image * img, const char *file_name,
 		const ImageFormat img_format );
+int write_img_params ( const Image * img, const char *file_name,
+		       const ImageFormat img_format,
+		       const EncodeParams * params );
+void set_encode_preset ( EncodeParams * params, const EncodePreset preset );
+
+/* integral_image.c */
+IntegralImage *alloc_integral_img ( const Image * img, const int with_squares );
+void free_integral_img ( IntegralImage * int_img );
+int calc_local_stats ( const IntegralImage * int_img, const int win_size,
+		       const int row, double *mean, double *var );
 
 /* invariant_moments.c */
 GeoMoments *calc_geo_moments ( const Image * img, const int label );
@@ -1139,6 +1463,13 @@ Image *filter_asf ( const Image * in_img, const Strel * se, const ASFSeq seq,
 Image *fill_holes ( const Image * in_img, const Strel * se );
 Image *clear_border ( const Image * in_img, const Strel * se );
 
+/* perf_stats.c */
+int enable_perf_stats ( void );
+void disable_perf_stats ( void );
+void begin_perf_stage ( const PerfStage stage );
+void end_perf_stage ( const PerfStage stage );
+void print_perf_stats ( FILE * fp );
+
 /* pnm_header.c */
 int read_pbmb_header ( FILE * file_ptr, int *num_rows, int *num_cols );
 void write_pbmb_header ( const int num_rows, const int num_cols,
@@ -1175,9 +1506,28 @@ Image *read_ppmb_data ( const int num_rows, const int num_cols,
 			FILE * file_ptr );
 int write_ppmb ( const Image * img, FILE * file_ptr );
 
+/* prefetch_io.c */
+PrefetchReader *open_prefetch_reader ( const char **file_names,
+				       const int num_files, const int depth );
+Image *read_next_img ( PrefetchReader * reader );
+void close_prefetch_reader ( PrefetchReader * reader );
+
 /* pseudo_color.c */
 Image *pseudo_color ( const Image * in_img, const ColorMap color_map );
 
+/* quality_maps.c */
+int calc_quality_maps ( const Image * ref_img, const Image * test_img,
+			const int tile_size, QualityMaps * qmaps );
+void free_quality_maps ( QualityMaps * qmaps );
+Image *quality_map_to_gray ( const Image * map_img, const double min_val,
+			     const double max_val, const int cell_size );
+
+/* quality_metrics.c */
+int calc_quality_metrics ( const Image * ref_img, const Image * test_img,
+			   const int border, QualityMetrics * qm );
+int calc_quality_metrics_ref ( const ReferenceStats * ref_stats,
+			       const Image * test_img, QualityMetrics * qm );
+
 /* quant_neural.c */
 Image *quant_neural ( const Image * in_img, const int num_colors,
 		      const int sampling_factor );
@@ -1195,6 +1545,10 @@ PointList *calc_min_area_rect ( const Image * img, const int label,
 double calc_rectangularity ( const Image * img, const int label,
 			     const PointList * cont );
 
+/* reference_stats.c */
+ReferenceStats *alloc_ref_stats ( const Image * ref_img );
+void free_ref_stats ( ReferenceStats * ref_stats );
+
 /* rotate.c */
 Image *rotate_img ( const Image * in_img, const double angle );
 
@@ -1206,6 +1560,17 @@ Image *scale_img ( const Image * in_img, const int num_rows,
 Image *srm ( const Image * in_img, const double Q_value,
 	     const double size_factor );
 
+/* ssim.c */
+int calc_ssim_metrics ( const Image * ref_img, const Image * test_img,
+			const int row0, const int col0, const int num_rows,
+			const int num_cols, SsimMetrics * sm );
+int calc_ssim_metrics_ref ( const ReferenceStats * ref_stats,
+			    const Image * test_img, SsimMetrics * sm );
+SsimReference *alloc_ssim_ref ( const Image * ref_img, const int row0,
+				const int col0, const int num_rows,
+				const int num_cols );
+void free_ssim_ref ( SsimReference * sref );
+
 /* threshold.c */
 Image *threshold_img ( const Image * gray_img, const int threshold );
 
@@ -1258,6 +1623,30 @@ int threshold_shanbhag ( const Image * img );
 /* threshold_yen.c */
 int threshold_yen ( const Image * img );
 
+/* tga_io.c */
+Image *read_tga ( FILE * file_ptr );
+int write_tga ( const Image * img, FILE * file_ptr );
+
+/* tiled_io.c */
+TiledImage *create_tiled_img ( const char *file_name, const PixelType pix_type,
+			       const int num_rows, const int num_cols,
+			       const int tile_size, const TileCodec codec );
+TiledImage *open_tiled_img ( const char *file_name, const int writable );
+Image *read_tile ( TiledImage * tiled, const int tile_row, const int tile_col );
+int write_tile ( TiledImage * tiled, const int tile_row, const int tile_col,
+		 const Image * tile );
+int close_tiled_img ( TiledImage * tiled );
+Image *read_tiled_img ( FILE * file_ptr );
+int write_tiled_img ( const Image * img, FILE * file_ptr,
+		      const EncodeParams * params );
+
+/* timeline.c */
+int enable_timeline ( const int capacity );
+void disable_timeline ( void );
+void begin_timeline_event ( const char *name, const int arg );
+void end_timeline_event ( void );
+int write_timeline_json ( const char *file_name );
+
 /* trace_contour.c */
 Chain *alloc_chain ( const int max_length );
 void free_chain ( Chain * chain );
@@ -1278,6 +1667,9 @@ ChainList *trace_contours ( const Image * lab_img, const int max_length );
 /* util.c */
 clock_t start_timer ( void );
 double stop_timer ( const clock_t start_time );
+double get_wall_time ( void );
+double get_cycle_count ( void );
+long get_thread_id ( void );
 double *gauss_1d ( const double sigma, int *mask_size );
 int select_kth_smallest ( const int num_elems, const int k, int *data );
 int find_median ( const int num_elems, int *data );
@@ -1298,19 +1690,41 @@ double *calc_zernike_moments ( const Image * in_img, const int label,
 #else
 	Image* filter_ms_rlsf(const Image* in_img, const int r, int alpha, const float sigma, const int iter);
 #endif
+float compute_weight_ms_rlsf(int* in_data, int width, float r, float g, float b, int pos, int alpha, float sigma, float* central_pix);
+float sum_smallest_rlsf(float* weights, const int alpha);
+void pack_img_rlsf(const Image* in_img, int* int_data);
+void unpack_img_rlsf(const int* int_data, Image* out_img);
+Image* filter_ms_rlsf_track(const Image* in_img, const int r, int alpha, const float sigma, const int iter,
+			    const Image* ref_img, const int ssim_tile, QualityCurve* curve);
+void free_quality_curve(QualityCurve* curve);
 
 double* calculate_snr(const Image* ref_img, const Image* test_img, FILE* fp);
 double calculate_iri(const Image* ref_img, const Image* test_img, FILE* fp);
 double* calculate_ssim(const Image* ref_img, const Image* test_img, FILE* fp);
+double* calculate_snr_ref(const ReferenceStats* ref_stats, const Image* test_img, FILE* fp);
+double* calculate_ssim_ref(const ReferenceStats* ref_stats, const Image* test_img, FILE* fp);
 Image* crop_img(const Image* in_img, int crop_size);
 
 void normalize(float* input_array1d, int length);
 
 Image* read_png_file(FILE* fp);
+Image* read_png_file_progressive(FILE* fp,
+	void (*row_func)(const Image* img, const int row, void* user_data),
+	void* user_data);
 int write_png_file(const Image* _img, FILE* fp);
+int write_png_file_params(const Image* img, FILE* fp, const EncodeParams* params);
+
+/* png_parallel.c */
+int write_png_file_parallel ( const Image * img, FILE * fp,
+			      const EncodeParams * params );
+Image *read_png_file_parallel ( FILE * fp );
 
 float filter_road(const Image* in_img, const int alpha);
 Image* detect_edge_VR(const Image* in_img, const int threshold);
 double calculate_prat(const Image* ref_img, const Image* test_img);
+double calc_prat(const Image* ref_img, const Image* test_img, const char* debug_prefix);
+double calculate_prat_ref(const ReferenceStats* ref_stats, const Image* test_img);
+double calc_prat_ref(const ReferenceStats* ref_stats, const Image* test_img, const char* debug_prefix);
+Image* detect_prat_edges(const Image* img, const char* debug_prefix, const char* tag, int* num_edges);
 
 #endif
@@ -12,6 +12,9 @@ int main(int argc, char** argv)
 	Image* in_img;
 	Image* noisy_img;
 	Image* out_img;
+	PrefetchReader* reader;
+	QualityCurve curve;
+	FILE* curve_file;
 	int iter;
 	int r;
 	float sigma;
@@ -21,10 +24,10 @@ int main(int argc, char** argv)
 	if (argc < 3)
 	{
 		printf("argc: %d\n", argc);
-		fprintf(stderr, "Usage: %s <reference image { rgb }> <noisy image {rgb}> <block_radius> <alpha> <sigma> <iter>\n", argv[0]);
+		fprintf(stderr, "Usage: %s <reference image { rgb }> <noisy image {rgb}> <block_radius> <alpha> <sigma> <iter> [convergence file]\n", argv[0]);
 		exit(EXIT_FAILURE);
 	}
-	if (argc == 7)
+	if (argc == 7 || argc == 8)
 	{
 		r = atoi(argv[3]);
 		alpha = atof(argv[4]);
@@ -39,9 +42,28 @@ int main(int argc, char** argv)
 	}
 
 	printf("Testing Robust MeanShift (RMS) Filter...\n");
-	/* Read the input image */
-	in_img = read_img(argv[1]);
-	noisy_img = read_img(argv[2]);
+	/* Collect hardware counters per stage when RMS_PERF_STATS is set */
+	if (getenv("RMS_PERF_STATS") != NULL)
+	{
+		enable_perf_stats();
+	}
+	/* Record a timeline of the threads when RMS_TIMELINE names a file */
+	if (getenv("RMS_TIMELINE") != NULL)
+	{
+		enable_timeline(1 << 16);
+	}
+
+	/* Read the reference and noisy images concurrently */
+	reader = open_prefetch_reader((const char**)(argv + 1), 2, 2);
+	in_img = read_next_img(reader);
+	noisy_img = read_next_img(reader);
+	close_prefetch_reader(reader);
+
+	if (in_img == NULL || noisy_img == NULL)
+	{
+		fprintf(stderr, "Cannot read the input images !\n");
+		exit(EXIT_FAILURE);
+	}
 
 	/* Make sure it's an rgb image */
 	if (is_gray_img(in_img))
@@ -52,23 +74,46 @@ int main(int argc, char** argv)
 
 	/* Start the timer */
 	start_time = start_timer();
+	if (argc == 8)
+	{
+		/* Record MSE, PSNR, and tile SSIM after every pass */
+		out_img = filter_ms_rlsf_track(noisy_img, r, alpha, sigma, iter, in_img, 64, &curve);
+	}
+	else
+	{
 	#ifdef CUDA
 	    out_img = CUDA_filter_ms_rlsf(noisy_img, r, alpha, sigma, iter);
 	#else
 		out_img = filter_ms_rlsf(noisy_img, r, alpha, sigma, iter);
 	#endif
+	}
 
     elapsed_time = stop_timer(start_time);
 
+	if (argc == 8 && out_img != NULL)
+	{
+		curve_file = fopen(argv[7], "w");
+		if (curve_file == NULL)
+		{
+			fprintf(stderr, "Cannot open %s !\n", argv[7]);
+		}
+		else
+		{
+			fprintf(curve_file, "iter mse psnr ssim active\n");
+			for (int i = 0; i < curve.num_iters; i++)
+				fprintf(curve_file, "%d %f %f %f %d\n", i + 1, curve.mse[i], curve.psnr[i], curve.ssim[i], curve.num_active[i]);
+			fclose(curve_file);
+		}
+		free_quality_curve(&curve);
+	}
+
     write_img(out_img, "out.png", FMT_PNG);
 
     printf("Used parameters: r, alpha, sigma, iter: %d, %d, %f, %d, %f\n\n=========== \n\n", r, alpha, sigma, iter,  elapsed_time);
 
     printf("Measures: \n \n");
 
-	#ifdef CUDA
-        printf("Prat: %f\n", calculate_prat(in_img, out_img));
-	#endif
+    printf("Prat: %f\n", calculate_prat(in_img, out_img));
     calculate_snr(in_img, out_img, NULL);
     calculate_ssim(in_img, out_img, NULL);
 
@@ -78,6 +123,18 @@ int main(int argc, char** argv)
         printf("\n\nRobust MeanShift (RMS) time = %f\n", elapsed_time);
 	#endif
 
+	if (getenv("RMS_PERF_STATS") != NULL)
+	{
+		printf("\n");
+		print_perf_stats(stdout);
+		disable_perf_stats();
+	}
+	if (getenv("RMS_TIMELINE") != NULL)
+	{
+		write_timeline_json(getenv("RMS_TIMELINE"));
+		disable_timeline();
+	}
+
 	/* Calculate and print various error measures */
 
 	free_img(in_img);
@@ -0,0 +1,822 @@
+/**
+ * @file add_noise.c
+ * Routines for adding noise to an image and measuring the error between
+ * an image and its estimate
+ */
+
+#include <stdint.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "image.h"
+
+#define LAB_EPSILON 0.008856451679035631	/* ( 6 / 29 )^3 */
+
+#define LAB_KAPPA 7.787037037037037	/* 1 / ( 3 * ( 6 / 29 )^2 ) */
+
+#define NCD_FIXED_ONE 16777216.0	/* 2^24, unit of the fixed-point NCD terms */
+
+#define LAB_CBRT_SIZE 2048	/* intervals of the cube root table over [ 0, 1 ] */
+
+#define PHILOX_ROUNDS 10
+
+#define PHILOX_LANES 4		/* samples per counter */
+
+#define DEFAULT_NOISE_SEED 0x5EEDUL
+
+/* Noise kinds, part of the counter so that they use disjoint streams */
+enum
+{
+ NOISE_GAUSSIAN = 1,
+ NOISE_SALTPEPPER,
+ NOISE_SPECKLE
+};
+
+/* Key of the generator and index of the next call */
+static uint32_t noise_key[2] = { ( uint32_t ) DEFAULT_NOISE_SEED, 0 };
+
+static uint32_t noise_stream = 0;
+
+/** @cond INTERNAL_FUNCTION */
+
+/* Philox4x32-10: encrypts the counter CTR with KEY in place */
+static void
+philox4x32 ( uint32_t * ctr, const uint32_t * key )
+{
+ uint32_t k0 = key[0], k1 = key[1];
+ int ir;
+
+ for ( ir = 0; ir < PHILOX_ROUNDS; ir++ )
+  {
+   uint64_t p0 = ( uint64_t ) 0xD2511F53 * ctr[0];
+   uint64_t p1 = ( uint64_t ) 0xCD9E8D57 * ctr[2];
+   uint32_t c1 = ctr[1], c3 = ctr[3];
+
+   ctr[0] = ( uint32_t ) ( p1 >> 32 ) ^ c1 ^ k0;
+   ctr[1] = ( uint32_t ) p1;
+   ctr[2] = ( uint32_t ) ( p0 >> 32 ) ^ c3 ^ k1;
+   ctr[3] = ( uint32_t ) p0;
+   k0 += 0x9E3779B9;
+   k1 += 0xBB67AE85;
+  }
+}
+
+/* Maps a random word to ( 0, 1 ) */
+static double
+word_to_unit ( const uint32_t word )
+{
+ return ( word + 0.5 ) * ( 1.0 / 4294967296.0 );
+}
+
+/* Clamps to [ 0, MAX_GRAY ] and rounds */
+static byte
+dbl_to_byte ( const double value )
+{
+ if ( value <= 0.0 )
+  {
+   return 0;
+  }
+ if ( value >= MAX_GRAY )
+  {
+   return MAX_GRAY;
+  }
+
+ return ( byte ) ( value + 0.5 );
+}
+
+/*
+ * Adds noise of the given kind to every sample (band value) of IN_IMG.
+ * Sample K takes lane K % 4 of the Philox output for the counter
+ * { K / 4, call index, kind }, so the result depends only on the seed and
+ * the call index, not on how the blocks are split among threads.
+ */
+static Image *
+add_noise ( const Image * in_img, const int kind, const double param1,
+	    const double param2 )
+{
+ SET_FUNC_NAME ( "add_noise" );
+ int ib;
+ int num_blocks;
+ uint32_t key[2];
+ uint32_t stream;
+ size_t num_samples;
+ const byte *in_data;
+ byte *out_data;
+ Image *out_img;
+
+ if ( !( is_gray_img ( in_img ) || is_rgb_img ( in_img ) ) )
+  {
+   ERROR_RET ( "Not a grayscale or color image !", NULL );
+  }
+
+ out_img = alloc_img ( get_pix_type ( in_img ), get_num_rows ( in_img ),
+		       get_num_cols ( in_img ) );
+ if ( IS_NULL ( out_img ) )
+  {
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+#pragma omp critical ( noise_stream )
+ {
+  key[0] = noise_key[0];
+  key[1] = noise_key[1];
+  stream = noise_stream++;
+ }
+
+ num_samples = ( size_t ) get_num_rows ( in_img ) * get_num_cols ( in_img ) *
+  get_num_bands ( in_img );
+ num_blocks = ( int ) ( ( num_samples + PHILOX_LANES - 1 ) / PHILOX_LANES );
+ in_data = ( const byte * ) get_img_data_1d ( in_img );
+ out_data = ( byte * ) get_img_data_1d ( out_img );
+
+#pragma omp parallel for schedule(static)
+ for ( ib = 0; ib < num_blocks; ib++ )
+  {
+   uint32_t ctr[PHILOX_LANES];
+   double noise[PHILOX_LANES];
+   size_t k0 = ( size_t ) ib * PHILOX_LANES;
+   int num_lanes = ( int ) MIN_2 ( ( size_t ) PHILOX_LANES, num_samples - k0 );
+   int il;
+
+   ctr[0] = ( uint32_t ) ib;
+   ctr[1] = 0;
+   ctr[2] = stream;
+   ctr[3] = ( uint32_t ) kind;
+   philox4x32 ( ctr, key );
+
+   if ( kind == NOISE_SALTPEPPER )
+    {
+     for ( il = 0; il < num_lanes; il++ )
+      {
+       double u = word_to_unit ( ctr[il] );
+
+       out_data[k0 + il] = u < 0.5 * param1 ? 0 :
+	u < param1 ? MAX_GRAY : in_data[k0 + il];
+      }
+     continue;
+    }
+
+   /* Box-Muller: two normal deviates from each pair of lanes */
+   for ( il = 0; il < PHILOX_LANES; il += 2 )
+    {
+     double radius = sqrt ( -2.0 * log ( word_to_unit ( ctr[il] ) ) );
+     double angle = TWO_PI * word_to_unit ( ctr[il + 1] );
+
+     noise[il] = radius * cos ( angle );
+     noise[il + 1] = radius * sin ( angle );
+    }
+
+   for ( il = 0; il < num_lanes; il++ )
+    {
+     double value = in_data[k0 + il];
+
+     out_data[k0 + il] = kind == NOISE_GAUSSIAN ?
+      dbl_to_byte ( value + param1 + param2 * noise[il] ) :
+      dbl_to_byte ( value + param2 * noise[il] * value );
+    }
+  }
+
+ return out_img;
+}
+
+/* Contribution of each 8-bit sRGB component to X / Xn, Y / Yn, and Z / Zn
+   (D65), and cube roots over the range of their sums */
+typedef struct
+{
+ double xyz[3][3][MAX_GRAY + 1];	/* [ band ][ X, Y, Z ][ value ] */
+ double cbrt[LAB_CBRT_SIZE + 1];	/* [ k ] = ( k / LAB_CBRT_SIZE )^( 1 / 3 ) */
+} LabTable;
+
+static void
+init_lab_table ( LabTable * table )
+{
+ static const double rgb_to_xyz[3][3] = {
+  {0.4124564, 0.3575761, 0.1804375},
+  {0.2126729, 0.7151522, 0.0721750},
+  {0.0193339, 0.1191920, 0.9503041}
+ };
+ static const double white[3] = { 0.95047, 1.0, 1.08883 };
+ int iv, ib, ic;
+
+ for ( iv = 0; iv <= MAX_GRAY; iv++ )
+  {
+   double c = iv / ( double ) MAX_GRAY;
+   double lin = c <= 0.04045 ? c / 12.92 : pow ( ( c + 0.055 ) / 1.055, 2.4 );
+
+   for ( ib = 0; ib < 3; ib++ )
+    {
+     for ( ic = 0; ic < 3; ic++ )
+      {
+       table->xyz[ib][ic][iv] = rgb_to_xyz[ic][ib] * lin / white[ic];
+      }
+    }
+  }
+
+ for ( iv = 0; iv <= LAB_CBRT_SIZE; iv++ )
+  {
+   table->cbrt[iv] = pow ( iv / ( double ) LAB_CBRT_SIZE, 1.0 / 3.0 );
+  }
+}
+
+/*
+ * The cube root is interpolated from the table and refined by one Newton
+ * step, which leaves a relative error below 1e-8 for T > LAB_EPSILON. T is
+ * at most 1 up to rounding; the last interval covers anything above.
+ */
+static double
+lab_f ( const LabTable * table, const double t )
+{
+ double pos, root;
+ int k;
+
+ if ( t <= LAB_EPSILON )
+  {
+   return LAB_KAPPA * t + 4.0 / 29.0;
+  }
+
+ pos = t * LAB_CBRT_SIZE;
+ k = MIN_2 ( ( int ) pos, LAB_CBRT_SIZE - 1 );
+ root = table->cbrt[k] + ( pos - k ) * ( table->cbrt[k + 1] - table->cbrt[k] );
+
+ return ( 2.0 * root + t / ( root * root ) ) / 3.0;
+}
+
+/* Converts an sRGB pixel to CIELAB */
+static void
+pix_to_lab ( const LabTable * table, const int red, const int green,
+	     const int blue, double *lab )
+{
+ double fx = lab_f ( table, table->xyz[0][0][red] + table->xyz[1][0][green] +
+			    table->xyz[2][0][blue] );
+ double fy = lab_f ( table, table->xyz[0][1][red] + table->xyz[1][1][green] +
+			    table->xyz[2][1][blue] );
+ double fz = lab_f ( table, table->xyz[0][2][red] + table->xyz[1][2][green] +
+			    table->xyz[2][2][blue] );
+
+ lab[0] = 116.0 * fy - 16.0;
+ lab[1] = 500.0 * ( fx - fy );
+ lab[2] = 200.0 * ( fy - fz );
+}
+
+/*
+ * Computes the per-pixel terms of a row: the numerator of the measure in
+ * NUM and, for NMSE and NCD, the denominator in DEN. Grayscale pixels are
+ * treated as R = G = B for NCD. The NCD terms are rounded to multiples of
+ * 1 / NCD_FIXED_ONE, so that all terms are integers and any sum of them is
+ * exact: a black pixel, whose CIELAB norm comes out as a rounding residue,
+ * contributes exactly 0. CIELAB norms stay below 2^9, so 2^29 such terms
+ * fit in 64 bits.
+ */
+static void
+calc_row_terms ( const ErrorMeasure err_meas, const byte * orig_row,
+		 const byte * est_row, const int num_cols, const int num_bands,
+		 const LabTable * table, int64_t * num, int64_t * den )
+{
+ int ix;
+
+ if ( err_meas == EM_NCD )
+  {
+   for ( ix = 0; ix < num_cols; ix++ )
+    {
+     const byte *o = orig_row + num_bands * ix;
+     const byte *e = est_row + num_bands * ix;
+     int ig = num_bands == 3 ? 1 : 0;
+     int ib = num_bands == 3 ? 2 : 0;
+     double lab_o[3], lab_e[3];
+
+     pix_to_lab ( table, o[0], o[ig], o[ib], lab_o );
+     pix_to_lab ( table, e[0], e[ig], e[ib], lab_e );
+     num[ix] = ( int64_t ) ( NCD_FIXED_ONE *
+			     sqrt ( ( lab_o[0] - lab_e[0] ) * ( lab_o[0] - lab_e[0] ) +
+				    ( lab_o[1] - lab_e[1] ) * ( lab_o[1] - lab_e[1] ) +
+				    ( lab_o[2] - lab_e[2] ) * ( lab_o[2] - lab_e[2] ) ) + 0.5 );
+     den[ix] = ( int64_t ) ( NCD_FIXED_ONE *
+			     sqrt ( lab_o[0] * lab_o[0] + lab_o[1] * lab_o[1] +
+				    lab_o[2] * lab_o[2] ) + 0.5 );
+    }
+   return;
+  }
+
+ for ( ix = 0; ix < num_cols; ix++ )
+  {
+   const byte *o = orig_row + num_bands * ix;
+   const byte *e = est_row + num_bands * ix;
+   int sum_num = 0, sum_den = 0;
+   int ib;
+
+   for ( ib = 0; ib < num_bands; ib++ )
+    {
+     int diff = o[ib] - e[ib];
+
+     sum_num += err_meas == EM_MAE ? abs ( diff ) : diff * diff;
+     sum_den += o[ib] * o[ib];
+    }
+   num[ix] = sum_num;
+   den[ix] = sum_den;
+  }
+}
+
+/* Turns the sums of the terms over NUM_SAMPLES samples into the measure */
+static double
+finish_error ( const ErrorMeasure err_meas, const double sum_num,
+	       const double sum_den, const double num_samples )
+{
+ switch ( err_meas )
+  {
+   case EM_MAE:		/*@fallthrough@ */
+   case EM_MSE:
+    return sum_num / num_samples;
+
+   case EM_RMSE:
+    return sqrt ( sum_num / num_samples );
+
+   case EM_PSNR:
+    return sum_num == 0.0 ? HUGE_VAL :
+     10.0 * log10 ( MAX_GRAY * MAX_GRAY / ( sum_num / num_samples ) );
+
+   default:			/* EM_NMSE, EM_NCD */
+    return sum_num / sum_den;
+  }
+}
+
+/* Checks the arguments shared by calc_error and calc_error_win */
+static int
+check_error_args ( const ErrorMeasure err_meas, const Image * orig_img,
+		   const Image * est_img )
+{
+ SET_FUNC_NAME ( "calc_error" );
+
+ if ( err_meas < EM_MAE || err_meas > EM_NCD )
+  {
+   ERROR ( "Error measure ( %d ) must be in [%d,%d] range !", err_meas,
+	   EM_MAE, EM_NCD );
+   return E_INVARG;
+  }
+
+ if ( !( is_gray_img ( orig_img ) || is_rgb_img ( orig_img ) ) ||
+      get_pix_type ( orig_img ) != get_pix_type ( est_img ) )
+  {
+   ERROR_RET ( "Images must be both grayscale or both color !", E_INVOBJ );
+  }
+
+ if ( get_num_rows ( orig_img ) != get_num_rows ( est_img ) ||
+      get_num_cols ( orig_img ) != get_num_cols ( est_img ) )
+  {
+   ERROR_RET ( "Image dimensions must be equal !", E_INVARG );
+  }
+
+ return E_SUCCESS;
+}
+
+/** @endcond INTERNAL_FUNCTION */
+
+/**
+ * @brief Sets the seed of the noise generators
+ *
+ * @param[in] seed Seed
+ *
+ * @return none
+ *
+ * @note Also restarts the call count, so the same sequence of calls after
+ *       the same seed produces the same noisy images. The generators use
+ *       Philox4x32-10 keyed by the seed, with the call index and the sample
+ *       index as the counter; the output does not depend on the number of
+ *       threads.
+ * @ref Salmon J.K. et al. (2011) "Parallel Random Numbers: As Easy as 1,
+ *      2, 3" Proc. of the Int. Conf. for High Performance Computing,
+ *      Networking, Storage and Analysis (SC11)
+ *
+ * @author Damian Kusnik
+ */
+
+void
+set_noise_seed ( const unsigned long seed )
+{
+#pragma omp critical ( noise_stream )
+ {
+  noise_key[0] = ( uint32_t ) seed;
+  noise_key[1] = ( uint32_t ) ( ( uint64_t ) seed >> 32 );
+  noise_stream = 0;
+ }
+}
+
+/**
+ * @brief Adds Gaussian noise to an image
+ *
+ * @param[in] in_img Image pointer { grayscale, rgb }
+ * @param[in] mean Mean of the noise
+ * @param[in] stdev Standard deviation of the noise [ >= 0 ]
+ *
+ * @return Pointer to the noisy image or NULL
+ *
+ * @note Each band of each pixel gets independent noise; the results are
+ *       rounded and clamped to [ 0, MAX_GRAY ].
+ * @see #set_noise_seed
+ *
+ * @author Damian Kusnik
+ */
+
+Image *
+add_gaussian_noise ( const Image * in_img, const double mean,
+		     const double stdev )
+{
+ SET_FUNC_NAME ( "add_gaussian_noise" );
+
+ if ( stdev < 0.0 )
+  {
+   ERROR ( "Standard deviation ( %f ) must be non-negative !", stdev );
+   return NULL;
+  }
+
+ return add_noise ( in_img, NOISE_GAUSSIAN, mean, stdev );
+}
+
+/**
+ * @brief Adds salt & pepper noise to an image
+ *
+ * @param[in] in_img Image pointer { grayscale, rgb }
+ * @param[in] prob Probability that a sample is corrupted [ 0, 1 ]
+ *
+ * @return Pointer to the noisy image or NULL
+ *
+ * @note Each band of each pixel is independently set to 0 or MAX_GRAY,
+ *       each with probability PROB / 2.
+ * @see #set_noise_seed
+ *
+ * @author Damian Kusnik
+ */
+
+Image *
+add_saltpepper_noise ( const Image * in_img, const double prob )
+{
+ SET_FUNC_NAME ( "add_saltpepper_noise" );
+
+ if ( prob < 0.0 || prob > 1.0 )
+  {
+   ERROR ( "Noise probability ( %f ) must be in [0,1] range !", prob );
+   return NULL;
+  }
+
+ return add_noise ( in_img, NOISE_SALTPEPPER, prob, 0.0 );
+}
+
+/**
+ * @brief Adds speckle noise to an image
+ *
+ * @param[in] in_img Image pointer { grayscale, rgb }
+ * @param[in] stdev Standard deviation of the noise [ >= 0 ]
+ *
+ * @return Pointer to the noisy image or NULL
+ *
+ * @note Multiplicative noise: each sample V becomes V + N * V, where N is
+ *       zero-mean Gaussian with the given standard deviation, independent
+ *       for each band of each pixel.
+ * @see #set_noise_seed
+ *
+ * @author Damian Kusnik
+ */
+
+Image *
+add_speckle_noise ( const Image * in_img, const double stdev )
+{
+ SET_FUNC_NAME ( "add_speckle_noise" );
+
+ if ( stdev < 0.0 )
+  {
+   ERROR ( "Standard deviation ( %f ) must be non-negative !", stdev );
+   return NULL;
+  }
+
+ return add_noise ( in_img, NOISE_SPECKLE, 0.0, stdev );
+}
+
+/**
+ * @brief Calculates the error between an image and its estimate
+ *
+ * @param[in] err_meas Error measure
+ * @param[in] orig_img Original image { grayscale, rgb }
+ * @param[in] est_img Estimated image { grayscale, rgb }
+ *
+ * @return Error value or DBL_MAX on failure
+ *
+ * @note MAE, MSE, RMSE, and PSNR are per sample (band value). NMSE is the
+ *       sum of the squared errors over the sum of the squared original
+ *       samples. NCD is the sum of the CIELAB distances between the
+ *       pixels over the sum of the CIELAB norms of the original pixels
+ *       (sRGB, D65); the conversion uses a table of the contribution of
+ *       each component value to XYZ. Rows are reduced in parallel; the
+ *       integer measures are summed exactly in 64 bits with a flat loop
+ *       over the interleaved samples, and the NCD terms are rounded to a
+ *       fixed-point unit of 2^-24 first, so no measure depends on the
+ *       number of threads.
+ * @ref Plataniotis K.N. and Venetsanopoulos A.N. (2000) "Color Image
+ *      Processing and Applications", Springer
+ *
+ * @author Damian Kusnik
+ */
+
+double
+calc_error ( const ErrorMeasure err_meas, const Image * orig_img,
+	     const Image * est_img )
+{
+ SET_FUNC_NAME ( "calc_error" );
+ int iy;
+ int fail = 0;
+ int num_rows, num_cols, num_bands;
+ double num_samples;
+ double sum_num = 0.0, sum_den = 0.0;
+
+ if ( check_error_args ( err_meas, orig_img, est_img ) != E_SUCCESS )
+  {
+   return DBL_MAX;
+  }
+
+ num_rows = get_num_rows ( orig_img );
+ num_cols = get_num_cols ( orig_img );
+ num_bands = get_num_bands ( orig_img );
+ num_samples = ( double ) num_rows * num_cols * num_bands;
+
+ if ( err_meas == EM_NCD )
+  {
+   LabTable table;
+   int64_t sum_fix_num = 0, sum_fix_den = 0;
+
+   init_lab_table ( &table );
+
+#pragma omp parallel reduction(+:sum_fix_num,sum_fix_den) reduction(|:fail)
+   {
+    int64_t *num = ( int64_t * ) malloc ( 2 * num_cols * sizeof ( int64_t ) );
+    int64_t *den = num + num_cols;
+
+#pragma omp for schedule(static)
+    for ( iy = 0; iy < num_rows; iy++ )
+     {
+      const byte *orig_row = ( const byte * ) get_img_data_1d ( orig_img ) +
+       ( size_t ) iy * num_cols * num_bands;
+      const byte *est_row = ( const byte * ) get_img_data_1d ( est_img ) +
+       ( size_t ) iy * num_cols * num_bands;
+      int ix;
+
+      if ( IS_NULL ( num ) )
+       {
+	continue;
+       }
+
+      calc_row_terms ( err_meas, orig_row, est_row, num_cols, num_bands,
+		       &table, num, den );
+      for ( ix = 0; ix < num_cols; ix++ )
+       {
+	sum_fix_num += num[ix];
+	sum_fix_den += den[ix];
+       }
+     }
+
+    if ( IS_NULL ( num ) )
+     {
+      fail = 1;
+     }
+    free ( num );
+   }
+
+   if ( fail )
+    {
+     ERROR_RET ( "Insufficient memory !", DBL_MAX );
+    }
+
+   sum_num = ( double ) sum_fix_num;
+   sum_den = ( double ) sum_fix_den;
+  }
+ else
+  {
+   int num_elems = num_cols * num_bands;
+   uint64_t sum_abs = 0, sum_sq = 0, sum_orig_sq = 0;
+
+#pragma omp parallel for schedule(static) reduction(+:sum_abs,sum_sq,sum_orig_sq)
+   for ( iy = 0; iy < num_rows; iy++ )
+    {
+     const byte *o = ( const byte * ) get_img_data_1d ( orig_img ) +
+      ( size_t ) iy * num_elems;
+     const byte *e = ( const byte * ) get_img_data_1d ( est_img ) +
+      ( size_t ) iy * num_elems;
+     /* the bands of all pixels are one flat array, so this loop vectorizes */
+     uint64_t row_abs = 0, row_sq = 0, row_orig_sq = 0;
+     int ik;
+
+     for ( ik = 0; ik < num_elems; ik++ )
+      {
+       int diff = o[ik] - e[ik];
+
+       row_abs += abs ( diff );
+       row_sq += diff * diff;
+       row_orig_sq += o[ik] * o[ik];
+      }
+     sum_abs += row_abs;
+     sum_sq += row_sq;
+     sum_orig_sq += row_orig_sq;
+    }
+
+   sum_num = ( double ) ( err_meas == EM_MAE ? sum_abs : sum_sq );
+   sum_den = ( double ) sum_orig_sq;
+  }
+
+ return finish_error ( err_meas, sum_num, sum_den, num_samples );
+}
+
+/**
+ * @brief Calculates the mean local error between an image and its estimate
+ *
+ * @param[in] err_meas Error measure
+ * @param[in] orig_img Original image { grayscale, rgb }
+ * @param[in] est_img Estimated image { grayscale, rgb }
+ * @param[in] win_size Window size [ odd, >= 1 ]
+ *
+ * @return Error value or DBL_MAX on failure
+ *
+ * @note The measure of calc_error is computed within every WIN_SIZE x
+ *       WIN_SIZE window that fits in the image and averaged over the
+ *       windows. Windows where it is undefined (no error for PSNR, zero
+ *       original energy for NMSE and NCD) are skipped; if all are, the
+ *       result is HUGE_VAL for PSNR and 0 otherwise. Window sums are kept
+ *       as running column sums that move down one row at a time plus a
+ *       running sum along the row, so the cost per pixel does not depend on
+ *       WIN_SIZE. Each thread handles a strip of window rows and keeps the
+ *       per-pixel terms of its last WIN_SIZE rows. The terms are integers
+ *       (fixed-point for NCD), so the running sums are exact and windows
+ *       with zero original energy are recognized as such; the window errors
+ *       are added up row by row in a fixed order, so the result does not
+ *       depend on the number of threads.
+ * @see #calc_error
+ *
+ * @author Damian Kusnik
+ */
+
+double
+calc_error_win ( const ErrorMeasure err_meas, const Image * orig_img,
+		 const Image * est_img, int win_size )
+{
+ SET_FUNC_NAME ( "calc_error_win" );
+ int num_rows, num_cols, num_bands;
+ int num_win_rows, num_win_cols;
+ int fail = 0;
+ int ir;
+ int64_t num_valid = 0;
+ double win_samples;
+ double sum_err = 0.0;
+ double *row_err;
+ LabTable table;
+ const byte *orig_data, *est_data;
+
+ if ( check_error_args ( err_meas, orig_img, est_img ) != E_SUCCESS )
+  {
+   return DBL_MAX;
+  }
+
+ if ( !IS_POS_ODD ( win_size ) )
+  {
+   ERROR ( "Window size ( %d ) must be positive and odd !", win_size );
+   return DBL_MAX;
+  }
+
+ num_rows = get_num_rows ( orig_img );
+ num_cols = get_num_cols ( orig_img );
+ num_bands = get_num_bands ( orig_img );
+ num_win_rows = num_rows - win_size + 1;
+ num_win_cols = num_cols - win_size + 1;
+ if ( num_win_rows <= 0 || num_win_cols <= 0 )
+  {
+   ERROR ( "Window size ( %d ) must not exceed the image size !", win_size );
+   return DBL_MAX;
+  }
+
+ /* sum of the window errors along each window row, added up in order at
+    the end so that the result does not depend on the number of threads */
+ row_err = ( double * ) calloc ( num_win_rows, sizeof ( double ) );
+ if ( IS_NULL ( row_err ) )
+  {
+   ERROR_RET ( "Insufficient memory !", DBL_MAX );
+  }
+
+ if ( err_meas == EM_NCD )
+  {
+   init_lab_table ( &table );
+  }
+
+ orig_data = ( const byte * ) get_img_data_1d ( orig_img );
+ est_data = ( const byte * ) get_img_data_1d ( est_img );
+ win_samples = ( double ) win_size * win_size * num_bands;
+
+#pragma omp parallel reduction(+:num_valid) reduction(|:fail)
+ {
+  /* terms of the last WIN_SIZE rows, then the column sums */
+  int64_t *ring_num = ( int64_t * ) malloc ( ( size_t ) ( 2 * win_size + 2 ) *
+					     num_cols * sizeof ( int64_t ) );
+  int64_t *ring_den = ring_num + ( size_t ) win_size * num_cols;
+  int64_t *col_num = ring_den + ( size_t ) win_size * num_cols;
+  int64_t *col_den = col_num + num_cols;
+  int num_threads = 1, thread_id = 0;
+  int y0, y1, iy, ix;
+
+#ifdef _OPENMP
+  num_threads = omp_get_num_threads ( );
+  thread_id = omp_get_thread_num ( );
+#endif
+
+  /* contiguous strips of window rows, so the column sums only move down */
+  y0 = ( int ) ( ( int64_t ) num_win_rows * thread_id / num_threads );
+  y1 = ( int ) ( ( int64_t ) num_win_rows * ( thread_id + 1 ) / num_threads );
+
+  if ( IS_NULL ( ring_num ) )
+   {
+    fail = 1;
+   }
+  else if ( y0 < y1 )
+   {
+    memset ( col_num, 0, 2 * num_cols * sizeof ( int64_t ) );
+    for ( iy = y0; iy < y0 + win_size; iy++ )
+     {
+      int64_t *num = ring_num + ( size_t ) ( iy % win_size ) * num_cols;
+      int64_t *den = ring_den + ( size_t ) ( iy % win_size ) * num_cols;
+
+      calc_row_terms ( err_meas, orig_data + ( size_t ) iy * num_cols * num_bands,
+		       est_data + ( size_t ) iy * num_cols * num_bands,
+		       num_cols, num_bands, &table, num, den );
+      for ( ix = 0; ix < num_cols; ix++ )
+       {
+	col_num[ix] += num[ix];
+	col_den[ix] += den[ix];
+       }
+     }
+
+    for ( iy = y0; iy < y1; iy++ )
+     {
+      int64_t win_num = 0, win_den = 0;
+
+      if ( iy > y0 )
+       {
+	/* replace the terms of row IY - 1 with those of row IY + WIN_SIZE - 1 */
+	int new_row = iy + win_size - 1;
+	int64_t *num = ring_num + ( size_t ) ( new_row % win_size ) * num_cols;
+	int64_t *den = ring_den + ( size_t ) ( new_row % win_size ) * num_cols;
+
+	for ( ix = 0; ix < num_cols; ix++ )
+	 {
+	  col_num[ix] -= num[ix];
+	  col_den[ix] -= den[ix];
+	 }
+	calc_row_terms ( err_meas,
+			 orig_data + ( size_t ) new_row * num_cols * num_bands,
+			 est_data + ( size_t ) new_row * num_cols * num_bands,
+			 num_cols, num_bands, &table, num, den );
+	for ( ix = 0; ix < num_cols; ix++ )
+	 {
+	  col_num[ix] += num[ix];
+	  col_den[ix] += den[ix];
+	 }
+       }
+
+      for ( ix = 0; ix < win_size; ix++ )
+       {
+	win_num += col_num[ix];
+	win_den += col_den[ix];
+       }
+      for ( ix = 0; ix < num_win_cols; ix++ )
+       {
+	if ( ix > 0 )
+	 {
+	  win_num += col_num[ix + win_size - 1] - col_num[ix - 1];
+	  win_den += col_den[ix + win_size - 1] - col_den[ix - 1];
+	 }
+
+	if ( ( err_meas == EM_PSNR && win_num == 0 ) ||
+	     ( ( err_meas == EM_NMSE || err_meas == EM_NCD ) && win_den == 0 ) )
+	 {
+	  continue;
+	 }
+	row_err[iy] += finish_error ( err_meas, ( double ) win_num,
+				      ( double ) win_den, win_samples );
+	num_valid++;
+       }
+     }
+   }
+
+  free ( ring_num );
+ }
+
+ for ( ir = 0; ir < num_win_rows; ir++ )
+  {
+   sum_err += row_err[ir];
+  }
+ free ( row_err );
+
+ if ( fail )
+  {
+   ERROR_RET ( "Insufficient memory !", DBL_MAX );
+  }
+
+ if ( num_valid == 0 )
+  {
+   return err_meas == EM_PSNR ? HUGE_VAL : 0.0;
+  }
+
+ return sum_err / num_valid;
+}
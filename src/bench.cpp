@@ -0,0 +1,382 @@
+/**
+ * @file bench.c
+ * Routines for benchmarking the filters
+ */
+
+#include <stdint.h>
+#include "image.h"
+
+#define SYNTH_NUM_DISCS 24	/* flat discs laid over the smooth background */
+
+#define BENCH_LINE_LEN 1024
+
+/** @cond INTERNAL_FUNCTION */
+
+static int
+cmp_double ( const void *a, const void *b )
+{
+ double x = *( const double * ) a;
+ double y = *( const double * ) b;
+
+ return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/* Next value of a 32-bit LCG, in [ 0, 1 ) */
+static double
+next_unit ( uint32_t * state )
+{
+ *state = *state * 1664525U + 1013904223U;
+
+ return *state / 4294967296.0;
+}
+
+/* Reads the string value of KEY from a JSON line into VALUE */
+static int
+get_json_string ( const char *line, const char *key, char *value,
+		  const int max_len )
+{
+ const char *start = strstr ( line, key );
+ int len = 0;
+
+ if ( IS_NULL ( start ) || IS_NULL ( start = strchr ( start + strlen ( key ), '"' ) ) )
+  {
+   return 0;
+  }
+
+ for ( start++; start[len] != '"' && start[len] != '\0' && len < max_len - 1; len++ )
+  {
+   value[len] = start[len];
+  }
+ value[len] = '\0';
+
+ return 1;
+}
+
+/** @endcond INTERNAL_FUNCTION */
+
+/**
+ * @brief Summarizes the run times of a benchmark
+ *
+ * @param[in] num_runs Number of runs [ >= 1 ]
+ * @param[in] times Run times (s)
+ * @param[out] stats Statistics
+ *
+ * @return none
+ *
+ * @note Percentiles use the nearest rank.
+ *
+ * @author Damian Kusnik
+ */
+
+void
+calc_bench_stats ( const int num_runs, const double *times, BenchStats * stats )
+{
+ int ik;
+ double *sorted;
+
+ memset ( stats, 0, sizeof ( BenchStats ) );
+ if ( num_runs <= 0 )
+  {
+   return;
+  }
+
+ sorted = ( double * ) malloc ( num_runs * sizeof ( double ) );
+ if ( IS_NULL ( sorted ) )
+  {
+   return;
+  }
+
+ memcpy ( sorted, times, num_runs * sizeof ( double ) );
+ qsort ( sorted, num_runs, sizeof ( double ), cmp_double );
+
+ stats->num_runs = num_runs;
+ stats->min = sorted[0];
+ stats->median = num_runs % 2 ? sorted[num_runs / 2] :
+  0.5 * ( sorted[num_runs / 2 - 1] + sorted[num_runs / 2] );
+ stats->p95 = sorted[( int ) ceil ( 0.95 * num_runs ) - 1];
+ for ( ik = 0; ik < num_runs; ik++ )
+  {
+   stats->mean += sorted[ik];
+  }
+ stats->mean /= num_runs;
+
+ free ( sorted );
+}
+
+/**
+ * @brief Generates a synthetic color test image
+ *
+ * @param[in] num_rows Number of rows [ >= 1 ]
+ * @param[in] num_cols Number of columns [ >= 1 ]
+ * @param[in] seed Seed
+ *
+ * @return Pointer to the image { rgb } or NULL
+ *
+ * @note A smooth sinusoidal background in each band with flat colored
+ *       discs on top, so that the image has both gradients and sharp
+ *       edges. The same size and seed always give the same image.
+ *
+ * @author Damian Kusnik
+ */
+
+Image *
+make_synthetic_img ( const int num_rows, const int num_cols,
+		     const unsigned long seed )
+{
+ SET_FUNC_NAME ( "make_synthetic_img" );
+ int iy, ib, id;
+ uint32_t state = ( uint32_t ) seed ^ 0x9E3779B9U;
+ double freq[3][2], phase[3];
+ double disc[SYNTH_NUM_DISCS][6];	/* y, x, radius^2, r, g, b */
+ byte ***out_data;
+ Image *out_img;
+
+ if ( num_rows <= 0 || num_cols <= 0 )
+  {
+   ERROR ( "Image dimensions ( %d x %d ) must be positive !", num_rows,
+	   num_cols );
+   return NULL;
+  }
+
+ out_img = alloc_img ( PIX_RGB, num_rows, num_cols );
+ if ( IS_NULL ( out_img ) )
+  {
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ for ( ib = 0; ib < 3; ib++ )
+  {
+   /* between 1 and 4 periods across the image */
+   freq[ib][0] = TWO_PI * ( 1.0 + 3.0 * next_unit ( &state ) ) / num_rows;
+   freq[ib][1] = TWO_PI * ( 1.0 + 3.0 * next_unit ( &state ) ) / num_cols;
+   phase[ib] = TWO_PI * next_unit ( &state );
+  }
+
+ for ( id = 0; id < SYNTH_NUM_DISCS; id++ )
+  {
+   double radius = ( 0.02 + 0.1 * next_unit ( &state ) ) *
+    MIN_2 ( num_rows, num_cols );
+
+   disc[id][0] = num_rows * next_unit ( &state );
+   disc[id][1] = num_cols * next_unit ( &state );
+   disc[id][2] = radius * radius;
+   for ( ib = 0; ib < 3; ib++ )
+    {
+     disc[id][3 + ib] = ( int ) ( MAX_GRAY * next_unit ( &state ) );
+    }
+  }
+
+ out_data = ( byte *** ) get_img_data_nd ( out_img );
+
+#pragma omp parallel for schedule(static)
+ for ( iy = 0; iy < num_rows; iy++ )
+  {
+   int ix, jb, jd;
+
+   for ( ix = 0; ix < num_cols; ix++ )
+    {
+     byte *pix = out_data[iy][ix];
+
+     for ( jb = 0; jb < 3; jb++ )
+      {
+       pix[jb] = ( byte ) ( 128.5 + 100.0 * sin ( freq[jb][0] * iy +
+						  freq[jb][1] * ix + phase[jb] ) );
+      }
+
+     /* the last disc covering the pixel wins */
+     for ( jd = SYNTH_NUM_DISCS - 1; jd >= 0; jd-- )
+      {
+       double dy = iy - disc[jd][0];
+       double dx = ix - disc[jd][1];
+
+       if ( dy * dy + dx * dx <= disc[jd][2] )
+	{
+	 pix[0] = ( byte ) disc[jd][3];
+	 pix[1] = ( byte ) disc[jd][4];
+	 pix[2] = ( byte ) disc[jd][5];
+	 break;
+	}
+      }
+    }
+  }
+
+ return out_img;
+}
+
+/**
+ * @brief Writes benchmark results as JSON
+ *
+ * @param[in] fp File pointer
+ * @param[in] suite Name of the benchmark suite
+ * @param[in] results Results
+ * @param[in] num_results Number of results
+ *
+ * @return E_SUCCESS or an error code
+ *
+ * @note Each result is written on a line of its own, so that
+ *       compare_bench_results can read the file back without a JSON parser.
+ *       Times are in seconds; Mpix/s, ns and cycles per pixel per
+ *       iteration are derived from the medians.
+ * @see #compare_bench_results
+ *
+ * @author Damian Kusnik
+ */
+
+int
+write_bench_json ( FILE * fp, const char *suite, const BenchResult * results,
+		   const int num_results )
+{
+ SET_FUNC_NAME ( "write_bench_json" );
+ int ir;
+
+ if ( IS_NULL ( fp ) || IS_NULL ( suite ) ||
+      ( num_results > 0 && IS_NULL ( results ) ) )
+  {
+   ERROR_RET ( "Invalid arguments !", E_INVARG );
+  }
+
+ fprintf ( fp, "{\n \"suite\": \"%s\",\n \"results\": [\n", suite );
+ for ( ir = 0; ir < num_results; ir++ )
+  {
+   const BenchResult *res = results + ir;
+   double median = res->stats.median;
+
+   fprintf ( fp, "  {\"name\": \"%s\", \"threads\": %d, \"runs\": %d, "
+	     "\"pixels\": %.0f, \"iters\": %d, \"min_s\": %.9f, "
+	     "\"median_s\": %.9f, \"p95_s\": %.9f, \"mean_s\": %.9f, "
+	     "\"mpix_per_s\": %.3f, \"ns_per_pixel_iter\": %.3f, ",
+	     res->name, res->num_threads, res->stats.num_runs,
+	     res->num_pixels, res->num_iters, res->stats.min, median,
+	     res->stats.p95, res->stats.mean,
+	     median > 0.0 ? 1e-6 * res->num_pixels / median : 0.0,
+	     1e9 * median / ( res->num_pixels * MAX_2 ( res->num_iters, 1 ) ) );
+   if ( res->cycles > 0.0 )
+    {
+     fprintf ( fp, "\"cycles_per_pixel_iter\": %.3f, ", res->cycles /
+	       ( res->num_pixels * MAX_2 ( res->num_iters, 1 ) ) );
+    }
+   else
+    {
+     fprintf ( fp, "\"cycles_per_pixel_iter\": null, " );
+    }
+   if ( res->efficiency > 0.0 )
+    {
+     fprintf ( fp, "\"efficiency\": %.3f}", res->efficiency );
+    }
+   else
+    {
+     fprintf ( fp, "\"efficiency\": null}" );
+    }
+   fprintf ( fp, "%s\n", ir < num_results - 1 ? "," : "" );
+  }
+ fprintf ( fp, " ]\n}\n" );
+
+ if ( ferror ( fp ) )
+  {
+   ERROR_RET ( "Cannot write the results !", E_FAILURE );
+  }
+
+ return E_SUCCESS;
+}
+
+/**
+ * @brief Compares benchmark results with a saved baseline
+ *
+ * @param[in] baseline_file Name of a file written by write_bench_json
+ * @param[in] results Current results
+ * @param[in] num_results Number of current results
+ * @param[in] tolerance Allowed relative slowdown of the median [ >= 0 ]
+ * @param[in] report File pointer for the comparison table, or NULL
+ *
+ * @return Number of regressions or -1 on failure
+ *
+ * @note Results are matched by name. A result is a regression if its
+ *       median is more than (1 + TOLERANCE) times the baseline median.
+ *       Results missing from the baseline are reported but not counted.
+ * @see #write_bench_json
+ *
+ * @author Damian Kusnik
+ */
+
+int
+compare_bench_results ( const char *baseline_file, const BenchResult * results,
+			const int num_results, const double tolerance,
+			FILE * report )
+{
+ SET_FUNC_NAME ( "compare_bench_results" );
+ char line[BENCH_LINE_LEN];
+ char name[BENCH_NAME_LEN];
+ int ir;
+ int num_regressions = 0;
+ double *base_median;
+ FILE *fp;
+
+ if ( tolerance < 0.0 )
+  {
+   ERROR ( "Tolerance ( %f ) must be non-negative !", tolerance );
+   return -1;
+  }
+
+ fp = fopen ( baseline_file, "r" );
+ if ( IS_NULL ( fp ) )
+  {
+   ERROR ( "Cannot open baseline file %s !", baseline_file );
+   return -1;
+  }
+
+ base_median = ( double * ) calloc ( MAX_2 ( num_results, 1 ), sizeof ( double ) );
+ if ( IS_NULL ( base_median ) )
+  {
+   fclose ( fp );
+   ERROR_RET ( "Insufficient memory !", -1 );
+  }
+
+ while ( !IS_NULL ( fgets ( line, sizeof ( line ), fp ) ) )
+  {
+   const char *median;
+
+   if ( !get_json_string ( line, "\"name\":", name, sizeof ( name ) ) ||
+	IS_NULL ( median = strstr ( line, "\"median_s\":" ) ) )
+    {
+     continue;
+    }
+
+   for ( ir = 0; ir < num_results; ir++ )
+    {
+     if ( !strcmp ( name, results[ir].name ) )
+      {
+       base_median[ir] = strtod ( median + strlen ( "\"median_s\":" ), NULL );
+      }
+    }
+  }
+ fclose ( fp );
+
+ for ( ir = 0; ir < num_results; ir++ )
+  {
+   double cur = results[ir].stats.median;
+   double base = base_median[ir];
+   int is_regression = base > 0.0 && cur > ( 1.0 + tolerance ) * base;
+
+   num_regressions += is_regression;
+   if ( IS_NULL ( report ) )
+    {
+     continue;
+    }
+
+   if ( base > 0.0 )
+    {
+     fprintf ( report, "%-10s %-48s %12.3f ms -> %12.3f ms (%+6.1f%%)\n",
+	       is_regression ? "REGRESSION" : "ok", results[ir].name,
+	       1e3 * base, 1e3 * cur, 100.0 * ( cur / base - 1.0 ) );
+    }
+   else
+    {
+     fprintf ( report, "%-10s %-48s %12s    -> %12.3f ms\n", "new",
+	       results[ir].name, "", 1e3 * cur );
+    }
+  }
+
+ free ( base_median );
+
+ return num_regressions;
+}
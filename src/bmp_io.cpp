@@ -0,0 +1,399 @@
+/**
+ * @file bmp_io.c
+ * Routines for reading/writing uncompressed BMP files
+ */
+
+#include "image.h"
+
+#define BMP_FILE_HEADER_SIZE 14	/* BITMAPFILEHEADER */
+
+#define BMP_INFO_HEADER_SIZE 40	/* BITMAPINFOHEADER */
+
+#define BMP_CORE_HEADER_SIZE 12	/* OS/2 BITMAPCOREHEADER */
+
+#define BI_RGB 0
+
+#define BI_BITFIELDS 3
+
+/** @cond INTERNAL_FUNCTION */
+
+static unsigned long
+get_le_uint ( const byte * buf, const int num_bytes )
+{
+ unsigned long val = 0;
+ int ik;
+
+ for ( ik = num_bytes - 1; ik >= 0; ik-- )
+  {
+   val = ( val << 8 ) | buf[ik];
+  }
+
+ return val;
+}
+
+static void
+put_le_uint ( byte * buf, const unsigned long val, const int num_bytes )
+{
+ int ik;
+
+ for ( ik = 0; ik < num_bytes; ik++ )
+  {
+   buf[ik] = ( byte ) ( val >> ( 8 * ik ) );
+  }
+}
+
+/* Returns the bit offset of a byte-aligned 8-bit mask or -1 */
+static int
+get_mask_shift ( const unsigned long mask )
+{
+ int shift;
+
+ for ( shift = 0; shift <= 24; shift += 8 )
+  {
+   if ( mask == ( 0xFFUL << shift ) )
+    {
+     return shift;
+    }
+  }
+
+ return -1;
+}
+
+/** @endcond INTERNAL_FUNCTION */
+
+/**
+ * @brief Reads an uncompressed BMP file
+ *
+ * @param[in,out] file_ptr File pointer (positioned at the start of the file)
+ *
+ * @return Pointer to the image or NULL
+ *
+ * @note The following BMP files are supported: 1) 8-bit palettized, read as
+ *       grayscale if the palette is gray and as RGB otherwise 2) 24-bit
+ *       3) 32-bit BI_RGB or BI_BITFIELDS with byte-aligned masks. Both
+ *       bottom-up and top-down files are accepted. The file is memory mapped
+ *       and each row is converted straight from the mapping.
+ * @ref http://www.fileformat.info/format/bmp/egff.htm
+ *
+ * @author Damian Kusnik
+ */
+
+Image *
+read_bmp ( FILE * file_ptr )
+{
+ SET_FUNC_NAME ( "read_bmp" );
+ int ir, ic;
+ int is_bottom_up;		/* is the BMP file stored bottom-up or top-down ? */
+ int is_gray;
+ int num_rows, num_cols;
+ int bpp;
+ int num_colors, pal_entry_size;
+ int shift[3];
+ long height;
+ unsigned long dib_size, compression, data_offset;
+ size_t row_size;
+ const byte *hdr;
+ const byte *pal;
+ byte gray_lut[NUM_GRAY];
+ FileMap map;
+ Image *img;
+
+ if ( map_file ( file_ptr, &map ) )
+  {
+   ERROR_RET ( "Cannot read file !", NULL );
+  }
+
+ hdr = map.data;
+ if ( map.size < BMP_FILE_HEADER_SIZE + BMP_CORE_HEADER_SIZE ||
+      hdr[0] != 'B' || hdr[1] != 'M' )
+  {
+   unmap_file ( &map );
+   ERROR_RET ( "Invalid BMP header !", NULL );
+  }
+
+ data_offset = get_le_uint ( hdr + 10, 4 );
+ dib_size = get_le_uint ( hdr + 14, 4 );
+ hdr += BMP_FILE_HEADER_SIZE;
+
+ if ( dib_size == BMP_CORE_HEADER_SIZE )
+  {
+   num_cols = ( int ) get_le_uint ( hdr + 4, 2 );
+   height = ( long ) get_le_uint ( hdr + 6, 2 );
+   bpp = ( int ) get_le_uint ( hdr + 10, 2 );
+   compression = BI_RGB;
+   num_colors = 0;
+   pal_entry_size = 3;
+  }
+ else if ( dib_size >= BMP_INFO_HEADER_SIZE &&
+	   map.size >= BMP_FILE_HEADER_SIZE + dib_size )
+  {
+   num_cols = ( int ) get_le_uint ( hdr + 4, 4 );
+   height = ( long ) ( int ) get_le_uint ( hdr + 8, 4 );
+   bpp = ( int ) get_le_uint ( hdr + 14, 2 );
+   compression = get_le_uint ( hdr + 16, 4 );
+   num_colors = ( int ) get_le_uint ( hdr + 32, 4 );
+   pal_entry_size = 4;
+  }
+ else
+  {
+   unmap_file ( &map );
+   ERROR_RET ( "Invalid BMP header !", NULL );
+  }
+
+ is_bottom_up = ( height > 0 );
+ num_rows = ( int ) ( is_bottom_up ? height : -height );
+ if ( num_rows <= 0 || num_cols <= 0 )
+  {
+   unmap_file ( &map );
+   ERROR_RET ( "Invalid BMP dimensions !", NULL );
+  }
+
+ /* Default channel layout is B, G, R in ascending byte order */
+ shift[0] = 16;
+ shift[1] = 8;
+ shift[2] = 0;
+
+ if ( compression == BI_BITFIELDS && bpp == 32 )
+  {
+   /* masks follow a BITMAPINFOHEADER, and are inside V4/V5 headers */
+   const byte *masks = hdr + BMP_INFO_HEADER_SIZE;
+
+   if ( map.size < BMP_FILE_HEADER_SIZE + BMP_INFO_HEADER_SIZE + 12 )
+    {
+     unmap_file ( &map );
+     ERROR_RET ( "Invalid BMP header !", NULL );
+    }
+
+   shift[0] = get_mask_shift ( get_le_uint ( masks, 4 ) );
+   shift[1] = get_mask_shift ( get_le_uint ( masks + 4, 4 ) );
+   shift[2] = get_mask_shift ( get_le_uint ( masks + 8, 4 ) );
+   if ( shift[0] < 0 || shift[1] < 0 || shift[2] < 0 )
+    {
+     unmap_file ( &map );
+     ERROR ( "BMP channel masks other than 8-bit are not supported { %s } !",
+	     error_str ( E_UNIMPL ) );
+     return NULL;
+    }
+   if ( dib_size == BMP_INFO_HEADER_SIZE )
+    {
+     dib_size += 12;
+    }
+  }
+ else if ( compression != BI_RGB || ( bpp != 8 && bpp != 24 && bpp != 32 ) )
+  {
+   unmap_file ( &map );
+   ERROR ( "Cannot read %d-bit BMP with compression %lu { %s } !",
+	   bpp, compression, error_str ( E_UNIMPL ) );
+   return NULL;
+  }
+
+ row_size = ( ( ( size_t ) num_cols * bpp + 31 ) / 32 ) * 4;
+ if ( data_offset + row_size * num_rows > map.size )
+  {
+   unmap_file ( &map );
+   ERROR_RET ( "Truncated BMP file !", NULL );
+  }
+
+ /* A palette of gray entries yields a grayscale image */
+ is_gray = 0;
+ pal = map.data + BMP_FILE_HEADER_SIZE + dib_size;
+ if ( bpp == 8 )
+  {
+   if ( num_colors <= 0 || num_colors > NUM_GRAY )
+    {
+     num_colors = NUM_GRAY;
+    }
+   if ( pal + num_colors * pal_entry_size > map.data + data_offset )
+    {
+     unmap_file ( &map );
+     ERROR_RET ( "Invalid BMP palette !", NULL );
+    }
+
+   is_gray = 1;
+   for ( ic = 0; ic < num_colors; ic++ )
+    {
+     const byte *entry = pal + ic * pal_entry_size;
+
+     if ( entry[0] != entry[1] || entry[1] != entry[2] )
+      {
+       is_gray = 0;
+      }
+     gray_lut[ic] = entry[0];
+    }
+   for ( ; ic < NUM_GRAY; ic++ )
+    {
+     gray_lut[ic] = 0;
+    }
+  }
+
+ img = alloc_img ( is_gray ? PIX_GRAY : PIX_RGB, num_rows, num_cols );
+ if ( IS_NULL ( img ) )
+  {
+   unmap_file ( &map );
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ for ( ir = 0; ir < num_rows; ir++ )
+  {
+   const byte *src = map.data + data_offset +
+    row_size * ( is_bottom_up ? num_rows - 1 - ir : ir );
+
+   if ( is_gray )
+    {
+     byte *dst = img->data_nd.byte_data_1b[ir];
+
+     for ( ic = 0; ic < num_cols; ic++ )
+      {
+       dst[ic] = gray_lut[src[ic]];
+      }
+    }
+   else if ( bpp == 8 )
+    {
+     byte *dst = img->data_nd.byte_data_3b[ir][0];
+
+     for ( ic = 0; ic < num_cols; ic++ )
+      {
+       int index = src[ic];
+
+       if ( index < num_colors )
+	{
+	 const byte *entry = pal + index * pal_entry_size;
+
+	 dst[3 * ic] = entry[2];
+	 dst[3 * ic + 1] = entry[1];
+	 dst[3 * ic + 2] = entry[0];
+	}
+       else
+	{
+	 dst[3 * ic] = dst[3 * ic + 1] = dst[3 * ic + 2] = 0;
+	}
+      }
+    }
+   else if ( bpp == 24 )
+    {
+     byte *dst = img->data_nd.byte_data_3b[ir][0];
+
+     for ( ic = 0; ic < num_cols; ic++ )
+      {
+       dst[3 * ic] = src[3 * ic + 2];
+       dst[3 * ic + 1] = src[3 * ic + 1];
+       dst[3 * ic + 2] = src[3 * ic];
+      }
+    }
+   else
+    {
+     byte *dst = img->data_nd.byte_data_3b[ir][0];
+     int r_off = shift[0] / 8, g_off = shift[1] / 8, b_off = shift[2] / 8;
+
+     for ( ic = 0; ic < num_cols; ic++ )
+      {
+       dst[3 * ic] = src[4 * ic + r_off];
+       dst[3 * ic + 1] = src[4 * ic + g_off];
+       dst[3 * ic + 2] = src[4 * ic + b_off];
+      }
+    }
+  }
+
+ unmap_file ( &map );
+
+ return img;
+}
+
+/**
+ * @brief Writes an uncompressed BMP file
+ *
+ * @param[in] img Image pointer { binary, grayscale, rgb }
+ * @param[in,out] file_ptr File pointer
+ *
+ * @return E_SUCCESS or an appropriate error code
+ *
+ * @note Binary and grayscale images are written as 8-bit palettized
+ *       files, RGB images as 24-bit files. Rows are stored bottom-up.
+ * @ref http://www.fileformat.info/format/bmp/egff.htm
+ *
+ * @author Damian Kusnik
+ */
+
+int
+write_bmp ( const Image * img, FILE * file_ptr )
+{
+ int ir, ic;
+ int num_rows, num_cols;
+ int bpp, num_colors;
+ size_t row_size, data_offset;
+ byte header[BMP_FILE_HEADER_SIZE + BMP_INFO_HEADER_SIZE];
+ byte palette[4 * NUM_GRAY];
+ byte *row;
+
+ if ( !is_byte_img ( img ) )
+  {
+   return E_INVOBJ;
+  }
+
+ num_rows = get_num_rows ( img );
+ num_cols = get_num_cols ( img );
+ bpp = is_rgb_img ( img ) ? 24 : 8;
+ num_colors = is_rgb_img ( img ) ? 0 : is_bin_img ( img ) ? 2 : NUM_GRAY;
+ row_size = ( ( ( size_t ) num_cols * bpp + 31 ) / 32 ) * 4;
+ data_offset = sizeof ( header ) + 4 * num_colors;
+
+ row = ( byte * ) calloc ( row_size, 1 );
+ if ( IS_NULL ( row ) )
+  {
+   return E_NOMEM;
+  }
+
+ memset ( header, 0, sizeof ( header ) );
+ header[0] = 'B';
+ header[1] = 'M';
+ put_le_uint ( header + 2, data_offset + row_size * num_rows, 4 );
+ put_le_uint ( header + 10, data_offset, 4 );
+ put_le_uint ( header + 14, BMP_INFO_HEADER_SIZE, 4 );
+ put_le_uint ( header + 18, num_cols, 4 );
+ put_le_uint ( header + 22, num_rows, 4 );
+ put_le_uint ( header + 26, 1, 2 );
+ put_le_uint ( header + 28, bpp, 2 );
+ put_le_uint ( header + 30, BI_RGB, 4 );
+ put_le_uint ( header + 34, row_size * num_rows, 4 );
+ put_le_uint ( header + 38, 2835, 4 );	/* 72 dpi */
+ put_le_uint ( header + 42, 2835, 4 );
+ put_le_uint ( header + 46, num_colors, 4 );
+ ( void ) fwrite ( header, 1, sizeof ( header ), file_ptr );
+
+ if ( num_colors )
+  {
+   for ( ic = 0; ic < num_colors; ic++ )
+    {
+     /* binary images store 0/1, so their palette is black and white */
+     byte val = ( byte ) ( num_colors == 2 ? ic * MAX_GRAY : ic );
+
+     palette[4 * ic] = palette[4 * ic + 1] = palette[4 * ic + 2] = val;
+     palette[4 * ic + 3] = 0;
+    }
+   ( void ) fwrite ( palette, 4, num_colors, file_ptr );
+  }
+
+ for ( ir = num_rows - 1; ir >= 0; ir-- )
+  {
+   if ( bpp == 8 )
+    {
+     memcpy ( row, img->data_nd.byte_data_1b[ir], num_cols );
+    }
+   else
+    {
+     const byte *src = img->data_nd.byte_data_3b[ir][0];
+
+     for ( ic = 0; ic < num_cols; ic++ )
+      {
+       row[3 * ic] = src[3 * ic + 2];
+       row[3 * ic + 1] = src[3 * ic + 1];
+       row[3 * ic + 2] = src[3 * ic];
+      }
+    }
+   ( void ) fwrite ( row, 1, row_size, file_ptr );
+  }
+
+ free ( row );
+
+ return ferror ( file_ptr ) ? E_FAILURE : E_SUCCESS;
+}
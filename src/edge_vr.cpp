@@ -0,0 +1,250 @@
+/**
+ * @file edge_vr.c
+ * Routines for VR edge detection on the CPU
+ */
+
+#include "image.h"
+
+#ifndef CUDA			/* the CUDA build uses edge_detection.cu */
+
+#define VR_WIN_SIZE 9		/* pixels in the 3x3 window */
+
+#define VR_NUM_OFFSETS 12	/* distinct offsets between two window pixels */
+
+/** @cond INTERNAL_FUNCTION */
+
+/* Offsets from window pixel A to a later pixel B, in raster order */
+static const int vr_offsets[VR_NUM_OFFSETS][2] = {
+ {0, 1}, {0, 2},
+ {1, -2}, {1, -1}, {1, 0}, {1, 1}, {1, 2},
+ {2, -2}, {2, -1}, {2, 0}, {2, 1}, {2, 2}
+};
+
+static int
+find_offset ( const int dr, const int dc )
+{
+ int io;
+
+ for ( io = 0; io < VR_NUM_OFFSETS; io++ )
+  {
+   if ( vr_offsets[io][0] == dr && vr_offsets[io][1] == dc )
+    {
+     return io;
+    }
+  }
+
+ return -1;
+}
+
+/*
+ * For each offset, stores the color distance between every pixel of ROW and
+ * the pixel at that offset from it (0 where the latter is outside the image).
+ */
+static void
+calc_offset_dists ( byte *** data, const int row, const int num_rows,
+		    const int num_cols, float *dists )
+{
+ int io, ic;
+
+ for ( io = 0; io < VR_NUM_OFFSETS; io++ )
+  {
+   int row2 = row + vr_offsets[io][0];
+   int dc = vr_offsets[io][1];
+   int c0 = MAX_2 ( 0, -dc );
+   int c1 = MIN_2 ( num_cols, num_cols - dc );
+   float *out = dists + ( size_t ) io * num_cols;
+
+   memset ( out, 0, num_cols * sizeof ( float ) );
+   if ( row2 >= num_rows )
+    {
+     continue;
+    }
+
+   {
+    const byte *p = data[row][0];
+    const byte *q = data[row2][0] + 3 * dc;
+
+    for ( ic = c0; ic < c1; ic++ )
+     {
+      int d0 = p[3 * ic] - q[3 * ic];
+      int d1 = p[3 * ic + 1] - q[3 * ic + 1];
+      int d2 = p[3 * ic + 2] - q[3 * ic + 2];
+
+      out[ic] = sqrtf ( ( float ) ( d0 * d0 + d1 * d1 + d2 * d2 ) );
+     }
+   }
+  }
+}
+
+/** @endcond INTERNAL_FUNCTION */
+
+/**
+ * @brief Implements the VR edge detector on the CPU
+ *
+ * @param[in] in_img Image pointer { rgb }
+ * @param[in] threshold Cut off for edge or not [ > 0 ]
+ *
+ * @return Pointer to the edge magnitude image { grayscale } or NULL
+ *
+ * @note Within each 3x3 window the pixels with the smallest and largest sums
+ *       of distances to the others are found; their distance is the output.
+ *       A pairwise distance depends only on the first pixel and the offset
+ *       to the second, so each thread keeps the 12 offset distances of the
+ *       three rows under the window and computes only one new row per output
+ *       row, with unit-stride loops. Results match the CUDA kernel,
+ *       including the truncation of the running min/max sums to integers
+ *       and the 8-bit wrap of the output; the one-pixel frame is set to 0.
+ * @ref Trahanias P.E. and Venetsanopoulos A.N. (1993) "Vector Order
+ *      Statistics Operators as Color Edge Detectors" IEEE Trans. on Image
+ *      Processing, 2(4): 528-534 (Eq. 2)
+ *
+ * @author Damian Kusnik
+ */
+
+Image *
+detect_edge_VR ( const Image * in_img, const int threshold )
+{
+ SET_FUNC_NAME ( "detect_edge_VR" );
+ int ir;
+ int num_rows, num_cols;
+ int pair_offset[VR_WIN_SIZE][VR_WIN_SIZE];
+ byte ***in_data;
+ byte **out_data;
+ Image *out_img;
+
+ if ( !is_rgb_img ( in_img ) )
+  {
+   ERROR_RET ( "Not a color image !", NULL );
+  }
+
+ if ( threshold <= 0 )
+  {
+   ERROR ( "Threshold ( %d ) must be positive !", threshold );
+   return NULL;
+  }
+
+ num_rows = get_num_rows ( in_img );
+ num_cols = get_num_cols ( in_img );
+
+ out_img = alloc_img ( PIX_GRAY, num_rows, num_cols );
+ if ( IS_NULL ( out_img ) )
+  {
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ in_data = ( byte *** ) get_img_data_nd ( in_img );
+ out_data = ( byte ** ) get_img_data_nd ( out_img );
+ memset ( out_data[0], 0, ( size_t ) num_rows * num_cols );
+ if ( num_rows < 3 || num_cols < 3 )
+  {
+   return out_img;
+  }
+
+ /* Offset index of each pair of window pixels, the first before the second */
+ {
+  int ia, ib;
+
+  for ( ia = 0; ia < VR_WIN_SIZE; ia++ )
+   {
+    for ( ib = ia + 1; ib < VR_WIN_SIZE; ib++ )
+     {
+      pair_offset[ia][ib] = find_offset ( ib / 3 - ia / 3, ib % 3 - ia % 3 );
+     }
+   }
+ }
+
+#pragma omp parallel
+ {
+  /* offset distances of the three rows under the window, reused as it moves down */
+  float *ring = ( float * ) malloc ( 3 * VR_NUM_OFFSETS * ( size_t ) num_cols *
+				     sizeof ( float ) );
+  float *sums = ( float * ) malloc ( VR_WIN_SIZE * ( size_t ) num_cols *
+				     sizeof ( float ) );
+  int last_row = -1;		/* last row whose distances are in RING */
+
+  if ( !IS_NULL ( ring ) && !IS_NULL ( sums ) )
+   {
+#pragma omp for schedule(static)
+    for ( ir = 1; ir < num_rows - 1; ir++ )
+     {
+      int iw, iv, ic;
+      int row;
+
+      /* a thread's rows are consecutive, so usually one row is missing */
+      for ( row = MAX_2 ( ir - 1, last_row + 1 ); row <= ir + 1; row++ )
+       {
+	calc_offset_dists ( in_data, row, num_rows, num_cols,
+			    ring + ( size_t ) ( row % 3 ) * VR_NUM_OFFSETS * num_cols );
+       }
+      last_row = ir + 1;
+
+      /* cumulative distance of each window pixel, in the kernel's order */
+      for ( iw = 0; iw < VR_WIN_SIZE; iw++ )
+       {
+	float *sum = sums + ( size_t ) iw * num_cols;
+
+	memset ( sum, 0, num_cols * sizeof ( float ) );
+	for ( iv = 0; iv < VR_WIN_SIZE; iv++ )
+	 {
+	  int ia = MIN_2 ( iv, iw );
+	  int ib = MAX_2 ( iv, iw );
+	  int dc = ia % 3 - 1;	/* column of pixel IA relative to the center */
+	  const float *dist;
+
+	  if ( iv == iw )
+	   {
+	    continue;
+	   }
+
+	  /* distance between pixels IA and IB, indexed by the column of IA */
+	  dist = ring + ( ( size_t ) ( ( ir - 1 + ia / 3 ) % 3 ) * VR_NUM_OFFSETS +
+			  pair_offset[ia][ib] ) * num_cols;
+	  for ( ic = 1; ic < num_cols - 1; ic++ )
+	   {
+	    sum[ic] += dist[ic + dc];
+	   }
+	 }
+       }
+
+      for ( ic = 1; ic < num_cols - 1; ic++ )
+       {
+	int min_dist = INT_MAX, max_dist = INT_MIN;
+	int min_index = VR_WIN_SIZE / 2, max_index = VR_WIN_SIZE / 2;
+	const byte *p, *q;
+	int d0, d1, d2;
+
+	for ( iw = 0; iw < VR_WIN_SIZE; iw++ )
+	 {
+	  float dist_sum = sums[( size_t ) iw * num_cols + ic];
+
+	  if ( dist_sum < min_dist )
+	   {
+	    min_dist = ( int ) dist_sum;
+	    min_index = iw;
+	   }
+	  if ( dist_sum > max_dist )
+	   {
+	    max_dist = ( int ) dist_sum;
+	    max_index = iw;
+	   }
+	 }
+
+	p = in_data[ir - 1 + min_index / 3][ic - 1 + min_index % 3];
+	q = in_data[ir - 1 + max_index / 3][ic - 1 + max_index % 3];
+	d0 = p[0] - q[0];
+	d1 = p[1] - q[1];
+	d2 = p[2] - q[2];
+	out_data[ir][ic] =
+	 ( byte ) ( ( int ) sqrtf ( ( float ) ( d0 * d0 + d1 * d1 + d2 * d2 ) ) & 0xFF );
+       }
+     }
+   }
+
+  free ( ring );
+  free ( sums );
+ }
+
+ return out_img;
+}
+
+#endif
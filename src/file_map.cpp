@@ -0,0 +1,138 @@
+/**
+ * @file file_map.c
+ * Routines for mapping image files into memory
+ */
+
+#if defined(__unix__) && !defined(NO_MMAP)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define USE_MMAP
+#endif
+
+#include "image.h"
+
+/**
+ * @brief Makes the whole contents of a file available in memory
+ *
+ * @param[in,out] file_ptr File pointer
+ * @param[out] map File map
+ *
+ * @return E_SUCCESS or an appropriate error code
+ *
+ * @note The file must be positioned at its start. It is memory mapped where
+ *       possible (define NO_MMAP to disable this); otherwise, e.g. for pipes,
+ *       it is read into a buffer. Either way the data must be released with
+ *       unmap_file.
+ * @see #unmap_file
+ *
+ * @author Damian Kusnik
+ */
+
+int
+map_file ( FILE * file_ptr, FileMap * map )
+{
+ size_t cap, num_read;
+ byte *tmp;
+
+ map->data = NULL;
+ map->size = 0;
+ map->is_mapped = 0;
+
+ if ( IS_NULL ( file_ptr ) )
+  {
+   return E_FOPEN;
+  }
+
+#ifdef USE_MMAP
+ {
+  struct stat st;
+
+  if ( !fstat ( fileno ( file_ptr ), &st ) && S_ISREG ( st.st_mode ) &&
+       st.st_size > 0 )
+   {
+    void *addr = mmap ( NULL, ( size_t ) st.st_size, PROT_READ, MAP_PRIVATE,
+			fileno ( file_ptr ), 0 );
+
+    if ( addr != MAP_FAILED )
+     {
+      /* the pixel data is read front to back exactly once */
+      ( void ) madvise ( addr, ( size_t ) st.st_size, MADV_SEQUENTIAL );
+      map->data = ( byte * ) addr;
+      map->size = ( size_t ) st.st_size;
+      map->is_mapped = 1;
+      return E_SUCCESS;
+     }
+   }
+ }
+#endif
+
+ /* Fall back to reading the file from its current position */
+ cap = 1 << 16;
+ map->data = ( byte * ) malloc ( cap );
+ if ( IS_NULL ( map->data ) )
+  {
+   return E_NOMEM;
+  }
+
+ while ( ( num_read = fread ( map->data + map->size, 1, cap - map->size,
+			      file_ptr ) ) > 0 )
+  {
+   map->size += num_read;
+   if ( map->size == cap )
+    {
+     cap *= 2;
+     tmp = ( byte * ) realloc ( map->data, cap );
+     if ( IS_NULL ( tmp ) )
+      {
+       unmap_file ( map );
+       return E_NOMEM;
+      }
+     map->data = tmp;
+    }
+  }
+
+ if ( ferror ( file_ptr ) )
+  {
+   unmap_file ( map );
+   return E_FREAD;
+  }
+
+ return E_SUCCESS;
+}
+
+/**
+ * @brief Releases the memory of a file map
+ *
+ * @param[in,out] map File map
+ *
+ * @return none
+ *
+ * @see #map_file
+ *
+ * @author Damian Kusnik
+ */
+
+void
+unmap_file ( FileMap * map )
+{
+ if ( IS_NULL ( map->data ) )
+  {
+   return;
+  }
+
+#ifdef USE_MMAP
+ if ( map->is_mapped )
+  {
+   ( void ) munmap ( map->data, map->size );
+  }
+ else
+#endif
+  {
+   free ( map->data );
+  }
+
+ map->data = NULL;
+ map->size = 0;
+ map->is_mapped = 0;
+}
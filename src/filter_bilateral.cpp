@@ -0,0 +1,483 @@
+/**
+ * @file filter_bilateral.c
+ * Routines for bilateral filtering
+ */
+
+#include "image.h"
+
+#define BIL_MIN_GRID_SIGMA 2.0	/* smaller spatial sigmas are filtered exactly */
+
+#define BIL_MAX_GRID_RATIO 2	/* max. grid cells per pixel */
+
+#define BIL_MIN_GRID_BUDGET 65536	/* cells always allowed, for small images */
+
+#define BIL_NUM_TAPS 5		/* [ 1 4 6 4 1 ] / 16, a Gaussian of sigma 1 cell */
+
+#define BIL_SPACING_STEP 1.05	/* growth of the grid spacing while over budget */
+
+/** @cond INTERNAL_FUNCTION */
+
+static const float bil_taps[BIL_NUM_TAPS] = {
+ 1.0f / 16, 4.0f / 16, 6.0f / 16, 4.0f / 16, 1.0f / 16
+};
+
+/* Checks the arguments and returns the range guide: the intensity of a
+   grayscale image or the luminance of a color one */
+static byte *
+start_bilateral ( const Image * in_img, const double range_sigma,
+		  const double spatial_sigma )
+{
+ SET_FUNC_NAME ( "start_bilateral" );
+ int num_bands;
+ size_t ik, num_pixels;
+ byte *in_data;
+ byte *guide;
+
+ if ( !is_gray_img ( in_img ) && !is_rgb_img ( in_img ) )
+  {
+   ERROR_RET ( "Not a grayscale or color image !", NULL );
+  }
+
+ if ( !IS_POS ( range_sigma ) || !IS_POS ( spatial_sigma ) )
+  {
+   ERROR ( "Sigma values ( %f, %f ) must be positive !", range_sigma,
+	   spatial_sigma );
+   return NULL;
+  }
+
+ num_bands = is_rgb_img ( in_img ) ? 3 : 1;
+ num_pixels = ( size_t ) get_num_rows ( in_img ) * get_num_cols ( in_img );
+ in_data = ( byte * ) get_img_data_1d ( in_img );
+
+ guide = ( byte * ) malloc ( num_pixels );
+ if ( IS_NULL ( guide ) )
+  {
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+#pragma omp parallel for schedule(static)
+ for ( ik = 0; ik < num_pixels; ik++ )
+  {
+   const byte *pix = in_data + num_bands * ik;
+
+   /* same weights as rgb_to_gray */
+   guide[ik] = num_bands == 1 ? pix[0] :
+    ( byte ) ( 0.29893602129378 * pix[0] + 0.58704307445112 * pix[1] +
+	       0.11402090425510 * pix[2] );
+  }
+
+ return guide;
+}
+
+/* Blurs NUM_LINES lines of LEN cells, STRIDE floats apart, with the
+   5-tap kernel TAPS; the lines start LINE_STEP floats apart and hold NUM_CH
+   floats per cell. Cells outside the grid count as zero. */
+static void
+blur_grid_axis ( const float *src, float *dst, const int num_lines,
+		 const size_t line_step, const int len, const size_t stride,
+		 const int num_ch, const float *taps )
+{
+ int il;
+
+#pragma omp parallel for schedule(static)
+ for ( il = 0; il < num_lines; il++ )
+  {
+   const float *src_line = src + ( size_t ) il * line_step;
+   float *dst_line = dst + ( size_t ) il * line_step;
+   int ic, it, ch;
+
+   for ( ic = 0; ic < len; ic++ )
+    {
+     float *out = dst_line + ic * stride;
+
+     for ( ch = 0; ch < num_ch; ch++ )
+      {
+       out[ch] = 0.0f;
+      }
+     for ( it = MAX_2 ( 0, 2 - ic ); it < MIN_2 ( BIL_NUM_TAPS, len + 2 - ic ); it++ )
+      {
+       const float *in = src_line + ( ic + it - 2 ) * stride;
+
+       for ( ch = 0; ch < num_ch; ch++ )
+	{
+	 out[ch] += taps[it] * in[ch];
+	}
+      }
+    }
+  }
+}
+
+/* The exact filter, given the range guide */
+static Image *
+filter_bilateral_exact ( const Image * in_img, const byte * guide,
+			 const double range_sigma, const double spatial_sigma )
+{
+ SET_FUNC_NAME ( "filter_bilateral_exact" );
+ int num_rows, num_cols, num_bands;
+ int radius, win_size;
+ int iy, ik;
+ float range_weight[MAX_GRAY + 1];
+ float *spatial_weight;
+ byte *in_data, *out_data;
+ Image *out_img;
+
+ num_rows = get_num_rows ( in_img );
+ num_cols = get_num_cols ( in_img );
+ num_bands = is_rgb_img ( in_img ) ? 3 : 1;
+ /* the spatial kernel is cut off at 3 sigma */
+ radius = ( int ) ceil ( 3.0 * spatial_sigma );
+ win_size = 2 * radius + 1;
+
+ out_img = alloc_img ( get_pix_type ( in_img ), num_rows, num_cols );
+ spatial_weight = ( float * ) malloc ( win_size * win_size * sizeof ( float ) );
+ if ( IS_NULL ( out_img ) || IS_NULL ( spatial_weight ) )
+  {
+   if ( !IS_NULL ( out_img ) )
+    {
+     free_img ( out_img );
+     free ( out_img );
+    }
+   free ( spatial_weight );
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ for ( ik = 0; ik <= MAX_GRAY; ik++ )
+  {
+   range_weight[ik] = ( float ) exp ( -0.5 * ik * ik / ( range_sigma * range_sigma ) );
+  }
+ for ( ik = 0; ik < win_size * win_size; ik++ )
+  {
+   int dy = ik / win_size - radius;
+   int dx = ik % win_size - radius;
+
+   spatial_weight[ik] = ( float ) exp ( -0.5 * ( dy * dy + dx * dx ) /
+					( spatial_sigma * spatial_sigma ) );
+  }
+
+ in_data = ( byte * ) get_img_data_1d ( in_img );
+ out_data = ( byte * ) get_img_data_1d ( out_img );
+
+#pragma omp parallel for schedule(dynamic)
+ for ( iy = 0; iy < num_rows; iy++ )
+  {
+   int ix, jy, jx, ib;
+
+   for ( ix = 0; ix < num_cols; ix++ )
+    {
+     int center = guide[( size_t ) iy * num_cols + ix];
+     float sum[3] = { 0.0f, 0.0f, 0.0f };
+     float sum_weight = 0.0f;
+
+     /* the window is cut off at the image border */
+     for ( jy = MAX_2 ( 0, iy - radius ); jy <= MIN_2 ( num_rows - 1, iy + radius ); jy++ )
+      {
+       const float *sw = spatial_weight + ( jy - iy + radius ) * win_size + radius - ix;
+       const byte *guide_row = guide + ( size_t ) jy * num_cols;
+       const byte *in_row = in_data + ( size_t ) jy * num_cols * num_bands;
+
+       for ( jx = MAX_2 ( 0, ix - radius ); jx <= MIN_2 ( num_cols - 1, ix + radius ); jx++ )
+	{
+	 float weight = sw[jx] * range_weight[abs ( guide_row[jx] - center )];
+
+	 sum_weight += weight;
+	 for ( ib = 0; ib < num_bands; ib++ )
+	  {
+	   sum[ib] += weight * in_row[jx * num_bands + ib];
+	  }
+	}
+      }
+
+     for ( ib = 0; ib < num_bands; ib++ )
+      {
+       out_data[( ( size_t ) iy * num_cols + ix ) * num_bands + ib] =
+	( byte ) ( sum[ib] / sum_weight + 0.5f );
+      }
+    }
+  }
+
+ free ( spatial_weight );
+
+ return out_img;
+}
+
+/** @endcond INTERNAL_FUNCTION */
+
+/**
+ * @brief Implements the bilateral filter
+ *
+ * @param[in] in_img Image pointer { grayscale, rgb }
+ * @param[in] range_sigma Range (intensity) standard deviation [ > 0 ]
+ * @param[in] spatial_sigma Spatial standard deviation (pixels) [ > 0 ]
+ *
+ * @return Pointer to the filtered image or NULL
+ *
+ * @note Approximates #filter_bilateral_ref with a bilateral grid: every
+ *       pixel is added to the nearest cell of a grid with a spacing of
+ *       SPATIAL_SIGMA pixels and RANGE_SIGMA intensity levels, the grid is
+ *       blurred with a Gaussian of one cell along each axis, and each pixel
+ *       reads the grid back by trilinear interpolation at its position and
+ *       intensity. The cost per pixel does not depend on the sigmas. For
+ *       color images all bands share the grid, indexed by the luminance.
+ *       The grid is kept within 2 cells per pixel (65536 cells for small
+ *       images): when the sigmas are small, both spacings grow by the same
+ *       factor F and the blur shrinks to a variance of 1 / F^2 cells^2, so
+ *       the filter keeps its sigmas but averages over coarser cells. A
+ *       SPATIAL_SIGMA below 2 is filtered exactly, at a cost of at most
+ *       13 x 13 pixels each.
+ * @ref Paris S. and Durand F. (2009) "A Fast Approximation of the
+ *      Bilateral Filter Using a Signal Processing Approach," Int. J. of
+ *      Computer Vision, 81(1): 24-52
+ * @ref Chen J., Paris S., and Durand F. (2007) "Real-Time Edge-Aware Image
+ *      Processing with the Bilateral Grid," ACM Trans. on Graphics, 26(3)
+ * @see #filter_bilateral_ref
+ *
+ * @author Damian Kusnik
+ */
+
+Image *
+filter_bilateral ( const Image * in_img, const double range_sigma,
+		   const double spatial_sigma )
+{
+ SET_FUNC_NAME ( "filter_bilateral" );
+ int num_rows, num_cols, num_bands, num_ch;
+ int grid_rows, grid_cols, grid_depth;
+ int iy, gy, ik;
+ int *first_row, *col_cell;
+ int level_cell[MAX_GRAY + 1];
+ float level_frac[MAX_GRAY + 1];
+ float taps[BIL_NUM_TAPS];
+ float *col_frac;
+ double scale, space_spacing, range_spacing, blur_var;
+ size_t num_cells, max_cells;
+ byte *guide;
+ byte *in_data, *out_data;
+ float *grid, *tmp;
+ Image *out_img;
+
+ guide = start_bilateral ( in_img, range_sigma, spatial_sigma );
+ if ( IS_NULL ( guide ) )
+  {
+   return NULL;
+  }
+
+ num_rows = get_num_rows ( in_img );
+ num_cols = get_num_cols ( in_img );
+ num_bands = is_rgb_img ( in_img ) ? 3 : 1;
+ num_ch = num_bands + 1;	/* the weight comes last */
+
+ if ( spatial_sigma < BIL_MIN_GRID_SIGMA )
+  {
+   out_img = filter_bilateral_exact ( in_img, guide, range_sigma, spatial_sigma );
+   free ( guide );
+   return out_img;
+  }
+
+ /* the spacings start at the sigmas and grow together until the grid fits
+    the budget; round ( x / spacing ) and the next cell, for the
+    interpolation */
+ max_cells = MAX_2 ( ( size_t ) BIL_MAX_GRID_RATIO * num_rows * num_cols,
+		     ( size_t ) BIL_MIN_GRID_BUDGET );
+ scale = 1.0;
+ while ( 1 )
+  {
+   space_spacing = scale * spatial_sigma;
+   range_spacing = scale * range_sigma;
+   grid_rows = ( int ) ( ( num_rows - 1 ) / space_spacing ) + 2;
+   grid_cols = ( int ) ( ( num_cols - 1 ) / space_spacing ) + 2;
+   grid_depth = ( int ) ( MAX_GRAY / range_spacing ) + 2;
+   num_cells = ( size_t ) grid_rows * grid_cols * grid_depth;
+   if ( num_cells <= max_cells || ( grid_rows == 2 && grid_cols == 2 && grid_depth == 2 ) )
+    {
+     break;
+    }
+   scale *= BIL_SPACING_STEP;
+  }
+
+ /* blend of the binomial kernel (variance 1) with the identity, so that
+    the blur is a Gaussian of one sigma, i.e. 1 / SCALE cells */
+ blur_var = 1.0 / ( scale * scale );
+ for ( ik = 0; ik < BIL_NUM_TAPS; ik++ )
+  {
+   taps[ik] = ( float ) ( blur_var * bil_taps[ik] +
+			  ( ik == BIL_NUM_TAPS / 2 ? 1.0 - blur_var : 0.0 ) );
+  }
+
+ out_img = alloc_img ( get_pix_type ( in_img ), num_rows, num_cols );
+ grid = ( float * ) calloc ( 2 * num_cells * num_ch, sizeof ( float ) );
+ first_row = ( int * ) malloc ( ( grid_rows + 1 ) * sizeof ( int ) );
+ col_cell = ( int * ) malloc ( num_cols * sizeof ( int ) );
+ col_frac = ( float * ) malloc ( num_cols * sizeof ( float ) );
+ if ( IS_NULL ( out_img ) || IS_NULL ( grid ) || IS_NULL ( first_row ) ||
+      IS_NULL ( col_cell ) || IS_NULL ( col_frac ) )
+  {
+   if ( !IS_NULL ( out_img ) )
+    {
+     free_img ( out_img );
+     free ( out_img );
+    }
+   free ( grid );
+   free ( first_row );
+   free ( col_cell );
+   free ( col_frac );
+   free ( guide );
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+ tmp = grid + num_cells * num_ch;
+
+ in_data = ( byte * ) get_img_data_1d ( in_img );
+ out_data = ( byte * ) get_img_data_1d ( out_img );
+
+ /* grid coordinates of the columns and intensities: cell and offset in it */
+ for ( ik = 0; ik < num_cols; ik++ )
+  {
+   col_cell[ik] = ( int ) ( ik / space_spacing );
+   col_frac[ik] = ( float ) ( ik / space_spacing - col_cell[ik] );
+  }
+ for ( ik = 0; ik <= MAX_GRAY; ik++ )
+  {
+   level_cell[ik] = ( int ) ( ik / range_spacing );
+   level_frac[ik] = ( float ) ( ik / range_spacing - level_cell[ik] );
+  }
+
+ /* image rows FIRST_ROW[gy] .. FIRST_ROW[gy + 1] - 1 go to grid row GY */
+ for ( gy = 0, iy = 0; gy <= grid_rows; gy++ )
+  {
+   while ( iy < num_rows && ( int ) ( iy / space_spacing + 0.5 ) < gy )
+    {
+     iy++;
+    }
+   first_row[gy] = iy;
+  }
+
+ /* splat: each thread owns whole grid rows, so no two write the same cell */
+#pragma omp parallel for schedule(dynamic)
+ for ( gy = 0; gy < grid_rows; gy++ )
+  {
+   int jy, jx, ib;
+
+   for ( jy = first_row[gy]; jy < first_row[gy + 1]; jy++ )
+    {
+     const byte *in_row = in_data + ( size_t ) jy * num_cols * num_bands;
+     const byte *guide_row = guide + ( size_t ) jy * num_cols;
+
+     for ( jx = 0; jx < num_cols; jx++ )
+      {
+       int gx = col_cell[jx] + ( col_frac[jx] >= 0.5f );
+       int gz = level_cell[guide_row[jx]] + ( level_frac[guide_row[jx]] >= 0.5f );
+       float *cell = grid + ( ( ( size_t ) gy * grid_cols + gx ) * grid_depth + gz ) * num_ch;
+
+       for ( ib = 0; ib < num_bands; ib++ )
+	{
+	 cell[ib] += in_row[jx * num_bands + ib];
+	}
+       cell[num_bands] += 1.0f;
+      }
+    }
+  }
+
+ /* blur along the intensity, the columns and the rows */
+ blur_grid_axis ( grid, tmp, grid_rows * grid_cols, ( size_t ) grid_depth * num_ch,
+		  grid_depth, num_ch, num_ch, taps );
+ for ( gy = 0; gy < grid_rows; gy++ )
+  {
+   /* one line per intensity cell of the grid row */
+   blur_grid_axis ( tmp + ( size_t ) gy * grid_cols * grid_depth * num_ch,
+		    grid + ( size_t ) gy * grid_cols * grid_depth * num_ch,
+		    grid_depth, num_ch, grid_cols, ( size_t ) grid_depth * num_ch, num_ch, taps );
+  }
+ blur_grid_axis ( grid, tmp, grid_cols * grid_depth, num_ch, grid_rows,
+		  ( size_t ) grid_cols * grid_depth * num_ch, num_ch, taps );
+
+ /* slice: interpolate between the 8 cells around each pixel */
+#pragma omp parallel for schedule(static)
+ for ( iy = 0; iy < num_rows; iy++ )
+  {
+   double fy = iy / space_spacing;
+   int y0 = ( int ) fy;
+   float wy = ( float ) ( fy - y0 );
+   const byte *guide_row = guide + ( size_t ) iy * num_cols;
+   byte *out_row = out_data + ( size_t ) iy * num_cols * num_bands;
+   int jx, ib, corner;
+
+   for ( jx = 0; jx < num_cols; jx++ )
+    {
+     int level = guide_row[jx];
+     float wx = col_frac[jx];
+     float wz = level_frac[level];
+     float value[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+     const float *base = tmp + ( ( ( size_t ) y0 * grid_cols + col_cell[jx] ) *
+				 grid_depth + level_cell[level] ) * num_ch;
+
+     /* the 4 spatial corners, each with its 2 intensity neighbors */
+     for ( corner = 0; corner < 4; corner++ )
+      {
+       int cy = corner >> 1, cx = corner & 1;
+       float weight = ( cy ? wy : 1.0f - wy ) * ( cx ? wx : 1.0f - wx );
+       const float *cell = base + ( ( size_t ) cy * grid_cols + cx ) * grid_depth * num_ch;
+
+       for ( ib = 0; ib < num_ch; ib++ )
+	{
+	 value[ib] += weight * ( ( 1.0f - wz ) * cell[ib] + wz * cell[num_ch + ib] );
+	}
+      }
+
+     for ( ib = 0; ib < num_bands; ib++ )
+      {
+       /* the weight is positive: the pixel itself is in a nearby cell */
+       float result = value[ib] / value[num_bands];
+
+       out_row[jx * num_bands + ib] = ( byte ) MIN_2 ( result + 0.5f, ( float ) MAX_GRAY );
+      }
+    }
+  }
+
+ free ( grid );
+ free ( first_row );
+ free ( col_cell );
+ free ( col_frac );
+ free ( guide );
+
+ return out_img;
+}
+
+/**
+ * @brief Implements the bilateral filter exactly
+ *
+ * @param[in] in_img Image pointer { grayscale, rgb }
+ * @param[in] range_sigma Range (intensity) standard deviation [ > 0 ]
+ * @param[in] spatial_sigma Spatial standard deviation (pixels) [ > 0 ]
+ *
+ * @return Pointer to the filtered image or NULL
+ *
+ * @note Each pixel becomes the average of the pixels within 3 *
+ *       SPATIAL_SIGMA, weighted by a Gaussian of their distance and a
+ *       Gaussian of their intensity difference; windows are cut off at the
+ *       border. For color images the intensity is the luminance (as in
+ *       rgb_to_gray) and all bands share the weights. The cost per pixel
+ *       grows with SPATIAL_SIGMA^2, so this is the reference for
+ *       #filter_bilateral rather than a replacement.
+ * @ref Tomasi C. and Manduchi R. (1998) "Bilateral Filtering for Gray and
+ *      Color Images," Proc. of the 6th Int. Conf. on Computer Vision,
+ *      839-846
+ *
+ * @author Damian Kusnik
+ */
+
+Image *
+filter_bilateral_ref ( const Image * in_img, const double range_sigma,
+		       const double spatial_sigma )
+{
+ byte *guide;
+ Image *out_img;
+
+ guide = start_bilateral ( in_img, range_sigma, spatial_sigma );
+ if ( IS_NULL ( guide ) )
+  {
+   return NULL;
+  }
+
+ out_img = filter_bilateral_exact ( in_img, guide, range_sigma, spatial_sigma );
+ free ( guide );
+
+ return out_img;
+}
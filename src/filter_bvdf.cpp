@@ -0,0 +1,30 @@
+/**
+ * @file filter_bvdf.c
+ * Routines for basic vector directional filtering
+ */
+
+#include "image.h"
+
+/**
+ * @brief Implements the Basic Vector Directional Filter
+ *
+ * @param[in] in_img Image pointer { rgb }
+ * @param[in] win_size Dimension of the filtering window { positive-odd }
+ *
+ * @return Pointer to the filtered image or NULL
+ *
+ * @note Each pixel is replaced by the window vector with the smallest sum of
+ *       angles to the other vectors in the window.
+ * @ref Trahanias P.E. and Venetsanopoulos A.N. (1993) "Vector Directional
+ *      Filters: A New Class of Multichannel Image Processing Filters,"
+ *      IEEE Trans. on Image Processing, 2(4): 528-534
+ * @see #filter_vector_order
+ *
+ * @author Damian Kusnik
+ */
+
+Image *
+filter_bvdf ( const Image * in_img, const int win_size )
+{
+ return filter_vector_order ( in_img, win_size, 1.0 );
+}
@@ -0,0 +1,31 @@
+/**
+ * @file filter_ddf.c
+ * Routines for directional-distance filtering
+ */
+
+#include "image.h"
+
+/**
+ * @brief Implements the Directional-Distance Filter
+ *
+ * @param[in] in_img Image pointer { rgb }
+ * @param[in] win_size Dimension of the filtering window { positive-odd }
+ *
+ * @return Pointer to the filtered image or NULL
+ *
+ * @note Each pixel is replaced by the window vector that minimizes the
+ *       geometric mean of its sum of Euclidean distances and its sum of
+ *       angles to the other vectors in the window.
+ * @ref Karakos D.G. and Trahanias P.E. (1997) "Generalized Multichannel
+ *      Image-Filtering Structures," IEEE Trans. on Image Processing,
+ *      6(7): 1038-1045
+ * @see #filter_vector_order
+ *
+ * @author Damian Kusnik
+ */
+
+Image *
+filter_ddf ( const Image * in_img, const int win_size )
+{
+ return filter_vector_order ( in_img, win_size, 0.5 );
+}
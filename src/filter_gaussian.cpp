@@ -0,0 +1,911 @@
+/**
+ * @file filter_gaussian.c
+ * Routines for Gaussian smoothing
+ *
+ * Sigmas from GAUSS_MIN_IIR_SIGMA up are filtered with the third-order
+ * recursive approximation of Young, van Vliet, and van Ginkel, whose cost
+ * per pixel does not depend on sigma; smaller ones with a truncated mask
+ * from gauss_1d. Both extend the image by replicating its border. The
+ * recursion runs along a line, so it is vectorized across lines instead:
+ * the vertical pass updates a whole row of columns at a time, and the
+ * horizontal pass interleaves a strip of GAUSS_STRIP_ROWS rows so that each
+ * step updates one pixel of every row in the strip.
+ */
+
+#include <stdint.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "image.h"
+
+#define GAUSS_MIN_IIR_SIGMA 2.5	/* smaller sigmas use the FIR mask */
+
+#define GAUSS_STRIP_ROWS 16	/* rows filtered together by the horizontal recursion */
+
+#define GAUSS_COL_CHUNK 512	/* columns per task of the vertical recursion */
+
+#define GAUSS_MIN_SLOPE 1e-6	/* lines flatter than this are taken as columns */
+
+#define GAUSS_MAX_ORDER 2	/* max. derivative order of the anisotropic filter */
+
+#define YVV_M0 1.16680	/* poles of the recursive filter for q = 1 */
+
+#define YVV_M1 1.10783
+
+#define YVV_M2 1.40586
+
+/** @cond INTERNAL_FUNCTION */
+
+#define SWAP_PTR( a, b ) { tmp_var = ( a ); ( a ) = ( b ); ( b ) = tmp_var; }
+
+typedef struct
+{
+ float gain;			/* weight of the input */
+ float b2, b3;			/* weights of the 2nd and 3rd previous outputs */
+ float init[3][3];		/* anticausal start from the causal end (Triggs-Sdika) */
+} IirCoefs;
+
+static int
+calc_iir_coefs ( const double sigma, IirCoefs * coefs )
+{
+ int ik, jk, num_steps;
+ double q, scale, b1, b2, b3;
+ double *causal, *anticausal;
+
+ /* Young, van Vliet, and van Ginkel (2002): three poles at fixed
+    positions, scaled by q */
+ q = sigma < 3.556 ? -0.2568 + 0.5784 * sigma + 0.0561 * sigma * sigma :
+  2.5091 + 0.9804 * ( sigma - 3.556 );
+ scale = ( YVV_M0 + q ) * ( YVV_M1 * YVV_M1 + YVV_M2 * YVV_M2 + 2.0 * YVV_M1 * q + q * q );
+ b1 = q * ( 2.0 * YVV_M0 * YVV_M1 + YVV_M1 * YVV_M1 + YVV_M2 * YVV_M2 +
+	    ( 2.0 * YVV_M0 + 4.0 * YVV_M1 ) * q + 3.0 * q * q ) / scale;
+ b2 = -q * q * ( YVV_M0 + 2.0 * YVV_M1 + 3.0 * q ) / scale;
+ b3 = q * q * q / scale;
+
+ coefs->gain = ( float ) ( 1.0 - b1 - b2 - b3 );
+ coefs->b2 = ( float ) b2;
+ coefs->b3 = ( float ) b3;
+
+ /*
+    Past the last sample the input is replicated, so the causal output
+    decays from its last 3 values towards it. Running that decay and the
+    anticausal filter over it for each unit deviation gives the linear map
+    from the last 3 causal outputs to the first 3 anticausal ones (the
+    closed form is in Triggs and Sdika, 2006).
+  */
+ num_steps = ( int ) ceil ( 30.0 * sigma ) + 64;
+ causal = ( double * ) malloc ( 2 * ( num_steps + 6 ) * sizeof ( double ) );
+ if ( IS_NULL ( causal ) )
+  {
+   return E_NOMEM;
+  }
+ anticausal = causal + num_steps + 6;
+ for ( jk = 0; jk < 3; jk++ )
+  {
+   for ( ik = 0; ik < 2 * ( num_steps + 6 ); ik++ )
+    {
+     causal[ik] = 0.0;
+    }
+   /* causal[2 - i] is the deviation of the (i + 1)th last output */
+   causal[2 - jk] = 1.0;
+   for ( ik = 3; ik < num_steps + 3; ik++ )
+    {
+     causal[ik] = b1 * causal[ik - 1] + b2 * causal[ik - 2] + b3 * causal[ik - 3];
+    }
+   for ( ik = num_steps + 2; ik >= 3; ik-- )
+    {
+     anticausal[ik] = ( 1.0 - b1 - b2 - b3 ) * causal[ik] + b1 * anticausal[ik + 1] +
+      b2 * anticausal[ik + 2] + b3 * anticausal[ik + 3];
+    }
+   for ( ik = 0; ik < 3; ik++ )
+    {
+     coefs->init[ik][jk] = ( float ) anticausal[3 + ik];
+    }
+  }
+
+ free ( causal );
+
+ return E_SUCCESS;
+}
+
+/* Filters NUM_LANES interleaved lines of LEN samples in place: sample N of
+   lane I is DATA[N * STEP + I]. EXT holds 4 * NUM_LANES floats. */
+static void
+iir_lines ( float *data, const int len, const size_t step, const int num_lanes,
+	    const IirCoefs * coefs, float *ext )
+{
+ const float gain = coefs->gain, b23 = coefs->b2 + coefs->b3, b3 = coefs->b3;
+ float *last_in = ext;
+ float *after = ext + num_lanes;	/* anticausal outputs past the end */
+ const float *last[3];
+ int n, ik;
+
+ for ( ik = 0; ik < num_lanes; ik++ )
+  {
+   last_in[ik] = data[( size_t ) ( len - 1 ) * step + ik];
+  }
+
+ /* causal: before the start the output equals the first sample, which is
+    also what the first step leaves in place */
+ for ( n = 0; n < len; n++ )
+  {
+   float *cur = data + ( size_t ) n * step;
+   const float *p1 = data + ( size_t ) MAX_2 ( n - 1, 0 ) * step;
+   const float *p2 = data + ( size_t ) MAX_2 ( n - 2, 0 ) * step;
+   const float *p3 = data + ( size_t ) MAX_2 ( n - 3, 0 ) * step;
+
+#pragma omp simd
+   for ( ik = 0; ik < num_lanes; ik++ )
+    {
+     cur[ik] = p1[ik] + gain * ( cur[ik] - p1[ik] ) - b23 * ( p1[ik] - p2[ik] ) -
+      b3 * ( p2[ik] - p3[ik] );
+    }
+  }
+
+ for ( ik = 0; ik < 3; ik++ )
+  {
+   last[ik] = data + ( size_t ) MAX_2 ( len - 1 - ik, 0 ) * step;
+  }
+ for ( n = 0; n < 3; n++ )
+  {
+   float *out = after + n * num_lanes;
+
+#pragma omp simd
+   for ( ik = 0; ik < num_lanes; ik++ )
+    {
+     float u = last_in[ik];
+
+     out[ik] = u + coefs->init[n][0] * ( last[0][ik] - u ) +
+      coefs->init[n][1] * ( last[1][ik] - u ) + coefs->init[n][2] * ( last[2][ik] - u );
+    }
+  }
+
+ /* anticausal */
+ for ( n = len - 1; n >= 0; n-- )
+  {
+   float *cur = data + ( size_t ) n * step;
+   const float *p1 = n + 1 < len ? data + ( size_t ) ( n + 1 ) * step :
+    after + ( size_t ) ( n + 1 - len ) * num_lanes;
+   const float *p2 = n + 2 < len ? data + ( size_t ) ( n + 2 ) * step :
+    after + ( size_t ) ( n + 2 - len ) * num_lanes;
+   const float *p3 = n + 3 < len ? data + ( size_t ) ( n + 3 ) * step :
+    after + ( size_t ) ( n + 3 - len ) * num_lanes;
+
+#pragma omp simd
+   for ( ik = 0; ik < num_lanes; ik++ )
+    {
+     cur[ik] = p1[ik] + gain * ( cur[ik] - p1[ik] ) - b23 * ( p1[ik] - p2[ik] ) -
+      b3 * ( p2[ik] - p3[ik] );
+    }
+  }
+}
+
+/* Recursive horizontal pass over a plane of NUM_ROWS x NUM_COLS pixels of
+   NUM_BANDS interleaved floats */
+static int
+iir_rows ( float *plane, const int num_rows, const int num_cols,
+	   const int num_bands, const IirCoefs * coefs )
+{
+ const size_t row_len = ( size_t ) num_cols * num_bands;
+ const int max_lanes = GAUSS_STRIP_ROWS * num_bands;
+ int iy;
+ int fail = 0;
+
+#pragma omp parallel reduction(|:fail)
+ {
+  float *tile = ( float * ) malloc ( ( num_cols + 4 ) * max_lanes * sizeof ( float ) );
+
+  if ( IS_NULL ( tile ) )
+   {
+    fail = 1;
+   }
+
+#pragma omp for schedule(dynamic)
+  for ( iy = 0; iy < num_rows; iy += GAUSS_STRIP_ROWS )
+   {
+    int strip_rows = MIN_2 ( GAUSS_STRIP_ROWS, num_rows - iy );
+    int num_lanes = strip_rows * num_bands;
+    int ir, ix, ib;
+
+    if ( IS_NULL ( tile ) )
+     {
+      continue;
+     }
+
+    /* pixel IX of strip row IR goes to tile row IX, lanes IR * NUM_BANDS + */
+    for ( ir = 0; ir < strip_rows; ir++ )
+     {
+      const float *row = plane + ( size_t ) ( iy + ir ) * row_len;
+
+      for ( ix = 0; ix < num_cols; ix++ )
+       {
+	for ( ib = 0; ib < num_bands; ib++ )
+	 {
+	  tile[( size_t ) ix * num_lanes + ir * num_bands + ib] = row[ix * num_bands + ib];
+	 }
+       }
+     }
+
+    iir_lines ( tile, num_cols, num_lanes, num_lanes, coefs,
+		tile + ( size_t ) num_cols * num_lanes );
+
+    for ( ir = 0; ir < strip_rows; ir++ )
+     {
+      float *row = plane + ( size_t ) ( iy + ir ) * row_len;
+
+      for ( ix = 0; ix < num_cols; ix++ )
+       {
+	for ( ib = 0; ib < num_bands; ib++ )
+	 {
+	  row[ix * num_bands + ib] = tile[( size_t ) ix * num_lanes + ir * num_bands + ib];
+	 }
+       }
+     }
+   }
+
+  free ( tile );
+ }
+
+ return fail ? E_NOMEM : E_SUCCESS;
+}
+
+/* Recursive vertical pass over a plane of NUM_ROWS rows of ROW_LEN floats */
+static int
+iir_cols ( float *plane, const int num_rows, const int row_len,
+	   const IirCoefs * coefs )
+{
+ int ix;
+ int fail = 0;
+
+#pragma omp parallel reduction(|:fail)
+ {
+  float *ext = ( float * ) malloc ( 4 * GAUSS_COL_CHUNK * sizeof ( float ) );
+
+  if ( IS_NULL ( ext ) )
+   {
+    fail = 1;
+   }
+
+#pragma omp for schedule(dynamic)
+  for ( ix = 0; ix < row_len; ix += GAUSS_COL_CHUNK )
+   {
+    if ( !IS_NULL ( ext ) )
+     {
+      iir_lines ( plane + ix, num_rows, row_len,
+		  MIN_2 ( GAUSS_COL_CHUNK, row_len - ix ), coefs, ext );
+     }
+   }
+
+  free ( ext );
+ }
+
+ return fail ? E_NOMEM : E_SUCCESS;
+}
+
+/* Converts the mask of gauss_1d to floats */
+static float *
+calc_fir_mask ( const double sigma, int *mask_size )
+{
+ int ik;
+ double *mask;
+ float *fmask;
+
+ mask = gauss_1d ( sigma, mask_size );
+ if ( IS_NULL ( mask ) )
+  {
+   return NULL;
+  }
+
+ fmask = ( float * ) malloc ( *mask_size * sizeof ( float ) );
+ if ( !IS_NULL ( fmask ) )
+  {
+   for ( ik = 0; ik < *mask_size; ik++ )
+    {
+     fmask[ik] = ( float ) mask[ik];
+    }
+  }
+
+ free ( mask );
+
+ return fmask;
+}
+
+/* Horizontal convolution with MASK, replicating the border */
+static int
+fir_rows ( float *plane, const int num_rows, const int num_cols,
+	   const int num_bands, const float *mask, const int mask_size )
+{
+ const int half = mask_size / 2;
+ const size_t row_len = ( size_t ) num_cols * num_bands;
+ int iy;
+ int fail = 0;
+
+#pragma omp parallel reduction(|:fail)
+ {
+  float *padded = ( float * ) malloc ( ( num_cols + 2 * half ) * num_bands *
+				       sizeof ( float ) );
+
+  if ( IS_NULL ( padded ) )
+   {
+    fail = 1;
+   }
+
+#pragma omp for schedule(static)
+  for ( iy = 0; iy < num_rows; iy++ )
+   {
+    float *row = plane + ( size_t ) iy * row_len;
+    int ix, ik;
+
+    if ( IS_NULL ( padded ) )
+     {
+      continue;
+     }
+
+    for ( ix = -half; ix < num_cols + half; ix++ )
+     {
+      const float *pix = row + MIN_2 ( MAX_2 ( ix, 0 ), num_cols - 1 ) * num_bands;
+
+      for ( ik = 0; ik < num_bands; ik++ )
+       {
+	padded[( ix + half ) * num_bands + ik] = pix[ik];
+       }
+     }
+
+    for ( ix = 0; ix < ( int ) row_len; ix++ )
+     {
+      row[ix] = 0.0f;
+     }
+    for ( ik = 0; ik < mask_size; ik++ )
+     {
+      const float *in = padded + ik * num_bands;
+      const float weight = mask[ik];
+
+#pragma omp simd
+      for ( ix = 0; ix < ( int ) row_len; ix++ )
+       {
+	row[ix] += weight * in[ix];
+       }
+     }
+   }
+
+  free ( padded );
+ }
+
+ return fail ? E_NOMEM : E_SUCCESS;
+}
+
+/* Vertical convolution with MASK, replicating the border */
+static int
+fir_cols ( float *plane, const int num_rows, const int row_len,
+	   const float *mask, const int mask_size )
+{
+ const int half = mask_size / 2;
+ int iy;
+ float *src;
+
+ src = ( float * ) malloc ( ( size_t ) num_rows * row_len * sizeof ( float ) );
+ if ( IS_NULL ( src ) )
+  {
+   return E_NOMEM;
+  }
+ memcpy ( src, plane, ( size_t ) num_rows * row_len * sizeof ( float ) );
+
+#pragma omp parallel for schedule(static)
+ for ( iy = 0; iy < num_rows; iy++ )
+  {
+   float *out = plane + ( size_t ) iy * row_len;
+   int ix, ik;
+
+   for ( ix = 0; ix < row_len; ix++ )
+    {
+     out[ix] = 0.0f;
+    }
+   for ( ik = 0; ik < mask_size; ik++ )
+    {
+     const float *in = src + ( size_t ) MIN_2 ( MAX_2 ( iy + ik - half, 0 ), num_rows - 1 ) * row_len;
+     const float weight = mask[ik];
+
+#pragma omp simd
+     for ( ix = 0; ix < row_len; ix++ )
+      {
+       out[ix] += weight * in[ix];
+      }
+    }
+  }
+
+ free ( src );
+
+ return E_SUCCESS;
+}
+
+/* Smooths the plane along the rows with SIGMA_X and along the columns
+   with SIGMA_Y; a zero sigma leaves that axis alone */
+static int
+smooth_plane ( float *plane, const int num_rows, const int num_cols,
+	       const int num_bands, const double sigma_x, const double sigma_y )
+{
+ int axis, mask_size;
+ int ret_code = E_SUCCESS;
+ double sigma;
+ float *mask;
+ IirCoefs coefs;
+
+ for ( axis = 0; axis < 2 && ret_code == E_SUCCESS; axis++ )
+  {
+   sigma = axis ? sigma_y : sigma_x;
+   if ( !IS_POS ( sigma ) )
+    {
+     continue;
+    }
+
+   if ( sigma >= GAUSS_MIN_IIR_SIGMA )
+    {
+     ret_code = calc_iir_coefs ( sigma, &coefs );
+     if ( ret_code != E_SUCCESS )
+      {
+       return ret_code;
+      }
+     ret_code = axis ? iir_cols ( plane, num_rows, num_cols * num_bands, &coefs ) :
+      iir_rows ( plane, num_rows, num_cols, num_bands, &coefs );
+    }
+   else
+    {
+     mask = calc_fir_mask ( sigma, &mask_size );
+     if ( IS_NULL ( mask ) )
+      {
+       return E_NOMEM;
+      }
+     ret_code = axis ? fir_cols ( plane, num_rows, num_cols * num_bands, mask, mask_size ) :
+      fir_rows ( plane, num_rows, num_cols, num_bands, mask, mask_size );
+     free ( mask );
+    }
+  }
+
+ return ret_code;
+}
+
+/* OUT[X] += WEIGHT * IN ( X + SHIFT ) for X in [ X_BEGIN, X_END ), where IN is
+   interpolated linearly and replicated past its NUM_COLS samples */
+static void
+add_shifted_row ( float *out, const float *in, const int x_begin, const int x_end,
+		  const int num_cols, const float weight, const double shift )
+{
+ int ix, ia, ib;
+ int offset = ( int ) floor ( shift );
+ float frac = ( float ) ( shift - offset );
+ float w0 = weight * ( 1.0f - frac ), w1 = weight * frac;
+ /* X + OFFSET and X + OFFSET + 1 are both inside for X in [ lo, hi ) */
+ int lo = MIN_2 ( MAX_2 ( x_begin, -offset ), x_end );
+ int hi = MAX_2 ( MIN_2 ( x_end, num_cols - 1 - offset ), lo );
+
+ for ( ix = x_begin; ix < lo; ix++ )
+  {
+   ia = MIN_2 ( MAX_2 ( ix + offset, 0 ), num_cols - 1 );
+   ib = MIN_2 ( MAX_2 ( ix + offset + 1, 0 ), num_cols - 1 );
+   out[ix] += w0 * in[ia] + w1 * in[ib];
+  }
+#pragma omp simd
+ for ( ix = lo; ix < hi; ix++ )
+  {
+   out[ix] += w0 * in[ix + offset] + w1 * in[ix + offset + 1];
+  }
+ for ( ix = hi; ix < x_end; ix++ )
+  {
+   ia = MIN_2 ( MAX_2 ( ix + offset, 0 ), num_cols - 1 );
+   ib = MIN_2 ( MAX_2 ( ix + offset + 1, 0 ), num_cols - 1 );
+   out[ix] += w0 * in[ia] + w1 * in[ib];
+  }
+}
+
+/* Smooths a single-band plane with SIGMA along the lines of slope
+   ( SLOPE, 1 ). A small SIGMA is applied as a mask whose taps are
+   interpolated from the rows above and below. Otherwise shifting row Y
+   left by SLOPE * Y turns the lines into columns, which are smoothed as
+   usual before the rows are shifted back. The recursion cannot run along
+   the lines directly: its feedback through the interpolation is unstable. */
+static int
+smooth_slanted ( float *plane, const int num_rows, const int num_cols,
+		 const double sigma, const double slope )
+{
+ const double offset = MAX_2 ( 0.0, slope * ( num_rows - 1 ) );
+ const int sheared_cols = num_cols + ( int ) ceil ( fabs ( slope ) * ( num_rows - 1 ) ) + 1;
+ int iy, ix;
+ int ret_code, mask_size;
+ float *mask, *sheared;
+
+ if ( sigma < GAUSS_MIN_IIR_SIGMA )
+  {
+   mask = calc_fir_mask ( sigma, &mask_size );
+   sheared = ( float * ) malloc ( ( size_t ) num_rows * num_cols * sizeof ( float ) );
+   if ( IS_NULL ( mask ) || IS_NULL ( sheared ) )
+    {
+     free ( mask );
+     free ( sheared );
+     return E_NOMEM;
+    }
+   memcpy ( sheared, plane, ( size_t ) num_rows * num_cols * sizeof ( float ) );
+
+#pragma omp parallel for schedule(static)
+   for ( iy = 0; iy < num_rows; iy++ )
+    {
+     float *out = plane + ( size_t ) iy * num_cols;
+     int jx, jk;
+
+     for ( jx = 0; jx < num_cols; jx++ )
+      {
+       out[jx] = 0.0f;
+      }
+     for ( jk = 0; jk < mask_size; jk++ )
+      {
+       int dy = jk - mask_size / 2;
+
+       add_shifted_row ( out, sheared + ( size_t ) MIN_2 ( MAX_2 ( iy + dy, 0 ),
+							   num_rows - 1 ) * num_cols,
+			 0, num_cols, num_cols, mask[jk], dy * slope );
+      }
+    }
+
+   free ( mask );
+   free ( sheared );
+
+   return E_SUCCESS;
+  }
+
+ sheared = ( float * ) calloc ( ( size_t ) num_rows * sheared_cols, sizeof ( float ) );
+ if ( IS_NULL ( sheared ) )
+  {
+   return E_NOMEM;
+  }
+
+ /* column T of the sheared plane is the line through ( T - OFFSET, 0 ) */
+#pragma omp parallel for schedule(static)
+ for ( iy = 0; iy < num_rows; iy++ )
+  {
+   add_shifted_row ( sheared + ( size_t ) iy * sheared_cols,
+		     plane + ( size_t ) iy * num_cols, 0, sheared_cols, num_cols,
+		     1.0f, slope * iy - offset );
+  }
+
+ ret_code = smooth_plane ( sheared, num_rows, sheared_cols, 1, 0.0, sigma );
+
+ if ( ret_code == E_SUCCESS )
+  {
+#pragma omp parallel for schedule(static)
+   for ( iy = 0; iy < num_rows; iy++ )
+    {
+     float *out = plane + ( size_t ) iy * num_cols;
+
+     for ( ix = 0; ix < num_cols; ix++ )
+      {
+       out[ix] = 0.0f;
+      }
+     add_shifted_row ( out, sheared + ( size_t ) iy * sheared_cols, 0, num_cols,
+		       sheared_cols, 1.0f, offset - slope * iy );
+    }
+  }
+
+ free ( sheared );
+
+ return ret_code;
+}
+
+/* OUT = the NUM_ROWS x NUM_COLS plane IN, transposed */
+static void
+transpose_plane ( const float *in, float *out, const int num_rows, const int num_cols )
+{
+ int iy;
+
+#pragma omp parallel for schedule(static)
+ for ( iy = 0; iy < num_rows; iy++ )
+  {
+   int ix;
+
+   for ( ix = 0; ix < num_cols; ix++ )
+    {
+     out[( size_t ) ix * num_rows + iy] = in[( size_t ) iy * num_cols + ix];
+    }
+  }
+}
+
+/* OUT = CX * d/dx IN + CY * d/dy IN, with central differences */
+static void
+calc_directional_diff ( const float *in, float *out, const int num_rows,
+			const int num_cols, const float cx, const float cy )
+{
+ int iy;
+
+#pragma omp parallel for schedule(static)
+ for ( iy = 0; iy < num_rows; iy++ )
+  {
+   const float *row = in + ( size_t ) iy * num_cols;
+   const float *up = in + ( size_t ) MAX_2 ( iy - 1, 0 ) * num_cols;
+   const float *down = in + ( size_t ) MIN_2 ( iy + 1, num_rows - 1 ) * num_cols;
+   float *out_row = out + ( size_t ) iy * num_cols;
+   int ix;
+
+   for ( ix = 0; ix < num_cols; ix++ )
+    {
+     float dx = row[MIN_2 ( ix + 1, num_cols - 1 )] - row[MAX_2 ( ix - 1, 0 )];
+
+     out_row[ix] = 0.5f * ( cx * dx + cy * ( down[ix] - up[ix] ) );
+    }
+  }
+}
+
+/** @endcond INTERNAL_FUNCTION */
+
+/**
+ * @brief Implements the Gaussian filter
+ *
+ * @param[in] in_img Image pointer { grayscale, rgb }
+ * @param[in] stdev Standard deviation (pixels) [ > 0 ]
+ *
+ * @return Pointer to the filtered image or NULL
+ *
+ * @note The image is extended by replicating its border. For STDEV below
+ *       2.5 the mask of gauss_1d (+/- 3 STDEV) is applied along the rows
+ *       and the columns; from 2.5 up, the third-order recursive filter of
+ *       Young, van Vliet, and van Ginkel is used instead, with the boundary
+ *       conditions of Triggs and Sdika, so the cost does not depend on
+ *       STDEV.
+ * @ref Young I.T., van Vliet L.J., and van Ginkel M. (2002) "Recursive
+ *      Gabor Filtering," IEEE Trans. on Signal Processing, 50(11):
+ *      2798-2805
+ * @ref Triggs B. and Sdika M. (2006) "Boundary Conditions for Young-van
+ *      Vliet Recursive Filtering," IEEE Trans. on Signal Processing, 54(6):
+ *      2365-2367
+ * @see #filter_ani_gaussian
+ *
+ * @author Damian Kusnik
+ */
+
+Image *
+filter_gaussian ( const Image * in_img, const double stdev )
+{
+ SET_FUNC_NAME ( "filter_gaussian" );
+ int num_rows, num_cols, num_bands;
+ int ret_code;
+ size_t ik, num_samples;
+ byte *in_data, *out_data;
+ float *plane;
+ Image *out_img;
+
+ if ( !is_gray_img ( in_img ) && !is_rgb_img ( in_img ) )
+  {
+   ERROR_RET ( "Not a grayscale or color image !", NULL );
+  }
+
+ if ( !IS_POS ( stdev ) )
+  {
+   ERROR ( "Standard deviation ( %f ) must be positive !", stdev );
+   return NULL;
+  }
+
+ num_rows = get_num_rows ( in_img );
+ num_cols = get_num_cols ( in_img );
+ num_bands = is_rgb_img ( in_img ) ? 3 : 1;
+ num_samples = ( size_t ) num_rows * num_cols * num_bands;
+
+ out_img = alloc_img ( get_pix_type ( in_img ), num_rows, num_cols );
+ plane = ( float * ) malloc ( num_samples * sizeof ( float ) );
+ if ( IS_NULL ( out_img ) || IS_NULL ( plane ) )
+  {
+   if ( !IS_NULL ( out_img ) )
+    {
+     free_img ( out_img );
+     free ( out_img );
+    }
+   free ( plane );
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ in_data = ( byte * ) get_img_data_1d ( in_img );
+ out_data = ( byte * ) get_img_data_1d ( out_img );
+
+#pragma omp parallel for schedule(static)
+ for ( ik = 0; ik < num_samples; ik++ )
+  {
+   plane[ik] = in_data[ik];
+  }
+
+ ret_code = smooth_plane ( plane, num_rows, num_cols, num_bands, stdev, stdev );
+ if ( ret_code != E_SUCCESS )
+  {
+   free_img ( out_img );
+   free ( out_img );
+   free ( plane );
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+#pragma omp parallel for schedule(static)
+ for ( ik = 0; ik < num_samples; ik++ )
+  {
+   out_data[ik] = ( byte ) CLAMP_BYTE ( plane[ik] + 0.5f );
+  }
+
+ free ( plane );
+
+ return out_img;
+}
+
+/**
+ * @brief Implements the anisotropic Gaussian filter and its derivatives
+ *
+ * @param[in] in_img Image pointer { grayscale }
+ * @param[in] sigma_v Standard deviation along the V axis (pixels) [ > 0 ]
+ * @param[in] sigma_u Standard deviation along the U axis (pixels) [ > 0 ]
+ * @param[in] phi Angle of the V axis (degrees), from the x (column) axis
+ *                towards the y (row) axis
+ * @param[in] order_v Order of the derivative along V [ 0, 2 ]
+ * @param[in] order_u Order of the derivative along U [ 0, 2 ]
+ *
+ * @return Pointer to the filtered image { double } or NULL
+ *
+ * @note The oriented Gaussian is split into a Gaussian along the x axis and
+ *       one along the lines of slope ( mu, 1 ), sampled by linear
+ *       interpolation between the two nearest pixels of each row (the
+ *       axes swap roles when | mu | > 1). Both are filtered as in
+ *       #filter_gaussian, so the cost does not depend on the sigmas; for the
+ *       recursive filter the rows are first sheared so that the lines
+ *       become columns. The derivatives are taken afterwards with central
+ *       differences along V = ( cos phi, sin phi ) and U = ( -sin phi,
+ *       cos phi ). Within 3 sigmas of the border the result only
+ *       approximates that of a replicated border.
+ * @ref Geusebroek J.M., Smeulders A.W.M., and van de Weijer J. (2003)
+ *      "Fast Anisotropic Gauss Filtering," IEEE Trans. on Image Processing,
+ *      12(8): 938-943
+ * @see #filter_gaussian
+ *
+ * @author Damian Kusnik
+ */
+
+Image *
+filter_ani_gaussian ( const Image * in_img, const double sigma_v,
+		      const double sigma_u, const double phi,
+		      const int order_v, const int order_u )
+{
+ SET_FUNC_NAME ( "filter_ani_gaussian" );
+ int num_rows, num_cols;
+ int work_rows, work_cols;
+ int ik, ret_code, is_transposed;
+ size_t ij, num_pixels;
+ double cos_phi, sin_phi;
+ double var_xx, var_xy, var_yy;
+ double sigma_x, sigma_line, slope;
+ byte *in_data;
+ double *out_data;
+ float *buf, *plane, *tmp, *tmp_var;
+ Image *out_img;
+
+ if ( !is_gray_img ( in_img ) )
+  {
+   ERROR_RET ( "Not a grayscale image !", NULL );
+  }
+
+ if ( !IS_POS ( sigma_v ) || !IS_POS ( sigma_u ) )
+  {
+   ERROR ( "Sigma values ( %f, %f ) must be positive !", sigma_v, sigma_u );
+   return NULL;
+  }
+
+ if ( order_v < 0 || order_v > GAUSS_MAX_ORDER || order_u < 0 ||
+      order_u > GAUSS_MAX_ORDER )
+  {
+   ERROR ( "Derivative orders ( %d, %d ) must be in [0,%d] !", order_v,
+	   order_u, GAUSS_MAX_ORDER );
+   return NULL;
+  }
+
+ num_rows = get_num_rows ( in_img );
+ num_cols = get_num_cols ( in_img );
+ num_pixels = ( size_t ) num_rows * num_cols;
+
+ out_img = alloc_img ( PIX_DBL_1B, num_rows, num_cols );
+ buf = ( float * ) malloc ( 2 * num_pixels * sizeof ( float ) );
+ if ( IS_NULL ( out_img ) || IS_NULL ( buf ) )
+  {
+   if ( !IS_NULL ( out_img ) )
+    {
+     free_img ( out_img );
+     free ( out_img );
+    }
+   free ( buf );
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+ plane = buf;
+ tmp = buf + num_pixels;
+
+ /* covariance of the oriented Gaussian */
+ cos_phi = cos ( phi * PI / 180.0 );
+ sin_phi = sin ( phi * PI / 180.0 );
+ var_xx = sigma_v * sigma_v * cos_phi * cos_phi + sigma_u * sigma_u * sin_phi * sin_phi;
+ var_yy = sigma_v * sigma_v * sin_phi * sin_phi + sigma_u * sigma_u * cos_phi * cos_phi;
+ var_xy = ( sigma_v * sigma_v - sigma_u * sigma_u ) * cos_phi * sin_phi;
+
+ in_data = ( byte * ) get_img_data_1d ( in_img );
+ out_data = ( double * ) get_img_data_1d ( out_img );
+
+#pragma omp parallel for schedule(static)
+ for ( ij = 0; ij < num_pixels; ij++ )
+  {
+   plane[ij] = in_data[ij];
+  }
+
+ /*
+    The Gaussian is that along the x axis convolved with that along the
+    lines ( slope, 1 ). If these are closer to the x axis than to the y
+    axis (| slope | > 1), the axes swap roles on the transposed plane.
+  */
+ is_transposed = fabs ( var_xy ) > var_yy;
+ if ( is_transposed )
+  {
+   transpose_plane ( plane, tmp, num_rows, num_cols );
+   SWAP_PTR ( plane, tmp );
+   work_rows = num_cols;
+   work_cols = num_rows;
+   sigma_line = sqrt ( var_xx );
+   slope = var_xy / var_xx;
+   sigma_x = sqrt ( MAX_2 ( var_yy - var_xy * slope, 0.0 ) );
+  }
+ else
+  {
+   work_rows = num_rows;
+   work_cols = num_cols;
+   sigma_line = sqrt ( var_yy );
+   slope = var_xy / var_yy;
+   sigma_x = sqrt ( MAX_2 ( var_xx - var_xy * slope, 0.0 ) );
+  }
+
+ if ( fabs ( slope ) < GAUSS_MIN_SLOPE )
+  {
+   ret_code = smooth_plane ( plane, work_rows, work_cols, 1, sigma_x, sigma_line );
+  }
+ else
+  {
+   ret_code = smooth_plane ( plane, work_rows, work_cols, 1, sigma_x, 0.0 );
+   if ( ret_code == E_SUCCESS )
+    {
+     ret_code = smooth_slanted ( plane, work_rows, work_cols, sigma_line, slope );
+    }
+  }
+
+ if ( is_transposed )
+  {
+   transpose_plane ( plane, tmp, work_rows, work_cols );
+   SWAP_PTR ( plane, tmp );
+  }
+
+ if ( ret_code != E_SUCCESS )
+  {
+   free_img ( out_img );
+   free ( out_img );
+   free ( buf );
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ /* derivatives, ping-ponging between the two halves of BUF */
+ for ( ik = 0; ik < order_v + order_u; ik++ )
+  {
+   if ( ik < order_v )
+    {
+     calc_directional_diff ( plane, tmp, num_rows, num_cols, ( float ) cos_phi,
+			     ( float ) sin_phi );
+    }
+   else
+    {
+     calc_directional_diff ( plane, tmp, num_rows, num_cols, ( float ) -sin_phi,
+			     ( float ) cos_phi );
+    }
+   SWAP_PTR ( plane, tmp );
+  }
+
+#pragma omp parallel for schedule(static)
+ for ( ij = 0; ij < num_pixels; ij++ )
+  {
+   out_data[ij] = plane[ij];
+  }
+
+ free ( buf );
+
+ return out_img;
+}
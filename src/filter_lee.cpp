@@ -0,0 +1,127 @@
+/**
+ * @file filter_lee.c
+ * Routines for Lee filtering
+ */
+
+#include "image.h"
+
+/**
+ * @brief Implements the Lee filter
+ *
+ * @param[in] in_img Image pointer { grayscale, rgb }
+ * @param[in] win_size Dimension of the filtering window { positive-odd }
+ * @param[in] stdev Standard deviation of the additive noise [ >= 0 ]
+ *
+ * @return Pointer to the filtered image or NULL
+ *
+ * @note Each sample moves towards the local mean M by the share of the
+ *       local variance V that the noise explains: the output is
+ *       M + max ( 0, V - STDEV^2 ) / V * ( X - M ). Flat areas are thus
+ *       averaged while edges, whose variance exceeds that of the noise, are
+ *       kept. Windows are cut off at the image border. The local statistics
+ *       come from summed-area tables, so the cost per pixel does not depend
+ *       on WIN_SIZE.
+ * @ref Lee J.S. (1980) "Digital Image Enhancement and Noise Filtering by
+ *      Use of Local Statistics," IEEE Trans. on Pattern Analysis and
+ *      Machine Intelligence, 2(2): 165-168
+ * @see #calc_local_stats
+ *
+ * @author Damian Kusnik
+ */
+
+Image *
+filter_lee ( const Image * in_img, const int win_size, const double stdev )
+{
+ SET_FUNC_NAME ( "filter_lee" );
+ int num_rows, num_cols, num_bands;
+ int iy;
+ int fail = 0;
+ double noise_var;
+ byte *in_data, *out_data;
+ IntegralImage *int_img;
+ Image *out_img;
+
+ if ( !is_gray_img ( in_img ) && !is_rgb_img ( in_img ) )
+  {
+   ERROR_RET ( "Not a grayscale or color image !", NULL );
+  }
+
+ if ( !IS_POS_ODD ( win_size ) )
+  {
+   ERROR ( "Window size ( %d ) must be positive and odd !", win_size );
+   return NULL;
+  }
+
+ if ( stdev < 0.0 )
+  {
+   ERROR ( "Standard deviation ( %f ) must be non-negative !", stdev );
+   return NULL;
+  }
+
+ num_rows = get_num_rows ( in_img );
+ num_cols = get_num_cols ( in_img );
+ num_bands = is_rgb_img ( in_img ) ? 3 : 1;
+ noise_var = stdev * stdev;
+
+ int_img = alloc_integral_img ( in_img, 1 );
+ if ( IS_NULL ( int_img ) )
+  {
+   return NULL;
+  }
+
+ out_img = alloc_img ( get_pix_type ( in_img ), num_rows, num_cols );
+ if ( IS_NULL ( out_img ) )
+  {
+   free_integral_img ( int_img );
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ in_data = ( byte * ) get_img_data_1d ( in_img );
+ out_data = ( byte * ) get_img_data_1d ( out_img );
+
+#pragma omp parallel reduction(|:fail)
+ {
+  double *mean = ( double * ) malloc ( 2 * num_cols * num_bands * sizeof ( double ) );
+  double *var = IS_NULL ( mean ) ? NULL : mean + num_cols * num_bands;
+
+  if ( IS_NULL ( mean ) )
+   {
+    fail = 1;
+   }
+
+#pragma omp for schedule(static)
+  for ( iy = 0; iy < num_rows; iy++ )
+   {
+    const byte *in_row = in_data + ( size_t ) iy * num_cols * num_bands;
+    byte *out_row = out_data + ( size_t ) iy * num_cols * num_bands;
+    int ik;
+
+    if ( IS_NULL ( mean ) )
+     {
+      continue;
+     }
+
+    calc_local_stats ( int_img, win_size, iy, mean, var );
+    for ( ik = 0; ik < num_cols * num_bands; ik++ )
+     {
+      double gain = var[ik] > noise_var ? ( var[ik] - noise_var ) / var[ik] : 0.0;
+      double value = mean[ik] + gain * ( in_row[ik] - mean[ik] );
+
+      out_row[ik] = ( byte ) CLAMP_BYTE ( value + 0.5 );
+     }
+   }
+
+  free ( mean );
+ }
+
+ free_integral_img ( int_img );
+
+ if ( fail )
+  {
+   free_img ( out_img );
+   free ( out_img );
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ return out_img;
+}
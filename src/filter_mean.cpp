@@ -0,0 +1,105 @@
+/**
+ * @file filter_mean.c
+ * Routines for mean filtering
+ */
+
+#include "image.h"
+
+/**
+ * @brief Implements the mean filter
+ *
+ * @param[in] in_img Image pointer { grayscale, rgb }
+ * @param[in] win_size Dimension of the filtering window { positive-odd }
+ *
+ * @return Pointer to the filtered image or NULL
+ *
+ * @note Each band is filtered separately. Windows are cut off at the image
+ *       border. The window sums come from summed-area tables, so the cost
+ *       per pixel does not depend on WIN_SIZE.
+ * @see #calc_local_stats
+ *
+ * @author Damian Kusnik
+ */
+
+Image *
+filter_mean ( const Image * in_img, const int win_size )
+{
+ SET_FUNC_NAME ( "filter_mean" );
+ int num_rows, num_cols, num_bands;
+ int iy;
+ int fail = 0;
+ byte *out_data;
+ IntegralImage *int_img;
+ Image *out_img;
+
+ if ( !is_gray_img ( in_img ) && !is_rgb_img ( in_img ) )
+  {
+   ERROR_RET ( "Not a grayscale or color image !", NULL );
+  }
+
+ if ( !IS_POS_ODD ( win_size ) )
+  {
+   ERROR ( "Window size ( %d ) must be positive and odd !", win_size );
+   return NULL;
+  }
+
+ num_rows = get_num_rows ( in_img );
+ num_cols = get_num_cols ( in_img );
+ num_bands = is_rgb_img ( in_img ) ? 3 : 1;
+
+ int_img = alloc_integral_img ( in_img, 0 );
+ if ( IS_NULL ( int_img ) )
+  {
+   return NULL;
+  }
+
+ out_img = alloc_img ( get_pix_type ( in_img ), num_rows, num_cols );
+ if ( IS_NULL ( out_img ) )
+  {
+   free_integral_img ( int_img );
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ out_data = ( byte * ) get_img_data_1d ( out_img );
+
+#pragma omp parallel reduction(|:fail)
+ {
+  double *mean = ( double * ) malloc ( num_cols * num_bands * sizeof ( double ) );
+
+  if ( IS_NULL ( mean ) )
+   {
+    fail = 1;
+   }
+
+#pragma omp for schedule(static)
+  for ( iy = 0; iy < num_rows; iy++ )
+   {
+    byte *out_row = out_data + ( size_t ) iy * num_cols * num_bands;
+    int ik;
+
+    if ( IS_NULL ( mean ) )
+     {
+      continue;
+     }
+
+    calc_local_stats ( int_img, win_size, iy, mean, NULL );
+    for ( ik = 0; ik < num_cols * num_bands; ik++ )
+     {
+      out_row[ik] = ( byte ) ( mean[ik] + 0.5 );
+     }
+   }
+
+  free ( mean );
+ }
+
+ free_integral_img ( int_img );
+
+ if ( fail )
+  {
+   free_img ( out_img );
+   free ( out_img );
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ return out_img;
+}
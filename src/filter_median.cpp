@@ -0,0 +1,622 @@
+/**
+ * @file filter_median.c
+ * Routines for median filtering
+ */
+
+#include <stdint.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "image.h"
+
+#define MED_NUM_BINS 256
+
+#define MED_NUM_COARSE 16	/* coarse bins of 16 fine bins each */
+
+#define MED_STRIPE_BYTES ( 512 * 1024 )	/* column histograms of a stripe */
+
+/** @cond INTERNAL_FUNCTION */
+
+/* Compare-exchange that compiles to a min/max pair, without branches */
+#define SORT_PAIR( A, B ) \
+ { byte tmp_ = MIN_2 ( ( A ), ( B ) ); ( B ) = MAX_2 ( ( A ), ( B ) ); ( A ) = tmp_; }
+
+/* Checks the arguments and returns a copy of the input, whose border
+   pixels are left as they are by all of the filters */
+static Image *
+start_median ( const Image * in_img, const int win_size )
+{
+ SET_FUNC_NAME ( "start_median" );
+ Image *out_img;
+
+ if ( !is_gray_img ( in_img ) && !is_rgb_img ( in_img ) )
+  {
+   ERROR_RET ( "Not a grayscale or color image !", NULL );
+  }
+
+ if ( !IS_POS_ODD ( win_size ) )
+  {
+   ERROR ( "Window size ( %d ) must be positive and odd !", win_size );
+   return NULL;
+  }
+
+ out_img = clone_img ( in_img );
+ if ( IS_NULL ( out_img ) )
+  {
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ return out_img;
+}
+
+/* Adds SIGN times row ROW_DATA to the column histograms of every band */
+static void
+update_col_hists ( const byte * row_data, const int num_cols,
+		   const int num_bands, const int sign, uint16_t * fine,
+		   uint16_t * coarse )
+{
+ int ix, ib;
+
+ for ( ix = 0; ix < num_cols; ix++ )
+  {
+   for ( ib = 0; ib < num_bands; ib++ )
+    {
+     int value = row_data[ix * num_bands + ib];
+     size_t hist = ( size_t ) ix * num_bands + ib;
+
+     fine[hist * MED_NUM_BINS + value] += sign;
+     coarse[hist * MED_NUM_COARSE + ( value >> 4 )] += sign;
+    }
+  }
+}
+
+/* KERNEL += ADD over NUM_ELEMS bins */
+static void
+add_hist ( const int num_elems, const uint16_t * add, int *kernel )
+{
+ int ik;
+
+#pragma omp simd
+ for ( ik = 0; ik < num_elems; ik++ )
+  {
+   kernel[ik] += add[ik];
+  }
+}
+
+/* KERNEL += ADD - SUB over NUM_ELEMS bins */
+static void
+add_sub_hist ( const int num_elems, const uint16_t * add, const uint16_t * sub,
+	       int *kernel )
+{
+ int ik;
+
+#pragma omp simd
+ for ( ik = 0; ik < num_elems; ik++ )
+  {
+   kernel[ik] += add[ik] - sub[ik];
+  }
+}
+
+/* Finds the bin of 16 where the running count from *COUNT first exceeds
+   THRESH, and sets *COUNT to the count before it; the bins are counted
+   without branching on the data, since the bin changes often */
+static int
+find_median_bin ( const int *hist, const int thresh, int *count )
+{
+ int prefix[MED_NUM_COARSE];
+ int ik;
+ int sum = *count;
+ int num_below = 0;
+
+ for ( ik = 0; ik < MED_NUM_COARSE; ik++ )
+  {
+   sum += hist[ik];
+   prefix[ik] = sum;
+  }
+
+ /* PREFIX is non-decreasing, so the bins at or below THRESH come first */
+ for ( ik = 0; ik < MED_NUM_COARSE; ik++ )
+  {
+   num_below += prefix[ik] <= thresh;
+  }
+
+ if ( num_below > 0 )
+  {
+   *count = prefix[num_below - 1];
+  }
+
+ return num_below;
+}
+
+/** @endcond INTERNAL_FUNCTION */
+
+/**
+ * @brief Implements the classical median filter
+ *
+ * @param[in] in_img Image pointer { grayscale, rgb }
+ * @param[in] win_size Dimension of the filtering window { positive-odd }
+ *
+ * @return Pointer to the filtered image or NULL
+ *
+ * @note Each band of a color image is filtered separately. The window is
+ *       sorted anew for every pixel, so the cost grows with WIN_SIZE^2;
+ *       the other median filters give the same result faster. The pixels
+ *       within WIN_SIZE / 2 of the border are copied from the input.
+ * @see #filter_running_median
+ * @see #filter_const_time_median
+ *
+ * @author Damian Kusnik
+ */
+
+Image *
+filter_classical_median ( const Image * in_img, const int win_size )
+{
+ SET_FUNC_NAME ( "filter_classical_median" );
+ int num_rows, num_cols, num_bands;
+ int half_win;
+ int iy;
+ int fail = 0;
+ byte *in_data, *out_data;
+ Image *out_img;
+
+ out_img = start_median ( in_img, win_size );
+ if ( IS_NULL ( out_img ) )
+  {
+   return NULL;
+  }
+
+ num_rows = get_num_rows ( in_img );
+ num_cols = get_num_cols ( in_img );
+ num_bands = is_rgb_img ( in_img ) ? 3 : 1;
+ half_win = win_size / 2;
+ in_data = ( byte * ) get_img_data_1d ( in_img );
+ out_data = ( byte * ) get_img_data_1d ( out_img );
+
+#pragma omp parallel reduction(|:fail)
+ {
+  int *window = ( int * ) malloc ( win_size * win_size * sizeof ( int ) );
+
+  if ( IS_NULL ( window ) )
+   {
+    fail = 1;
+   }
+
+#pragma omp for schedule(static)
+  for ( iy = half_win; iy < num_rows - half_win; iy++ )
+   {
+    int ix, ib, jy, jx, count;
+
+    if ( IS_NULL ( window ) )
+     {
+      continue;
+     }
+
+    for ( ix = half_win; ix < num_cols - half_win; ix++ )
+     {
+      for ( ib = 0; ib < num_bands; ib++ )
+       {
+	count = 0;
+	for ( jy = iy - half_win; jy <= iy + half_win; jy++ )
+	 {
+	  const byte *row = in_data + ( size_t ) jy * num_cols * num_bands;
+
+	  for ( jx = ix - half_win; jx <= ix + half_win; jx++ )
+	   {
+	    window[count++] = row[jx * num_bands + ib];
+	   }
+	 }
+	out_data[( ( size_t ) iy * num_cols + ix ) * num_bands + ib] =
+	 ( byte ) find_median ( count, window );
+       }
+     }
+   }
+
+  free ( window );
+ }
+
+ if ( fail )
+  {
+   free_img ( out_img );
+   free ( out_img );
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ return out_img;
+}
+
+/**
+ * @brief Implements the running median filter
+ *
+ * @param[in] in_img Image pointer { grayscale, rgb }
+ * @param[in] win_size Dimension of the filtering window { positive-odd }
+ *
+ * @return Pointer to the filtered image or NULL
+ *
+ * @note Each band of a color image is filtered separately. Along each row
+ *       a histogram of the window is kept: moving one column removes the
+ *       left column and adds the right one, and the median moves from its
+ *       previous value using the count of values below it, so the cost per
+ *       pixel grows with WIN_SIZE. Rows are filtered in parallel. The
+ *       pixels within WIN_SIZE / 2 of the border are copied from the input.
+ * @ref Huang T.S., Yang G.J., and Tang G.Y. (1979) "A Fast Two-Dimensional
+ *      Median Filtering Algorithm," IEEE Trans. on Acoustics, Speech, and
+ *      Signal Processing, 27(1): 13-18
+ * @see #filter_const_time_median
+ *
+ * @author Damian Kusnik
+ */
+
+Image *
+filter_running_median ( const Image * in_img, const int win_size )
+{
+ int num_rows, num_cols, num_bands;
+ int half_win;
+ int iy;
+ int thresh;
+ byte *in_data, *out_data;
+ Image *out_img;
+
+ out_img = start_median ( in_img, win_size );
+ if ( IS_NULL ( out_img ) )
+  {
+   return NULL;
+  }
+
+ num_rows = get_num_rows ( in_img );
+ num_cols = get_num_cols ( in_img );
+ num_bands = is_rgb_img ( in_img ) ? 3 : 1;
+ half_win = win_size / 2;
+ /* the median has at most THRESH values below it */
+ thresh = ( win_size * win_size - 1 ) / 2;
+ in_data = ( byte * ) get_img_data_1d ( in_img );
+ out_data = ( byte * ) get_img_data_1d ( out_img );
+
+#pragma omp parallel for schedule(static)
+ for ( iy = half_win; iy < num_rows - half_win; iy++ )
+  {
+   const size_t row_len = ( size_t ) num_cols * num_bands;
+   const byte *top = in_data + ( iy - half_win ) * row_len;
+   byte *out_row = out_data + iy * row_len;
+   int ib;
+
+   begin_timeline_event ( "row", iy );
+   for ( ib = 0; ib < num_bands; ib++ )
+    {
+     int hist[MED_NUM_BINS];
+     int median = 0, num_below = 0;
+     int ix, jy, jx;
+
+     memset ( hist, 0, sizeof ( hist ) );
+     for ( jy = 0; jy < win_size; jy++ )
+      {
+       for ( jx = 0; jx < win_size; jx++ )
+	{
+	 hist[top[jy * row_len + jx * num_bands + ib]]++;
+	}
+      }
+
+     for ( ix = half_win; ix < num_cols - half_win; ix++ )
+      {
+       if ( ix > half_win )
+	{
+	 int col_out = ( ix - half_win - 1 ) * num_bands + ib;
+	 int col_in = ( ix + half_win ) * num_bands + ib;
+
+	 for ( jy = 0; jy < win_size; jy++ )
+	  {
+	   int value = top[jy * row_len + col_out];
+
+	   hist[value]--;
+	   num_below -= value < median;
+
+	   value = top[jy * row_len + col_in];
+	   hist[value]++;
+	   num_below += value < median;
+	  }
+	}
+
+       /* move the median until it has at most THRESH values below it and
+          more than THRESH values below or at it */
+       while ( num_below > thresh )
+	{
+	 median--;
+	 num_below -= hist[median];
+	}
+       while ( num_below + hist[median] <= thresh )
+	{
+	 num_below += hist[median];
+	 median++;
+	}
+
+       out_row[ix * num_bands + ib] = ( byte ) median;
+      }
+    }
+   end_timeline_event (  );
+  }
+
+ return out_img;
+}
+
+/**
+ * @brief Implements the 3x3 median filter
+ *
+ * @param[in] in_img Image pointer { grayscale, rgb }
+ *
+ * @return Pointer to the filtered image or NULL
+ *
+ * @note Each band of a color image is filtered separately. The median of
+ *       the nine values is found with a sorting network of 19
+ *       compare-exchange steps made of min/max operations, which have no
+ *       branches and are applied to a whole row of samples with SIMD
+ *       instructions. Rows are filtered in parallel. The one-pixel frame is
+ *       copied from the input.
+ * @ref Devillard N. (1998) "Fast Median Search: An ANSI C Implementation"
+ *      http://ndevilla.free.fr/median/median/index.html
+ * @see #filter_const_time_median
+ *
+ * @author Damian Kusnik
+ */
+
+Image *
+filter_3x3_median ( const Image * in_img )
+{
+ int num_rows, num_cols, num_bands;
+ int iy;
+ byte *in_data, *out_data;
+ Image *out_img;
+
+ out_img = start_median ( in_img, 3 );
+ if ( IS_NULL ( out_img ) )
+  {
+   return NULL;
+  }
+
+ num_rows = get_num_rows ( in_img );
+ num_cols = get_num_cols ( in_img );
+ num_bands = is_rgb_img ( in_img ) ? 3 : 1;
+ in_data = ( byte * ) get_img_data_1d ( in_img );
+ out_data = ( byte * ) get_img_data_1d ( out_img );
+
+#pragma omp parallel for schedule(static)
+ for ( iy = 1; iy < num_rows - 1; iy++ )
+  {
+   const int row_len = num_cols * num_bands;
+   const byte *above = in_data + ( size_t ) ( iy - 1 ) * row_len;
+   const byte *cur = above + row_len;
+   const byte *below = cur + row_len;
+   byte *out_row = out_data + ( size_t ) iy * row_len;
+   int ik;
+
+   /* the samples of a band are NUM_BANDS apart */
+#pragma omp simd
+   for ( ik = num_bands; ik < row_len - num_bands; ik++ )
+    {
+     byte p0 = above[ik - num_bands], p1 = above[ik], p2 = above[ik + num_bands];
+     byte p3 = cur[ik - num_bands], p4 = cur[ik], p5 = cur[ik + num_bands];
+     byte p6 = below[ik - num_bands], p7 = below[ik], p8 = below[ik + num_bands];
+
+     SORT_PAIR ( p1, p2 );
+     SORT_PAIR ( p4, p5 );
+     SORT_PAIR ( p7, p8 );
+     SORT_PAIR ( p0, p1 );
+     SORT_PAIR ( p3, p4 );
+     SORT_PAIR ( p6, p7 );
+     SORT_PAIR ( p1, p2 );
+     SORT_PAIR ( p4, p5 );
+     SORT_PAIR ( p7, p8 );
+     SORT_PAIR ( p0, p3 );
+     SORT_PAIR ( p5, p8 );
+     SORT_PAIR ( p4, p7 );
+     SORT_PAIR ( p3, p6 );
+     SORT_PAIR ( p1, p4 );
+     SORT_PAIR ( p2, p5 );
+     SORT_PAIR ( p4, p7 );
+     SORT_PAIR ( p4, p2 );
+     SORT_PAIR ( p6, p4 );
+     SORT_PAIR ( p4, p2 );
+
+     out_row[ik] = p4;
+    }
+  }
+
+ return out_img;
+}
+
+/**
+ * @brief Implements the constant-time median filter
+ *
+ * @param[in] in_img Image pointer { grayscale, rgb }
+ * @param[in] win_size Dimension of the filtering window { positive-odd }
+ *
+ * @return Pointer to the filtered image or NULL
+ *
+ * @note Each band of a color image is filtered separately. A histogram is
+ *       kept for every column of the rows under the window and moved down
+ *       one row at a time; the window histogram is moved along the row by
+ *       adding the column histogram that enters and subtracting the one
+ *       that leaves. Both have 16 coarse bins, updated at every step, and
+ *       256 fine bins, of which only the 16 under the coarse bin holding
+ *       the median are brought up to date, so the cost per pixel does not
+ *       depend on WIN_SIZE; it is higher than that of the running median
+ *       for small windows. Each thread handles a strip of rows, in stripes
+ *       of columns whose histograms fit in the cache. The pixels within
+ *       WIN_SIZE / 2 of the border are copied from the input.
+ * @ref Perreault S. and Hebert P. (2007) "Median Filtering in Constant
+ *      Time," IEEE Trans. on Image Processing, 16(9): 2389-2394
+ * @see #filter_running_median
+ *
+ * @author Damian Kusnik
+ */
+
+Image *
+filter_const_time_median ( const Image * in_img, const int win_size )
+{
+ SET_FUNC_NAME ( "filter_const_time_median" );
+ int num_rows, num_cols, num_bands;
+ int half_win;
+ int thresh;
+ int stripe_width;		/* output columns per stripe */
+ int fail = 0;
+ byte *in_data, *out_data;
+ Image *out_img;
+
+ out_img = start_median ( in_img, win_size );
+ if ( IS_NULL ( out_img ) )
+  {
+   return NULL;
+  }
+
+ num_rows = get_num_rows ( in_img );
+ num_cols = get_num_cols ( in_img );
+ num_bands = is_rgb_img ( in_img ) ? 3 : 1;
+ half_win = win_size / 2;
+ thresh = ( win_size * win_size - 1 ) / 2;
+ stripe_width = MAX_2 ( MED_STRIPE_BYTES / ( num_bands * ( MED_NUM_BINS + MED_NUM_COARSE ) *
+					   ( int ) sizeof ( uint16_t ) ) - 2 * half_win, 1 );
+ in_data = ( byte * ) get_img_data_1d ( in_img );
+ out_data = ( byte * ) get_img_data_1d ( out_img );
+
+ if ( num_rows < win_size || num_cols < win_size )
+  {
+   /* every pixel is on the border */
+   return out_img;
+  }
+
+#pragma omp parallel reduction(|:fail)
+ {
+  const size_t row_len = ( size_t ) num_cols * num_bands;
+  const int hist_cols = MIN_2 ( stripe_width + 2 * half_win, num_cols );
+  const size_t num_hists = ( size_t ) hist_cols * num_bands;
+  int num_out_rows = num_rows - 2 * half_win;
+  int num_threads = 1, thread_id = 0;
+  int y0, y1, iy, jy, x0;
+  uint16_t *col_fine, *col_coarse;
+
+#ifdef _OPENMP
+  num_threads = omp_get_num_threads ( );
+  thread_id = omp_get_thread_num ( );
+#endif
+
+  /* contiguous strips of rows, so the column histograms only move down */
+  y0 = half_win + ( int ) ( ( int64_t ) num_out_rows * thread_id / num_threads );
+  y1 = half_win + ( int ) ( ( int64_t ) num_out_rows * ( thread_id + 1 ) / num_threads );
+
+  col_fine = ( uint16_t * ) malloc ( num_hists * ( MED_NUM_BINS + MED_NUM_COARSE ) *
+				     sizeof ( uint16_t ) );
+  col_coarse = col_fine + num_hists * MED_NUM_BINS;
+  if ( IS_NULL ( col_fine ) )
+   {
+    fail = 1;
+   }
+
+  /* the strip is done in stripes of columns whose histograms stay in cache;
+     histogram column 0 is image column X0 - HALF_WIN */
+  for ( x0 = half_win; x0 < num_cols - half_win && y0 < y1 && !fail; x0 += stripe_width )
+   {
+    const int x1 = MIN_2 ( x0 + stripe_width, num_cols - half_win );
+    const int num_hist_cols = x1 - x0 + 2 * half_win;
+    const byte *in_col = in_data + ( size_t ) ( x0 - half_win ) * num_bands;
+
+    begin_timeline_event ( "stripe", x0 );
+    memset ( col_fine, 0, num_hists * ( MED_NUM_BINS + MED_NUM_COARSE ) *
+	     sizeof ( uint16_t ) );
+    for ( jy = y0 - half_win; jy < y0 + half_win; jy++ )
+     {
+      update_col_hists ( in_col + jy * row_len, num_hist_cols, num_bands, 1,
+			 col_fine, col_coarse );
+     }
+
+    for ( iy = y0; iy < y1; iy++ )
+     {
+      byte *out_row = out_data + iy * row_len;
+      int ib;
+
+      if ( iy > y0 )
+       {
+	update_col_hists ( in_col + ( iy - half_win - 1 ) * row_len, num_hist_cols,
+			   num_bands, -1, col_fine, col_coarse );
+       }
+      update_col_hists ( in_col + ( iy + half_win ) * row_len, num_hist_cols,
+			 num_bands, 1, col_fine, col_coarse );
+
+      for ( ib = 0; ib < num_bands; ib++ )
+       {
+	int coarse[MED_NUM_COARSE];
+	int fine[MED_NUM_COARSE][MED_NUM_COARSE];
+	int last_col[MED_NUM_COARSE];	/* window center FINE[i] is valid for */
+	int ix, jx, ic;
+
+	memset ( coarse, 0, sizeof ( coarse ) );
+	for ( jx = 0; jx < win_size; jx++ )
+	 {
+	  add_hist ( MED_NUM_COARSE, col_coarse +
+		     ( ( size_t ) jx * num_bands + ib ) * MED_NUM_COARSE, coarse );
+	 }
+	for ( ic = 0; ic < MED_NUM_COARSE; ic++ )
+	 {
+	  last_col[ic] = -1;
+	 }
+
+	/* IX is the histogram column of the window center */
+	for ( ix = half_win; ix < num_hist_cols - half_win; ix++ )
+	 {
+	  int count = 0;
+	  int jf;
+
+	  if ( ix > half_win )
+	   {
+	    add_sub_hist ( MED_NUM_COARSE,
+			   col_coarse + ( ( size_t ) ( ix + half_win ) * num_bands + ib ) * MED_NUM_COARSE,
+			   col_coarse + ( ( size_t ) ( ix - half_win - 1 ) * num_bands + ib ) * MED_NUM_COARSE,
+			   coarse );
+	   }
+
+	  ic = find_median_bin ( coarse, thresh, &count );
+
+	  /* bring the fine bins under coarse bin IC up to this column; if
+	     they are a whole window behind, start them over */
+	  if ( last_col[ic] < 0 || ix - last_col[ic] >= win_size )
+	   {
+	    memset ( fine[ic], 0, sizeof ( fine[ic] ) );
+	    for ( jx = ix - half_win; jx <= ix + half_win; jx++ )
+	     {
+	      add_hist ( MED_NUM_COARSE,
+			 col_fine + ( ( size_t ) jx * num_bands + ib ) * MED_NUM_BINS +
+			 ic * MED_NUM_COARSE, fine[ic] );
+	     }
+	   }
+	  else
+	   {
+	    for ( jx = last_col[ic] + 1; jx <= ix; jx++ )
+	     {
+	      add_sub_hist ( MED_NUM_COARSE,
+			     col_fine + ( ( size_t ) ( jx + half_win ) * num_bands + ib ) *
+			     MED_NUM_BINS + ic * MED_NUM_COARSE,
+			     col_fine + ( ( size_t ) ( jx - half_win - 1 ) * num_bands + ib ) *
+			     MED_NUM_BINS + ic * MED_NUM_COARSE, fine[ic] );
+	     }
+	   }
+	  last_col[ic] = ix;
+
+	  jf = find_median_bin ( fine[ic], thresh, &count );
+
+	  out_row[( x0 - half_win + ix ) * num_bands + ib] =
+	   ( byte ) ( ic * MED_NUM_COARSE + jf );
+	 }
+       }
+     }
+    end_timeline_event (  );
+   }
+
+  free ( col_fine );
+ }
+
+ if ( fail )
+  {
+   free_img ( out_img );
+   free ( out_img );
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ return out_img;
+}
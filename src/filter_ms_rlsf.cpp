@@ -21,6 +21,58 @@
 #define MAX(x, y) (((x) > (y)) ? (x) : (y))
 #define MIN(x, y) (((x) < (y)) ? (x) : (y))
 
+/* Sums the ALPHA smallest of the 9 distances; WEIGHTS is overwritten */
+float sum_smallest_rlsf(float* weights, const int alpha)
+{
+	float w = 0;
+
+	for (int i = 0; (i < alpha) && (i < 9); i++)
+	{
+		float min = weights[0];
+		int tmp = 0;
+		for (int j = 1; j < 9; j++)
+		{
+			if (weights[j] < min)
+			{
+				min = weights[j];
+				tmp = j;
+			}
+		}
+		w += min;
+		weights[tmp] = +INFINITY;
+	}
+
+	return w;
+}
+
+/* Packs an RGB image into one 0xRRGGBB int per pixel */
+void pack_img_rlsf(const Image* in_img, int* int_data)
+{
+	byte*** in_data = (byte***)get_img_data_nd(in_img);
+	int num_rows = get_num_rows(in_img);
+	int num_cols = get_num_cols(in_img);
+
+	for (int i = 0; i < num_rows; i++)
+		for (int j = 0; j < num_cols; j++)
+			int_data[i * num_cols + j] = (((int)in_data[i][j][0]) << 16) | ((int)in_data[i][j][1] << 8) | ((int)in_data[i][j][2]);
+}
+
+/* Unpacks 0xRRGGBB ints into an RGB image */
+void unpack_img_rlsf(const int* int_data, Image* out_img)
+{
+	byte*** out_data = (byte***)get_img_data_nd(out_img);
+	int num_rows = get_num_rows(out_img);
+	int num_cols = get_num_cols(out_img);
+
+	for (int i = 0; i < num_rows; i++)
+		for (int j = 0; j < num_cols; j++)
+		{
+			out_data[i][j][0] = (int_data[i * num_cols + j] >> 16) & 0xFF;
+			out_data[i][j][1] = (int_data[i * num_cols + j] >> 8) & 0xFF;
+			out_data[i][j][2] = (int_data[i * num_cols + j]) & 0xFF;
+		}
+}
+
 float compute_weight_ms_rlsf(int* in_data, int width, float r, float g, float b, int pos, int alpha, float sigma, float* central_pix) {
 	float w, weights[9], r1, g1, b1;
 
@@ -46,115 +98,132 @@ float compute_weight_ms_rlsf(int* in_data, int width, float r, float g, float b,
 			a++;
 		}
 
-	w = 0;
-	
-	for (int i = 0; (i < alpha) && (i < 9); i++)
-	{
-		float min = weights[0];
-		int tmp = 0;
-		for (int j = 1; j < 9; j++)
-		{
-			if (weights[j] < min)
-			{
-				min = weights[j];
-				tmp = j;
-			}
-		}
-		w += min;
-		weights[tmp] = +INFINITY;
-	}
+	w = sum_smallest_rlsf(weights, alpha);
 	w /= (float)(alpha);
 	w = expf(-(w / sigma));
 	return w;
 }
 
-void denoise_pixel_rlsf(int* in_data, int* out_data, const int width, const int height, const int radius, const int alpha, const float sigma, const int iter, float ic, float ir)
+/* Mean-shift state of one pixel: position and color of the current estimate */
+typedef struct
 {
-	int f = 1;
-	float wsum = 0.0, w, mx, my,r,g,b, last_ir, last_ic, last_r, last_g, last_b;
-	int iter_count = 0;
-
-	if (ic >= width-f || ir >= height-f || ic < f || ir <f )
-		return;
+	float ir, ic;
+	float r, g, b;
+	int is_done;	/* has the pixel stopped moving ? */
+} MsRlsfState;
 
+static void init_state_rlsf(const int* in_data, const int width, const int ir, const int ic, MsRlsfState* s)
+{
 	int pos = ir * width + ic;
-	int out_pos = pos;
 
-	//if we are in the image borders
-	//if (ir >= height - r || ic >= width - r) return;
-	//if (ir < r || ic < r) return;
-	r = (in_data[pos] & 0XFF0000) >> 16;
-	g = (in_data[pos] & 0XFF00) >> 8;
-	b = (in_data[pos] & 0XFF);
+	s->ir = ir;
+	s->ic = ic;
+	s->r = (in_data[pos] & 0XFF0000) >> 16;
+	s->g = (in_data[pos] & 0XFF00) >> 8;
+	s->b = (in_data[pos] & 0XFF);
+	s->is_done = 0;
+}
 
-	
+/* Performs one mean-shift iteration of a pixel; returns nonzero if it moved */
+static int step_pixel_rlsf(const int* in_data, const int width, const int height, const int radius, const int alpha, const float sigma, MsRlsfState* s)
+{
+	float wsum = 0.0, w, mx, my, r, g, b, ir, ic, last_ir, last_ic, last_r, last_g, last_b;
 	float diff = 0;
-
 	float central_pix[3];
+	int pos;
 
-	// go through all pixels in block
-	do {
+	ir = s->ir;
+	ic = s->ic;
 
-		int istart = MAX((int)round(ir) - radius-1, 1);
-		int iend = MIN((int)round(ir) + radius + 1, height - 2);
-		int jstart = MAX((int)round(ic) - radius-1, 1);
-		int jend = MIN((int)round(ic) + radius+1, width - 2);
-		
-		wsum = w = 0.0;
-		last_ir = ir;
-		last_ic = ic;
-		last_r = r;
-		last_g = g;
-		last_b = b;
-
-		central_pix[0] = r;
-		central_pix[1] = g;
-		central_pix[2] = b;
-
-		r = 0;
-		g = 0;
-		b = 0;
-
-		wsum = 0;
-		mx = 0, my = 0;
-		pos = (int)round(ir) * width + (int)round(ic);
-		for (int i = istart; i <= iend; i++) { // i = y
-			for (int j = jstart; j <= jend; j++) { // j = x
-				int q = i * width + j;
-				w = compute_weight_ms_rlsf(in_data, width, 
-					(in_data[q] & 0XFF0000) >> 16, 
-					(in_data[q] & 0XFF00) >> 8,
-					(in_data[q] & 0XFF),
-					pos, alpha, sigma, central_pix);
-				r += ((in_data[q] & 0XFF0000) >> 16) * w;
-				g += ((in_data[q] & 0XFF00) >> 8) * w ;
-				b += (in_data[q] & 0XFF) *w;
-				wsum += w;
-				mx += i * w;
-				my += j * w;
-			}
+	int istart = MAX((int)round(ir) - radius-1, 1);
+	int iend = MIN((int)round(ir) + radius + 1, height - 2);
+	int jstart = MAX((int)round(ic) - radius-1, 1);
+	int jend = MIN((int)round(ic) + radius+1, width - 2);
+	
+	last_ir = ir;
+	last_ic = ic;
+	last_r = s->r;
+	last_g = s->g;
+	last_b = s->b;
+
+	central_pix[0] = s->r;
+	central_pix[1] = s->g;
+	central_pix[2] = s->b;
+
+	r = 0;
+	g = 0;
+	b = 0;
+
+	wsum = 0;
+	mx = 0, my = 0;
+	pos = (int)round(ir) * width + (int)round(ic);
+	for (int i = istart; i <= iend; i++) { // i = y
+		for (int j = jstart; j <= jend; j++) { // j = x
+			int q = i * width + j;
+			w = compute_weight_ms_rlsf((int*)in_data, width, 
+				(in_data[q] & 0XFF0000) >> 16, 
+				(in_data[q] & 0XFF00) >> 8,
+				(in_data[q] & 0XFF),
+				pos, alpha, sigma, central_pix);
+			r += ((in_data[q] & 0XFF0000) >> 16) * w;
+			g += ((in_data[q] & 0XFF00) >> 8) * w ;
+			b += (in_data[q] & 0XFF) *w;
+			wsum += w;
+			mx += i * w;
+			my += j * w;
 		}
+	}
+
+	r = r / wsum;
+	g = g / wsum;
+	b = b / wsum;
+
+	ir = mx / wsum;
+	ic = my/ wsum;
+
+	if (ir < 0)
+		ir = 0;
+	if (ic < -0)
+		ic = 0;
+	diff = (last_r - r) * (last_r - r) + (last_g - g) * (last_g - g) + (last_b - b) * (last_b - b)
+			+ (last_ir-ir) * (last_ir - ir) + (last_ic - ic) * (last_ic - ic);
+
+	s->ir = ir;
+	s->ic = ic;
+	s->r = r;
+	s->g = g;
+	s->b = b;
 
-		diff = 0;
-		r = r / wsum;
-		g = g / wsum;
-		b = b / wsum;
+	return diff > 0;
+}
+
+/* Packs the color of a pixel state the way the filter output is stored */
+static int pack_state_rlsf(const MsRlsfState* s)
+{
+	return ((int)(s->r) << 16) |
+		((int)(s->g) << 8) |
+		((int)(s->b));
+}
+
+void denoise_pixel_rlsf(int* in_data, int* out_data, const int width, const int height, const int radius, const int alpha, const float sigma, const int iter, float ic, float ir)
+{
+	int f = 1;
+	int iter_count = 0;
+	int moved;
+	MsRlsfState state;
+
+	if (ic >= width-f || ir >= height-f || ic < f || ir <f )
+		return;
 
-		ir = mx / wsum;
-		ic = my/ wsum;
+	init_state_rlsf(in_data, width, (int)ir, (int)ic, &state);
 
-		if (ir < 0)
-			ir = 0;
-		if (ic < -0)
-			ic = 0;
-		diff = (last_r - r) * (last_r - r) + (last_g - g) * (last_g - g) + (last_b - b) * (last_b - b)
-				+ (last_ir-ir) * (last_ir - ir) + (last_ic - ic) * (last_ic - ic);
+	// go through all pixels in block
+	do {
+		moved = step_pixel_rlsf(in_data, width, height, radius, alpha, sigma, &state);
 		iter_count++;
-	} while (iter_count < iter && diff >0);
+	} while (iter_count < iter && moved);
 	
-	out_data[out_pos] = ((int)(r) << 16) |
-		((int)(g) << 8) |
-		((int)(b));
+	out_data[(int)ir * width + (int)ic] = pack_state_rlsf(&state);
 
 	return;
 }
@@ -167,8 +236,6 @@ filter_ms_rlsf ( const Image * in_img, const int r, int alpha, const float sigma
  //clock_t start_time;
  //start_time = start_timer();
 
- byte*** in_data;
- byte*** out_data;
  int num_rows, num_cols;
  Image* out_img;
  if ( !is_rgb_img ( in_img ) )
@@ -206,35 +273,38 @@ filter_ms_rlsf ( const Image * in_img, const int r, int alpha, const float sigma
  num_rows = get_num_rows(in_img);
  num_cols = get_num_cols(in_img);
 
- in_data = (byte***)get_img_data_nd(in_img);
  out_img = alloc_img(PIX_RGB, num_rows, num_cols);
- out_data = (byte***)get_img_data_nd(out_img);
 
  size_t size_i = size_t(num_rows * num_cols) * sizeof(int);
 
  int* int_in_data = (int*)malloc(size_i);
  int* int_out_data = (int*)malloc(size_i);
 
- for (int i = 0; i < num_rows; i++) 
-	 for (int j = 0; j < num_cols; j++)
-		int_in_data[i * num_cols + j] = (((int)in_data[i][j][0]) << 16) | ((int)in_data[i][j][1] << 8) | ((int)in_data[i][j][2]);
+ begin_perf_stage(PERF_STAGE_PACK);
+ pack_img_rlsf(in_img, int_in_data);
+
+ /* the one-pixel frame is not filtered and keeps the input values */
+ memcpy(int_out_data, int_in_data, size_i);
+ end_perf_stage(PERF_STAGE_PACK);
 
  #pragma omp parallel \
     shared(int_in_data, int_out_data)
  {
+ begin_perf_stage(PERF_STAGE_FILTER);
 #pragma omp for schedule(dynamic) nowait
  for (int ir = 0; ir < num_rows; ir++) 
- 	 for (int ic = 0; ic < num_cols; ic++)
-  	 denoise_pixel_rlsf(int_in_data, int_out_data, num_cols, num_rows, r, alpha, 2 * sigma * sigma, iter, ic, ir);
+  {
+   begin_timeline_event("row", ir);
+   for (int ic = 0; ic < num_cols; ic++)
+     denoise_pixel_rlsf(int_in_data, int_out_data, num_cols, num_rows, r, alpha, 2 * sigma * sigma, iter, ic, ir);
+   end_timeline_event();
+  }
+ end_perf_stage(PERF_STAGE_FILTER);
  }
 
- for (int i = 0; i < num_rows; i++)
-	 for (int j = 0; j < num_cols; j++)
-	 {
-		 out_data[i][j][0] = (int_out_data[i * num_cols + j] >> 16) & 0xFF;
-		 out_data[i][j][1] = (int_out_data[i * num_cols + j] >> 8) & 0xFF;
-		 out_data[i][j][2] = (int_out_data[i * num_cols + j]) & 0xFF;
-	 }
+ begin_perf_stage(PERF_STAGE_UNPACK);
+ unpack_img_rlsf(int_out_data, out_img);
+ end_perf_stage(PERF_STAGE_UNPACK);
 
  // Free device memory
 
@@ -243,3 +313,231 @@ filter_ms_rlsf ( const Image * in_img, const int r, int alpha, const float sigma
 
  return out_img;
 }
+
+/** 
+ * @brief Implements the Robust Mean-ShiftS (RMS) and records its convergence
+ *
+ * @param[in] in_img Image pointer { rgb }
+ * @param[in] r Radius of the Block { positive }
+ * @param[in] alpha Alpha prameter (Number of pixels taken into account in patch) { positive }
+ * @param[in] sigma Sigma prameter (smoothing parameter) { positive }
+ * @param[in] iter Number of iteration limit { positive }
+ * @param[in] ref_img Reference image the passes are compared with { rgb }
+ * @param[in] ssim_tile Tile size of the SSIM map averaged after each pass,
+ *            or 0 to skip SSIM
+ * @param[out] curve Quality after each pass; the arrays belong to the caller
+ *
+ * @return Pointer to the filtered image or NULL
+ *
+ * @note The mean-shift state of every pixel is kept between passes and all
+ *       pixels take one step per pass, so after pass k the image equals the
+ *       output of filter_ms_rlsf with iter = k. The image is updated in
+ *       place for the pixels that moved and compared with REF_IMG
+ *       (MSE and PSNR as in calculate_snr, optionally the mean tile SSIM of
+ *       calc_quality_maps), which gives the whole convergence curve for the
+ *       cost of the run with the largest ITER. Passes stop early once no
+ *       pixel moves.
+ * @see #free_quality_curve
+ *
+ * @author Kusnik Damian 
+ */
+
+Image *
+filter_ms_rlsf_track ( const Image * in_img, const int r, int alpha, const float sigma, const int iter,
+		       const Image * ref_img, const int ssim_tile, QualityCurve * curve )
+{
+ SET_FUNC_NAME ( "filter_ms_rlsf_track" );
+ byte*** out_data;
+ int num_rows, num_cols;
+ int num_active;
+ int fail = 0;
+ Image* out_img;
+ MsRlsfState* states;
+
+ if ( !is_rgb_img ( in_img ) || !is_rgb_img ( ref_img ) )
+  {
+   ERROR_RET ( "Not a color image !", NULL );
+  }
+
+ if ( get_num_rows ( in_img ) != get_num_rows ( ref_img ) ||
+      get_num_cols ( in_img ) != get_num_cols ( ref_img ) )
+  {
+   ERROR_RET ( "Image dimensions must be equal !", NULL );
+  }
+
+ if ( !IS_POS ( r ) )
+  {
+   ERROR ( "Window size ( %d ) must be positive !", r );
+   return NULL;
+  }
+
+ if ( !IS_POS ( alpha ) )
+  {
+   ERROR ( "Alpha value ( %d ) must be positive !", alpha );
+   return NULL;
+  }
+
+ if ( !IS_POS ( sigma ) )
+  {
+   ERROR ( "Sigma value ( %d ) must be positive !", sigma );
+   return NULL;
+  }
+
+ if ( !IS_POS ( iter ) )
+  {
+   ERROR ( "Numer of iterations ( %d ) must be positive !", iter );
+   return NULL;
+  }
+
+ if ( ssim_tile < 0 )
+  {
+   ERROR ( "SSIM tile size ( %d ) must be nonnegative !", ssim_tile );
+   return NULL;
+  }
+
+ if(alpha>9)
+     alpha=9;
+
+ num_rows = get_num_rows(in_img);
+ num_cols = get_num_cols(in_img);
+
+ memset(curve, 0, sizeof(QualityCurve));
+ curve->mse = (double*)calloc(iter, sizeof(double));
+ curve->psnr = (double*)calloc(iter, sizeof(double));
+ curve->num_active = (int*)calloc(iter, sizeof(int));
+ if (ssim_tile > 0)
+	 curve->ssim = (double*)calloc(iter, sizeof(double));
+
+ out_img = clone_img(in_img);
+ states = (MsRlsfState*)malloc(size_t(num_rows) * num_cols * sizeof(MsRlsfState));
+ int* int_in_data = (int*)malloc(size_t(num_rows) * num_cols * sizeof(int));
+ if (IS_NULL(curve->mse) || IS_NULL(curve->psnr) || IS_NULL(curve->num_active) ||
+     (ssim_tile > 0 && IS_NULL(curve->ssim)) || IS_NULL(out_img) ||
+     IS_NULL(states) || IS_NULL(int_in_data))
+  {
+   free_quality_curve(curve);
+   if (!IS_NULL(out_img))
+    {
+     free_img(out_img);
+     free(out_img);
+    }
+   free(states);
+   free(int_in_data);
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+ out_data = (byte***)get_img_data_nd(out_img);
+
+ begin_perf_stage(PERF_STAGE_PACK);
+ pack_img_rlsf(in_img, int_in_data);
+ end_perf_stage(PERF_STAGE_PACK);
+
+ /* the one-pixel frame is not filtered */
+ for (int i = 1; i < num_rows - 1; i++)
+	 for (int j = 1; j < num_cols - 1; j++)
+		 init_state_rlsf(int_in_data, num_cols, i, j, &states[i * num_cols + j]);
+
+ num_active = MAX(num_rows - 2, 0) * MAX(num_cols - 2, 0);
+ for (int it = 0; it < iter && num_active > 0 && !fail; it++)
+  {
+   QualityMetrics qm;
+   int moved = 0;
+
+#pragma omp parallel reduction(+:moved)
+   {
+   begin_perf_stage(PERF_STAGE_FILTER);
+#pragma omp for schedule(dynamic) nowait
+   for (int ir = 1; ir < num_rows - 1; ir++)
+    {
+     begin_timeline_event("row", ir);
+     for (int ic = 1; ic < num_cols - 1; ic++)
+      {
+       MsRlsfState* s = &states[ir * num_cols + ic];
+       int value;
+
+       if (s->is_done)
+	 continue;
+
+       s->is_done = !step_pixel_rlsf(int_in_data, num_cols, num_rows, r, alpha, 2 * sigma * sigma, s);
+       moved += !s->is_done;
+
+       value = pack_state_rlsf(s);
+       out_data[ir][ic][0] = (value >> 16) & 0xFF;
+       out_data[ir][ic][1] = (value >> 8) & 0xFF;
+       out_data[ir][ic][2] = value & 0xFF;
+      }
+     end_timeline_event();
+    }
+   end_perf_stage(PERF_STAGE_FILTER);
+   }
+
+   if (calc_quality_metrics(ref_img, out_img, 10, &qm) != E_SUCCESS)
+    {
+     fail = 1;
+     break;
+    }
+   curve->mse[it] = qm.mse;
+   curve->psnr[it] = qm.psnr;
+   curve->num_active[it] = moved;
+
+   if (ssim_tile > 0)
+    {
+     QualityMaps qmaps;
+     double** ssim_data;
+     double sum = 0.0;
+     int num_tiles;
+
+     if (calc_quality_maps(ref_img, out_img, ssim_tile, &qmaps) != E_SUCCESS)
+      {
+       fail = 1;
+       break;
+      }
+     ssim_data = (double**)get_img_data_nd(qmaps.ssim_map);
+     num_tiles = get_num_rows(qmaps.ssim_map) * get_num_cols(qmaps.ssim_map);
+     for (int k = 0; k < num_tiles; k++)
+	     sum += ssim_data[0][k];
+     curve->ssim[it] = sum / num_tiles;
+     free_quality_maps(&qmaps);
+    }
+
+   curve->num_iters = it + 1;
+   num_active = moved;
+  }
+
+ free(states);
+ free(int_in_data);
+
+ if (fail)
+  {
+   free_quality_curve(curve);
+   free_img(out_img);
+   free(out_img);
+   return NULL;
+  }
+
+ return out_img;
+}
+
+/** 
+ * @brief Releases the arrays of a convergence curve
+ *
+ * @param[in,out] curve Convergence curve
+ *
+ * @return none
+ *
+ * @author Kusnik Damian 
+ */
+
+void
+free_quality_curve ( QualityCurve * curve )
+{
+ if ( IS_NULL ( curve ) )
+  {
+   return;
+  }
+
+ free ( curve->mse );
+ free ( curve->psnr );
+ free ( curve->ssim );
+ free ( curve->num_active );
+ memset ( curve, 0, sizeof ( QualityCurve ) );
+}
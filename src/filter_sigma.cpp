@@ -0,0 +1,153 @@
+/**
+ * @file filter_sigma.c
+ * Routines for sigma filtering
+ */
+
+#include "image.h"
+
+/**
+ * @brief Implements the sigma filter
+ *
+ * @param[in] in_img Image pointer { grayscale, rgb }
+ * @param[in] win_size Dimension of the filtering window { positive-odd }
+ * @param[in] k_value Min. number of pixels in the intensity range
+ *                    [ 1, WIN_SIZE * WIN_SIZE ]
+ *
+ * @return Pointer to the filtered image or NULL
+ *
+ * @note Each sample X becomes the average of the window samples within
+ *       2 sigma of it, sigma being the local standard deviation. If fewer
+ *       than K_VALUE samples (X included) qualify, X is taken to be an
+ *       impulse and replaced with the window mean. Each band is filtered
+ *       separately and windows are cut off at the image border. The local
+ *       statistics come from summed-area tables; only the selection visits
+ *       each window.
+ * @ref Lee J.S. (1983) "Digital Image Smoothing and the Sigma Filter,"
+ *      Computer Vision, Graphics, and Image Processing, 24(2): 255-269
+ * @see #calc_local_stats
+ *
+ * @author Damian Kusnik
+ */
+
+Image *
+filter_sigma ( const Image * in_img, const int win_size, const int k_value )
+{
+ SET_FUNC_NAME ( "filter_sigma" );
+ int num_rows, num_cols, num_bands;
+ int half_win;
+ int iy;
+ int fail = 0;
+ byte *in_data, *out_data;
+ IntegralImage *int_img;
+ Image *out_img;
+
+ if ( !is_gray_img ( in_img ) && !is_rgb_img ( in_img ) )
+  {
+   ERROR_RET ( "Not a grayscale or color image !", NULL );
+  }
+
+ if ( !IS_POS_ODD ( win_size ) )
+  {
+   ERROR ( "Window size ( %d ) must be positive and odd !", win_size );
+   return NULL;
+  }
+
+ if ( k_value < 1 || k_value > win_size * win_size )
+  {
+   ERROR ( "K value ( %d ) must be in [1,%d] !", k_value, win_size * win_size );
+   return NULL;
+  }
+
+ num_rows = get_num_rows ( in_img );
+ num_cols = get_num_cols ( in_img );
+ num_bands = is_rgb_img ( in_img ) ? 3 : 1;
+ half_win = win_size / 2;
+
+ int_img = alloc_integral_img ( in_img, 1 );
+ if ( IS_NULL ( int_img ) )
+  {
+   return NULL;
+  }
+
+ out_img = alloc_img ( get_pix_type ( in_img ), num_rows, num_cols );
+ if ( IS_NULL ( out_img ) )
+  {
+   free_integral_img ( int_img );
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ in_data = ( byte * ) get_img_data_1d ( in_img );
+ out_data = ( byte * ) get_img_data_1d ( out_img );
+
+#pragma omp parallel reduction(|:fail)
+ {
+  double *mean = ( double * ) malloc ( 2 * num_cols * num_bands * sizeof ( double ) );
+  double *var = IS_NULL ( mean ) ? NULL : mean + num_cols * num_bands;
+
+  if ( IS_NULL ( mean ) )
+   {
+    fail = 1;
+   }
+
+#pragma omp for schedule(static)
+  for ( iy = 0; iy < num_rows; iy++ )
+   {
+    int y_begin = MAX_2 ( iy - half_win, 0 );
+    int y_end = MIN_2 ( iy + half_win, num_rows - 1 );
+    int ix, ib, jy, jx;
+
+    if ( IS_NULL ( mean ) )
+     {
+      continue;
+     }
+
+    calc_local_stats ( int_img, win_size, iy, mean, var );
+    for ( ix = 0; ix < num_cols; ix++ )
+     {
+      int x_begin = MAX_2 ( ix - half_win, 0 );
+      int x_end = MIN_2 ( ix + half_win, num_cols - 1 );
+
+      for ( ib = 0; ib < num_bands; ib++ )
+       {
+	int ik = ix * num_bands + ib;
+	int center = in_data[( ( size_t ) iy * num_cols + ix ) * num_bands + ib];
+	/* integer bounds of [ X - 2 sigma, X + 2 sigma ] */
+	int delta = ( int ) ( 2.0 * sqrt ( var[ik] ) );
+	int low = center - delta, high = center + delta;
+	int count = 0;
+	int64_t sum = 0;
+
+	for ( jy = y_begin; jy <= y_end; jy++ )
+	 {
+	  const byte *row = in_data + ( size_t ) jy * num_cols * num_bands + ib;
+
+	  for ( jx = x_begin; jx <= x_end; jx++ )
+	   {
+	    int value = row[jx * num_bands];
+	    int in_range = value >= low && value <= high;
+
+	    count += in_range;
+	    sum += in_range ? value : 0;
+	   }
+	 }
+
+	out_data[( ( size_t ) iy * num_cols + ix ) * num_bands + ib] = ( byte )
+	 ( count >= k_value ? ( sum + count / 2 ) / count : ( int ) ( mean[ik] + 0.5 ) );
+       }
+     }
+   }
+
+  free ( mean );
+ }
+
+ free_integral_img ( int_img );
+
+ if ( fail )
+  {
+   free_img ( out_img );
+   free ( out_img );
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ return out_img;
+}
@@ -0,0 +1,555 @@
+/**
+ * @file filter_vector_order.c
+ * Routines for vector order-statistic filtering with a sliding window
+ */
+
+#include <stdint.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "image.h"
+
+#define VO_DIST_SCALE 65536.0	/* fixed point of the Euclidean distances */
+
+#define VO_ANGLE_SCALE 16777216.0	/* fixed point of the angles (radians) */
+
+/** @cond INTERNAL_FUNCTION */
+
+/* Planar copy of the input: one array per band plus the squared norms */
+typedef struct
+{
+ int num_rows;
+ int num_cols;
+ int *red;
+ int *green;
+ int *blue;
+ int *norm_sq;
+} VoPlanes;
+
+/* Per-thread state of one measure (distance or angle) over a band of
+   WIN_SIZE rows. SPAN = 2 * WIN_SIZE - 1 column offsets. Rows are kept in
+   slots ( row % WIN_SIZE ).
+   pair[slot][oy][k][x]: measure between ( y, x ) and ( y + oy, x + k - WIN_SIZE + 1 )
+   col[slot][k][x]: sum of the measure between ( y, x ) and the band pixels in
+                    column x + k - WIN_SIZE + 1
+   prefix[slot][k][x]: sum of col[slot][0..k-1][x] */
+typedef struct
+{
+ uint32_t *pair;
+ int64_t *col;
+ int64_t *prefix;
+} VoMeasure;
+
+static uint32_t
+calc_dist_q ( const VoPlanes * planes, const size_t ia, const size_t ib )
+{
+ int dr = planes->red[ia] - planes->red[ib];
+ int dg = planes->green[ia] - planes->green[ib];
+ int db = planes->blue[ia] - planes->blue[ib];
+
+ return ( uint32_t ) ( sqrt ( ( double ) ( dr * dr + dg * dg + db * db ) ) *
+		       VO_DIST_SCALE + 0.5 );
+}
+
+static uint32_t
+calc_angle_q ( const VoPlanes * planes, const size_t ia, const size_t ib )
+{
+ int na = planes->norm_sq[ia];
+ int nb = planes->norm_sq[ib];
+ double cos_val;
+
+ if ( na == 0 || nb == 0 )
+  {
+   /* black has no direction: as close as can be to itself, orthogonal to the rest */
+   return na == nb ? 0 : ( uint32_t ) ( 0.5 * PI * VO_ANGLE_SCALE + 0.5 );
+  }
+
+ cos_val = ( planes->red[ia] * planes->red[ib] +
+	     planes->green[ia] * planes->green[ib] +
+	     planes->blue[ia] * planes->blue[ib] ) / sqrt ( ( double ) na * nb );
+
+ return ( uint32_t ) ( acos ( MIN_2 ( cos_val, 1.0 ) ) * VO_ANGLE_SCALE + 0.5 );
+}
+
+/* Adds row YN to the band of the measure; the band holds rows FIRST..YN-1 */
+static void
+add_band_row ( const VoPlanes * planes, const int win_size, int first,
+	       const int yn, const int is_angle, VoMeasure * meas )
+{
+ const int num_cols = planes->num_cols;
+ const int span = 2 * win_size - 1;
+ const int half = win_size - 1;
+ const size_t pair_slot = ( size_t ) win_size * span * num_cols;
+ const size_t col_slot = ( size_t ) span * num_cols;
+ int slot_n = yn % win_size;
+ int y, k, x;
+
+ /* drop the oldest row; its slot is about to be reused */
+ if ( yn - win_size >= first )
+  {
+   int yd = yn - win_size;
+   const uint32_t *pair_d = meas->pair + ( size_t ) ( yd % win_size ) * pair_slot;
+
+   for ( y = yd + 1; y < yn; y++ )
+    {
+     int64_t *col = meas->col + ( size_t ) ( y % win_size ) * col_slot;
+     const uint32_t *pair = pair_d + ( size_t ) ( y - yd ) * span * num_cols;
+
+     for ( k = 0; k < span; k++ )
+      {
+       int dx = k - half;
+       int64_t *col_k = col + ( size_t ) k * num_cols;
+       /* ( y, x ) to ( yd, x + dx ) is stored at ( yd, x + dx ), offset -dx */
+       const uint32_t *pair_k = pair + ( size_t ) ( span - 1 - k ) * num_cols + dx;
+
+       for ( x = MAX_2 ( 0, -dx ); x < MIN_2 ( num_cols, num_cols - dx ); x++ )
+	{
+	 col_k[x] -= pair_k[x];
+	}
+      }
+    }
+   first = yd + 1;
+  }
+
+ /* measures between the new row and every row of the band, itself included */
+ for ( y = MAX_2 ( first, yn - win_size + 1 ); y <= yn; y++ )
+  {
+   uint32_t *pair = meas->pair + ( size_t ) ( y % win_size ) * pair_slot +
+    ( size_t ) ( yn - y ) * span * num_cols;
+   size_t row_a = ( size_t ) y * num_cols;
+   size_t row_b = ( size_t ) yn * num_cols;
+
+   for ( k = 0; k < span; k++ )
+    {
+     int dx = k - half;
+     int x_lo = MAX_2 ( 0, -dx ), x_hi = MIN_2 ( num_cols, num_cols - dx );
+     uint32_t *pair_k = pair + ( size_t ) k * num_cols;
+
+     for ( x = 0; x < x_lo; x++ )
+      {
+       pair_k[x] = 0;
+      }
+     if ( is_angle )
+      {
+       for ( x = x_lo; x < x_hi; x++ )
+	{
+	 pair_k[x] = calc_angle_q ( planes, row_a + x, row_b + x + dx );
+	}
+      }
+     else
+      {
+       for ( x = x_lo; x < x_hi; x++ )
+	{
+	 pair_k[x] = calc_dist_q ( planes, row_a + x, row_b + x + dx );
+	}
+      }
+     for ( x = MAX_2 ( x_hi, x_lo ); x < num_cols; x++ )
+      {
+       pair_k[x] = 0;
+      }
+    }
+  }
+
+ /* the rows already in the band gain the new row */
+ for ( y = MAX_2 ( first, yn - win_size + 1 ); y < yn; y++ )
+  {
+   int64_t *col = meas->col + ( size_t ) ( y % win_size ) * col_slot;
+   const uint32_t *pair = meas->pair + ( size_t ) ( y % win_size ) * pair_slot +
+    ( size_t ) ( yn - y ) * span * num_cols;
+
+   for ( k = 0; k < span; k++ )
+    {
+     int64_t *col_k = col + ( size_t ) k * num_cols;
+     const uint32_t *pair_k = pair + ( size_t ) k * num_cols;
+
+     for ( x = 0; x < num_cols; x++ )
+      {
+       col_k[x] += pair_k[x];
+      }
+    }
+  }
+
+ /* the new row gains the whole band */
+ {
+  int64_t *col = meas->col + ( size_t ) slot_n * col_slot;
+  const uint32_t *pair_n = meas->pair + ( size_t ) slot_n * pair_slot;
+
+  for ( k = 0; k < span; k++ )
+   {
+    int64_t *col_k = col + ( size_t ) k * num_cols;
+    const uint32_t *pair_k = pair_n + ( size_t ) k * num_cols;
+
+    for ( x = 0; x < num_cols; x++ )
+     {
+      col_k[x] = pair_k[x];
+     }
+   }
+
+  for ( y = MAX_2 ( first, yn - win_size + 1 ); y < yn; y++ )
+   {
+    const uint32_t *pair = meas->pair + ( size_t ) ( y % win_size ) * pair_slot +
+     ( size_t ) ( yn - y ) * span * num_cols;
+
+    for ( k = 0; k < span; k++ )
+     {
+      int dx = k - half;
+      int64_t *col_k = col + ( size_t ) k * num_cols;
+      const uint32_t *pair_k = pair + ( size_t ) ( span - 1 - k ) * num_cols + dx;
+
+      for ( x = MAX_2 ( 0, -dx ); x < MIN_2 ( num_cols, num_cols - dx ); x++ )
+       {
+	col_k[x] += pair_k[x];
+       }
+     }
+   }
+ }
+}
+
+/* Prefix sums over the column offsets of every row of the band */
+static void
+calc_band_prefix ( const int num_cols, const int win_size, VoMeasure * meas )
+{
+ const int span = 2 * win_size - 1;
+ int slot, k, x;
+
+ for ( slot = 0; slot < win_size; slot++ )
+  {
+   const int64_t *col = meas->col + ( size_t ) slot * span * num_cols;
+   int64_t *prefix = meas->prefix + ( size_t ) slot * ( span + 1 ) * num_cols;
+
+   memset ( prefix, 0, num_cols * sizeof ( int64_t ) );
+   for ( k = 0; k < span; k++ )
+    {
+     const int64_t *col_k = col + ( size_t ) k * num_cols;
+     const int64_t *prev = prefix + ( size_t ) k * num_cols;
+     int64_t *next = prefix + ( size_t ) ( k + 1 ) * num_cols;
+
+     for ( x = 0; x < num_cols; x++ )
+      {
+       next[x] = prev[x] + col_k[x];
+      }
+    }
+  }
+}
+
+/* Aggregate measure of member ( Y, C + J ) of the windows centered at
+   ( *, C ), for C in [ HALF_WIN, NUM_COLS - HALF_WIN ) */
+static void
+calc_member_sums ( const int num_cols, const int win_size, const int y,
+		   const int j, const VoMeasure * meas, int64_t * sums )
+{
+ const int span = 2 * win_size - 1;
+ const int half_win = win_size / 2;
+ const int64_t *prefix = meas->prefix + ( size_t ) ( y % win_size ) * ( span + 1 ) * num_cols;
+ /* the window columns are the offsets [ -HALF_WIN - J, HALF_WIN - J ] */
+ const int64_t *hi = prefix + ( size_t ) ( 3 * half_win + 1 - j ) * num_cols + j;
+ const int64_t *lo = prefix + ( size_t ) ( half_win - j ) * num_cols + j;
+ int c;
+
+ for ( c = half_win; c < num_cols - half_win; c++ )
+  {
+   sums[c] = hi[c] - lo[c];
+  }
+}
+
+/* Frees the tables and clears the pointers, so it may be called again */
+static void
+free_measure ( VoMeasure * meas )
+{
+ free ( meas->pair );
+ free ( meas->col );
+ free ( meas->prefix );
+ meas->pair = NULL;
+ meas->col = NULL;
+ meas->prefix = NULL;
+}
+
+static int
+alloc_measure ( const int num_cols, const int win_size, VoMeasure * meas )
+{
+ size_t span = 2 * win_size - 1;
+
+ meas->pair = ( uint32_t * ) malloc ( win_size * win_size * span * num_cols *
+				      sizeof ( uint32_t ) );
+ meas->col = ( int64_t * ) malloc ( win_size * span * num_cols * sizeof ( int64_t ) );
+ meas->prefix = ( int64_t * ) malloc ( win_size * ( span + 1 ) * num_cols *
+				       sizeof ( int64_t ) );
+
+ if ( IS_NULL ( meas->pair ) || IS_NULL ( meas->col ) || IS_NULL ( meas->prefix ) )
+  {
+   free_measure ( meas );
+   return E_NOMEM;
+  }
+
+ return E_SUCCESS;
+}
+
+/** @endcond INTERNAL_FUNCTION */
+
+/**
+ * @brief Implements a family of vector order-statistic filters
+ *
+ * @param[in] in_img Image pointer { rgb }
+ * @param[in] win_size Dimension of the filtering window { positive-odd }
+ * @param[in] p_value Weight of the angles against the distances [ 0, 1 ]
+ *
+ * @return Pointer to the filtered image or NULL
+ *
+ * @note Each pixel is replaced by the window vector x_i that minimizes
+ *       ( sum_j || x_i - x_j || )^( 1 - P ) * ( sum_j A ( x_i, x_j ) )^P
+ *       where A is the angle between the vectors, i.e. the vector median
+ *       filter for P = 0, the basic vector directional filter for P = 1 and
+ *       the directional-distance filter for P = 0.5. Ties go to the first
+ *       vector in raster order. The pixels within WIN_SIZE / 2 of the
+ *       border are copied from the input.
+ *
+ *       Each distance and angle between two pixels is computed once, in
+ *       fixed point, and kept while both pixels are in the band of rows
+ *       under the window. For every pixel of the band the sums over each
+ *       column of the band are updated as the band moves down a row, and
+ *       prefix sums over the columns give the sum over any window in O(1).
+ *       The cost per pixel is O(WIN_SIZE^2) instead of the O(WIN_SIZE^4) of
+ *       the direct method, and since the sums are exact integers the
+ *       result is the same. Each thread handles a strip of rows.
+ * @see #filter_vmf
+ * @see #filter_bvdf
+ * @see #filter_ddf
+ *
+ * @author Damian Kusnik
+ */
+
+Image *
+filter_vector_order ( const Image * in_img, const int win_size,
+		      const double p_value )
+{
+ SET_FUNC_NAME ( "filter_vector_order" );
+ int num_rows, num_cols;
+ int half_win;
+ int fail = 0;
+ int use_dist, use_angle;
+ size_t ik, num_pixels;
+ byte *in_data;
+ byte ***out_data;
+ VoPlanes planes;
+ Image *out_img;
+
+ if ( !is_rgb_img ( in_img ) )
+  {
+   ERROR_RET ( "Not a color image !", NULL );
+  }
+
+ if ( !IS_POS_ODD ( win_size ) )
+  {
+   ERROR ( "Window size ( %d ) must be positive and odd !", win_size );
+   return NULL;
+  }
+
+ if ( !IS_IN_0_1 ( p_value ) )
+  {
+   ERROR ( "P value ( %f ) must be in [0,1] range !", p_value );
+   return NULL;
+  }
+
+ num_rows = get_num_rows ( in_img );
+ num_cols = get_num_cols ( in_img );
+ half_win = win_size / 2;
+
+ out_img = clone_img ( in_img );
+ if ( IS_NULL ( out_img ) )
+  {
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ if ( num_rows < win_size || num_cols < win_size )
+  {
+   /* every pixel is on the border */
+   return out_img;
+  }
+
+ num_pixels = ( size_t ) num_rows * num_cols;
+ planes.num_rows = num_rows;
+ planes.num_cols = num_cols;
+ planes.red = ( int * ) malloc ( 4 * num_pixels * sizeof ( int ) );
+ if ( IS_NULL ( planes.red ) )
+  {
+   free_img ( out_img );
+   free ( out_img );
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+ planes.green = planes.red + num_pixels;
+ planes.blue = planes.green + num_pixels;
+ planes.norm_sq = planes.blue + num_pixels;
+
+ in_data = ( byte * ) get_img_data_1d ( in_img );
+
+#pragma omp parallel for schedule(static)
+ for ( ik = 0; ik < num_pixels; ik++ )
+  {
+   const byte *pix = in_data + 3 * ik;
+
+   planes.red[ik] = pix[0];
+   planes.green[ik] = pix[1];
+   planes.blue[ik] = pix[2];
+   planes.norm_sq[ik] = pix[0] * pix[0] + pix[1] * pix[1] + pix[2] * pix[2];
+  }
+
+ use_dist = p_value < 1.0;
+ use_angle = p_value > 0.0;
+ out_data = ( byte *** ) get_img_data_nd ( out_img );
+
+#pragma omp parallel reduction(|:fail)
+ {
+  int num_out_rows = num_rows - 2 * half_win;
+  int num_threads = 1, thread_id = 0;
+  int y0, y1, yn;
+  VoMeasure dist, angle;
+  int64_t *sums_d, *sums_a, *best_sum;
+  double *best_score;
+  int *best_member;
+
+#ifdef _OPENMP
+  num_threads = omp_get_num_threads ( );
+  thread_id = omp_get_thread_num ( );
+#endif
+
+  /* contiguous strips of rows, so the band only moves down */
+  y0 = half_win + ( int ) ( ( int64_t ) num_out_rows * thread_id / num_threads );
+  y1 = half_win + ( int ) ( ( int64_t ) num_out_rows * ( thread_id + 1 ) / num_threads );
+
+  memset ( &dist, 0, sizeof ( dist ) );
+  memset ( &angle, 0, sizeof ( angle ) );
+  sums_d = ( int64_t * ) malloc ( 3 * num_cols * sizeof ( int64_t ) );
+  sums_a = IS_NULL ( sums_d ) ? NULL : sums_d + num_cols;
+  best_sum = IS_NULL ( sums_d ) ? NULL : sums_a + num_cols;
+  best_score = ( double * ) malloc ( num_cols * sizeof ( double ) );
+  best_member = ( int * ) malloc ( num_cols * sizeof ( int ) );
+
+  if ( IS_NULL ( sums_d ) || IS_NULL ( best_score ) || IS_NULL ( best_member ) ||
+       ( use_dist && alloc_measure ( num_cols, win_size, &dist ) != E_SUCCESS ) ||
+       ( use_angle && alloc_measure ( num_cols, win_size, &angle ) != E_SUCCESS ) )
+   {
+    fail = 1;
+   }
+
+  for ( yn = y0 - half_win; !fail && y0 < y1 && yn < y1 + half_win; yn++ )
+   {
+    int iy = yn - half_win;	/* output row, once the band is full */
+    int dy, j, c;
+
+    begin_timeline_event ( "row", iy );
+    if ( use_dist )
+     {
+      add_band_row ( &planes, win_size, y0 - half_win, yn, 0, &dist );
+     }
+    if ( use_angle )
+     {
+      add_band_row ( &planes, win_size, y0 - half_win, yn, 1, &angle );
+     }
+
+    if ( iy < y0 )
+     {
+      end_timeline_event (  );
+      continue;
+     }
+
+    if ( use_dist )
+     {
+      calc_band_prefix ( num_cols, win_size, &dist );
+     }
+    if ( use_angle )
+     {
+      calc_band_prefix ( num_cols, win_size, &angle );
+     }
+
+    for ( dy = -half_win; dy <= half_win; dy++ )
+     {
+      for ( j = -half_win; j <= half_win; j++ )
+       {
+	int member = ( dy + half_win ) * win_size + j + half_win;
+	int is_first = member == 0;
+
+	if ( use_dist )
+	 {
+	  calc_member_sums ( num_cols, win_size, iy + dy, j, &dist, sums_d );
+	 }
+	if ( use_angle )
+	 {
+	  calc_member_sums ( num_cols, win_size, iy + dy, j, &angle, sums_a );
+	 }
+
+	if ( !use_angle || !use_dist )
+	 {
+	  /* a single measure: compare the exact sums */
+	  const int64_t *sums = use_dist ? sums_d : sums_a;
+
+	  for ( c = half_win; c < num_cols - half_win; c++ )
+	   {
+	    if ( is_first || sums[c] < best_sum[c] )
+	     {
+	      best_sum[c] = sums[c];
+	      best_member[c] = member;
+	     }
+	   }
+	 }
+	else if ( p_value == 0.5 )
+	 {
+	  /* same order as the geometric mean, without the logarithms */
+	  for ( c = half_win; c < num_cols - half_win; c++ )
+	   {
+	    double score = ( double ) sums_d[c] * sums_a[c];
+
+	    if ( is_first || score < best_score[c] )
+	     {
+	      best_score[c] = score;
+	      best_member[c] = member;
+	     }
+	   }
+	 }
+	else
+	 {
+	  for ( c = half_win; c < num_cols - half_win; c++ )
+	   {
+	    double score = ( 1.0 - p_value ) * log ( ( double ) sums_d[c] ) +
+	     p_value * log ( ( double ) sums_a[c] );
+
+	    if ( is_first || score < best_score[c] )
+	     {
+	      best_score[c] = score;
+	      best_member[c] = member;
+	     }
+	   }
+	 }
+       }
+     }
+
+    for ( c = half_win; c < num_cols - half_win; c++ )
+     {
+      int src_y = iy + best_member[c] / win_size - half_win;
+      int src_x = c + best_member[c] % win_size - half_win;
+      const byte *src = in_data + 3 * ( ( size_t ) src_y * num_cols + src_x );
+
+      out_data[iy][c][0] = src[0];
+      out_data[iy][c][1] = src[1];
+      out_data[iy][c][2] = src[2];
+     }
+    end_timeline_event (  );
+   }
+
+  free_measure ( &dist );
+  free_measure ( &angle );
+  free ( sums_d );
+  free ( best_score );
+  free ( best_member );
+ }
+
+ free ( planes.red );
+
+ if ( fail )
+  {
+   free_img ( out_img );
+   free ( out_img );
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ return out_img;
+}
@@ -0,0 +1,29 @@
+/**
+ * @file filter_vmf.c
+ * Routines for vector median filtering
+ */
+
+#include "image.h"
+
+/**
+ * @brief Implements the Vector Median Filter
+ *
+ * @param[in] in_img Image pointer { rgb }
+ * @param[in] win_size Dimension of the filtering window { positive-odd }
+ *
+ * @return Pointer to the filtered image or NULL
+ *
+ * @note Each pixel is replaced by the window vector with the smallest sum of
+ *       Euclidean distances to the other vectors in the window.
+ * @ref Astola J., Haavisto P., and Neuvo Y. (1990) "Vector Median Filters,"
+ *      Proc. of the IEEE, 78(4): 678-689
+ * @see #filter_vector_order
+ *
+ * @author Damian Kusnik
+ */
+
+Image *
+filter_vmf ( const Image * in_img, const int win_size )
+{
+ return filter_vector_order ( in_img, win_size, 0.0 );
+}
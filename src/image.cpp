@@ -7,9 +7,6 @@
  */
 
 #include "image.h"
-extern "C" {
-#include "iqa.h"
-}
 static int alloc_img_data ( Image * img );
 
 /** 
@@ -1493,76 +1490,88 @@ Image* crop_img(const Image* in_img, int crop_size)
 	return out_img;
 }
 
-double* calculate_ssim(const Image* ref_img, const Image* test_img, FILE* fp)
+/* Prints the SSIM measures and returns them as { SSIM, MS_SSIM, MS_SSIM_AVG } */
+static double* report_ssim(const SsimMetrics* sm, FILE* fp)
 {
-	//first crop image 10 px each border (mostly a black window)
-	Image* ref_img_crop = crop_img(ref_img, 10);
-	Image* test_img_crop = crop_img(test_img, 10);
-	Image * ref_red, * ref_blue, * ref_green;
-	Image * test_red, * test_blue, * test_green;
-	int num_bands = get_num_bands(ref_img); 
-	double ms_ssim, ms_ssim_avg=0;
-	double* result = (double*)malloc(3 * sizeof(double));
+	double* result;
 
+	result = (double*)malloc(3 * sizeof(double));
+	result[0] = sm->ssim;
+	result[1] = sm->ms_ssim;
+	result[2] = sm->ms_ssim_avg;
 
-	int height = get_num_rows(ref_img_crop);
-	int width = get_num_cols(test_img_crop);
+	printf("SSIM: %f, MS_SSIM: %f, MS_SSIM_AVG: %f\n", result[0], result[1], result[2]);
 	
-	unsigned char* ref_data = (unsigned char*)get_img_data_1d(rgb_to_gray(ref_img_crop));
-	unsigned char* test_data = (unsigned char*)get_img_data_1d(rgb_to_gray(test_img_crop));
-
-	ms_ssim = iqa_ssim(ref_data, test_data, width, height, width, 0, NULL);
-	result[0] = ms_ssim;
-
-	ms_ssim = iqa_ms_ssim(ref_data, test_data, width, height, width, NULL);
-	//printf("\nMSSIM %f\n", ms_ssim);
-	result[1] = ms_ssim;
+	if (fp)
+		fprintf(fp, "SSIM: % f, MS_SSIM : % f, MS_SSIM_AVG : % f\n", result[0], result[1], result[2]);
 
-	//printf("SSIM %f\n", ms_ssim);
-	//printf("\n\n");
+	return result;
+}
 
-	if (num_bands > 1)
+double* calculate_ssim(const Image* ref_img, const Image* test_img, FILE* fp)
+{
+	SET_FUNC_NAME("calculate_ssim");
+	int crop_size = 10;
+	int side;
+	SsimMetrics sm;
+
+	//skip 10 px along each border (mostly a black window) and compare the
+	//largest square that is left
+	side = MIN_2(get_num_rows(ref_img), get_num_cols(ref_img)) - 2 * crop_size;
+	if (side <= 0)
 	{
+		ERROR_RET("Image is too small !", NULL);
+	}
 
-		get_rgb_bands(ref_img_crop, &ref_red, &ref_green, &ref_blue);
-		get_rgb_bands(test_img_crop, &test_red, &test_green, &test_blue);
-		//write_img(ref_blue, "red.pgm", FMT_PGM);
-		
-		ref_data = (unsigned char*) get_img_data_1d(ref_red);
-		test_data = (unsigned char*) get_img_data_1d(test_red);
-		ms_ssim = iqa_ms_ssim(ref_data, test_data, width, height, width, NULL);
-		ms_ssim_avg += ms_ssim;
-
-		ms_ssim = iqa_ms_ssim((unsigned char*)get_img_data_1d(ref_green),
-			(unsigned char*)get_img_data_1d(test_green), width, height, width, NULL);
-		ms_ssim_avg += ms_ssim;
-
-		ms_ssim = iqa_ms_ssim((unsigned char*)get_img_data_1d(ref_blue),
-			(unsigned char*)get_img_data_1d(test_blue), width, height, width, NULL);
-		ms_ssim_avg += ms_ssim;
-		
-		free_img(ref_red);
-		free_img(ref_green);
-		free_img(ref_blue);
-
-		free_img(test_red);
-		free_img(test_green);
-		free_img(test_blue);
-
-		result[2] = ms_ssim_avg / 3.0;
+	if (calc_ssim_metrics(ref_img, test_img, crop_size, crop_size, side, side, &sm) != E_SUCCESS)
+	{
+		return NULL;
 	}
-	else
+
+	return report_ssim(&sm, fp);
+}
+
+double* calculate_ssim_ref(const ReferenceStats* ref_stats, const Image* test_img, FILE* fp)
+{
+	SsimMetrics sm;
+
+	if (calc_ssim_metrics_ref(ref_stats, test_img, &sm) != E_SUCCESS)
 	{
-		result[2] = ms_ssim;
+		return NULL;
 	}
-	printf("SSIM: %f, MS_SSIM: %f, MS_SSIM_AVG: %f\n", result[0], result[1], result[2]);
-	//printf("SSIM: %f, MS_SSIM: %f, MS_SSIM_AVG: %f\n", 10.0 * log(1-result[0]) / log(10.0), log(1-result[1]), result[2]);
-	
-	if (fp)
-		fprintf(fp, "SSIM: % f, MS_SSIM : % f, MS_SSIM_AVG : % f\n", result[0], result[1], result[2]);
 
-	free_img(ref_img_crop);
-	free_img(test_img_crop);
+	return report_ssim(&sm, fp);
+}
+
+/* Prints the quality measures and returns them as { SNR, PSNR, RMSE, MAE, IRI } */
+static double* report_snr(QualityMetrics qm, FILE* fp)
+{
+	double* result;
+
+	if (qm.num_pixels > 0.0) {
+		printf("IRI: %f \n", qm.iri);
+		if (fp)
+			fprintf(fp, "IRI: %f \n", qm.iri);
+
+		if (qm.mse != 0.0) {
+			printf("SNR: %f, PSNR: %f, MSE: %f, MAE: %f, IRI: %f\n", qm.snr, qm.psnr, qm.rmse, qm.mae, qm.iri);
+			if(fp)
+				fprintf(fp,"SNR: %f, PSNR: %f, MSE: %f, MAE: %f, IRI: %f\n", qm.snr, qm.psnr, qm.rmse, qm.mae, qm.iri);
+		}
+		else {
+			printf("SNR: Invalid\n");
+			qm.snr = qm.psnr = qm.rmse = 0.0;
+		}
+	}
+	else {
+		printf("IRI: Invalid \n");
+	}
+    result = (double*) malloc(5*sizeof(double));
+    result[0]=qm.snr;
+    result[1]=qm.psnr;
+    result[2]=qm.rmse;
+    result[3]=qm.mae;
+	result[4] = qm.iri;
 	return result;
 }
 
@@ -1570,136 +1579,63 @@ double*
 calculate_snr(const Image* ref_img, const Image* test_img, FILE* fp)
 {
 	SET_FUNC_NAME("calculate_snr");
-	byte*** ref_data;
-	byte*** test_data;
-	long height, width, data_len;
-    double* result;
+	QualityMetrics qm;
 
 	if (!is_rgb_img(ref_img) || !is_rgb_img(test_img))
 	{
 		ERROR_RET("Not a color image !", NULL);
 	}
-	
-	height = get_num_rows(ref_img);
-	width = get_num_cols(ref_img);
-	data_len = width * height;
-
-	ref_data = (byte***)get_img_data_nd(ref_img);
-	test_data = (byte***)get_img_data_nd(test_img);
 
-	double mse = 0, mae = 0, es = 0, ms = 0, iri = 0;
-	long s1, t1;
-	double snr=0, psnr=0, rmse=0;
-	double N = 0;
 	//obcinamy krawedzie, zeby ich nei liczyl
-	for (int y = 10; y < height-10; y++) {
-		for (int x = 10; x < width-10; x++)
-		{
-			//s1 =  ipRef.getPixelValue(x, y);
-			for (int dim = 0; dim <= 2; dim++)
-			{
-				s1 = (long) ref_data[y][x][dim];
-				t1 = (long) test_data[y][x][dim];
-				mse += (s1 - t1) * (s1 - t1);
-				mae += abs((s1 - t1));
-				es += s1 * s1;
-				ms += s1;
-				N+=1;
-			}
-		}
+	if (calc_quality_metrics(ref_img, test_img, 10, &qm) != E_SUCCESS)
+	{
+		return NULL;
 	}
-	if (N > 0.0) {
-		mse /= N;
-		mae /= N;
-		es /= N;
-		ms /= N;
-		iri= calculate_iri(ref_img, test_img, fp);
-
-		if (mse != 0.0) {
-			snr = 10.0 * log(es / mse) / log(10.0);
-			psnr = 10.0 * log(255.0 * 255.0 / mse) / log(10.0);
-			rmse = sqrt(mse);
-			printf("SNR: %f, PSNR: %f, MSE: %f, MAE: %f, IRI: %f\n", snr, psnr, rmse, mae, iri);
-			if(fp)
-				fprintf(fp,"SNR: %f, PSNR: %f, MSE: %f, MAE: %f, IRI: %f\n", snr, psnr, rmse, mae, iri);
-		}
-		else {
-			printf("SNR: Invalid\n");
 
-		}
+	return report_snr(qm, fp);
+}
+
+double*
+calculate_snr_ref(const ReferenceStats* ref_stats, const Image* test_img, FILE* fp)
+{
+	QualityMetrics qm;
+
+	if (calc_quality_metrics_ref(ref_stats, test_img, &qm) != E_SUCCESS)
+	{
+		return NULL;
 	}
-    result = (double*) malloc(5*sizeof(double));
-    result[0]=snr;
-    result[1]=psnr;
-    result[2]=rmse;
-    result[3]=mae;
-	result[4] = iri;
-	return result;
+
+	return report_snr(qm, fp);
 }
 
 double
 calculate_iri(const Image* ref_img, const Image* test_img, FILE* fp)
 {
 	SET_FUNC_NAME("calculate_iri");
-	byte*** ref_data;
-	byte*** test_data;
-	long height, width, data_len;
+	QualityMetrics qm;
 
 	if (!is_rgb_img(ref_img) || !is_rgb_img(test_img))
 	{
-		ERROR_RET("Not a color image !", NULL);
+		ERROR_RET("Not a color image !", 0.0);
 	}
 
-	height = get_num_rows(ref_img);
-	width = get_num_cols(ref_img);
-	data_len = width * height;
-
-	ref_data = (byte***)get_img_data_nd(ref_img);
-	test_data = (byte***)get_img_data_nd(test_img);
-
-	double iri = 0;
-	long s1, t1, diff, min;
-	double N = 0;
 	//obcinamy krawedzie, zeby ich nei liczyl
-	for (int y = 10; y < height-10; y++) {
-		for (int x = 10; x < width-10; x++)
-		{
-			//s1 =  ipRef.getPixelValue(x, y);
-			min = LONG_MAX;
-			for (int i=-1; i<1; i++)
-				for (int j =-1; j < 1; j++)
-				{
-					diff = 0;
-					for (int dim = 0; dim < 3; dim++)
-					{
-						s1 = (long)ref_data[y+i][x+j][dim];
-						t1 = (long)test_data[y][x][dim];
-						diff+=(s1 - t1)* (s1 - t1);
-						
-					}
-					if (diff < min)
-					{
-						min = diff;
-					}
-					
-				}
-			N += 1;
-			iri += min;
-		}
+	if (calc_quality_metrics(ref_img, test_img, 10, &qm) != E_SUCCESS)
+	{
+		return 0.0;
 	}
-	if (N > 0.0) {
-		iri /= (double)N;
-		iri = 10.0 * log(255.0 * 255.0 / iri) / log(10.0);
-		printf("IRI: %f \n", iri);
+
+	if (qm.num_pixels > 0.0) {
+		printf("IRI: %f \n", qm.iri);
 		if (fp)
-			fprintf(fp, "IRI: %f \n", iri);
+			fprintf(fp, "IRI: %f \n", qm.iri);
 	}
 	else 
 	{
 			printf("IRI: Invalid \n");
 	}
 	
-	return iri;
+	return qm.iri;
 }
 
 
@@ -1710,11 +1646,8 @@ float square(float var)
 
 #define INF 1E20
 
-/* dt of 1d function using squared distance */
-static float* dt(float* f, int n) {
-	float* d = (float*) malloc(sizeof(float)*n);
-	int* v = (int*)malloc(sizeof(int) * n);
-	float* z = (float*)malloc(sizeof(float) * (n+1));
+/* dt of 1d function using squared distance; V and Z are scratch of N and N+1 */
+static void dt(const float* f, float* d, int* v, float* z, int n) {
 	int k = 0;
 	v[0] = 0;
 	z[0] = -INF;
@@ -1737,163 +1670,372 @@ static float* dt(float* f, int n) {
 			k++;
 		d[q] = square(q - v[k]) + f[v[k]];
 	}
-
-	free(v);
-	free(z);
-	return d;
 }
 
-/* dt of 2d function using squared distance */
-Image* dt(byte** in_img_data, int width, int height, int on) {
-	Image* out_img = alloc_img(PIX_DBL_1B, height, width);
-	double** out_data = (double**)get_img_data_nd(out_img);
+/* dt of 2d function using squared distance, returns the distances clamped to a byte */
+static Image* dt(byte** in_img_data, int width, int height, int on) {
+	SET_FUNC_NAME("dt");
+	int len = MAX_2(width, height);
+	int failed = 0;
+	float* sq_dist;
+	Image* out_img;
+
+	out_img = alloc_img(PIX_GRAY, height, width);
+	sq_dist = (float*)malloc(sizeof(float) * width * height);
+	if (IS_NULL(out_img) || IS_NULL(sq_dist)) {
+		free(sq_dist);
+		if (!IS_NULL(out_img)) {
+			free_img(out_img);
+			free(out_img);
+		}
+		ERROR_RET("Insufficient memory !", NULL);
+	}
+
 	for (int y = 0; y < height; y++) {
 		for (int x = 0; x < width; x++) {
-			if (in_img_data[y][x] == on)
-				out_data[y][x] = 0;
-			else
-				out_data[y][x] = INF;
+			sq_dist[y * width + x] = (in_img_data[y][x] == on) ? 0 : INF;
 		}
 	}
-	float* f;
-	if (width > height)
-		f = (float*)malloc(sizeof(float) * width);
-	else
-		f = (float*)malloc(sizeof(float) * height);
 
-	// transform along columns
-	for (int x = 0; x < width; x++) {
-		for (int y = 0; y < height; y++) {
-			f[y] = out_data[y][x];
-		}
-		float* d = dt(f, height);
-		for (int y = 0; y < height; y++) {
-			out_data[y][x] = d[y];
+	/* every thread allocates its scratch once and reuses it for all its lines */
+#pragma omp parallel
+	{
+		float* f = (float*)malloc(sizeof(float) * len);
+		float* d = (float*)malloc(sizeof(float) * len);
+		int* v = (int*)malloc(sizeof(int) * len);
+		float* z = (float*)malloc(sizeof(float) * (len + 1));
+		int ok = !IS_NULL(f) && !IS_NULL(d) && !IS_NULL(v) && !IS_NULL(z);
+
+		if (!ok) {
+#pragma omp atomic
+			failed++;
 		}
-		free(d);
-	}
-	
-	// transform along rows
-	for (int y = 0; y < height; y++) {
+
+		// transform along columns
+#pragma omp for schedule(static)
 		for (int x = 0; x < width; x++) {
-			f[x] = out_data[y][x];
+			if (!ok)
+				continue;
+			for (int y = 0; y < height; y++) {
+				f[y] = sq_dist[y * width + x];
+			}
+			dt(f, d, v, z, height);
+			for (int y = 0; y < height; y++) {
+				sq_dist[y * width + x] = d[y];
+			}
 		}
-		float* d = dt(f, width);
-		for (int x = 0; x < width; x++) {
-			out_data[y][x] = d[x];
+
+		// transform along rows
+#pragma omp for schedule(static)
+		for (int y = 0; y < height; y++) {
+			float* row = sq_dist + y * width;
+			byte* out_row = ((byte**)get_img_data_nd(out_img))[y];
+
+			if (!ok)
+				continue;
+			dt(row, d, v, z, width);
+			for (int x = 0; x < width; x++) {
+				out_row[x] = (d[x] < MAX_GRAY * MAX_GRAY) ? (byte)sqrt(d[x]) : MAX_GRAY;
+			}
 		}
+
+		free(f);
 		free(d);
+		free(v);
+		free(z);
 	}
-	
-	free(f);
-	Image* out_img2 = alloc_img(PIX_GRAY, height, width);
-	byte** out_data2 = (byte**)get_img_data_nd(out_img2);
-	int max = 0;
-	for (int y = 0; y < height; y++) {
-		for (int x = 0; x < width; x++) {
-			if (out_data[y][x] > max)
-				max = out_data[y][x];
-		}
+
+	free(sq_dist);
+	if (failed) {
+		free_img(out_img);
+		free(out_img);
+		ERROR_RET("Insufficient memory !", NULL);
 	}
-	for (int y = 0; y < height; y++) {
-		for (int x = 0; x < width; x++) {
-			out_data2[y][x] = (byte)(sqrt(out_data[y][x]));
-		}
+
+	return out_img;
+}
+
+/* Writes IMG to PREFIX followed by NAME, for inspecting the steps of calc_prat */
+static void
+write_prat_debug(const Image* img, const char* prefix, const char* name)
+{
+	char* file_name = (char*)malloc(strlen(prefix) + strlen(name) + 1);
+
+	if (!IS_NULL(file_name)) {
+		sprintf(file_name, "%s%s", prefix, name);
+		write_img(img, file_name, FMT_PGM);
+		free(file_name);
 	}
-	return out_img2;
 }
 
 /** 
- * @brief Checks whether or not the object is a binary image
+ * @brief Finds the edges compared by Pratt's figure of merit
  *
- * @param[in] ref_img Reference Image pointer
- * @param[in] test_img Test Image pointer
+ * @param[in] img Image { rgb }
+ * @param[in] debug_prefix Path prefix of the maps to save, or NULL
+ * @param[in] tag Name of the image in the saved file names
+ * @param[out] num_edges Number of edge pixels
  *
- * @return prat value
+ * @return Pointer to the edge map of the cropped image { grayscale } or NULL
+ *
+ * @note The image is cropped by 10 pixels (mostly a black window) and its
+ *       VR edge magnitudes are thresholded at 20; edge pixels are 255.
  *
  * @author D. Kusnik
- * @date 10.10.2020
  */
 
-
-#ifdef CUDA
-double
-calculate_prat(const Image* ref_img, const Image* test_img)
+Image*
+detect_prat_edges(const Image* img, const char* debug_prefix, const char* tag, int* num_edges)
 {
+	SET_FUNC_NAME("detect_prat_edges");
+	int height, width;
+	int count = 0;
+	byte** data;
+	Image* img_crop;
+	Image* edge_img;
+	char name[64];
+
+	if (!is_rgb_img(img))
+	{
+		ERROR_RET("Not a color image !", NULL);
+	}
+
 	//first crop image 10 px each border (mostly a black window)
-	Image* ref_img_crop = crop_img(ref_img, 10);
-	Image* test_img_crop = crop_img(test_img, 10);
-	double result=0;
-	byte** ref_data;
-	byte** test_data;
-
-	int height = get_num_rows(ref_img_crop);
-	int width = get_num_cols(test_img_crop);
-	int count_test = 0, count_ref = 0;
-
-	Image* edge_ref_img = detect_edge_VR(ref_img_crop, 100);
-	Image* edge_test_img = detect_edge_VR(test_img_crop, 100);
-	
-	/*Image* edge_ref_img = detect_edge_canny(rgb_to_gray(ref_img_crop), 1, 0.89, 0.9);
-	Image* edge_test_img = detect_edge_canny(rgb_to_gray(test_img_crop), 1, 0.89, 0.9);
-	*/
-	//write_img(rgb_to_gray(ref_img_crop), "gray_oryginal.pbm", FMT_PGM);
+	img_crop = crop_img(img, 10);
+	if (IS_NULL(img_crop))
+		return NULL;
 
+	edge_img = detect_edge_VR(img_crop, 100);
+	free_img(img_crop);
+	free(img_crop);
+	if (IS_NULL(edge_img))
+		return NULL;
 
-	ref_data = (byte**)get_img_data_nd(edge_ref_img);
-	test_data = (byte**)get_img_data_nd(edge_test_img);
+	if (debug_prefix) {
+		sprintf(name, "gradient_%.40s.pbm", tag);
+		write_prat_debug(edge_img, debug_prefix, name);
+	}
 
-	/********************************/
-	write_img(edge_ref_img, "gradient_oryginal.pbm", FMT_PGM);
-	write_img(edge_test_img, "gradient_test.pbm", FMT_PGM);
+	height = get_num_rows(edge_img);
+	width = get_num_cols(edge_img);
+	data = (byte**)get_img_data_nd(edge_img);
 
 	//THRESHOLD 
+#pragma omp parallel for schedule(static) reduction(+:count)
 	for (int y = 0; y < height; y++) {
 		for (int x = 0; x < width; x++)
 		{
-			if (ref_data[y][x] < 20)
-				ref_data[y][x] = 0;
-			else
-				ref_data[y][x] = 255;
-
-			if (test_data[y][x] < 20)
-				test_data[y][x] = 0;
-			else
-				test_data[y][x] = 255;
+			data[y][x] = (data[y][x] < 20) ? 0 : 255;
+			count += (data[y][x] != 0);
 		}
 	}
 
-	write_img(edge_ref_img, "edge_oryginal.pbm", FMT_PGM);
-	write_img(edge_test_img, "edge_test.pbm", FMT_PGM);
+	if (debug_prefix) {
+		sprintf(name, "edge_%.40s.pbm", tag);
+		write_prat_debug(edge_img, debug_prefix, name);
+	}
 
+	*num_edges = count;
+	return edge_img;
+}
 
-	Image* df_ref_img = dt(ref_data, width, height, 255);
-	Image* df_test_img = dt(test_data, width, height, 255);
+/* Scores the edges of TEST_IMG against the reference edge map REF_EDGE_IMG */
+static double
+eval_prat(const Image* ref_edge_img, const int num_ref_edges,
+	  const Image* test_img, const char* debug_prefix)
+{
+	double result = -1.0;
+	double sum = 0.0;
+	int num_test_edges = 0;
+	Image* edge_test_img;
+	Image* df_test_img = NULL;
+
+	edge_test_img = detect_prat_edges(test_img, debug_prefix, "test", &num_test_edges);
+	if (!IS_NULL(edge_test_img))
+		df_test_img = dt((byte**)get_img_data_nd(edge_test_img),
+				 get_num_cols(edge_test_img), get_num_rows(edge_test_img), 255);
+
+	if (!IS_NULL(df_test_img))
+	{
+		int height = get_num_rows(df_test_img);
+		int width = get_num_cols(df_test_img);
+		byte** ref_data = (byte**)get_img_data_nd(ref_edge_img);
+		byte** test_data = (byte**)get_img_data_nd(df_test_img);
 
-	write_img(df_ref_img, "edge_oryginal_dt.pgm", FMT_PGM);
-	write_img(df_test_img, "edge_test_dt.pgm", FMT_PGM);
-	/********************************/
-	ref_data = (byte**)get_img_data_nd(df_ref_img);
-	test_data = (byte**)get_img_data_nd(df_test_img);
+		if (debug_prefix)
+			write_prat_debug(df_test_img, debug_prefix, "edge_test_dt.pgm");
 
-	for (int y = 0; y < height; y++) {
-		for (int x = 0; x < width; x++)
-		{
-			if (ref_data[y][x] == 0)
+		/* the distance to the nearest reference edge is 0 exactly on the edges */
+#pragma omp parallel for schedule(static) reduction(+:sum)
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++)
 			{
-				result += 1.0 / (1 + test_data[y][x] / 9);
-				count_ref++;
+				if (ref_data[y][x] != 0)
+					sum += 1.0 / (1 + test_data[y][x] / 9);
 			}
-			if (test_data[y][x] == 0)
-				count_test++;	
-			//if (test_data[y][x] > 0)
+		}
+
+		result = sum / MAX_2(num_ref_edges, num_test_edges);
+	}
+
+	if (!IS_NULL(edge_test_img)) {
+		free_img(edge_test_img);
+		free(edge_test_img);
+	}
+	if (!IS_NULL(df_test_img)) {
+		free_img(df_test_img);
+		free(df_test_img);
+	}
+
+	return result;
+}
+
+/** 
+ * @brief Calculates Pratt's figure of merit of the edges of a test image
+ *
+ * @param[in] ref_img Reference image { rgb }
+ * @param[in] test_img Test image { rgb }
+ * @param[in] debug_prefix Path prefix of the intermediate maps to save, or NULL
+ *
+ * @return Pratt's figure of merit [ 0, 1 ] or -1.0 on error
+ *
+ * @note Both images are cropped by 10 pixels (mostly a black window), their
+ *       VR edge magnitudes are thresholded at 20, and the distance transform
+ *       of the test edge map is taken. Every reference edge pixel then scores
+ *       1 / ( 1 + d / 9 ), d being the integer distance to the nearest test
+ *       edge, and the sum is normalized by the larger edge count. If
+ *       DEBUG_PREFIX is given the gradient, edge, and distance maps are
+ *       written with it as PGM files.
+ * @see #calculate_prat
+ * @see #calc_prat_ref
+ *
+ * @author D. Kusnik
+ * @date 10.10.2020
+ */
+
+double
+calc_prat(const Image* ref_img, const Image* test_img, const char* debug_prefix)
+{
+	SET_FUNC_NAME("calc_prat");
+	double result;
+	int num_ref_edges;
+	Image* edge_ref_img;
+
+	if (!is_rgb_img(ref_img) || !is_rgb_img(test_img))
+	{
+		ERROR_RET("Not a color image !", -1.0);
+	}
+
+	if (get_num_rows(ref_img) != get_num_rows(test_img) ||
+	    get_num_cols(ref_img) != get_num_cols(test_img))
+	{
+		ERROR_RET("Image dimensions must be equal !", -1.0);
+	}
+
+	begin_perf_stage(PERF_STAGE_METRICS);
+	edge_ref_img = detect_prat_edges(ref_img, debug_prefix, "oryginal", &num_ref_edges);
+	if (IS_NULL(edge_ref_img))
+	{
+		end_perf_stage(PERF_STAGE_METRICS);
+		return -1.0;
+	}
+
+	if (debug_prefix) {
+		Image* df_ref_img = dt((byte**)get_img_data_nd(edge_ref_img),
+				       get_num_cols(edge_ref_img), get_num_rows(edge_ref_img), 255);
+
+		if (!IS_NULL(df_ref_img)) {
+			write_prat_debug(df_ref_img, debug_prefix, "edge_oryginal_dt.pgm");
+			free_img(df_ref_img);
+			free(df_ref_img);
 		}
 	}
+
+	result = eval_prat(edge_ref_img, num_ref_edges, test_img, debug_prefix);
+
+	free_img(edge_ref_img);
 	free(edge_ref_img);
-	free(edge_test_img);
-	if (count_ref > count_test)
-		return result / count_ref;
-	return result / count_test;
+	end_perf_stage(PERF_STAGE_METRICS);
+
+	return result;
+}
+
+/** 
+ * @brief Calculates Pratt's figure of merit of the edges of a test image
+ *
+ * @param[in] ref_img Reference image { rgb }
+ * @param[in] test_img Test image { rgb }
+ *
+ * @return Pratt's figure of merit [ 0, 1 ] or -1.0 on error
+ *
+ * @see #calc_prat
+ *
+ * @author D. Kusnik
+ * @date 10.10.2020
+ */
+
+double
+calculate_prat(const Image* ref_img, const Image* test_img)
+{
+	return calc_prat(ref_img, test_img, NULL);
+}
+
+/** 
+ * @brief Calculates Pratt's figure of merit against precomputed reference edges
+ *
+ * @param[in] ref_stats Reference statistics
+ * @param[in] test_img Test image { rgb }
+ * @param[in] debug_prefix Path prefix of the test maps to save, or NULL
+ *
+ * @return Pratt's figure of merit [ 0, 1 ] or -1.0 on error
+ *
+ * @note The result equals that of calc_prat; only the test image is
+ *       processed.
+ * @see #calc_prat
+ * @see #alloc_ref_stats
+ *
+ * @author D. Kusnik
+ */
+
+double
+calc_prat_ref(const ReferenceStats* ref_stats, const Image* test_img, const char* debug_prefix)
+{
+	SET_FUNC_NAME("calc_prat_ref");
+	double result;
+
+	if (IS_NULL(ref_stats) || IS_NULL(ref_stats->edge_img))
+	{
+		ERROR_RET("Invalid reference statistics !", -1.0);
+	}
+
+	if (get_num_rows(ref_stats->ref_img) != get_num_rows(test_img) ||
+	    get_num_cols(ref_stats->ref_img) != get_num_cols(test_img))
+	{
+		ERROR_RET("Image dimensions must be equal !", -1.0);
+	}
+
+	begin_perf_stage(PERF_STAGE_METRICS);
+	result = eval_prat(ref_stats->edge_img, ref_stats->num_edges, test_img, debug_prefix);
+	end_perf_stage(PERF_STAGE_METRICS);
+
+	return result;
 }
 
-#endif
+/** 
+ * @brief Calculates Pratt's figure of merit against precomputed reference edges
+ *
+ * @param[in] ref_stats Reference statistics
+ * @param[in] test_img Test image { rgb }
+ *
+ * @return Pratt's figure of merit [ 0, 1 ] or -1.0 on error
+ *
+ * @see #calc_prat_ref
+ *
+ * @author D. Kusnik
+ */
+
+double
+calculate_prat_ref(const ReferenceStats* ref_stats, const Image* test_img)
+{
+	return calc_prat_ref(ref_stats, test_img, NULL);
+}
@@ -151,6 +151,16 @@ get_img_format ( FILE * file_ptr, ImageFormat * img_format )
      }
     break;
 
+   case 'R':			/* RTI 26 */
+
+    if ( magic[1] == 'T' &&
+	 fgetc ( file_ptr ) == 'I' && fgetc ( file_ptr ) == 26 )
+     {
+      *img_format = FMT_RTI;
+      return E_SUCCESS;
+     }
+    break;
+
    case 137:			/* 137 80 78 71 13 10 26 10 */
 
     if ( magic[1] == 80 &&
@@ -215,6 +225,8 @@ img_format_str ( const ImageFormat img_format )
     return "PSD";
    case FMT_RAS:
     return "RAS";
+   case FMT_RTI:
+    return "RTI";
    case FMT_TGA:
     return "TGA";
    case FMT_TIFF:
@@ -22,29 +22,63 @@
 #include "png.h"
 #include "image.h"
 
-Image *read_png_file(FILE *fp)
+/**
+ * @brief Reads a PNG file row by row directly into an RGB image
+ *
+ * @param[in,out] fp File pointer
+ * @param[in] row_func Function called after each final row is decoded or NULL
+ * @param[in] user_data Pointer passed unchanged to row_func
+ *
+ * @return Pointer to the image or NULL
+ *
+ * @note Any color type or bit depth is converted to 8-bit RGB; alpha is
+ *       stripped and no scratch rows are allocated, libpng writes straight
+ *       into the rows of the image. For interlaced files row_func is called
+ *       during the last pass only, when the rows are complete.
+ *
+ * @author Damian Kusnik
+ */
+
+Image *read_png_file_progressive(FILE *fp,
+                                 void (*row_func)(const Image *img, const int row, void *user_data),
+                                 void *user_data)
 {
-  int x, y;
+  SET_FUNC_NAME("read_png_file_progressive");
+  int y, pass, num_passes;
   int width, height;
   png_byte color_type;
   png_byte bit_depth;
-  png_bytep *row_pointers;
   png_infop info;
   png_structp png;
 
-  Image *img_fourier;
+  Image *volatile img = NULL;
   byte ***data;
 
+  if (IS_NULL(fp))
+  {
+    ERROR_RET("Invalid file pointer !", NULL);
+  }
+
   png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
   if (!png)
-    abort();
+  {
+    ERROR_RET("Insufficient memory !", NULL);
+  }
 
   info = png_create_info_struct(png);
   if (!info)
-    abort();
+  {
+    png_destroy_read_struct(&png, NULL, NULL);
+    ERROR_RET("Insufficient memory !", NULL);
+  }
 
   if (setjmp(png_jmpbuf(png)))
-    abort();
+  {
+    png_destroy_read_struct(&png, &info, NULL);
+    free_img(img);
+    free(img);
+    ERROR_RET("Cannot decode PNG data !", NULL);
+  }
 
   png_init_io(png, fp);
 
@@ -55,7 +89,7 @@ Image *read_png_file(FILE *fp)
   color_type = png_get_color_type(png, info);
   bit_depth = png_get_bit_depth(png, info);
 
-  /* Read any color_type into 8bit depth, RGBA format.
+  /* Read any color_type into 8bit depth, RGB format.
    * See http://www.libpng.org/pub/png/libpng-manual.txt
    */
 
@@ -69,140 +103,147 @@ Image *read_png_file(FILE *fp)
   if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8)
     png_set_expand_gray_1_2_4_to_8(png);
 
-  if (png_get_valid(png, info, PNG_INFO_tRNS))
-    png_set_tRNS_to_alpha(png);
-
-  /*
-  // These color_type don't have an alpha channel then fill it with 0xff.
-  */
-  if (color_type == PNG_COLOR_TYPE_RGB ||
-      color_type == PNG_COLOR_TYPE_GRAY ||
-      color_type == PNG_COLOR_TYPE_PALETTE)
-    png_set_filler(png, 0xFF, PNG_FILLER_AFTER);
-
-  /*  png_set_filler(png, 0xFF, PNG_FILLER_AFTER);*/
+  /* The image has no alpha band, so drop it instead of expanding tRNS */
+  if (color_type & PNG_COLOR_MASK_ALPHA)
+    png_set_strip_alpha(png);
 
   if (color_type == PNG_COLOR_TYPE_GRAY ||
       color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
     png_set_gray_to_rgb(png);
 
+  num_passes = png_set_interlace_handling(png);
+
   png_read_update_info(png, info);
 
-  row_pointers = (png_bytep *)malloc(sizeof(png_bytep) * height);
-  for (y = 0; y < height; y++)
-  {
-    row_pointers[y] = (png_byte *)malloc(png_get_rowbytes(png, info));
-  }
+  if (png_get_rowbytes(png, info) != (png_size_t)(3 * width))
+    png_error(png, "unexpected row size");
 
-  png_read_image(png, row_pointers);
+  /* alloc_img sizes the RGB image in an int */
+  if ((size_t)height * width * 3 > INT_MAX)
+    png_error(png, "image too large");
 
-  img_fourier = alloc_img(PIX_RGB, height, width);
-  data = (byte***)get_img_data_nd(img_fourier);
+  img = alloc_img(PIX_RGB, height, width);
+  if (IS_NULL(img))
+    png_error(png, "insufficient memory");
+  data = (byte ***)get_img_data_nd(img);
 
-  for (y = 0; y < height; y++)
+  for (pass = 0; pass < num_passes; pass++)
   {
-    png_bytep row = row_pointers[y];
-    for (x = 0; x < width; x++)
+    for (y = 0; y < height; y++)
     {
-      /* this is a pointer to unsigned char */
-      png_bytep px = &(row[x * 4]);
-      data[y][x][0] = px[0];
-      data[y][x][1] = px[1];
-      data[y][x][2] = px[2];
+      /* the rows of an RGB image are contiguous, 3 bytes per pixel */
+      png_read_row(png, (png_bytep)data[y][0], NULL);
+      if (row_func && pass == num_passes - 1)
+        row_func(img, y, user_data);
     }
   }
-  //fclose(fp);
-  for (y = 0; y < height; y++)
-  {
-    free(row_pointers[y]);
-  }
-  free(row_pointers);
 
+  png_read_end(png, NULL);
   png_destroy_read_struct(&png, &info, NULL);
-  png = NULL;
-  info = NULL;
 
-  return img_fourier;
+  return img;
 }
 
-int write_png_file(const Image* _img, FILE* fp)
+Image *read_png_file(FILE *fp)
 {
-  int x, y;
-  int width = _img->num_cols; 
-  int height = _img->num_rows;
+  return read_png_file_progressive(fp, NULL, NULL);
+}
 
-  //png_byte bit_depth;
-  //png_byte color_type;
-  png_bytep *row_pointers;
-  byte ***data = (byte ***) get_img_data_nd(_img);
+/**
+ * @brief Writes an image to a PNG file
+ *
+ * @param[in] img Image pointer { grayscale, rgb }
+ * @param[in,out] fp File pointer
+ * @param[in] params Compression parameters or NULL for the libpng defaults
+ *
+ * @return 0 on success, 1 otherwise
+ *
+ * @note Rows are passed to libpng straight from the image storage.
+ *
+ * @author Damian Kusnik
+ */
 
+int write_png_file_params(const Image* img, FILE* fp, const EncodeParams* params)
+{
+  int y;
+  int width, height;
+  int color_type;
   png_structp png;
   png_infop info;
+
   if (!fp)
 	  return 1;
 
+  if (params && (params->num_threads == ENC_THREADS_ALL || params->num_threads > 1))
+	  return write_png_file_parallel(img, fp, params) != E_SUCCESS;
+
+  if (is_rgb_img(img))
+	  color_type = PNG_COLOR_TYPE_RGB;
+  else if (is_gray_img(img))
+	  color_type = PNG_COLOR_TYPE_GRAY;
+  else
+	  return 1;
+
+  width = get_num_cols(img);
+  height = get_num_rows(img);
+
   png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
   if (!png)
 	  return 1;
 
   info = png_create_info_struct(png);
   if (!info)
+  {
+	  png_destroy_write_struct(&png, NULL);
 	  return 1;
+  }
 
   if (setjmp(png_jmpbuf(png)))
+  {
+	  png_destroy_write_struct(&png, &info);
 	  return 1;
+  }
 
   png_init_io(png, fp);
 
-  /* Output is 8bit depth, RGBA format. */
+  if (params)
+  {
+	  if (params->level >= 0)
+		  png_set_compression_level(png, MIN_2(params->level, 9));
+	  if (params->filters)
+		  png_set_filter(png, PNG_FILTER_TYPE_BASE, params->filters & PNG_ALL_FILTERS);
+	  if (params->strategy != ENC_STRATEGY_DEFAULT)
+		  png_set_compression_strategy(png, params->strategy);
+  }
+
+  /* Output is 8bit depth, RGB or gray format. */
   png_set_IHDR(
       png,
       info,
       width, height,
       8,
-      PNG_COLOR_TYPE_RGB,
+      color_type,
       PNG_INTERLACE_NONE,
       PNG_COMPRESSION_TYPE_DEFAULT,
       PNG_FILTER_TYPE_DEFAULT);
   png_write_info(png, info);
 
-  /* To remove the alpha channel for PNG_COLOR_TYPE_RGB format,
-   * Use png_set_filler().
-   */
-  png_set_filler(png, 0, PNG_FILLER_AFTER);
-
-  row_pointers = (png_bytep *)malloc(sizeof(png_bytep) * height);
-  for (y = 0; y < height; y++)
-  {
-    row_pointers[y] = (png_byte *)malloc(sizeof(png_byte) * width * 4);
-    //row_pointers[y] = (png_byte *)malloc(png_get_rowbytes(png, info));
-
-  }
+  /* image rows are contiguous, 1 or 3 bytes per pixel, as PNG expects */
   for (y = 0; y < height; y++)
   {
-    png_bytep row = row_pointers[y];
-    for (x = 0; x < width; x++)
-    {
-      png_bytep px = &(row[x*4]);
-      px[0] = data[y][x][0];
-      px[1] = data[y][x][1];
-      px[2] = data[y][x][2];
-    }
+    if (color_type == PNG_COLOR_TYPE_RGB)
+      png_write_row(png, (png_const_bytep)img->data_nd.byte_data_3b[y][0]);
+    else
+      png_write_row(png, (png_const_bytep)img->data_nd.byte_data_1b[y]);
   }
 
-  png_write_image(png, row_pointers);
-
   png_write_end(png, NULL);
 
-  for (y = 0; y < height; y++)
-  {
-    free(row_pointers[y]);
-  }
-  free(row_pointers);
-
-  //fclose(fp);
-  if (png && info)
-    png_destroy_write_struct(&png, &info);
+  png_destroy_write_struct(&png, &info);
   return 0;
 }
 
+int write_png_file(const Image* _img, FILE* fp)
+{
+  return write_png_file_params(_img, fp, NULL);
+}
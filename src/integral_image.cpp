@@ -0,0 +1,261 @@
+/**
+ * @file integral_image.c
+ * Routines for summed-area tables and local window statistics
+ */
+
+#include "image.h"
+
+#define INT_IMG_COL_CHUNK 1024	/* table columns per task of the column pass */
+
+#define INT_IMG_MAX_EXACT ( 1 << 23 )	/* larger windows overflow count^2 * 255^2 */
+
+/** @cond INTERNAL_FUNCTION */
+
+/* Turns the row prefix sums in TABLE into 2-D sums by adding each row to
+   the one below it */
+static void
+accumulate_cols ( int64_t * table, const int num_rows, const int row_len )
+{
+ int ix;
+
+#pragma omp parallel for schedule(static)
+ for ( ix = 0; ix < row_len; ix += INT_IMG_COL_CHUNK )
+  {
+   int chunk = MIN_2 ( INT_IMG_COL_CHUNK, row_len - ix );
+   int iy, ik;
+
+   for ( iy = 1; iy < num_rows; iy++ )
+    {
+     int64_t *cur = table + ( size_t ) iy * row_len + ix;
+     const int64_t *prev = cur - row_len;
+
+#pragma omp simd
+     for ( ik = 0; ik < chunk; ik++ )
+      {
+       cur[ik] += prev[ik];
+      }
+    }
+  }
+}
+
+/** @endcond INTERNAL_FUNCTION */
+
+/**
+ * @brief Computes the summed-area tables of an image
+ *
+ * @param[in] img Image pointer { grayscale, rgb }
+ * @param[in] with_squares Whether to also sum the squared samples (needed
+ *                         for variances) { 0, 1 }
+ *
+ * @return Pointer to the tables or NULL
+ *
+ * @note Entry ( Y, X ) of each table holds the sum over rows 0 .. Y - 1 and
+ *       columns 0 .. X - 1, so any window sum takes 4 lookups. The tables
+ *       are 64-bit, so no image fitting in memory can overflow them. They
+ *       are built with prefix sums along the rows (parallel over the rows)
+ *       followed by a pass down the columns (parallel over column chunks).
+ * @ref Crow F.C. (1984) "Summed-Area Tables for Texture Mapping," Computer
+ *      Graphics (Proc. SIGGRAPH), 18(3): 207-212
+ * @see #calc_local_stats
+ * @see #free_integral_img
+ *
+ * @author Damian Kusnik
+ */
+
+IntegralImage *
+alloc_integral_img ( const Image * img, const int with_squares )
+{
+ SET_FUNC_NAME ( "alloc_integral_img" );
+ int num_rows, num_cols, num_bands;
+ int row_len;
+ int iy;
+ size_t table_size;
+ byte *data;
+ IntegralImage *int_img;
+
+ if ( !is_gray_img ( img ) && !is_rgb_img ( img ) )
+  {
+   ERROR_RET ( "Not a grayscale or color image !", NULL );
+  }
+
+ num_rows = get_num_rows ( img );
+ num_cols = get_num_cols ( img );
+ num_bands = is_rgb_img ( img ) ? 3 : 1;
+ row_len = ( num_cols + 1 ) * num_bands;
+ table_size = ( size_t ) ( num_rows + 1 ) * row_len;
+
+ int_img = CALLOC_STRUCT ( IntegralImage );
+ if ( IS_NULL ( int_img ) )
+  {
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ int_img->num_rows = num_rows;
+ int_img->num_cols = num_cols;
+ int_img->num_bands = num_bands;
+ int_img->sum = ( int64_t * ) malloc ( table_size * sizeof ( int64_t ) );
+ if ( with_squares )
+  {
+   int_img->sum_sq = ( int64_t * ) malloc ( table_size * sizeof ( int64_t ) );
+  }
+ if ( IS_NULL ( int_img->sum ) || ( with_squares && IS_NULL ( int_img->sum_sq ) ) )
+  {
+   free_integral_img ( int_img );
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ data = ( byte * ) get_img_data_1d ( img );
+
+ /* the first row and column are zero */
+ memset ( int_img->sum, 0, row_len * sizeof ( int64_t ) );
+ if ( with_squares )
+  {
+   memset ( int_img->sum_sq, 0, row_len * sizeof ( int64_t ) );
+  }
+
+#pragma omp parallel for schedule(static)
+ for ( iy = 0; iy < num_rows; iy++ )
+  {
+   const byte *in_row = data + ( size_t ) iy * num_cols * num_bands;
+   int64_t *sum_row = int_img->sum + ( size_t ) ( iy + 1 ) * row_len;
+   int64_t *sq_row = with_squares ? int_img->sum_sq + ( size_t ) ( iy + 1 ) * row_len : NULL;
+   int ix, ib;
+
+   for ( ib = 0; ib < num_bands; ib++ )
+    {
+     sum_row[ib] = 0;
+     if ( with_squares )
+      {
+       sq_row[ib] = 0;
+      }
+    }
+   for ( ix = 0; ix < num_cols * num_bands; ix++ )
+    {
+     int value = in_row[ix];
+
+     sum_row[ix + num_bands] = sum_row[ix] + value;
+     if ( with_squares )
+      {
+       sq_row[ix + num_bands] = sq_row[ix] + value * value;
+      }
+    }
+  }
+
+ accumulate_cols ( int_img->sum, num_rows + 1, row_len );
+ if ( with_squares )
+  {
+   accumulate_cols ( int_img->sum_sq, num_rows + 1, row_len );
+  }
+
+ return int_img;
+}
+
+/**
+ * @brief Frees summed-area tables
+ *
+ * @param[in,out] int_img Tables (freed on return)
+ *
+ * @return none
+ *
+ * @author Damian Kusnik
+ */
+
+void
+free_integral_img ( IntegralImage * int_img )
+{
+ if ( IS_NULL ( int_img ) )
+  {
+   return;
+  }
+
+ free ( int_img->sum );
+ free ( int_img->sum_sq );
+ free ( int_img );
+}
+
+/**
+ * @brief Computes the local means and variances along one image row
+ *
+ * @param[in] int_img Summed-area tables
+ * @param[in] win_size Dimension of the square window { positive-odd }
+ * @param[in] row Image row [ 0, # rows - 1 ]
+ * @param[out] mean Mean of the window centered on each sample of the row
+ *                  ( # columns x # bands, interleaved like the image )
+ * @param[out] var Variance of the same windows, or NULL if not needed
+ *
+ * @return E_SUCCESS or an error code
+ *
+ * @note Windows are cut off at the image border and averaged over the
+ *       pixels they keep. Each window takes O(1) time whatever its size,
+ *       and the variance is computed from exact integer sums (for windows
+ *       of up to 2^23 pixels), so it is never negative. Rows are
+ *       independent, so callers can process them in parallel.
+ * @see #alloc_integral_img
+ *
+ * @author Damian Kusnik
+ */
+
+int
+calc_local_stats ( const IntegralImage * int_img, const int win_size,
+		   const int row, double *mean, double *var )
+{
+ SET_FUNC_NAME ( "calc_local_stats" );
+ int num_cols, num_bands, row_len;
+ int half_win, ix, ib;
+ size_t top, bottom;
+
+ if ( IS_NULL ( int_img ) || IS_NULL ( mean ) || row < 0 ||
+      row >= int_img->num_rows )
+  {
+   ERROR_RET ( "Invalid argument !", E_INVARG );
+  }
+
+ if ( !IS_POS_ODD ( win_size ) )
+  {
+   ERROR ( "Window size ( %d ) must be positive and odd !", win_size );
+   return E_INVARG;
+  }
+
+ if ( !IS_NULL ( var ) && IS_NULL ( int_img->sum_sq ) )
+  {
+   ERROR_RET ( "Tables lack the squared samples !", E_INVARG );
+  }
+
+ num_cols = int_img->num_cols;
+ num_bands = int_img->num_bands;
+ row_len = ( num_cols + 1 ) * num_bands;
+ half_win = win_size / 2;
+ top = ( size_t ) MAX_2 ( row - half_win, 0 ) * row_len;
+ bottom = ( size_t ) ( MIN_2 ( row + half_win, int_img->num_rows - 1 ) + 1 ) * row_len;
+
+ for ( ix = 0; ix < num_cols; ix++ )
+  {
+   int left = MAX_2 ( ix - half_win, 0 ) * num_bands;
+   int right = ( MIN_2 ( ix + half_win, num_cols - 1 ) + 1 ) * num_bands;
+   int64_t count = ( int64_t ) ( ( bottom - top ) / row_len ) * ( ( right - left ) / num_bands );
+
+   for ( ib = 0; ib < num_bands; ib++ )
+    {
+     const int64_t *sum = int_img->sum + ib;
+     int64_t sum_win = sum[bottom + right] - sum[top + right] -
+      sum[bottom + left] + sum[top + left];
+
+     mean[ix * num_bands + ib] = sum_win / ( double ) count;
+
+     if ( !IS_NULL ( var ) )
+      {
+       const int64_t *sum_sq = int_img->sum_sq + ib;
+       int64_t sq_win = sum_sq[bottom + right] - sum_sq[top + right] -
+	sum_sq[bottom + left] + sum_sq[top + left];
+
+       /* count^2 * variance, exactly */
+       var[ix * num_bands + ib] = count <= INT_IMG_MAX_EXACT ?
+	( count * sq_win - sum_win * sum_win ) / ( ( double ) count * count ) :
+	MAX_2 ( sq_win / ( double ) count - mean[ix * num_bands + ib] *
+		mean[ix * num_bands + ib], 0.0 );
+      }
+    }
+  }
+
+ return E_SUCCESS;
+}
@@ -0,0 +1,434 @@
+/**
+ * @file perf_stats.c
+ * Routines for timing pipeline stages with hardware performance counters
+ */
+
+#include <stdint.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#include "image.h"
+
+#define MAX_PERF_THREADS 256
+
+/** @cond INTERNAL_FUNCTION */
+
+/* Counters of one OS thread; only that thread writes its slot */
+typedef struct
+{
+ volatile long tid;		/* owner, 0 while the slot is free */
+ int fds[PERF_NUM_EVENTS];	/* -1 where the event is not available */
+ int depth[PERF_NUM_STAGES];	/* nesting of begin_perf_stage calls */
+ double start_time[PERF_NUM_STAGES];
+ double start_counts[PERF_NUM_STAGES][PERF_NUM_EVENTS][3];
+ double time[PERF_NUM_STAGES];
+ double counts[PERF_NUM_STAGES][PERF_NUM_EVENTS];
+ int num_calls[PERF_NUM_STAGES];
+} PerfSlot;
+
+static PerfSlot perf_slots[MAX_PERF_THREADS];
+
+static volatile int perf_num_slots = 0;
+
+static volatile int perf_enabled = 0;
+
+static const char *perf_stage_names[PERF_NUM_STAGES] = {
+ "pack", "filter", "unpack", "metrics", "io"
+};
+
+/* Opens the counters of the calling thread; missing events stay at -1 */
+static int
+open_counters ( int *fds )
+{
+ int ie;
+ int num_open = 0;
+
+ for ( ie = 0; ie < PERF_NUM_EVENTS; ie++ )
+  {
+   fds[ie] = -1;
+  }
+
+#ifdef __linux__
+ {
+  static const uint64_t configs[PERF_NUM_EVENTS] = {
+   PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+   PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES,
+   PERF_COUNT_HW_STALLED_CYCLES_BACKEND
+  };
+
+  for ( ie = 0; ie < PERF_NUM_EVENTS; ie++ )
+   {
+    struct perf_event_attr attr;
+
+    memset ( &attr, 0, sizeof ( attr ) );
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof ( attr );
+    attr.config = configs[ie];
+    attr.exclude_kernel = 1;	/* allowed at the default paranoia level */
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+     PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    fds[ie] = ( int ) syscall ( __NR_perf_event_open, &attr, 0, -1, -1, 0 );
+    num_open += fds[ie] >= 0;
+   }
+ }
+#endif
+
+ return num_open;
+}
+
+static void
+close_counters ( int *fds )
+{
+ int ie;
+
+ for ( ie = 0; ie < PERF_NUM_EVENTS; ie++ )
+  {
+#ifdef __linux__
+   if ( fds[ie] >= 0 )
+    {
+     close ( fds[ie] );
+    }
+#endif
+   fds[ie] = -1;
+  }
+}
+
+/* Reads value, time enabled, and time running of each open counter */
+static void
+read_counters ( const int *fds, double values[][3] )
+{
+ int ie;
+
+ for ( ie = 0; ie < PERF_NUM_EVENTS; ie++ )
+  {
+   values[ie][0] = values[ie][1] = values[ie][2] = 0.0;
+#ifdef __linux__
+   {
+    uint64_t buf[3];
+
+    if ( fds[ie] >= 0 && read ( fds[ie], buf, sizeof ( buf ) ) == sizeof ( buf ) )
+     {
+      values[ie][0] = ( double ) buf[0];
+      values[ie][1] = ( double ) buf[1];
+      values[ie][2] = ( double ) buf[2];
+     }
+   }
+#endif
+  }
+}
+
+/* Finds the slot of the calling thread, claiming one on first use */
+static PerfSlot *
+get_slot ( void )
+{
+ long tid = get_thread_id (  );
+ PerfSlot *slot = NULL;
+ int is;
+
+ for ( is = 0; is < perf_num_slots; is++ )
+  {
+   if ( perf_slots[is].tid == tid )
+    {
+     return perf_slots + is;
+    }
+  }
+
+#pragma omp critical ( perf_slots )
+ {
+  for ( is = 0; is < perf_num_slots && IS_NULL ( slot ); is++ )
+   {
+    if ( perf_slots[is].tid == tid )
+     {
+      slot = perf_slots + is;
+     }
+   }
+
+  if ( IS_NULL ( slot ) && perf_num_slots < MAX_PERF_THREADS )
+   {
+    slot = perf_slots + perf_num_slots;
+    memset ( slot, 0, sizeof ( PerfSlot ) );
+    open_counters ( slot->fds );
+    slot->tid = tid;
+    perf_num_slots++;
+   }
+ }
+
+ return slot;
+}
+
+/** @endcond INTERNAL_FUNCTION */
+
+/**
+ * @brief Starts collecting stage timings and performance counters
+ *
+ * @return Number of hardware counters available to the calling thread
+ *         [ 0, PERF_NUM_EVENTS ]
+ *
+ * @note Until this is called begin_perf_stage and end_perf_stage return
+ *       at once. Each thread that enters a stage opens its own counters
+ *       (user-space only) with perf_event_open; events the kernel or the
+ *       CPU do not allow are left out, so with none available only the
+ *       times are collected. Not available outside Linux.
+ * @see #print_perf_stats
+ * @see #disable_perf_stats
+ *
+ * @author Damian Kusnik
+ */
+
+int
+enable_perf_stats ( void )
+{
+ PerfSlot *slot;
+ int ie;
+ int num_open = 0;
+
+ perf_enabled = 1;
+ slot = get_slot (  );
+ if ( IS_NULL ( slot ) )
+  {
+   return 0;
+  }
+
+ for ( ie = 0; ie < PERF_NUM_EVENTS; ie++ )
+  {
+   num_open += slot->fds[ie] >= 0;
+  }
+
+ return num_open;
+}
+
+/**
+ * @brief Stops collecting and closes the counters
+ *
+ * @return none
+ *
+ * @note Must not be called while other threads are inside a stage. The
+ *       collected statistics are discarded.
+ *
+ * @author Damian Kusnik
+ */
+
+void
+disable_perf_stats ( void )
+{
+ int is;
+
+ perf_enabled = 0;
+ for ( is = 0; is < perf_num_slots; is++ )
+  {
+   close_counters ( perf_slots[is].fds );
+  }
+ perf_num_slots = 0;
+}
+
+/**
+ * @brief Marks the start of a pipeline stage on the calling thread
+ *
+ * @param[in] stage Stage
+ *
+ * @return none
+ *
+ * @note Nested calls for the same stage are counted once. The stage is
+ *       also recorded on the timeline when that is enabled.
+ * @see #end_perf_stage
+ * @see #begin_timeline_event
+ *
+ * @author Damian Kusnik
+ */
+
+void
+begin_perf_stage ( const PerfStage stage )
+{
+ PerfSlot *slot;
+
+ if ( stage < 0 || stage >= PERF_NUM_STAGES )
+  {
+   return;
+  }
+
+ begin_timeline_event ( perf_stage_names[stage], -1 );
+ if ( !perf_enabled || IS_NULL ( slot = get_slot (  ) ) )
+  {
+   return;
+  }
+
+ if ( slot->depth[stage]++ == 0 )
+  {
+   read_counters ( slot->fds, slot->start_counts[stage] );
+   slot->start_time[stage] = get_wall_time (  );
+  }
+}
+
+/**
+ * @brief Marks the end of a pipeline stage on the calling thread
+ *
+ * @param[in] stage Stage
+ *
+ * @return none
+ *
+ * @note Counts are scaled by the fraction of the stage during which each
+ *       counter was scheduled, in case the kernel had to multiplex them.
+ * @see #begin_perf_stage
+ *
+ * @author Damian Kusnik
+ */
+
+void
+end_perf_stage ( const PerfStage stage )
+{
+ double values[PERF_NUM_EVENTS][3];
+ PerfSlot *slot;
+ int ie;
+
+ if ( stage < 0 || stage >= PERF_NUM_STAGES )
+  {
+   return;
+  }
+
+ end_timeline_event (  );
+ if ( !perf_enabled || IS_NULL ( slot = get_slot (  ) ) || slot->depth[stage] <= 0 ||
+      --slot->depth[stage] > 0 )
+  {
+   return;
+  }
+
+ slot->time[stage] += get_wall_time (  ) - slot->start_time[stage];
+ slot->num_calls[stage]++;
+
+ read_counters ( slot->fds, values );
+ for ( ie = 0; ie < PERF_NUM_EVENTS; ie++ )
+  {
+   double count = values[ie][0] - slot->start_counts[stage][ie][0];
+   double enabled = values[ie][1] - slot->start_counts[stage][ie][1];
+   double running = values[ie][2] - slot->start_counts[stage][ie][2];
+
+   if ( running > 0.0 && running < enabled )
+    {
+     count *= enabled / running;
+    }
+   slot->counts[stage][ie] += count;
+  }
+}
+
+/**
+ * @brief Prints the statistics of each stage, summed over the threads
+ *
+ * @param[in] fp File pointer
+ *
+ * @return none
+ *
+ * @note Calls and wall are the most calls and the longest time of any one
+ *       thread in the stage. Busy is the wall-clock time each thread spent
+ *       in the stage, summed over the threads; it is not CPU time, so it
+ *       includes any time a thread was blocked or descheduled. The
+ *       counters are summed over the threads as well. Only threads that
+ *       begin a stage are counted; the filter and quality map stages are
+ *       begun by every worker thread, the other stages only by the calling
+ *       thread. IPC below about 1 together with many stalled cycles and LLC
+ *       misses per 1000 instructions points to a memory-bound stage, many
+ *       branch misses per 1000 instructions to a branch-bound one.
+ *       Counters that are not available are printed as '-'.
+ *
+ * @author Damian Kusnik
+ */
+
+void
+print_perf_stats ( FILE * fp )
+{
+ int ig, is, ie;
+ int has_event[PERF_NUM_EVENTS];
+
+ for ( ie = 0; ie < PERF_NUM_EVENTS; ie++ )
+  {
+   has_event[ie] = 0;
+   for ( is = 0; is < perf_num_slots; is++ )
+    {
+     has_event[ie] |= perf_slots[is].fds[ie] >= 0;
+    }
+  }
+
+ fprintf ( fp, "%-8s %6s %4s %10s %10s %14s %14s %6s %9s %9s %8s\n", "stage",
+	   "calls", "thr", "wall (s)", "busy (s)", "cycles", "instructions",
+	   "IPC", "LLC/kI", "brmiss/kI", "stalled" );
+
+ for ( ig = 0; ig < PERF_NUM_STAGES; ig++ )
+  {
+   double wall = 0.0, busy = 0.0;
+   double counts[PERF_NUM_EVENTS];
+   int num_calls = 0, num_threads = 0;
+   char cell[PERF_NUM_EVENTS + 4][32];
+
+   for ( ie = 0; ie < PERF_NUM_EVENTS; ie++ )
+    {
+     counts[ie] = 0.0;
+    }
+
+   for ( is = 0; is < perf_num_slots; is++ )
+    {
+     const PerfSlot *slot = perf_slots + is;
+
+     if ( slot->num_calls[ig] == 0 )
+      {
+       continue;
+      }
+     num_threads++;
+     num_calls = MAX_2 ( num_calls, slot->num_calls[ig] );
+     wall = MAX_2 ( wall, slot->time[ig] );
+     busy += slot->time[ig];
+     for ( ie = 0; ie < PERF_NUM_EVENTS; ie++ )
+      {
+       counts[ie] += slot->counts[ig][ie];
+      }
+    }
+
+   if ( num_threads == 0 )
+    {
+     continue;
+    }
+
+   for ( ie = 0; ie < PERF_NUM_EVENTS + 4; ie++ )
+    {
+     strcpy ( cell[ie], "-" );
+    }
+   if ( has_event[PERF_CYCLES] )
+    {
+     sprintf ( cell[0], "%.0f", counts[PERF_CYCLES] );
+    }
+   if ( has_event[PERF_INSTRUCTIONS] )
+    {
+     sprintf ( cell[1], "%.0f", counts[PERF_INSTRUCTIONS] );
+    }
+   if ( has_event[PERF_CYCLES] && has_event[PERF_INSTRUCTIONS] &&
+	counts[PERF_CYCLES] > 0.0 )
+    {
+     sprintf ( cell[2], "%.2f", counts[PERF_INSTRUCTIONS] / counts[PERF_CYCLES] );
+    }
+   if ( has_event[PERF_INSTRUCTIONS] && counts[PERF_INSTRUCTIONS] > 0.0 )
+    {
+     if ( has_event[PERF_LLC_MISSES] )
+      {
+       sprintf ( cell[3], "%.3f", 1e3 * counts[PERF_LLC_MISSES] /
+		 counts[PERF_INSTRUCTIONS] );
+      }
+     if ( has_event[PERF_BRANCH_MISSES] )
+      {
+       sprintf ( cell[4], "%.3f", 1e3 * counts[PERF_BRANCH_MISSES] /
+		 counts[PERF_INSTRUCTIONS] );
+      }
+    }
+   if ( has_event[PERF_CYCLES] && has_event[PERF_STALLED_CYCLES] &&
+	counts[PERF_CYCLES] > 0.0 )
+    {
+     sprintf ( cell[5], "%.1f%%", 100.0 * counts[PERF_STALLED_CYCLES] /
+	       counts[PERF_CYCLES] );
+    }
+
+   fprintf ( fp, "%-8s %6d %4d %10.4f %10.4f %14s %14s %6s %9s %9s %8s\n",
+	     perf_stage_names[ig], num_calls, num_threads, wall, busy, cell[0],
+	     cell[1], cell[2], cell[3], cell[4], cell[5] );
+  }
+}
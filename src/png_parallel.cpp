@@ -0,0 +1,1112 @@
+/**
+ * @file png_parallel.c
+ * Routines for multi-threaded PNG encoding and decoding
+ */
+
+#include <sched.h>
+#include <zlib.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "image.h"
+
+#define PNG_WINDOW_SIZE 32768	/* deflate window carried between strips */
+
+#define PNG_MIN_STRIP_SIZE 262144	/* smallest strip worth a thread */
+
+#define PNG_BAND_ROWS 16	/* rows handed from the inflate to the defilter stage at once */
+
+#define PNG_NUM_BANDS 8		/* bands in flight between the two stages */
+
+#define PNG_MAX_DIM 0x7FFFFFFFUL	/* largest width and height allowed by the PNG spec */
+
+/** @cond INTERNAL_FUNCTION */
+
+static int
+paeth_predictor ( const int a, const int b, const int c )
+{
+ int p = a + b - c;
+ int pa = abs ( p - a );
+ int pb = abs ( p - b );
+ int pc = abs ( p - c );
+
+ if ( pa <= pb && pa <= pc )
+  {
+   return a;
+  }
+
+ return ( pb <= pc ) ? b : c;
+}
+
+/** @endcond INTERNAL_FUNCTION */
+
+/** @cond INTERNAL_FUNCTION */
+
+/**
+ * @brief Applies one PNG filter to a row
+ *
+ * @param[in] type Filter type { 0..4 }
+ * @param[in] row Current row
+ * @param[in] prev Previous row or NULL for the first row
+ * @param[in] row_bytes # bytes in a row
+ * @param[in] bpp # bytes per pixel
+ * @param[out] out Filtered row (without the filter type byte)
+ *
+ * @return Sum of absolute values of the filtered bytes (taken as signed)
+ */
+
+static unsigned long
+filter_png_row ( const int type, const byte * row, const byte * prev,
+		 const int row_bytes, const int bpp, byte * out )
+{
+ int ik;
+ unsigned long sum = 0;
+
+ /* PNG treats bytes outside the image as zero */
+ switch ( type )
+  {
+   case 1:
+    for ( ik = 0; ik < bpp; ik++ )
+     {
+      out[ik] = row[ik];
+     }
+    for ( ; ik < row_bytes; ik++ )
+     {
+      out[ik] = ( byte ) ( row[ik] - row[ik - bpp] );
+     }
+    break;
+
+   case 2:
+    for ( ik = 0; ik < row_bytes; ik++ )
+     {
+      out[ik] = ( byte ) ( row[ik] - ( prev ? prev[ik] : 0 ) );
+     }
+    break;
+
+   case 3:
+    for ( ik = 0; ik < bpp; ik++ )
+     {
+      out[ik] = ( byte ) ( row[ik] - ( ( prev ? prev[ik] : 0 ) >> 1 ) );
+     }
+    for ( ; ik < row_bytes; ik++ )
+     {
+      out[ik] = ( byte ) ( row[ik] -
+			   ( ( row[ik - bpp] + ( prev ? prev[ik] : 0 ) ) >> 1 ) );
+     }
+    break;
+
+   case 4:
+    for ( ik = 0; ik < bpp; ik++ )
+     {
+      out[ik] = ( byte ) ( row[ik] - ( prev ? prev[ik] : 0 ) );
+     }
+    for ( ; ik < row_bytes; ik++ )
+     {
+      out[ik] = ( byte ) ( row[ik] -
+			   ( prev ? paeth_predictor ( row[ik - bpp], prev[ik],
+						      prev[ik - bpp] ) : row[ik - bpp] ) );
+     }
+    break;
+
+   default:
+    memcpy ( out, row, row_bytes );
+    break;
+  }
+
+ for ( ik = 0; ik < row_bytes; ik++ )
+  {
+   sum += ( out[ik] < 128 ) ? out[ik] : 256 - out[ik];
+  }
+
+ return sum;
+}
+
+/** @endcond INTERNAL_FUNCTION */
+
+/** @cond INTERNAL_FUNCTION */
+
+static void
+write_png_chunk ( FILE * fp, const char *type, const byte * data,
+		  const size_t length )
+{
+ byte buf[4];
+ unsigned long crc;
+
+ buf[0] = ( byte ) ( length >> 24 );
+ buf[1] = ( byte ) ( length >> 16 );
+ buf[2] = ( byte ) ( length >> 8 );
+ buf[3] = ( byte ) length;
+ ( void ) fwrite ( buf, 1, 4, fp );
+ ( void ) fwrite ( type, 1, 4, fp );
+ if ( length )
+  {
+   ( void ) fwrite ( data, 1, length, fp );
+  }
+
+ crc = crc32 ( 0L, ( const Bytef * ) type, 4 );
+ if ( length )
+  {
+   crc = crc32 ( crc, data, ( uInt ) length );
+  }
+ buf[0] = ( byte ) ( crc >> 24 );
+ buf[1] = ( byte ) ( crc >> 16 );
+ buf[2] = ( byte ) ( crc >> 8 );
+ buf[3] = ( byte ) crc;
+ ( void ) fwrite ( buf, 1, 4, fp );
+}
+
+/** @endcond INTERNAL_FUNCTION */
+
+/**
+ * @brief Writes an image to a PNG file using several threads
+ *
+ * @param[in] img Image pointer { grayscale, rgb }
+ * @param[in,out] fp File pointer
+ * @param[in] params Compression parameters or NULL for the defaults
+ *
+ * @return E_SUCCESS or an appropriate error code
+ *
+ * @note Rows are filtered in parallel, then the filtered data is split into
+ *       strips that are deflated concurrently. Each strip is primed with the
+ *       last 32 KB of the previous one as a preset dictionary and all but the
+ *       last end with a sync flush, so the strips concatenate into a single
+ *       zlib stream whose Adler-32 is combined from the per-strip checksums
+ *       (the pigz scheme). The output is a standard non-interlaced PNG.
+ *       PARAMS->num_threads selects the thread count; ENC_THREADS_ALL, or
+ *       NULL PARAMS, means all.
+ * @ref http://zlib.net/pigz/
+ *
+ * @author Damian Kusnik
+ */
+
+int
+write_png_file_parallel ( const Image * img, FILE * fp,
+			  const EncodeParams * params )
+{
+ SET_FUNC_NAME ( "write_png_file_parallel" );
+ int num_rows, num_cols;
+ int bpp, row_bytes;
+ int filters, level, strategy;
+ int num_threads, num_strips;
+ int fail = 0;
+ int ir, is;
+ size_t filt_size, strip_size;
+ byte *filt_data;
+ byte **strip_out;
+ size_t *strip_len;
+ unsigned long *strip_adler;
+ unsigned long adler;
+ byte header[13];
+
+ if ( IS_NULL ( fp ) )
+  {
+   ERROR_RET ( "Invalid file pointer !", E_NULL );
+  }
+
+ if ( is_rgb_img ( img ) )
+  {
+   bpp = 3;
+  }
+ else if ( is_gray_img ( img ) )
+  {
+   bpp = 1;
+  }
+ else
+  {
+   ERROR_RET ( "Not a grayscale or color image !", E_INVOBJ );
+  }
+
+ num_rows = get_num_rows ( img );
+ num_cols = get_num_cols ( img );
+ row_bytes = bpp * num_cols;
+
+ level = Z_DEFAULT_COMPRESSION;
+ filters = ENC_FILTER_ALL;
+ strategy = Z_FILTERED;
+ num_threads = ENC_THREADS_ALL;
+ if ( !IS_NULL ( params ) )
+  {
+   if ( params->level >= 0 )
+    {
+     level = MIN_2 ( params->level, 9 );
+    }
+   if ( params->filters & ENC_FILTER_ALL )
+    {
+     filters = params->filters & ENC_FILTER_ALL;
+    }
+   strategy = ( filters == ENC_FILTER_NONE ) ? Z_DEFAULT_STRATEGY : Z_FILTERED;
+   if ( params->strategy != ENC_STRATEGY_DEFAULT )
+    {
+     strategy = params->strategy;
+    }
+   num_threads = params->num_threads;
+  }
+
+#ifdef _OPENMP
+ if ( num_threads == ENC_THREADS_ALL )
+  {
+   num_threads = omp_get_max_threads ( );
+  }
+ num_threads = MAX_2 ( num_threads, 1 );
+#else
+ num_threads = 1;
+#endif
+
+ /* Filter all rows; each row only reads the unfiltered row above it */
+ filt_size = ( size_t ) num_rows * ( row_bytes + 1 );
+ filt_data = ( byte * ) malloc ( filt_size );
+ if ( IS_NULL ( filt_data ) )
+  {
+   ERROR_RET ( "Insufficient memory !", E_NOMEM );
+  }
+
+#pragma omp parallel num_threads(num_threads)
+ {
+  byte *trial = ( byte * ) malloc ( row_bytes );
+
+#pragma omp for schedule(static)
+  for ( ir = 0; ir < num_rows; ir++ )
+   {
+    const byte *row = img->data_1d.byte_data + ( size_t ) ir * row_bytes;
+    const byte *prev = ir ? row - row_bytes : NULL;
+    byte *out = filt_data + ( size_t ) ir * ( row_bytes + 1 );
+    unsigned long sum, best_sum = ULONG_MAX;
+    int type, best_type = 0;
+
+    for ( type = 0; type < 5; type++ )
+     {
+      if ( !( filters & ( ENC_FILTER_NONE << type ) ) )
+       {
+	continue;
+       }
+
+      if ( best_sum == ULONG_MAX || IS_NULL ( trial ) )
+       {
+	/* first candidate goes straight to the output row */
+	best_sum = filter_png_row ( type, row, prev, row_bytes, bpp, out + 1 );
+	best_type = type;
+	continue;
+       }
+
+      sum = filter_png_row ( type, row, prev, row_bytes, bpp, trial );
+      if ( sum < best_sum )
+       {
+	best_sum = sum;
+	best_type = type;
+	memcpy ( out + 1, trial, row_bytes );
+       }
+     }
+    out[0] = ( byte ) best_type;
+   }
+
+  free ( trial );
+ }
+
+ /* Split the filtered stream into strips on row boundaries */
+ strip_size = filt_size / num_threads + 1;
+ strip_size = MAX_2 ( strip_size, ( size_t ) PNG_MIN_STRIP_SIZE );
+ strip_size += ( row_bytes + 1 ) - strip_size % ( row_bytes + 1 );
+ num_strips = ( int ) ( ( filt_size + strip_size - 1 ) / strip_size );
+
+ strip_out = ( byte ** ) calloc ( num_strips, sizeof ( byte * ) );
+ strip_len = ( size_t * ) calloc ( num_strips, sizeof ( size_t ) );
+ strip_adler = ( unsigned long * ) calloc ( num_strips, sizeof ( unsigned long ) );
+ if ( IS_NULL ( strip_out ) || IS_NULL ( strip_len ) || IS_NULL ( strip_adler ) )
+  {
+   free ( filt_data );
+   free ( strip_out );
+   free ( strip_len );
+   free ( strip_adler );
+   ERROR_RET ( "Insufficient memory !", E_NOMEM );
+  }
+
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads) reduction(|:fail)
+ for ( is = 0; is < num_strips; is++ )
+  {
+   size_t start = ( size_t ) is * strip_size;
+   size_t len = MIN_2 ( strip_size, filt_size - start );
+   size_t bound;
+   size_t dict_len;
+   z_stream strm;
+
+   memset ( &strm, 0, sizeof ( strm ) );
+   if ( deflateInit2 ( &strm, level, Z_DEFLATED, -MAX_WBITS, 8, strategy ) != Z_OK )
+    {
+     fail |= 1;
+     continue;
+    }
+
+   begin_timeline_event ( "deflate", is );
+
+   if ( is > 0 )
+    {
+     dict_len = MIN_2 ( start, ( size_t ) PNG_WINDOW_SIZE );
+     deflateSetDictionary ( &strm, filt_data + start - dict_len, ( uInt ) dict_len );
+    }
+
+   /* room for the sync flush marker on top of the worst case */
+   bound = deflateBound ( &strm, ( uLong ) len ) + 16;
+   /* 2 spare bytes in front for the zlib header, 4 at the end for Adler-32 */
+   strip_out[is] = ( byte * ) malloc ( bound + 6 );
+   if ( IS_NULL ( strip_out[is] ) )
+    {
+     deflateEnd ( &strm );
+     end_timeline_event (  );
+     fail |= 1;
+     continue;
+    }
+
+   strm.next_in = filt_data + start;
+   strm.avail_in = ( uInt ) len;
+   strm.next_out = strip_out[is] + 2;
+   strm.avail_out = ( uInt ) bound;
+   if ( deflate ( &strm, ( is == num_strips - 1 ) ? Z_FINISH : Z_SYNC_FLUSH ) ==
+	Z_STREAM_ERROR || strm.avail_in != 0 )
+    {
+     fail |= 1;
+    }
+   strip_len[is] = bound - strm.avail_out;
+   deflateEnd ( &strm );
+
+   strip_adler[is] = adler32 ( adler32 ( 0L, Z_NULL, 0 ), filt_data + start, ( uInt ) len );
+   end_timeline_event (  );
+  }
+
+ if ( !fail )
+  {
+   static const byte signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+   byte *trailer;
+   int flevel;
+
+   ( void ) fwrite ( signature, 1, 8, fp );
+
+   /* IHDR: width, height, bit depth, color type, compression, filter, interlace */
+   header[0] = ( byte ) ( num_cols >> 24 );
+   header[1] = ( byte ) ( num_cols >> 16 );
+   header[2] = ( byte ) ( num_cols >> 8 );
+   header[3] = ( byte ) num_cols;
+   header[4] = ( byte ) ( num_rows >> 24 );
+   header[5] = ( byte ) ( num_rows >> 16 );
+   header[6] = ( byte ) ( num_rows >> 8 );
+   header[7] = ( byte ) num_rows;
+   header[8] = 8;
+   header[9] = ( bpp == 3 ) ? 2 : 0;
+   header[10] = 0;
+   header[11] = 0;
+   header[12] = 0;
+   write_png_chunk ( fp, "IHDR", header, 13 );
+
+   adler = strip_adler[0];
+   for ( is = 1; is < num_strips; is++ )
+    {
+     size_t len = MIN_2 ( strip_size, filt_size - ( size_t ) is * strip_size );
+
+     adler = adler32_combine ( adler, strip_adler[is], ( z_off_t ) len );
+    }
+
+   /* zlib header: deflate with a 32K window plus the level hint */
+   flevel = ( level == Z_DEFAULT_COMPRESSION ) ? 2 :
+    ( level < 2 ) ? 0 : ( level < 6 ) ? 1 : ( level == 6 ) ? 2 : 3;
+   strip_out[0][0] = 0x78;
+   strip_out[0][1] = ( byte ) ( flevel << 6 );
+   strip_out[0][1] += ( byte ) ( 31 - ( 0x78 * 256 + strip_out[0][1] ) % 31 );
+
+   trailer = strip_out[num_strips - 1] + 2 + strip_len[num_strips - 1];
+   trailer[0] = ( byte ) ( adler >> 24 );
+   trailer[1] = ( byte ) ( adler >> 16 );
+   trailer[2] = ( byte ) ( adler >> 8 );
+   trailer[3] = ( byte ) adler;
+
+   /* one IDAT per strip */
+   for ( is = 0; is < num_strips; is++ )
+    {
+     write_png_chunk ( fp, "IDAT", strip_out[is] + ( is ? 2 : 0 ),
+		       strip_len[is] + ( is ? 0 : 2 ) +
+		       ( is == num_strips - 1 ? 4 : 0 ) );
+    }
+   write_png_chunk ( fp, "IEND", NULL, 0 );
+  }
+
+ for ( is = 0; is < num_strips; is++ )
+  {
+   free ( strip_out[is] );
+  }
+ free ( strip_out );
+ free ( strip_len );
+ free ( strip_adler );
+ free ( filt_data );
+
+ if ( fail )
+  {
+   ERROR_RET ( "Cannot compress PNG data !", E_FAILURE );
+  }
+
+ return ferror ( fp ) ? E_FAILURE : E_SUCCESS;
+}
+
+/** @cond INTERNAL_FUNCTION */
+
+static unsigned long
+get_png_uint ( const byte * buf )
+{
+ return ( ( unsigned long ) buf[0] << 24 ) | ( ( unsigned long ) buf[1] << 16 ) |
+  ( ( unsigned long ) buf[2] << 8 ) | ( unsigned long ) buf[3];
+}
+
+/** @endcond INTERNAL_FUNCTION */
+
+/** @cond INTERNAL_STRUCT */
+
+typedef struct
+{
+ FILE *fp;			/* input file */
+ z_stream strm;			/* inflate state */
+ byte *chunk;			/* data of the current chunk */
+ size_t chunk_cap;		/* capacity of CHUNK */
+ unsigned long next_len;	/* length of an IDAT chunk whose header was already read */
+ int have_next;			/* is NEXT_LEN valid ? */
+ int in_idat;			/* is the reader inside the IDAT sequence ? */
+ int stream_end;		/* has the end of the zlib stream been reached ? */
+} PngInflater;
+
+/** @endcond INTERNAL_STRUCT */
+
+/** @cond INTERNAL_FUNCTION */
+
+/**
+ * @brief Reads the data and CRC of a chunk whose header has been read
+ *
+ * @return E_SUCCESS or an appropriate error code
+ */
+
+static int
+load_png_chunk ( PngInflater * inf, const char *type, const unsigned long length )
+{
+ byte buf[4];
+ unsigned long crc;
+
+ if ( length > inf->chunk_cap )
+  {
+   byte *tmp = ( byte * ) realloc ( inf->chunk, length );
+
+   if ( IS_NULL ( tmp ) )
+    {
+     return E_NOMEM;
+    }
+   inf->chunk = tmp;
+   inf->chunk_cap = length;
+  }
+
+ if ( fread ( inf->chunk, 1, length, inf->fp ) != length ||
+      fread ( buf, 1, 4, inf->fp ) != 4 )
+  {
+   return E_FREAD;
+  }
+
+ crc = crc32 ( 0L, ( const Bytef * ) type, 4 );
+ crc = crc32 ( crc, inf->chunk, ( uInt ) length );
+
+ return ( crc == get_png_uint ( buf ) ) ? E_SUCCESS : E_FAILURE;
+}
+
+/** @endcond INTERNAL_FUNCTION */
+
+/** @cond INTERNAL_FUNCTION */
+
+/**
+ * @brief Loads the next IDAT chunk as the input of the inflater
+ *
+ * @return E_SUCCESS, E_FEOF if the IDAT sequence has ended, or another
+ *         error code
+ */
+
+static int
+fetch_png_idat ( PngInflater * inf )
+{
+ byte buf[8];
+ int ret;
+
+ /* the IDAT chunks must be consecutive */
+ if ( !inf->have_next )
+  {
+   if ( !inf->in_idat || fread ( buf, 1, 8, inf->fp ) != 8 ||
+	memcmp ( buf + 4, "IDAT", 4 ) )
+    {
+     inf->in_idat = 0;
+     return E_FEOF;
+    }
+   inf->next_len = get_png_uint ( buf );
+  }
+
+ inf->have_next = 0;
+ inf->in_idat = 1;
+ ret = load_png_chunk ( inf, "IDAT", inf->next_len );
+ if ( ret )
+  {
+   return ret;
+  }
+ inf->strm.next_in = inf->chunk;
+ inf->strm.avail_in = ( uInt ) inf->next_len;
+
+ return E_SUCCESS;
+}
+
+/** @endcond INTERNAL_FUNCTION */
+
+/** @cond INTERNAL_FUNCTION */
+
+/**
+ * @brief Inflates exactly LEN bytes of image data, reading IDAT chunks as needed
+ *
+ * @return E_SUCCESS or an appropriate error code
+ */
+
+static int
+inflate_png_data ( PngInflater * inf, byte * out, const size_t len )
+{
+ int ret;
+
+ inf->strm.next_out = out;
+ inf->strm.avail_out = ( uInt ) len;
+
+ while ( inf->strm.avail_out > 0 )
+  {
+   if ( inf->strm.avail_in == 0 )
+    {
+     ret = fetch_png_idat ( inf );
+     if ( ret )
+      {
+       return ret;
+      }
+     continue;
+    }
+
+   ret = inflate ( &inf->strm, Z_NO_FLUSH );
+   if ( ret == Z_STREAM_END )
+    {
+     inf->stream_end = 1;
+     return ( inf->strm.avail_out > 0 ) ? E_FEOF : E_SUCCESS;
+    }
+   if ( ret != Z_OK && ret != Z_BUF_ERROR )
+    {
+     return E_FAILURE;
+    }
+  }
+
+ return E_SUCCESS;
+}
+
+/** @endcond INTERNAL_FUNCTION */
+
+/** @cond INTERNAL_FUNCTION */
+
+/**
+ * @brief Runs the inflater to the end of the zlib stream, which may lie in
+ *        a later IDAT chunk, so that its Adler-32 gets checked
+ *
+ * @return E_SUCCESS or an appropriate error code
+ *
+ * @note Excess data before the end of the stream is discarded, as libpng
+ *       does.
+ */
+
+static int
+finish_png_data ( PngInflater * inf )
+{
+ byte extra;
+ int ret;
+
+ while ( !inf->stream_end )
+  {
+   if ( inf->strm.avail_in == 0 )
+    {
+     ret = fetch_png_idat ( inf );
+     if ( ret )
+      {
+       return ret;
+      }
+     continue;
+    }
+
+   inf->strm.next_out = &extra;
+   inf->strm.avail_out = 1;
+   ret = inflate ( &inf->strm, Z_NO_FLUSH );
+   if ( ret == Z_STREAM_END )
+    {
+     inf->stream_end = 1;
+    }
+   else if ( ret != Z_OK && ret != Z_BUF_ERROR )
+    {
+     return E_FAILURE;
+    }
+  }
+
+ return E_SUCCESS;
+}
+
+/** @endcond INTERNAL_FUNCTION */
+
+/** @cond INTERNAL_FUNCTION */
+
+/**
+ * @brief Reverses the PNG filter of a row
+ *
+ * @param[in] src Filtered row, starting with the filter type byte
+ * @param[in] prev Previous reconstructed row or NULL for the first row
+ * @param[in] row_bytes # bytes in a row
+ * @param[in] bpp # bytes per pixel
+ * @param[out] dst Reconstructed row
+ *
+ * @return E_SUCCESS or E_FAILURE for an invalid filter type
+ */
+
+static int
+unfilter_png_row ( const byte * src, const byte * prev, const int row_bytes,
+		   const int bpp, byte * dst )
+{
+ int ik;
+ int type = src[0];
+
+ src++;
+ switch ( type )
+  {
+   case 0:
+    memcpy ( dst, src, row_bytes );
+    break;
+
+   case 1:
+    for ( ik = 0; ik < bpp; ik++ )
+     {
+      dst[ik] = src[ik];
+     }
+    for ( ; ik < row_bytes; ik++ )
+     {
+      dst[ik] = ( byte ) ( src[ik] + dst[ik - bpp] );
+     }
+    break;
+
+   case 2:
+    for ( ik = 0; ik < row_bytes; ik++ )
+     {
+      dst[ik] = ( byte ) ( src[ik] + ( prev ? prev[ik] : 0 ) );
+     }
+    break;
+
+   case 3:
+    for ( ik = 0; ik < bpp; ik++ )
+     {
+      dst[ik] = ( byte ) ( src[ik] + ( ( prev ? prev[ik] : 0 ) >> 1 ) );
+     }
+    for ( ; ik < row_bytes; ik++ )
+     {
+      dst[ik] = ( byte ) ( src[ik] +
+			   ( ( dst[ik - bpp] + ( prev ? prev[ik] : 0 ) ) >> 1 ) );
+     }
+    break;
+
+   case 4:
+    for ( ik = 0; ik < bpp; ik++ )
+     {
+      dst[ik] = ( byte ) ( src[ik] + ( prev ? prev[ik] : 0 ) );
+     }
+    for ( ; ik < row_bytes; ik++ )
+     {
+      dst[ik] = ( byte ) ( src[ik] +
+			   ( prev ? paeth_predictor ( dst[ik - bpp], prev[ik],
+						      prev[ik - bpp] ) : dst[ik - bpp] ) );
+     }
+    break;
+
+   default:
+    return E_FAILURE;
+  }
+
+ return E_SUCCESS;
+}
+
+/** @endcond INTERNAL_FUNCTION */
+
+/** @cond INTERNAL_FUNCTION */
+
+/**
+ * @brief Converts a reconstructed row of any supported layout to 8-bit RGB
+ */
+
+static void
+convert_png_row ( const byte * src, const int num_cols, const int color_type,
+		  const int bit_depth, const byte * palette, const int num_colors,
+		  byte * dst )
+{
+ int ic;
+ int step = bit_depth / 8;	/* 16-bit samples keep their high byte */
+ int channels;
+
+ if ( color_type == 3 )
+  {
+   for ( ic = 0; ic < num_cols; ic++ )
+    {
+     int index = src[ic];
+
+     if ( index < num_colors )
+      {
+       dst[3 * ic] = palette[3 * index];
+       dst[3 * ic + 1] = palette[3 * index + 1];
+       dst[3 * ic + 2] = palette[3 * index + 2];
+      }
+     else
+      {
+       dst[3 * ic] = dst[3 * ic + 1] = dst[3 * ic + 2] = 0;
+      }
+    }
+   return;
+  }
+
+ channels = ( color_type == 0 ) ? 1 : ( color_type == 2 ) ? 3 :
+  ( color_type == 4 ) ? 2 : 4;
+
+ if ( channels < 3 )
+  {
+   for ( ic = 0; ic < num_cols; ic++ )
+    {
+     dst[3 * ic] = dst[3 * ic + 1] = dst[3 * ic + 2] = src[ic * channels * step];
+    }
+  }
+ else
+  {
+   for ( ic = 0; ic < num_cols; ic++ )
+    {
+     const byte *px = src + ic * channels * step;
+
+     dst[3 * ic] = px[0];
+     dst[3 * ic + 1] = px[step];
+     dst[3 * ic + 2] = px[2 * step];
+    }
+  }
+}
+
+/** @endcond INTERNAL_FUNCTION */
+
+/**
+ * @brief Reads a PNG file, inflating and defiltering on separate threads
+ *
+ * @param[in,out] fp File pointer (positioned at the PNG signature)
+ *
+ * @return Pointer to the RGB image or NULL
+ *
+ * @note One thread reads the IDAT chunks and inflates bands of rows into a
+ *       small ring buffer while a second thread reverses the row filters and
+ *       converts the rows into the image, so the two stages overlap. All
+ *       state lives on the stack, so any number of files can be decoded
+ *       concurrently. With a single thread the stages simply alternate.
+ *       Interlaced files and bit depths below 8 are handed to libpng.
+ *       The conversion matches read_png_file: 16-bit samples are truncated,
+ *       gray is replicated and alpha is dropped. Zero or out-of-range
+ *       dimensions, and images of more than INT_MAX bytes, are rejected
+ *       before anything is allocated, and the zlib stream is run to its
+ *       end, even in a later IDAT chunk, so that its Adler-32 is always
+ *       checked.
+ *
+ * @author Damian Kusnik
+ */
+
+Image *
+read_png_file_parallel ( FILE * fp )
+{
+ SET_FUNC_NAME ( "read_png_file_parallel" );
+ static const byte signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+ byte buf[8];
+ byte palette[768];
+ int num_colors = 0;
+ long start_pos;
+ unsigned long length;
+ int num_rows, num_cols, bit_depth, color_type, interlace;
+ int channels, bpp, row_bytes;
+ size_t row_size;		/* filtered row with its filter type byte */
+ int num_bands;
+ int bands_inflated = 0, bands_done = 0;
+ int fail = E_SUCCESS;
+ int num_threads = 1;
+ int need_scratch;
+ byte *ring = NULL;
+ byte *scratch = NULL;
+ PngInflater inf;
+ Image *img;
+
+ if ( IS_NULL ( fp ) )
+  {
+   ERROR_RET ( "Invalid file pointer !", NULL );
+  }
+
+ memset ( &inf, 0, sizeof ( inf ) );
+ inf.fp = fp;
+
+ start_pos = ftell ( fp );
+ if ( fread ( buf, 1, 8, fp ) != 8 || memcmp ( buf, signature, 8 ) ||
+      fread ( buf, 1, 8, fp ) != 8 || memcmp ( buf + 4, "IHDR", 4 ) ||
+      load_png_chunk ( &inf, "IHDR", get_png_uint ( buf ) ) ||
+      get_png_uint ( buf ) != 13 )
+  {
+   free ( inf.chunk );
+   ERROR_RET ( "Invalid PNG header !", NULL );
+  }
+
+ if ( get_png_uint ( inf.chunk ) == 0 || get_png_uint ( inf.chunk ) > PNG_MAX_DIM ||
+      get_png_uint ( inf.chunk + 4 ) == 0 || get_png_uint ( inf.chunk + 4 ) > PNG_MAX_DIM )
+  {
+   free ( inf.chunk );
+   ERROR_RET ( "Invalid PNG image dimensions !", NULL );
+  }
+
+ num_cols = ( int ) get_png_uint ( inf.chunk );
+ num_rows = ( int ) get_png_uint ( inf.chunk + 4 );
+
+ /* alloc_img sizes the RGB image in an int */
+ if ( ( size_t ) num_rows * num_cols * 3 > INT_MAX )
+  {
+   free ( inf.chunk );
+   ERROR_RET ( "PNG image is too large !", NULL );
+  }
+ bit_depth = inf.chunk[8];
+ color_type = inf.chunk[9];
+ interlace = inf.chunk[12];
+
+ if ( interlace || ( bit_depth != 8 && bit_depth != 16 ) ||
+      ( color_type == 3 && bit_depth != 8 ) || start_pos < 0 )
+  {
+   /* not worth a second implementation; let libpng handle it */
+   free ( inf.chunk );
+   if ( fseek ( fp, start_pos, SEEK_SET ) )
+    {
+     ERROR_RET ( "Cannot rewind PNG file !", NULL );
+    }
+   return read_png_file ( fp );
+  }
+
+ switch ( color_type )
+  {
+   case 0:
+    channels = 1;
+    break;
+   case 2:
+    channels = 3;
+    break;
+   case 3:
+    channels = 1;
+    break;
+   case 4:
+    channels = 2;
+    break;
+   case 6:
+    channels = 4;
+    break;
+   default:
+    free ( inf.chunk );
+    ERROR_RET ( "Invalid PNG color type !", NULL );
+  }
+ bpp = channels * bit_depth / 8;
+
+ /* the ring of filtered rows must stay within 32 bits, so that a band
+    fits in one zlib output buffer (uInt) and no size can overflow */
+ if ( ( size_t ) num_cols > ( UINT_MAX / ( PNG_NUM_BANDS * PNG_BAND_ROWS ) - 1 ) / bpp )
+  {
+   free ( inf.chunk );
+   ERROR_RET ( "PNG image is too wide !", NULL );
+  }
+ row_bytes = num_cols * bpp;
+ row_size = ( size_t ) row_bytes + 1;
+
+ /* Collect the palette and skip ancillary chunks up to the first IDAT */
+ while ( 1 )
+  {
+   if ( fread ( buf, 1, 8, fp ) != 8 || !memcmp ( buf + 4, "IEND", 4 ) )
+    {
+     free ( inf.chunk );
+     ERROR_RET ( "PNG file has no image data !", NULL );
+    }
+
+   length = get_png_uint ( buf );
+   if ( !memcmp ( buf + 4, "IDAT", 4 ) )
+    {
+     inf.next_len = length;
+     inf.have_next = 1;
+     break;
+    }
+
+   if ( !memcmp ( buf + 4, "PLTE", 4 ) )
+    {
+     if ( load_png_chunk ( &inf, "PLTE", length ) || length > 768 )
+      {
+       free ( inf.chunk );
+       ERROR_RET ( "Invalid PNG palette !", NULL );
+      }
+     memcpy ( palette, inf.chunk, length );
+     num_colors = ( int ) ( length / 3 );
+    }
+   else if ( fseek ( fp, ( long ) length + 4, SEEK_CUR ) )
+    {
+     free ( inf.chunk );
+     ERROR_RET ( "Cannot read PNG file !", NULL );
+    }
+  }
+
+ img = alloc_img ( PIX_RGB, num_rows, num_cols );
+ if ( IS_NULL ( img ) )
+  {
+   free ( inf.chunk );
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ num_bands = ( num_rows + PNG_BAND_ROWS - 1 ) / PNG_BAND_ROWS;
+ ring = ( byte * ) malloc ( PNG_NUM_BANDS * PNG_BAND_ROWS * row_size );
+ /* 8-bit RGB is reconstructed in place, everything else through two rows */
+ need_scratch = ( color_type != 2 || bit_depth != 8 );
+ if ( need_scratch )
+  {
+   scratch = ( byte * ) malloc ( 2 * ( size_t ) row_bytes );
+  }
+ if ( IS_NULL ( ring ) || ( need_scratch && IS_NULL ( scratch ) ) ||
+      inflateInit ( &inf.strm ) != Z_OK )
+  {
+   free ( ring );
+   free ( scratch );
+   free ( inf.chunk );
+   free_img ( img );
+   free ( img );
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+#ifdef _OPENMP
+ num_threads = MIN_2 ( 2, omp_get_max_threads ( ) );
+#endif
+
+#pragma omp parallel num_threads(num_threads)
+ {
+  int ib, ir;
+  int is_producer = 1, is_consumer = 1;
+  int ready, err;
+
+#ifdef _OPENMP
+  if ( omp_get_num_threads ( ) > 1 )
+   {
+    is_producer = ( omp_get_thread_num ( ) == 0 );
+    is_consumer = !is_producer;
+   }
+#endif
+
+  for ( ib = 0; ib < num_bands; ib++ )
+   {
+    byte *band = ring + ( size_t ) ( ib % PNG_NUM_BANDS ) * PNG_BAND_ROWS * row_size;
+    int band_rows = MIN_2 ( PNG_BAND_ROWS, num_rows - ib * PNG_BAND_ROWS );
+
+    if ( is_producer )
+     {
+      /* wait for a free slot in the ring */
+      while ( is_consumer == 0 )
+       {
+#pragma omp atomic read
+	ready = bands_done;
+#pragma omp atomic read
+	err = fail;
+	if ( err || ib - ready < PNG_NUM_BANDS )
+	 {
+	  break;
+	 }
+	sched_yield ( );
+       }
+#pragma omp flush
+
+      err = inflate_png_data ( &inf, band, band_rows * row_size );
+      if ( err )
+       {
+#pragma omp atomic write
+	fail = err;
+       }
+
+#pragma omp flush
+#pragma omp atomic write
+      bands_inflated = ib + 1;
+     }
+
+    if ( is_consumer )
+     {
+      /* wait until the band is inflated */
+      while ( is_producer == 0 )
+       {
+#pragma omp atomic read
+	ready = bands_inflated;
+	if ( ready > ib )
+	 {
+	  break;
+	 }
+	sched_yield ( );
+       }
+#pragma omp flush
+
+#pragma omp atomic read
+      err = fail;
+      if ( err )
+       {
+	break;
+       }
+
+      for ( ir = 0; ir < band_rows; ir++ )
+       {
+	int row = ib * PNG_BAND_ROWS + ir;
+	const byte *src = band + ir * row_size;
+	byte *out = img->data_nd.byte_data_3b[row][0];
+
+	if ( IS_NULL ( scratch ) )
+	 {
+	  err = unfilter_png_row ( src, row ? img->data_nd.byte_data_3b[row - 1][0] : NULL,
+				   row_bytes, bpp, out );
+	 }
+	else
+	 {
+	  byte *cur = scratch + ( row & 1 ) * row_bytes;
+
+	  err = unfilter_png_row ( src, row ? scratch + ( ( row - 1 ) & 1 ) * row_bytes : NULL,
+				   row_bytes, bpp, cur );
+	  convert_png_row ( cur, num_cols, color_type, bit_depth, palette, num_colors, out );
+	 }
+
+	if ( err )
+	 {
+#pragma omp atomic write
+	  fail = err;
+	  break;
+	 }
+       }
+
+#pragma omp flush
+#pragma omp atomic write
+      bands_done = ib + 1;
+     }
+
+#pragma omp atomic read
+    err = fail;
+    if ( err )
+     {
+      break;
+     }
+   }
+ }
+
+ if ( !fail )
+  {
+   fail = finish_png_data ( &inf );
+  }
+
+ inflateEnd ( &inf.strm );
+ free ( inf.chunk );
+ free ( ring );
+ free ( scratch );
+
+ if ( fail )
+  {
+   free_img ( img );
+   free ( img );
+   ERROR_RET ( "Cannot decode PNG data !", NULL );
+  }
+
+ return img;
+}
@@ -0,0 +1,265 @@
+/**
+ * @file prefetch_io.c
+ * Routines for reading a sequence of image files ahead of their use
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "image.h"
+
+#define PREFETCH_DEFAULT_DEPTH 2	/* files in flight when none is requested */
+
+struct PrefetchReader
+{
+ const char **file_names;	/* files to read, in order */
+ int num_files;
+ int depth;			/* max. number of files decoded ahead */
+ int next_claim;		/* next file a worker will decode */
+ int next_read;			/* next file handed out by read_next_img */
+ int closing;			/* set by close_prefetch_reader */
+ Image **slots;			/* ring of DEPTH decoded images */
+ int *is_ready;			/* is the matching slot filled ? */
+ pthread_t *workers;		/* DEPTH decoding threads */
+ int num_workers;
+ pthread_mutex_t lock;
+ pthread_cond_t changed;	/* signaled whenever a slot is filled or freed */
+};
+
+/** @cond INTERNAL_FUNCTION */
+
+/* Asks the kernel to start reading FILE_NAME into the page cache */
+static void
+hint_file ( const char *file_name )
+{
+#if defined(POSIX_FADV_WILLNEED)
+ int fd = open ( file_name, O_RDONLY );
+
+ if ( fd >= 0 )
+  {
+   ( void ) posix_fadvise ( fd, 0, 0, POSIX_FADV_WILLNEED );
+   close ( fd );
+  }
+#else
+ ( void ) file_name;
+#endif
+}
+
+static void *
+prefetch_worker ( void *arg )
+{
+ PrefetchReader *reader = ( PrefetchReader * ) arg;
+ int index;
+ Image *img;
+
+ for ( ;; )
+  {
+   pthread_mutex_lock ( &reader->lock );
+   /* a file may only be claimed once its slot has been handed out */
+   while ( !reader->closing && reader->next_claim < reader->num_files &&
+	   reader->next_claim >= reader->next_read + reader->depth )
+    {
+     pthread_cond_wait ( &reader->changed, &reader->lock );
+    }
+   if ( reader->closing || reader->next_claim >= reader->num_files )
+    {
+     pthread_mutex_unlock ( &reader->lock );
+     break;
+    }
+   index = reader->next_claim++;
+   pthread_mutex_unlock ( &reader->lock );
+
+   /* the file one window ahead is claimed next; warm it up meanwhile */
+   if ( index + reader->depth < reader->num_files )
+    {
+     hint_file ( reader->file_names[index + reader->depth] );
+    }
+
+   img = read_img ( reader->file_names[index] );
+
+   pthread_mutex_lock ( &reader->lock );
+   reader->slots[index % reader->depth] = img;
+   reader->is_ready[index % reader->depth] = 1;
+   pthread_cond_broadcast ( &reader->changed );
+   pthread_mutex_unlock ( &reader->lock );
+  }
+
+ return NULL;
+}
+
+/** @endcond INTERNAL_FUNCTION */
+
+/**
+ * @brief Starts reading a list of image files in the background
+ *
+ * @param[in] file_names File names (must stay valid until the reader is closed)
+ * @param[in] num_files Number of files
+ * @param[in] depth Number of files read ahead [ 0 selects the default of 2 ]
+ *
+ * @return Pointer to the reader or NULL
+ *
+ * @note DEPTH threads decode the files with read_img, each as soon as it
+ *       falls within DEPTH files of the one the caller is waiting for, so
+ *       at most DEPTH decoded images are held at a time. Before decoding a
+ *       file each thread advises the kernel to fetch the file one window
+ *       further on, which hides open and read latency on slow storage.
+ * @see #read_next_img
+ * @see #close_prefetch_reader
+ *
+ * @author Damian Kusnik
+ */
+
+PrefetchReader *
+open_prefetch_reader ( const char **file_names, const int num_files,
+		       const int depth )
+{
+ SET_FUNC_NAME ( "open_prefetch_reader" );
+ int ik;
+ PrefetchReader *reader;
+
+ if ( IS_NULL ( file_names ) || num_files < 0 || depth < 0 )
+  {
+   ERROR_RET ( "Invalid argument !", NULL );
+  }
+
+ reader = CALLOC_STRUCT ( PrefetchReader );
+ if ( IS_NULL ( reader ) )
+  {
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ reader->file_names = file_names;
+ reader->num_files = num_files;
+ reader->depth = depth ? depth : PREFETCH_DEFAULT_DEPTH;
+ reader->slots = ( Image ** ) calloc ( reader->depth, sizeof ( Image * ) );
+ reader->is_ready = ( int * ) calloc ( reader->depth, sizeof ( int ) );
+ reader->workers = ( pthread_t * ) calloc ( reader->depth, sizeof ( pthread_t ) );
+ if ( IS_NULL ( reader->slots ) || IS_NULL ( reader->is_ready ) ||
+      IS_NULL ( reader->workers ) )
+  {
+   free ( reader->slots );
+   free ( reader->is_ready );
+   free ( reader->workers );
+   free ( reader );
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ pthread_mutex_init ( &reader->lock, NULL );
+ pthread_cond_init ( &reader->changed, NULL );
+
+ for ( ik = 0; ik < MIN_2 ( reader->depth, num_files ); ik++ )
+  {
+   if ( pthread_create ( &reader->workers[ik], NULL, prefetch_worker, reader ) )
+    {
+     break;
+    }
+   reader->num_workers++;
+  }
+
+ if ( num_files > 0 && !reader->num_workers )
+  {
+   close_prefetch_reader ( reader );
+   ERROR_RET ( "Cannot create reader thread !", NULL );
+  }
+
+ return reader;
+}
+
+/**
+ * @brief Returns the next image of a prefetching reader
+ *
+ * @param[in,out] reader Reader
+ *
+ * @return Pointer to the image or NULL (end of list or unreadable file)
+ *
+ * @note Images are returned in the order of the file list and belong to the
+ *       caller. The call blocks only if the image is still being decoded.
+ *
+ * @author Damian Kusnik
+ */
+
+Image *
+read_next_img ( PrefetchReader * reader )
+{
+ int slot;
+ Image *img;
+
+ if ( IS_NULL ( reader ) )
+  {
+   return NULL;
+  }
+
+ pthread_mutex_lock ( &reader->lock );
+ if ( reader->next_read >= reader->num_files )
+  {
+   pthread_mutex_unlock ( &reader->lock );
+   return NULL;
+  }
+
+ slot = reader->next_read % reader->depth;
+ /* time spent here is a pipeline bubble: the consumer outran the workers */
+ begin_timeline_event ( "wait_prefetch", reader->next_read );
+ while ( !reader->is_ready[slot] )
+  {
+   pthread_cond_wait ( &reader->changed, &reader->lock );
+  }
+ end_timeline_event (  );
+
+ img = reader->slots[slot];
+ reader->slots[slot] = NULL;
+ reader->is_ready[slot] = 0;
+ reader->next_read++;
+ pthread_cond_broadcast ( &reader->changed );
+ pthread_mutex_unlock ( &reader->lock );
+
+ return img;
+}
+
+/**
+ * @brief Stops a prefetching reader and releases its resources
+ *
+ * @param[in,out] reader Reader (freed on return)
+ *
+ * @return none
+ *
+ * @note Images decoded ahead but never returned by read_next_img are freed.
+ *
+ * @author Damian Kusnik
+ */
+
+void
+close_prefetch_reader ( PrefetchReader * reader )
+{
+ int ik;
+
+ if ( IS_NULL ( reader ) )
+  {
+   return;
+  }
+
+ pthread_mutex_lock ( &reader->lock );
+ reader->closing = 1;
+ pthread_cond_broadcast ( &reader->changed );
+ pthread_mutex_unlock ( &reader->lock );
+
+ for ( ik = 0; ik < reader->num_workers; ik++ )
+  {
+   pthread_join ( reader->workers[ik], NULL );
+  }
+
+ for ( ik = 0; ik < reader->depth; ik++ )
+  {
+   if ( !IS_NULL ( reader->slots[ik] ) )
+    {
+     free_img ( reader->slots[ik] );
+     free ( reader->slots[ik] );
+    }
+  }
+
+ pthread_cond_destroy ( &reader->changed );
+ pthread_mutex_destroy ( &reader->lock );
+ free ( reader->slots );
+ free ( reader->is_ready );
+ free ( reader->workers );
+ free ( reader );
+}
@@ -0,0 +1,130 @@
+/**
+ * @file pseudo_color.c
+ * Routines for pseudo-coloring grayscale images
+ */
+
+#include "image.h"
+
+/** @cond INTERNAL_FUNCTION */
+
+/* Clamps to [ 0, 1 ] and scales to a byte */
+static byte
+unit_to_byte ( const double value )
+{
+ if ( value <= 0.0 )
+  {
+   return 0;
+  }
+ if ( value >= 1.0 )
+  {
+   return MAX_GRAY;
+  }
+
+ return ( byte ) ( MAX_GRAY * value + 0.5 );
+}
+
+/* Fills LUT with the RGB color of each gray level */
+static void
+fill_color_lut ( const ColorMap color_map, byte lut[][3] )
+{
+ int ik;
+
+ for ( ik = 0; ik <= MAX_GRAY; ik++ )
+  {
+   double t = ik / ( double ) MAX_GRAY;
+
+   switch ( color_map )
+    {
+     case CMAP_HSV:
+      {
+       /* full-saturation hue circle, stopping short of red again */
+       double h = 6.0 * ik / ( MAX_GRAY + 1.0 );
+       int sector = ( int ) h;
+       double f = h - sector;
+       double rgb[6][3] = {
+	{1.0, f, 0.0}, {1.0 - f, 1.0, 0.0}, {0.0, 1.0, f},
+	{0.0, 1.0 - f, 1.0}, {f, 0.0, 1.0}, {1.0, 0.0, 1.0 - f}
+       };
+
+       lut[ik][0] = unit_to_byte ( rgb[sector][0] );
+       lut[ik][1] = unit_to_byte ( rgb[sector][1] );
+       lut[ik][2] = unit_to_byte ( rgb[sector][2] );
+       break;
+      }
+
+     case CMAP_INFRARED:
+      /* black, red, yellow, white */
+      lut[ik][0] = unit_to_byte ( 3.0 * t );
+      lut[ik][1] = unit_to_byte ( 3.0 * t - 1.0 );
+      lut[ik][2] = unit_to_byte ( 3.0 * t - 2.0 );
+      break;
+
+     default:			/* CMAP_JET: dark blue, cyan, yellow, dark red */
+      lut[ik][0] = unit_to_byte ( 1.5 - fabs ( 4.0 * t - 3.0 ) );
+      lut[ik][1] = unit_to_byte ( 1.5 - fabs ( 4.0 * t - 2.0 ) );
+      lut[ik][2] = unit_to_byte ( 1.5 - fabs ( 4.0 * t - 1.0 ) );
+      break;
+    }
+  }
+}
+
+/** @endcond INTERNAL_FUNCTION */
+
+/**
+ * @brief Pseudo-colors a grayscale image
+ *
+ * @param[in] in_img Image pointer { grayscale }
+ * @param[in] color_map Color map
+ *
+ * @return Pointer to the color image or NULL
+ *
+ * @note Gray level 0 maps to the first color of the map and MAX_GRAY to
+ *       the last.
+ *
+ * @author Damian Kusnik
+ */
+
+Image *
+pseudo_color ( const Image * in_img, const ColorMap color_map )
+{
+ SET_FUNC_NAME ( "pseudo_color" );
+ byte lut[MAX_GRAY + 1][3];
+ byte *in_data;
+ byte *out_data;
+ int ik;
+ int num_pixels;
+ Image *out_img;
+
+ if ( !is_gray_img ( in_img ) )
+  {
+   ERROR_RET ( "Not a grayscale image !", NULL );
+  }
+
+ if ( color_map != CMAP_HSV && color_map != CMAP_INFRARED &&
+      color_map != CMAP_JET )
+  {
+   ERROR_RET ( "Invalid color map !", NULL );
+  }
+
+ num_pixels = get_num_rows ( in_img ) * get_num_cols ( in_img );
+ out_img = alloc_img ( PIX_RGB, get_num_rows ( in_img ), get_num_cols ( in_img ) );
+ if ( IS_NULL ( out_img ) )
+  {
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ fill_color_lut ( color_map, lut );
+
+ in_data = ( byte * ) get_img_data_1d ( in_img );
+ out_data = ( byte * ) get_img_data_1d ( out_img );
+ for ( ik = 0; ik < num_pixels; ik++ )
+  {
+   const byte *color = lut[in_data[ik]];
+
+   out_data[3 * ik] = color[0];
+   out_data[3 * ik + 1] = color[1];
+   out_data[3 * ik + 2] = color[2];
+  }
+
+ return out_img;
+}
@@ -0,0 +1,372 @@
+/**
+ * @file quality_maps.c
+ * Routines for computing per-tile quality measures of RGB images
+ */
+
+#include "image.h"
+
+#define QMAP_WIN_SIZE 8		/* SSIM window, as in calculate_ssim */
+
+#define QMAP_K1 0.01
+
+#define QMAP_K2 0.03
+
+#define QMAP_NUM_MOMENTS 5	/* sums of a, b, a^2, b^2, ab */
+
+/** @cond INTERNAL_FUNCTION */
+
+#define SQR_DIFF( a, b ) ( ( ( int ) ( a ) - ( int ) ( b ) ) * ( ( int ) ( a ) - ( int ) ( b ) ) )
+
+/* Sum of squared differences between two RGB pixels */
+#define PIX_SSD( p, q ) ( SQR_DIFF ( ( p )[0], ( q )[0] ) + SQR_DIFF ( ( p )[1], ( q )[1] ) + SQR_DIFF ( ( p )[2], ( q )[2] ) )
+
+/* Luma of an RGB pixel, as computed by rgb_to_gray */
+#define PIX_LUMA( p ) ( ( byte ) ( 0.29893602129378 * ( p )[0] + 0.58704307445112 * ( p )[1] + 0.11402090425510 * ( p )[2] ) )
+
+/*
+ * Computes the measures of the tile with top-left corner (ROW0, COL0).
+ * SUMS is scratch for the integral images of the luma moments and must
+ * hold QMAP_NUM_MOMENTS * ( NUM_ROWS + 1 ) * ( NUM_COLS + 1 ) doubles.
+ */
+static void
+calc_tile ( byte *** ref_data, byte *** test_data, const int row0,
+	    const int col0, const int num_rows, const int num_cols,
+	    double *sums, double *psnr, double *ssim, double *iri )
+{
+ int iy, ix, im;
+ int stride = QMAP_NUM_MOMENTS * ( num_cols + 1 );
+ int win_rows = MIN_2 ( QMAP_WIN_SIZE, num_rows );
+ int win_cols = MIN_2 ( QMAP_WIN_SIZE, num_cols );
+ double num_pixels = ( double ) num_rows * num_cols;
+ double sum_sq_err = 0.0, sum_iri = 0.0, sum_ssim = 0.0;
+ double c1 = ( QMAP_K1 * MAX_GRAY ) * ( QMAP_K1 * MAX_GRAY );
+ double c2 = ( QMAP_K2 * MAX_GRAY ) * ( QMAP_K2 * MAX_GRAY );
+ double win_area = ( double ) win_rows * win_cols;
+
+ memset ( sums, 0, stride * sizeof ( double ) );
+
+ /* One pass over the pixels: errors, IRI, and the luma integral images */
+ for ( iy = 0; iy < num_rows; iy++ )
+  {
+   int row = row0 + iy;
+   const byte *ref_row = ref_data[row][col0];
+   const byte *ref_up = row > 0 ? ref_data[row - 1][col0] : NULL;
+   const byte *test_row = test_data[row][col0];
+   double *cur = sums + ( iy + 1 ) * stride;
+   double *prev = sums + iy * stride;
+   double run[QMAP_NUM_MOMENTS] = { 0.0, 0.0, 0.0, 0.0, 0.0 };
+
+   for ( im = 0; im < QMAP_NUM_MOMENTS; im++ )
+    {
+     cur[im] = 0.0;
+    }
+
+   for ( ix = 0; ix < num_cols; ix++ )
+    {
+     const byte *r = ref_row + 3 * ix;
+     const byte *t = test_row + 3 * ix;
+     int ssd = PIX_SSD ( r, t );
+     int min_ssd = ssd;
+     double a = PIX_LUMA ( r );
+     double b = PIX_LUMA ( t );
+
+     /* the IRI neighbors outside the image are skipped */
+     if ( col0 + ix > 0 )
+      {
+       min_ssd = MIN_2 ( min_ssd, PIX_SSD ( r - 3, t ) );
+      }
+     if ( !IS_NULL ( ref_up ) )
+      {
+       min_ssd = MIN_2 ( min_ssd, PIX_SSD ( ref_up + 3 * ix, t ) );
+       if ( col0 + ix > 0 )
+	{
+	 min_ssd = MIN_2 ( min_ssd, PIX_SSD ( ref_up + 3 * ix - 3, t ) );
+	}
+      }
+     sum_sq_err += ssd;
+     sum_iri += min_ssd;
+
+     run[0] += a;
+     run[1] += b;
+     run[2] += a * a;
+     run[3] += b * b;
+     run[4] += a * b;
+     for ( im = 0; im < QMAP_NUM_MOMENTS; im++ )
+      {
+       cur[QMAP_NUM_MOMENTS * ( ix + 1 ) + im] =
+	prev[QMAP_NUM_MOMENTS * ( ix + 1 ) + im] + run[im];
+      }
+    }
+  }
+
+ /* Mean SSIM over the windows that fit in the tile */
+ for ( iy = 0; iy + win_rows <= num_rows; iy++ )
+  {
+   const double *top = sums + iy * stride;
+   const double *bot = sums + ( iy + win_rows ) * stride;
+
+   for ( ix = 0; ix + win_cols <= num_cols; ix++ )
+    {
+     double m[QMAP_NUM_MOMENTS];
+     double mu_a, mu_b, var_a, var_b, cov;
+
+     for ( im = 0; im < QMAP_NUM_MOMENTS; im++ )
+      {
+       int left = QMAP_NUM_MOMENTS * ix + im;
+       int right = QMAP_NUM_MOMENTS * ( ix + win_cols ) + im;
+
+       m[im] = ( bot[right] - bot[left] - top[right] + top[left] ) / win_area;
+      }
+     mu_a = m[0];
+     mu_b = m[1];
+     var_a = m[2] - mu_a * mu_a;
+     var_b = m[3] - mu_b * mu_b;
+     cov = m[4] - mu_a * mu_b;
+     sum_ssim += ( ( 2.0 * mu_a * mu_b + c1 ) * ( 2.0 * cov + c2 ) ) /
+      ( ( mu_a * mu_a + mu_b * mu_b + c1 ) * ( var_a + var_b + c2 ) );
+    }
+  }
+
+ *ssim = sum_ssim / ( ( num_rows - win_rows + 1 ) * ( num_cols - win_cols + 1 ) );
+ *psnr = sum_sq_err == 0.0 ? HUGE_VAL :
+  10.0 * log10 ( MAX_GRAY * MAX_GRAY / ( sum_sq_err / ( 3.0 * num_pixels ) ) );
+ /* the IRI distance is summed over the bands rather than averaged */
+ *iri = sum_iri == 0.0 ? HUGE_VAL :
+  10.0 * log10 ( MAX_GRAY * MAX_GRAY / ( sum_iri / num_pixels ) );
+}
+
+/** @endcond INTERNAL_FUNCTION */
+
+/**
+ * @brief Computes PSNR, SSIM, and IRI maps of a test image over a grid of tiles
+ *
+ * @param[in] ref_img Reference image { rgb }
+ * @param[in] test_img Test image { rgb }
+ * @param[in] tile_size Tile width and height [ >= 1 ]
+ * @param[out] qmaps Quality maps; the images belong to the caller
+ *
+ * @return E_SUCCESS or an appropriate error code
+ *
+ * @note Each map is a double image with one pixel per tile; the last tile
+ *       of a row or column is cut at the image edge. The tiles are
+ *       processed in parallel, each in a single pass over its pixels, so
+ *       the cost is that of calc_quality_metrics plus a small SSIM term.
+ *       The measures follow calc_quality_metrics and calculate_ssim with
+ *       these differences: the whole image is covered (IRI neighbors
+ *       outside the image are skipped), and SSIM is the mean over the 8x8
+ *       luma windows inside the tile at full resolution. Tiles that match
+ *       exactly have infinite PSNR and IRI.
+ * @see #quality_map_to_gray
+ * @see #free_quality_maps
+ *
+ * @author Damian Kusnik
+ */
+
+int
+calc_quality_maps ( const Image * ref_img, const Image * test_img,
+		    const int tile_size, QualityMaps * qmaps )
+{
+ SET_FUNC_NAME ( "calc_quality_maps" );
+ int it;
+ int num_rows, num_cols;
+ int num_tile_rows, num_tile_cols;
+ int fail = 0;
+ byte ***ref_data;
+ byte ***test_data;
+ double **psnr_data, **ssim_data, **iri_data;
+
+ if ( !is_rgb_img ( ref_img ) || !is_rgb_img ( test_img ) )
+  {
+   ERROR_RET ( "Not a color image !", E_INVOBJ );
+  }
+
+ num_rows = get_num_rows ( ref_img );
+ num_cols = get_num_cols ( ref_img );
+ if ( get_num_rows ( test_img ) != num_rows ||
+      get_num_cols ( test_img ) != num_cols )
+  {
+   ERROR_RET ( "Image dimensions must be equal !", E_INVARG );
+  }
+
+ if ( tile_size < 1 )
+  {
+   ERROR ( "Tile size ( %d ) must be positive !", tile_size );
+   return E_INVARG;
+  }
+
+ num_tile_rows = ( num_rows + tile_size - 1 ) / tile_size;
+ num_tile_cols = ( num_cols + tile_size - 1 ) / tile_size;
+
+ memset ( qmaps, 0, sizeof ( QualityMaps ) );
+ qmaps->tile_size = tile_size;
+ qmaps->psnr_map = alloc_img ( PIX_DBL_1B, num_tile_rows, num_tile_cols );
+ qmaps->ssim_map = alloc_img ( PIX_DBL_1B, num_tile_rows, num_tile_cols );
+ qmaps->iri_map = alloc_img ( PIX_DBL_1B, num_tile_rows, num_tile_cols );
+ if ( IS_NULL ( qmaps->psnr_map ) || IS_NULL ( qmaps->ssim_map ) ||
+      IS_NULL ( qmaps->iri_map ) )
+  {
+   free_quality_maps ( qmaps );
+   ERROR_RET ( "Insufficient memory !", E_NOMEM );
+  }
+
+ ref_data = ( byte *** ) get_img_data_nd ( ref_img );
+ test_data = ( byte *** ) get_img_data_nd ( test_img );
+ psnr_data = ( double ** ) get_img_data_nd ( qmaps->psnr_map );
+ ssim_data = ( double ** ) get_img_data_nd ( qmaps->ssim_map );
+ iri_data = ( double ** ) get_img_data_nd ( qmaps->iri_map );
+
+#pragma omp parallel reduction(|:fail)
+ {
+  int tile_cap = MIN_2 ( tile_size, MAX_2 ( num_rows, num_cols ) ) + 1;
+  double *sums = ( double * ) malloc ( QMAP_NUM_MOMENTS * ( size_t ) tile_cap *
+				       tile_cap * sizeof ( double ) );
+
+  if ( IS_NULL ( sums ) )
+   {
+    fail = 1;
+   }
+
+  begin_perf_stage ( PERF_STAGE_METRICS );
+
+  /* edge tiles are smaller, so let the threads pick tiles as they go */
+#pragma omp for schedule(dynamic)
+  for ( it = 0; it < num_tile_rows * num_tile_cols; it++ )
+   {
+    int ty = it / num_tile_cols;
+    int tx = it % num_tile_cols;
+    int row0 = ty * tile_size;
+    int col0 = tx * tile_size;
+
+    if ( IS_NULL ( sums ) )
+     {
+      continue;
+     }
+
+    begin_timeline_event ( "tile", it );
+    calc_tile ( ref_data, test_data, row0, col0,
+		MIN_2 ( tile_size, num_rows - row0 ),
+		MIN_2 ( tile_size, num_cols - col0 ), sums,
+		&psnr_data[ty][tx], &ssim_data[ty][tx], &iri_data[ty][tx] );
+    end_timeline_event (  );
+   }
+
+  end_perf_stage ( PERF_STAGE_METRICS );
+  free ( sums );
+ }
+
+ if ( fail )
+  {
+   free_quality_maps ( qmaps );
+   ERROR_RET ( "Insufficient memory !", E_NOMEM );
+  }
+
+ return E_SUCCESS;
+}
+
+/**
+ * @brief Releases the images of quality maps
+ *
+ * @param[in,out] qmaps Quality maps
+ *
+ * @return none
+ *
+ * @author Damian Kusnik
+ */
+
+void
+free_quality_maps ( QualityMaps * qmaps )
+{
+ Image **maps[3];
+ int ik;
+
+ if ( IS_NULL ( qmaps ) )
+  {
+   return;
+  }
+
+ maps[0] = &qmaps->psnr_map;
+ maps[1] = &qmaps->ssim_map;
+ maps[2] = &qmaps->iri_map;
+ for ( ik = 0; ik < 3; ik++ )
+  {
+   if ( !IS_NULL ( *maps[ik] ) )
+    {
+     free_img ( *maps[ik] );
+     free ( *maps[ik] );
+     *maps[ik] = NULL;
+    }
+  }
+}
+
+/**
+ * @brief Converts a quality map to a viewable grayscale image
+ *
+ * @param[in] map_img Quality map { double }
+ * @param[in] min_val Value mapped to 0
+ * @param[in] max_val Value mapped to MAX_GRAY [ > MIN_VAL ]
+ * @param[in] cell_size Width and height of the block drawn for each map
+ *            pixel [ >= 1 ]; pass the tile size to overlay the image
+ *
+ * @return Pointer to the grayscale image or NULL
+ *
+ * @note Values are scaled linearly and clamped, so infinite PSNR and IRI
+ *       values become MAX_GRAY. The result can be written with write_img
+ *       as PGM or colored with pseudo_color.
+ * @see #calc_quality_maps
+ *
+ * @author Damian Kusnik
+ */
+
+Image *
+quality_map_to_gray ( const Image * map_img, const double min_val,
+		      const double max_val, const int cell_size )
+{
+ SET_FUNC_NAME ( "quality_map_to_gray" );
+ int ir, ic;
+ int num_rows, num_cols;
+ double scale;
+ double **map_data;
+ byte **out_data;
+ Image *out_img;
+
+ if ( get_pix_type ( map_img ) != PIX_DBL_1B )
+  {
+   ERROR_RET ( "Not a single-band double image !", NULL );
+  }
+
+ if ( !( max_val > min_val ) )
+  {
+   ERROR_RET ( "Invalid value range !", NULL );
+  }
+
+ if ( cell_size < 1 )
+  {
+   ERROR ( "Cell size ( %d ) must be positive !", cell_size );
+   return NULL;
+  }
+
+ num_rows = get_num_rows ( map_img );
+ num_cols = get_num_cols ( map_img );
+ out_img = alloc_img ( PIX_GRAY, num_rows * cell_size, num_cols * cell_size );
+ if ( IS_NULL ( out_img ) )
+  {
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ map_data = ( double ** ) get_img_data_nd ( map_img );
+ out_data = ( byte ** ) get_img_data_nd ( out_img );
+ scale = MAX_GRAY / ( max_val - min_val );
+
+ for ( ir = 0; ir < num_rows * cell_size; ir++ )
+  {
+   for ( ic = 0; ic < num_cols * cell_size; ic++ )
+    {
+     double value = ( map_data[ir / cell_size][ic / cell_size] - min_val ) * scale;
+
+     out_data[ir][ic] = value <= 0.0 ? 0 :
+      ( value >= MAX_GRAY ? MAX_GRAY : ( byte ) ( value + 0.5 ) );
+    }
+  }
+
+ return out_img;
+}
@@ -0,0 +1,230 @@
+/**
+ * @file quality_metrics.c
+ * Routines for computing full-reference quality measures of RGB images
+ */
+
+#include <stdint.h>
+#include "image.h"
+
+/** @cond INTERNAL_FUNCTION */
+
+#define SQR_DIFF( a, b ) ( ( ( int ) ( a ) - ( int ) ( b ) ) * ( ( int ) ( a ) - ( int ) ( b ) ) )
+
+/* Sum of squared differences between two RGB pixels */
+#define PIX_SSD( p, q ) ( SQR_DIFF ( ( p )[0], ( q )[0] ) + SQR_DIFF ( ( p )[1], ( q )[1] ) + SQR_DIFF ( ( p )[2], ( q )[2] ) )
+
+/*
+ * Sums the squared and absolute errors, the squared reference samples (only
+ * if WITH_ENERGY), and the IRI distances over the pixels inside BORDER.
+ */
+static void
+sum_errors ( const Image * ref_img, const Image * test_img, const int border,
+	     const int with_energy, uint64_t * sum_sq_err,
+	     uint64_t * sum_abs_err, uint64_t * sum_sq_ref, uint64_t * sum_iri )
+{
+ int iy;
+ int num_rows = get_num_rows ( ref_img );
+ int num_cols = get_num_cols ( ref_img );
+ uint64_t sq_err = 0, abs_err = 0, sq_ref = 0, iri = 0;
+ byte ***ref_data = ( byte *** ) get_img_data_nd ( ref_img );
+ byte ***test_data = ( byte *** ) get_img_data_nd ( test_img );
+
+#pragma omp parallel for schedule(static) reduction(+:sq_err,abs_err,sq_ref,iri)
+ for ( iy = border; iy < num_rows - border; iy++ )
+  {
+   const byte *ref_up = ref_data[iy - 1][0];
+   const byte *ref_row = ref_data[iy][0];
+   const byte *test_row = test_data[iy][0];
+   /* per-pixel terms fit in an int; rows are summed in 64 bits */
+   uint64_t row_sq_err = 0, row_abs_err = 0, row_sq_ref = 0, row_iri = 0;
+   int ix;
+
+   for ( ix = 3 * border; ix < 3 * ( num_cols - border ); ix += 3 )
+    {
+     const byte *r = ref_row + ix;
+     const byte *t = test_row + ix;
+     int d0 = r[0] - t[0];
+     int d1 = r[1] - t[1];
+     int d2 = r[2] - t[2];
+     int ssd = d0 * d0 + d1 * d1 + d2 * d2;
+     int min_ssd = ssd;
+     int cand;
+
+     row_sq_err += ssd;
+     row_abs_err += abs ( d0 ) + abs ( d1 ) + abs ( d2 );
+     if ( with_energy )
+      {
+       row_sq_ref += r[0] * r[0] + r[1] * r[1] + r[2] * r[2];
+      }
+
+     cand = PIX_SSD ( r - 3, t );
+     min_ssd = MIN_2 ( min_ssd, cand );
+     cand = PIX_SSD ( ref_up + ix, t );
+     min_ssd = MIN_2 ( min_ssd, cand );
+     cand = PIX_SSD ( ref_up + ix - 3, t );
+     min_ssd = MIN_2 ( min_ssd, cand );
+     row_iri += min_ssd;
+    }
+
+   sq_err += row_sq_err;
+   abs_err += row_abs_err;
+   sq_ref += row_sq_ref;
+   iri += row_iri;
+  }
+
+ *sum_sq_err = sq_err;
+ *sum_abs_err = abs_err;
+ *sum_sq_ref = sq_ref;
+ *sum_iri = iri;
+}
+
+/* Converts the sums over the pixels inside BORDER into the quality measures */
+static void
+set_metrics ( const int num_rows, const int num_cols, const int border,
+	      const uint64_t sum_sq_err, const uint64_t sum_abs_err,
+	      const double sum_sq_ref, const uint64_t sum_iri,
+	      QualityMetrics * qm )
+{
+ double num_samples;
+
+ num_samples = ( double ) ( num_rows - 2 * border ) * ( num_cols - 2 * border );
+ qm->num_pixels = num_samples;
+ num_samples *= 3.0;
+
+ qm->mse = sum_sq_err / num_samples;
+ qm->mae = sum_abs_err / num_samples;
+ qm->rmse = sqrt ( qm->mse );
+ qm->snr = 10.0 * log10 ( ( sum_sq_ref / num_samples ) / qm->mse );
+ qm->psnr = 10.0 * log10 ( MAX_GRAY * MAX_GRAY / qm->mse );
+ /* the IRI distance is summed over the bands rather than averaged */
+ qm->iri = 10.0 * log10 ( MAX_GRAY * MAX_GRAY /
+			  ( sum_iri / qm->num_pixels ) );
+}
+
+/** @endcond INTERNAL_FUNCTION */
+
+/**
+ * @brief Computes SNR, PSNR, MSE, MAE, and IRI of a test image in one pass
+ *
+ * @param[in] ref_img Reference image { rgb }
+ * @param[in] test_img Test image { rgb }
+ * @param[in] border Number of pixels ignored along each image edge [ >= 1 ]
+ * @param[out] qm Quality measures
+ *
+ * @return E_SUCCESS or an appropriate error code
+ *
+ * @note All sums are accumulated in 64-bit integers, so the results do not
+ *       depend on the number of threads. The IRI term of a pixel is the
+ *       smallest squared RGB distance between the test pixel and the
+ *       reference pixels at offsets (0,0), (0,-1), (-1,0), and (-1,-1),
+ *       which is why BORDER must be at least 1. When the images are
+ *       identical MSE is 0 and the logarithmic measures are infinite.
+ * @see #calculate_snr
+ *
+ * @author Damian Kusnik
+ */
+
+int
+calc_quality_metrics ( const Image * ref_img, const Image * test_img,
+		       const int border, QualityMetrics * qm )
+{
+ SET_FUNC_NAME ( "calc_quality_metrics" );
+ int num_rows, num_cols;
+ uint64_t sum_sq_err, sum_abs_err, sum_sq_ref, sum_iri;
+
+ if ( !is_rgb_img ( ref_img ) || !is_rgb_img ( test_img ) )
+  {
+   ERROR_RET ( "Not a color image !", E_INVOBJ );
+  }
+
+ num_rows = get_num_rows ( ref_img );
+ num_cols = get_num_cols ( ref_img );
+ if ( get_num_rows ( test_img ) != num_rows ||
+      get_num_cols ( test_img ) != num_cols )
+  {
+   ERROR_RET ( "Image dimensions must be equal !", E_INVARG );
+  }
+
+ if ( border < 1 )
+  {
+   ERROR ( "Border ( %d ) must be positive !", border );
+   return E_INVARG;
+  }
+
+ memset ( qm, 0, sizeof ( QualityMetrics ) );
+ if ( num_rows <= 2 * border || num_cols <= 2 * border )
+  {
+   return E_SUCCESS;
+  }
+
+ begin_perf_stage ( PERF_STAGE_METRICS );
+ sum_errors ( ref_img, test_img, border, 1, &sum_sq_err, &sum_abs_err,
+	      &sum_sq_ref, &sum_iri );
+ set_metrics ( num_rows, num_cols, border, sum_sq_err, sum_abs_err,
+	       ( double ) sum_sq_ref, sum_iri, qm );
+ end_perf_stage ( PERF_STAGE_METRICS );
+
+ return E_SUCCESS;
+}
+
+/**
+ * @brief Computes SNR, PSNR, MSE, MAE, and IRI of a test image against
+ *        precomputed reference statistics
+ *
+ * @param[in] ref_stats Reference statistics
+ * @param[in] test_img Test image { rgb }
+ * @param[out] qm Quality measures
+ *
+ * @return E_SUCCESS or an appropriate error code
+ *
+ * @note Uses the border and the reference energy stored by alloc_ref_stats;
+ *       the results equal those of calc_quality_metrics.
+ * @see #calc_quality_metrics
+ * @see #alloc_ref_stats
+ *
+ * @author Damian Kusnik
+ */
+
+int
+calc_quality_metrics_ref ( const ReferenceStats * ref_stats,
+			   const Image * test_img, QualityMetrics * qm )
+{
+ SET_FUNC_NAME ( "calc_quality_metrics_ref" );
+ int num_rows, num_cols;
+ int border;
+ uint64_t sum_sq_err, sum_abs_err, sum_sq_ref, sum_iri;
+
+ if ( IS_NULL ( ref_stats ) )
+  {
+   ERROR_RET ( "Invalid reference statistics !", E_INVARG );
+  }
+
+ if ( !is_rgb_img ( ref_stats->ref_img ) || !is_rgb_img ( test_img ) )
+  {
+   ERROR_RET ( "Not a color image !", E_INVOBJ );
+  }
+
+ num_rows = get_num_rows ( ref_stats->ref_img );
+ num_cols = get_num_cols ( ref_stats->ref_img );
+ if ( get_num_rows ( test_img ) != num_rows ||
+      get_num_cols ( test_img ) != num_cols )
+  {
+   ERROR_RET ( "Image dimensions must be equal !", E_INVARG );
+  }
+
+ border = ref_stats->border;
+ memset ( qm, 0, sizeof ( QualityMetrics ) );
+ if ( num_rows <= 2 * border || num_cols <= 2 * border )
+  {
+   return E_SUCCESS;
+  }
+
+ begin_perf_stage ( PERF_STAGE_METRICS );
+ sum_errors ( ref_stats->ref_img, test_img, border, 0, &sum_sq_err,
+	      &sum_abs_err, &sum_sq_ref, &sum_iri );
+ set_metrics ( num_rows, num_cols, border, sum_sq_err, sum_abs_err,
+	       ref_stats->sum_sq_ref, sum_iri, qm );
+ end_perf_stage ( PERF_STAGE_METRICS );
+
+ return E_SUCCESS;
+}
@@ -0,0 +1,133 @@
+/**
+ * @file reference_stats.c
+ * Routines for precomputing the reference side of the quality measures
+ */
+
+#include <stdint.h>
+#include "image.h"
+
+#define REF_STATS_CROP 10	/* border skipped by every measure (mostly a black window) */
+
+/**
+ * @brief Precomputes everything the quality measures need from a reference
+ *
+ * @param[in] ref_img Reference image { grayscale, rgb } (must stay valid
+ *            until the statistics are freed)
+ *
+ * @return Pointer to the reference statistics or NULL
+ *
+ * @note Holds the energy of the reference inside the SNR border, the SSIM
+ *       window statistics of every scale of the region compared by
+ *       calculate_ssim, and the thresholded VR edge map used by the Pratt
+ *       figure of merit, so that evaluating many outputs against one
+ *       ground truth processes the reference only once. The energy and the
+ *       edge map are computed for color images only.
+ * @see #calc_quality_metrics_ref
+ * @see #calc_ssim_metrics_ref
+ * @see #calc_prat_ref
+ * @see #free_ref_stats
+ *
+ * @author Damian Kusnik
+ */
+
+ReferenceStats *
+alloc_ref_stats ( const Image * ref_img )
+{
+ SET_FUNC_NAME ( "alloc_ref_stats" );
+ int num_rows, num_cols;
+ int side;
+ ReferenceStats *ref_stats;
+
+ if ( !( is_gray_img ( ref_img ) || is_rgb_img ( ref_img ) ) )
+  {
+   ERROR_RET ( "Not a grayscale or color image !", NULL );
+  }
+
+ ref_stats = CALLOC_STRUCT ( ReferenceStats );
+ if ( IS_NULL ( ref_stats ) )
+  {
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ num_rows = get_num_rows ( ref_img );
+ num_cols = get_num_cols ( ref_img );
+ ref_stats->ref_img = ref_img;
+ ref_stats->border = REF_STATS_CROP;
+
+ /* SSIM compares the largest square left inside the border */
+ side = MIN_2 ( num_rows, num_cols ) - 2 * REF_STATS_CROP;
+ if ( side > 0 )
+  {
+   ref_stats->ssim = alloc_ssim_ref ( ref_img, REF_STATS_CROP, REF_STATS_CROP,
+				      side, side );
+   if ( IS_NULL ( ref_stats->ssim ) )
+    {
+     free_ref_stats ( ref_stats );
+     return NULL;
+    }
+  }
+
+ if ( is_rgb_img ( ref_img ) )
+  {
+   int iy;
+   uint64_t sum_sq_ref = 0;
+   byte ***ref_data = ( byte *** ) get_img_data_nd ( ref_img );
+
+#pragma omp parallel for schedule(static) reduction(+:sum_sq_ref)
+   for ( iy = REF_STATS_CROP; iy < num_rows - REF_STATS_CROP; iy++ )
+    {
+     const byte *ref_row = ref_data[iy][0];
+     uint64_t row_sq_ref = 0;
+     int ix;
+
+     for ( ix = 3 * REF_STATS_CROP; ix < 3 * ( num_cols - REF_STATS_CROP ); ix++ )
+      {
+       row_sq_ref += ref_row[ix] * ref_row[ix];
+      }
+     sum_sq_ref += row_sq_ref;
+    }
+   ref_stats->sum_sq_ref = ( double ) sum_sq_ref;
+
+   if ( side > 0 )
+    {
+     ref_stats->edge_img = detect_prat_edges ( ref_img, NULL, "oryginal",
+					       &ref_stats->num_edges );
+     if ( IS_NULL ( ref_stats->edge_img ) )
+      {
+       free_ref_stats ( ref_stats );
+       return NULL;
+      }
+    }
+  }
+
+ return ref_stats;
+}
+
+/**
+ * @brief Releases precomputed reference statistics
+ *
+ * @param[in,out] ref_stats Reference statistics (freed on return)
+ *
+ * @return none
+ *
+ * @note The reference image itself is not freed.
+ *
+ * @author Damian Kusnik
+ */
+
+void
+free_ref_stats ( ReferenceStats * ref_stats )
+{
+ if ( IS_NULL ( ref_stats ) )
+  {
+   return;
+  }
+
+ free_ssim_ref ( ref_stats->ssim );
+ if ( !IS_NULL ( ref_stats->edge_img ) )
+  {
+   free_img ( ref_stats->edge_img );
+   free ( ref_stats->edge_img );
+  }
+ free ( ref_stats );
+}
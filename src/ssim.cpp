@@ -0,0 +1,1071 @@
+/**
+ * @file ssim.c
+ * Routines for computing the SSIM and MS-SSIM indices
+ *
+ * The measures follow the defaults of the IQA library that was used before:
+ * SSIM uses an 8x8 box window after the images are averaged down by
+ * round ( min ( width, height ) / 256 ), and MS-SSIM is the five-scale
+ * MS-SSIM* variant of Rouse and Hemami (no stabilization constants) with
+ * an 11x11 Gaussian window and a 9/7 wavelet low-pass filter between the
+ * scales. All windows are separable, so each statistic is computed with a
+ * horizontal pass followed by a vertical pass.
+ */
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "image.h"
+
+#define SSIM_MAX_TAPS 11
+
+#define SSIM_BOX_LEN 8		/* SSIM window */
+
+#define SSIM_GAUSS_LEN 11	/* MS-SSIM window */
+
+#define SSIM_GAUSS_SIGMA 1.5
+
+#define SSIM_NUM_SCALES 5
+
+#define SSIM_K1 0.01
+
+#define SSIM_K2 0.03
+
+#define SSIM_NUM_MOMENTS 3	/* mean b, mean b^2, mean ab of the test plane */
+
+/** @cond INTERNAL_FUNCTION */
+
+typedef struct
+{
+ int len;
+ int is_box;			/* all taps equal ? */
+ double taps[SSIM_MAX_TAPS];
+} SsimKernel;
+
+/* One scale of a reference plane */
+typedef struct
+{
+ int w, h;			/* plane size */
+ int owns_pix;			/* was PIX allocated for this level ? */
+ float *pix;
+ double *mu;			/* window means, ( w - len + 1 ) x ( h - len + 1 ) */
+ float *var;			/* window variances, same size */
+} SsimLevel;
+
+struct SsimReference
+{
+ int row0, col0;		/* region compared */
+ int num_rows, num_cols;
+ int num_planes;		/* luma, then R, G, B for color images */
+ int scale;			/* averaging factor applied before SSIM */
+ int has_ms;			/* large enough for all MS-SSIM scales ? */
+ float *planes;			/* output of split_planes */
+ SsimLevel ssim_level;		/* SSIM statistics of the luma */
+ SsimLevel ms_levels[4][SSIM_NUM_SCALES];	/* MS-SSIM statistics of each plane */
+};
+
+/* exponents of the luminance, contrast, and structure terms at each scale */
+static const double ms_ssim_alphas[SSIM_NUM_SCALES] =
+ { 0.0, 0.0, 0.0, 0.0, 0.1333 };
+static const double ms_ssim_betas[SSIM_NUM_SCALES] =
+ { 0.0448, 0.2856, 0.3001, 0.2363, 0.1333 };
+
+/* 9/7 biorthogonal wavelet low-pass filter */
+static const double ms_ssim_lpf[9] = {
+ 0.026748757411, -0.016864118443, -0.078223266529, 0.266864118443,
+ 0.602949018236, 0.266864118443, -0.078223266529, -0.016864118443,
+ 0.026748757411
+};
+
+static void
+init_box_kernel ( SsimKernel * k, const int len )
+{
+ int i;
+
+ k->len = len;
+ k->is_box = 1;
+ for ( i = 0; i < len; i++ )
+  {
+   k->taps[i] = 1.0 / len;
+  }
+}
+
+static void
+init_gauss_kernel ( SsimKernel * k )
+{
+ int i;
+ double sum = 0.0;
+
+ k->len = SSIM_GAUSS_LEN;
+ k->is_box = 0;
+ for ( i = 0; i < SSIM_GAUSS_LEN; i++ )
+  {
+   double d = i - SSIM_GAUSS_LEN / 2;
+
+   k->taps[i] = exp ( -d * d / ( 2.0 * SSIM_GAUSS_SIGMA * SSIM_GAUSS_SIGMA ) );
+   sum += k->taps[i];
+  }
+ for ( i = 0; i < SSIM_GAUSS_LEN; i++ )
+  {
+   k->taps[i] /= sum;
+  }
+}
+
+static void
+init_lpf_kernel ( SsimKernel * k )
+{
+ k->len = 9;
+ k->is_box = 0;
+ memcpy ( k->taps, ms_ssim_lpf, sizeof ( ms_ssim_lpf ) );
+}
+
+/* Mirrors an out-of-range coordinate back into [ 0, n ) */
+static int
+reflect ( const int i, const int n )
+{
+ if ( i < 0 )
+  {
+   return -1 - i;
+  }
+ if ( i >= n )
+  {
+   return 2 * n - i - 1;
+  }
+ return i;
+}
+
+/*
+ * Low-pass filters a plane with K and keeps every FACTOR-th pixel. The
+ * output has W / FACTOR + ( W & 1 ) columns and likewise rows; an even
+ * length kernel covers the pixel and the ones before it.
+ */
+static float *
+decimate_plane ( const float *src, const int w, const int h, const int factor,
+		 const SsimKernel * k, int *out_w, int *out_h )
+{
+ int iy;
+ int dw = w / factor + ( w & 1 );
+ int dh = h / factor + ( h & 1 );
+ int first = -( k->len / 2 );
+ float *tmp;
+ float *dst;
+
+ tmp = ( float * ) malloc ( ( size_t ) h * dw * sizeof ( float ) );
+ dst = ( float * ) malloc ( ( size_t ) dh * dw * sizeof ( float ) );
+ if ( IS_NULL ( tmp ) || IS_NULL ( dst ) )
+  {
+   free ( tmp );
+   free ( dst );
+   return NULL;
+  }
+
+#pragma omp parallel for schedule(static)
+ for ( iy = 0; iy < h; iy++ )
+  {
+   const float *row = src + ( size_t ) iy * w;
+   float *out = tmp + ( size_t ) iy * dw;
+   int ix, it;
+
+   for ( ix = 0; ix < dw; ix++ )
+    {
+     double sum = 0.0;
+
+     for ( it = 0; it < k->len; it++ )
+      {
+       sum += k->taps[it] * row[reflect ( ix * factor + first + it, w )];
+      }
+     out[ix] = ( float ) sum;
+    }
+  }
+
+#pragma omp parallel for schedule(static)
+ for ( iy = 0; iy < dh; iy++ )
+  {
+   float *out = dst + ( size_t ) iy * dw;
+   int ix, it;
+
+   for ( ix = 0; ix < dw; ix++ )
+    {
+     out[ix] = 0.0f;
+    }
+   for ( it = 0; it < k->len; it++ )
+    {
+     const float *row = tmp + ( size_t ) reflect ( iy * factor + first + it, h ) * dw;
+     float tap = ( float ) k->taps[it];
+
+     for ( ix = 0; ix < dw; ix++ )
+      {
+       out[ix] += tap * row[ix];
+      }
+    }
+  }
+
+ free ( tmp );
+ *out_w = dw;
+ *out_h = dh;
+
+ return dst;
+}
+
+/*
+ * Computes the mean and the variance of LV->PIX under window K at every
+ * position where it fits. These depend on one image only, so the reference
+ * side of each scale is computed once and kept in an SsimReference.
+ */
+static int
+calc_window_stats ( SsimLevel * lv, const SsimKernel * k )
+{
+ int iy;
+ int w = lv->w;
+ int h = lv->h;
+ int dw = w - k->len + 1;
+ int dh = h - k->len + 1;
+ int fail = 0;
+ size_t plane_size;
+ float *moments;
+
+ if ( dw <= 0 || dh <= 0 )
+  {
+   return E_INVARG;
+  }
+
+ plane_size = ( size_t ) h * dw;
+ moments = ( float * ) malloc ( 2 * plane_size * sizeof ( float ) );
+ lv->mu = ( double * ) malloc ( ( size_t ) dh * dw * sizeof ( double ) );
+ lv->var = ( float * ) malloc ( ( size_t ) dh * dw * sizeof ( float ) );
+ if ( IS_NULL ( moments ) || IS_NULL ( lv->mu ) || IS_NULL ( lv->var ) )
+  {
+   free ( moments );
+   return E_NOMEM;
+  }
+
+ /* Horizontal pass: window sums of a and a^2 for every row */
+#pragma omp parallel for schedule(static)
+ for ( iy = 0; iy < h; iy++ )
+  {
+   const float *ra = lv->pix + ( size_t ) iy * w;
+   float *ma = moments + ( size_t ) iy * dw;
+   float *maa = ma + plane_size;
+   int ix, it;
+
+   if ( k->is_box )
+    {
+     /* running sums over the window */
+     double sa = 0.0, saa = 0.0;
+     double tap = k->taps[0];
+
+     for ( it = 0; it < k->len; it++ )
+      {
+       sa += ra[it];
+       saa += ( double ) ra[it] * ra[it];
+      }
+     for ( ix = 0; ; ix++ )
+      {
+       int ox = ix + k->len;
+
+       ma[ix] = ( float ) ( tap * sa );
+       maa[ix] = ( float ) ( tap * saa );
+       if ( ix + 1 >= dw )
+	{
+	 break;
+	}
+       sa += ra[ox] - ra[ix];
+       saa += ( double ) ra[ox] * ra[ox] - ( double ) ra[ix] * ra[ix];
+      }
+    }
+   else
+    {
+     for ( ix = 0; ix < dw; ix++ )
+      {
+       double sa = 0.0, saa = 0.0;
+
+       for ( it = 0; it < k->len; it++ )
+	{
+	 double va = ra[ix + it];
+	 double tap = k->taps[it];
+
+	 sa += tap * va;
+	 saa += tap * va * va;
+	}
+       ma[ix] = ( float ) sa;
+       maa[ix] = ( float ) saa;
+      }
+    }
+  }
+
+ /* Vertical pass */
+#pragma omp parallel reduction(|:fail)
+ {
+  double *acc = ( double * ) malloc ( 2 * dw * sizeof ( double ) );
+  int ix, it;
+
+  if ( IS_NULL ( acc ) )
+   {
+    fail = 1;
+   }
+
+#pragma omp for schedule(static)
+  for ( iy = 0; iy < dh; iy++ )
+   {
+    double *mu = lv->mu + ( size_t ) iy * dw;
+    float *var = lv->var + ( size_t ) iy * dw;
+
+    if ( IS_NULL ( acc ) )
+     {
+      continue;
+     }
+
+    memset ( acc, 0, 2 * dw * sizeof ( double ) );
+    for ( it = 0; it < k->len; it++ )
+     {
+      const float *src_a = moments + ( size_t ) ( iy + it ) * dw;
+      const float *src_aa = src_a + plane_size;
+      double tap = k->taps[it];
+
+      for ( ix = 0; ix < dw; ix++ )
+       {
+	acc[ix] += tap * src_a[ix];
+	acc[dw + ix] += tap * src_aa[ix];
+       }
+     }
+
+    for ( ix = 0; ix < dw; ix++ )
+     {
+      mu[ix] = acc[ix];
+      var[ix] = ( float ) ( acc[dw + ix] - acc[ix] * acc[ix] );
+     }
+   }
+
+  free ( acc );
+ }
+
+ free ( moments );
+
+ return fail ? E_NOMEM : E_SUCCESS;
+}
+
+/*
+ * Slides window K over every position where it fits in the reference level
+ * REF and plane B and averages the per-window index. With IS_MS_STAR == 0,
+ * OUT[0] receives the mean SSIM; otherwise OUT[0..2] receive the mean
+ * luminance, contrast, and structure terms of MS-SSIM* (no stabilization
+ * constants).
+ */
+static int
+calc_ssim_means ( const SsimLevel * ref, const float *b, const SsimKernel * k,
+		  const int is_ms_star, double *out )
+{
+ int iy;
+ int w = ref->w;
+ int h = ref->h;
+ int dw = w - k->len + 1;
+ int dh = h - k->len + 1;
+ int num_terms = is_ms_star ? 3 : 1;
+ int fail = 0;
+ size_t plane_size;
+ double c1, c2;
+ double *row_sums;
+ float *moments;
+
+ if ( dw <= 0 || dh <= 0 )
+  {
+   return E_INVARG;
+  }
+
+ plane_size = ( size_t ) h * dw;
+ moments = ( float * ) malloc ( SSIM_NUM_MOMENTS * plane_size * sizeof ( float ) );
+ row_sums = ( double * ) calloc ( ( size_t ) dh * num_terms, sizeof ( double ) );
+ if ( IS_NULL ( moments ) || IS_NULL ( row_sums ) )
+  {
+   free ( moments );
+   free ( row_sums );
+   return E_NOMEM;
+  }
+
+ /* Horizontal pass: window sums of b, b^2, and ab for every row */
+#pragma omp parallel for schedule(static)
+ for ( iy = 0; iy < h; iy++ )
+  {
+   const float *ra = ref->pix + ( size_t ) iy * w;
+   const float *rb = b + ( size_t ) iy * w;
+   float *mb = moments + ( size_t ) iy * dw;
+   float *mbb = mb + plane_size;
+   float *mab = mbb + plane_size;
+   int ix, it;
+
+   if ( k->is_box )
+    {
+     /* running sums over the window */
+     double sb = 0.0, sbb = 0.0, sab = 0.0;
+     double tap = k->taps[0];
+
+     for ( it = 0; it < k->len; it++ )
+      {
+       sb += rb[it];
+       sbb += ( double ) rb[it] * rb[it];
+       sab += ( double ) ra[it] * rb[it];
+      }
+     for ( ix = 0; ; ix++ )
+      {
+       int ox = ix + k->len;
+
+       mb[ix] = ( float ) ( tap * sb );
+       mbb[ix] = ( float ) ( tap * sbb );
+       mab[ix] = ( float ) ( tap * sab );
+       if ( ix + 1 >= dw )
+	{
+	 break;
+	}
+       sb += rb[ox] - rb[ix];
+       sbb += ( double ) rb[ox] * rb[ox] - ( double ) rb[ix] * rb[ix];
+       sab += ( double ) ra[ox] * rb[ox] - ( double ) ra[ix] * rb[ix];
+      }
+    }
+   else
+    {
+     for ( ix = 0; ix < dw; ix++ )
+      {
+       double sb = 0.0, sbb = 0.0, sab = 0.0;
+
+       for ( it = 0; it < k->len; it++ )
+	{
+	 double va = ra[ix + it];
+	 double vb = rb[ix + it];
+	 double tap = k->taps[it];
+
+	 sb += tap * vb;
+	 sbb += tap * vb * vb;
+	 sab += tap * va * vb;
+	}
+       mb[ix] = ( float ) sb;
+       mbb[ix] = ( float ) sbb;
+       mab[ix] = ( float ) sab;
+      }
+    }
+  }
+
+ c1 = is_ms_star ? 0.0 : ( SSIM_K1 * MAX_GRAY ) * ( SSIM_K1 * MAX_GRAY );
+ c2 = is_ms_star ? 0.0 : ( SSIM_K2 * MAX_GRAY ) * ( SSIM_K2 * MAX_GRAY );
+
+ /* Vertical pass fused with the per-window index */
+#pragma omp parallel reduction(|:fail)
+ {
+  double *acc = ( double * ) malloc ( SSIM_NUM_MOMENTS * dw * sizeof ( double ) );
+  int ix, it, im;
+
+  if ( IS_NULL ( acc ) )
+   {
+    fail = 1;
+   }
+
+#pragma omp for schedule(static)
+  for ( iy = 0; iy < dh; iy++ )
+   {
+    const double *ref_mu = ref->mu + ( size_t ) iy * dw;
+    const float *ref_var = ref->var + ( size_t ) iy * dw;
+    double *row_sum = row_sums + ( size_t ) iy * num_terms;
+
+    if ( IS_NULL ( acc ) )
+     {
+      continue;
+     }
+
+    memset ( acc, 0, SSIM_NUM_MOMENTS * dw * sizeof ( double ) );
+    for ( it = 0; it < k->len; it++ )
+     {
+      double tap = k->taps[it];
+
+      for ( im = 0; im < SSIM_NUM_MOMENTS; im++ )
+       {
+	const float *src = moments + im * plane_size + ( size_t ) ( iy + it ) * dw;
+	double *dst = acc + im * dw;
+
+	for ( ix = 0; ix < dw; ix++ )
+	 {
+	  dst[ix] += tap * src[ix];
+	 }
+       }
+     }
+
+    for ( ix = 0; ix < dw; ix++ )
+     {
+      double mu_a = ref_mu[ix];
+      double mu_b = acc[ix];
+      double var_a = ref_var[ix];
+      /* rounded like VAR_A so that identical planes give exactly 1 */
+      double var_b = ( float ) ( acc[dw + ix] - mu_b * mu_b );
+      double cov = ( float ) ( acc[2 * dw + ix] - mu_a * mu_b );
+
+      if ( !is_ms_star )
+       {
+	row_sum[0] += ( ( 2.0 * mu_a * mu_b + c1 ) * ( 2.0 * cov + c2 ) ) /
+	 ( ( mu_a * mu_a + mu_b * mu_b + c1 ) * ( var_a + var_b + c2 ) );
+       }
+      else
+       {
+	double sigma_ab;
+
+	var_a = MAX_2 ( var_a, 0.0 );
+	var_b = MAX_2 ( var_b, 0.0 );
+	sigma_ab = sqrt ( var_a * var_b );
+
+	/* luminance */
+	if ( mu_a * mu_a + mu_b * mu_b == 0.0 )
+	 {
+	  row_sum[0] += 1.0;
+	 }
+	else
+	 {
+	  row_sum[0] += 2.0 * mu_a * mu_b / ( mu_a * mu_a + mu_b * mu_b );
+	 }
+
+	/* contrast */
+	if ( var_a + var_b == 0.0 )
+	 {
+	  row_sum[1] += 1.0;
+	 }
+	else
+	 {
+	  row_sum[1] += 2.0 * sigma_ab / ( var_a + var_b );
+	 }
+
+	/* structure */
+	if ( sigma_ab == 0.0 )
+	 {
+	  row_sum[2] += ( var_a == 0.0 && var_b == 0.0 ) ? 1.0 : 0.0;
+	 }
+	else
+	 {
+	  row_sum[2] += cov / sigma_ab;
+	 }
+       }
+     }
+   }
+
+  free ( acc );
+ }
+
+ /* Sum the rows in order so that the result does not depend on the threads */
+ if ( !fail )
+  {
+   int it;
+
+   for ( it = 0; it < num_terms; it++ )
+    {
+     out[it] = 0.0;
+    }
+   for ( iy = 0; iy < dh; iy++ )
+    {
+     for ( it = 0; it < num_terms; it++ )
+      {
+       out[it] += row_sums[( size_t ) iy * num_terms + it];
+      }
+    }
+   for ( it = 0; it < num_terms; it++ )
+    {
+     out[it] /= ( double ) dw * dh;
+    }
+  }
+
+ free ( moments );
+ free ( row_sums );
+
+ return fail ? E_NOMEM : E_SUCCESS;
+}
+
+/*
+ * Splits a region of a byte image into float planes in a single pass:
+ * luma (as computed by rgb_to_gray) followed by the R, G, and B bands for
+ * color images, or the gray band alone.
+ */
+static float *
+split_planes ( const Image * img, const int row0, const int col0,
+	       const int num_rows, const int num_cols, int *num_planes )
+{
+ int iy;
+ int is_rgb = is_rgb_img ( img );
+ size_t plane_size = ( size_t ) num_rows * num_cols;
+ float *planes;
+
+ *num_planes = is_rgb ? 4 : 1;
+ planes = ( float * ) malloc ( *num_planes * plane_size * sizeof ( float ) );
+ if ( IS_NULL ( planes ) )
+  {
+   return NULL;
+  }
+
+#pragma omp parallel for schedule(static)
+ for ( iy = 0; iy < num_rows; iy++ )
+  {
+   float *luma = planes + ( size_t ) iy * num_cols;
+   int ix;
+
+   if ( !is_rgb )
+    {
+     const byte *src = img->data_nd.byte_data_1b[row0 + iy] + col0;
+
+     for ( ix = 0; ix < num_cols; ix++ )
+      {
+       luma[ix] = src[ix];
+      }
+    }
+   else
+    {
+     const byte *src = img->data_nd.byte_data_3b[row0 + iy][col0];
+     float *red = luma + plane_size;
+     float *green = red + plane_size;
+     float *blue = green + plane_size;
+
+     for ( ix = 0; ix < num_cols; ix++, src += 3 )
+      {
+       luma[ix] = ( byte ) ( 0.29893602129378 * src[0] +
+			     0.58704307445112 * src[1] +
+			     0.11402090425510 * src[2] );
+       red[ix] = src[0];
+       green[ix] = src[1];
+       blue[ix] = src[2];
+      }
+    }
+  }
+
+ return planes;
+}
+
+
+/* Averaging factor applied before SSIM so that large images are compared at ~256 pixels */
+static int
+get_ssim_scale ( const int w, const int h )
+{
+ return MAX_2 ( 1, ( int ) floor ( MIN_2 ( w, h ) / 256.0 + 0.5 ) );
+}
+
+/* Is the plane large enough for every MS-SSIM scale ? */
+static int
+has_ms_scales ( int w, int h )
+{
+ int is;
+
+ for ( is = 0; is < SSIM_NUM_SCALES; is++ )
+  {
+   if ( w < SSIM_GAUSS_LEN || h < SSIM_GAUSS_LEN )
+    {
+     return 0;
+    }
+   w /= 2;
+   h /= 2;
+  }
+
+ return 1;
+}
+
+static void
+free_level ( SsimLevel * lv )
+{
+ if ( lv->owns_pix )
+  {
+   free ( lv->pix );
+  }
+ free ( lv->mu );
+ free ( lv->var );
+ memset ( lv, 0, sizeof ( SsimLevel ) );
+}
+
+/*
+ * Computes SSIM and MS-SSIM of the matching region of TEST_IMG against the
+ * precomputed reference. Only the test planes are filtered and decimated.
+ */
+static int
+eval_ssim ( const SsimReference * sref, const Image * test_img,
+	    SsimMetrics * sm )
+{
+ int ret_code = E_SUCCESS;
+ int num_planes;
+ int ip, is;
+ size_t plane_size = ( size_t ) sref->num_rows * sref->num_cols;
+ float *test_planes;
+ SsimKernel box, window, lpf;
+
+ test_planes = split_planes ( test_img, sref->row0, sref->col0,
+			      sref->num_rows, sref->num_cols, &num_planes );
+ if ( IS_NULL ( test_planes ) )
+  {
+   return E_NOMEM;
+  }
+
+ init_box_kernel ( &box, SSIM_BOX_LEN );
+ init_gauss_kernel ( &window );
+ init_lpf_kernel ( &lpf );
+
+ /* SSIM of the luma */
+ if ( sref->scale == 1 )
+  {
+   ret_code = calc_ssim_means ( &sref->ssim_level, test_planes, &box, 0,
+				&sm->ssim );
+  }
+ else
+  {
+   int dw, dh;
+   float *db;
+   SsimKernel avg;
+
+   init_box_kernel ( &avg, sref->scale );
+   db = decimate_plane ( test_planes, sref->num_cols, sref->num_rows,
+			 sref->scale, &avg, &dw, &dh );
+   ret_code = IS_NULL ( db ) ? E_NOMEM :
+    calc_ssim_means ( &sref->ssim_level, db, &box, 0, &sm->ssim );
+   free ( db );
+  }
+
+ /* MS-SSIM of the luma and of each color band */
+ for ( ip = 0; ip < num_planes && !ret_code; ip++ )
+  {
+   const float *cur_b = test_planes + ip * plane_size;
+   double ms_ssim = HUGE_VAL;
+
+   if ( sref->has_ms )
+    {
+     ms_ssim = 1.0;
+     for ( is = 0; is < SSIM_NUM_SCALES && !ret_code; is++ )
+      {
+       const SsimLevel *lv = &sref->ms_levels[ip][is];
+       float *next_b = NULL;
+       double lcs[3];
+       int dw, dh;
+
+       ret_code = calc_ssim_means ( lv, cur_b, &window, 1, lcs );
+       if ( !ret_code )
+	{
+	 ms_ssim *= pow ( lcs[0], ms_ssim_alphas[is] ) *
+	  pow ( lcs[1], ms_ssim_betas[is] ) * pow ( fabs ( lcs[2] ), ms_ssim_betas[is] );
+	}
+
+       if ( !ret_code && is + 1 < SSIM_NUM_SCALES )
+	{
+	 next_b = decimate_plane ( cur_b, lv->w, lv->h, 2, &lpf, &dw, &dh );
+	 if ( IS_NULL ( next_b ) )
+	  {
+	   ret_code = E_NOMEM;
+	  }
+	}
+
+       if ( is > 0 )
+	{
+	 free ( ( float * ) cur_b );
+	}
+       cur_b = next_b;
+      }
+    }
+
+   if ( ip == 0 )
+    {
+     sm->ms_ssim = ms_ssim;
+    }
+   else
+    {
+     sm->ms_ssim_band[ip - 1] = ms_ssim;
+    }
+  }
+
+ free ( test_planes );
+
+ if ( !ret_code )
+  {
+   if ( num_planes == 1 )
+    {
+     sm->ms_ssim_band[0] = sm->ms_ssim_band[1] = sm->ms_ssim_band[2] =
+      sm->ms_ssim;
+    }
+   sm->ms_ssim_avg = sm->ms_ssim_band[0] / 3.0 + sm->ms_ssim_band[1] / 3.0 +
+    sm->ms_ssim_band[2] / 3.0;
+  }
+
+ return ret_code;
+}
+
+/** @endcond INTERNAL_FUNCTION */
+
+/**
+ * @brief Precomputes the reference side of the SSIM and MS-SSIM indices
+ *
+ * @param[in] ref_img Reference image { grayscale, rgb }
+ * @param[in] row0 First row of the region compared
+ * @param[in] col0 First column of the region compared
+ * @param[in] num_rows Number of rows of the region
+ * @param[in] num_cols Number of columns of the region
+ *
+ * @return Pointer to the reference statistics or NULL
+ *
+ * @note Holds the luma and color planes of the region, their MS-SSIM
+ *       pyramids, and the window means and variances of every scale,
+ *       about 16 bytes per pixel and plane in total.
+ * @see #calc_ssim_metrics_ref
+ *
+ * @author Damian Kusnik
+ */
+
+SsimReference *
+alloc_ssim_ref ( const Image * ref_img, const int row0, const int col0,
+		 const int num_rows, const int num_cols )
+{
+ SET_FUNC_NAME ( "alloc_ssim_ref" );
+ int ret_code = E_SUCCESS;
+ int ip, is;
+ size_t plane_size;
+ SsimReference *sref;
+ SsimKernel box, window, lpf;
+
+ if ( !( is_gray_img ( ref_img ) || is_rgb_img ( ref_img ) ) )
+  {
+   ERROR_RET ( "Not a grayscale or color image !", NULL );
+  }
+
+ if ( row0 < 0 || col0 < 0 || num_rows <= 0 || num_cols <= 0 ||
+      row0 + num_rows > get_num_rows ( ref_img ) ||
+      col0 + num_cols > get_num_cols ( ref_img ) )
+  {
+   ERROR_RET ( "Invalid region !", NULL );
+  }
+
+ sref = CALLOC_STRUCT ( SsimReference );
+ if ( IS_NULL ( sref ) )
+  {
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ sref->row0 = row0;
+ sref->col0 = col0;
+ sref->num_rows = num_rows;
+ sref->num_cols = num_cols;
+ sref->scale = get_ssim_scale ( num_cols, num_rows );
+ sref->has_ms = has_ms_scales ( num_cols, num_rows );
+ sref->planes = split_planes ( ref_img, row0, col0, num_rows, num_cols,
+			       &sref->num_planes );
+ if ( IS_NULL ( sref->planes ) )
+  {
+   free ( sref );
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+ plane_size = ( size_t ) num_rows * num_cols;
+
+ init_box_kernel ( &box, SSIM_BOX_LEN );
+ init_gauss_kernel ( &window );
+ init_lpf_kernel ( &lpf );
+
+ /* SSIM window statistics of the (averaged) luma */
+ if ( sref->scale == 1 )
+  {
+   sref->ssim_level.pix = sref->planes;
+   sref->ssim_level.w = num_cols;
+   sref->ssim_level.h = num_rows;
+  }
+ else
+  {
+   SsimKernel avg;
+
+   init_box_kernel ( &avg, sref->scale );
+   sref->ssim_level.owns_pix = 1;
+   sref->ssim_level.pix = decimate_plane ( sref->planes, num_cols, num_rows,
+					    sref->scale, &avg,
+					    &sref->ssim_level.w,
+					    &sref->ssim_level.h );
+   if ( IS_NULL ( sref->ssim_level.pix ) )
+    {
+     ret_code = E_NOMEM;
+    }
+  }
+ if ( !ret_code )
+  {
+   ret_code = calc_window_stats ( &sref->ssim_level, &box );
+  }
+
+ /* MS-SSIM pyramid and window statistics of each plane */
+ for ( ip = 0; ip < sref->num_planes && sref->has_ms && !ret_code; ip++ )
+  {
+   SsimLevel *lv = sref->ms_levels[ip];
+
+   lv[0].pix = sref->planes + ip * plane_size;
+   lv[0].w = num_cols;
+   lv[0].h = num_rows;
+   for ( is = 0; is < SSIM_NUM_SCALES && !ret_code; is++ )
+    {
+     ret_code = calc_window_stats ( &lv[is], &window );
+     if ( !ret_code && is + 1 < SSIM_NUM_SCALES )
+      {
+       lv[is + 1].owns_pix = 1;
+       lv[is + 1].pix = decimate_plane ( lv[is].pix, lv[is].w, lv[is].h, 2,
+					 &lpf, &lv[is + 1].w, &lv[is + 1].h );
+       if ( IS_NULL ( lv[is + 1].pix ) )
+	{
+	 ret_code = E_NOMEM;
+	}
+      }
+    }
+  }
+
+ if ( ret_code )
+  {
+   free_ssim_ref ( sref );
+   if ( ret_code == E_INVARG )
+    {
+     ERROR_RET ( "Region is too small !", NULL );
+    }
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ return sref;
+}
+
+/**
+ * @brief Releases precomputed SSIM reference statistics
+ *
+ * @param[in,out] sref Reference statistics (freed on return)
+ *
+ * @return none
+ *
+ * @author Damian Kusnik
+ */
+
+void
+free_ssim_ref ( SsimReference * sref )
+{
+ int ip, is;
+
+ if ( IS_NULL ( sref ) )
+  {
+   return;
+  }
+
+ free_level ( &sref->ssim_level );
+ for ( ip = 0; ip < 4; ip++ )
+  {
+   for ( is = 0; is < SSIM_NUM_SCALES; is++ )
+    {
+     free_level ( &sref->ms_levels[ip][is] );
+    }
+  }
+ free ( sref->planes );
+ free ( sref );
+}
+
+/**
+ * @brief Computes the SSIM and MS-SSIM indices of a test image
+ *
+ * @param[in] ref_img Reference image { grayscale, rgb }
+ * @param[in] test_img Test image { grayscale, rgb }
+ * @param[in] row0 First row of the region compared
+ * @param[in] col0 First column of the region compared
+ * @param[in] num_rows Number of rows of the region
+ * @param[in] num_cols Number of columns of the region
+ * @param[out] sm SSIM measures
+ *
+ * @return E_SUCCESS or an appropriate error code
+ *
+ * @note The luma and color bands are read from the interleaved pixels in a
+ *       single pass; each window sweep is then parallel over rows. SSIM and
+ *       MS-SSIM are computed on the luma; MS-SSIM is also computed on each
+ *       color band. For grayscale images the band values equal the luma
+ *       values. MS-SSIM is infinite if the region is too small for five
+ *       scales. When many images are compared with one reference, build its
+ *       statistics once and use calc_ssim_metrics_ref.
+ * @see #calculate_ssim
+ * @ref Wang Z., Bovik A.C., Sheikh H.R., and Simoncelli E.P. (2004) "Image
+ *      Quality Assessment: From Error Visibility to Structural Similarity"
+ *      IEEE Trans. on Image Processing, 13(4): 600-612
+ * @ref Rouse D.M. and Hemami S.S. (2008) "Analyzing the Role of Visual
+ *      Structure in the Recognition of Natural Image Content with Multi-Scale
+ *      SSIM" Proc. SPIE 6806, Human Vision and Electronic Imaging XIII
+ *
+ * @author Damian Kusnik
+ */
+
+int
+calc_ssim_metrics ( const Image * ref_img, const Image * test_img,
+		    const int row0, const int col0, const int num_rows,
+		    const int num_cols, SsimMetrics * sm )
+{
+ SET_FUNC_NAME ( "calc_ssim_metrics" );
+ int ret_code;
+ SsimReference *sref;
+
+ if ( !( is_gray_img ( ref_img ) || is_rgb_img ( ref_img ) ) ||
+      get_pix_type ( ref_img ) != get_pix_type ( test_img ) )
+  {
+   ERROR_RET ( "Images must be both grayscale or both color !", E_INVOBJ );
+  }
+
+ if ( get_num_rows ( ref_img ) != get_num_rows ( test_img ) ||
+      get_num_cols ( ref_img ) != get_num_cols ( test_img ) )
+  {
+   ERROR_RET ( "Image dimensions must be equal !", E_INVARG );
+  }
+
+ begin_perf_stage ( PERF_STAGE_METRICS );
+ sref = alloc_ssim_ref ( ref_img, row0, col0, num_rows, num_cols );
+ if ( IS_NULL ( sref ) )
+  {
+   end_perf_stage ( PERF_STAGE_METRICS );
+   return E_FAILURE;
+  }
+
+ ret_code = eval_ssim ( sref, test_img, sm );
+ free_ssim_ref ( sref );
+ end_perf_stage ( PERF_STAGE_METRICS );
+
+ if ( ret_code )
+  {
+   ERROR_RET ( "Insufficient memory !", ret_code );
+  }
+
+ return E_SUCCESS;
+}
+
+/**
+ * @brief Computes the SSIM and MS-SSIM indices of a test image against
+ *        precomputed reference statistics
+ *
+ * @param[in] ref_stats Reference statistics
+ * @param[in] test_img Test image { grayscale, rgb }
+ * @param[out] sm SSIM measures
+ *
+ * @return E_SUCCESS or an appropriate error code
+ *
+ * @note Compares the region chosen by alloc_ref_stats; the results equal
+ *       those of calc_ssim_metrics on the same region.
+ * @see #calc_ssim_metrics
+ * @see #alloc_ref_stats
+ *
+ * @author Damian Kusnik
+ */
+
+int
+calc_ssim_metrics_ref ( const ReferenceStats * ref_stats,
+			const Image * test_img, SsimMetrics * sm )
+{
+ SET_FUNC_NAME ( "calc_ssim_metrics_ref" );
+ int ret_code;
+
+ if ( IS_NULL ( ref_stats ) || IS_NULL ( ref_stats->ssim ) )
+  {
+   ERROR_RET ( "Invalid reference statistics !", E_INVARG );
+  }
+
+ if ( get_pix_type ( ref_stats->ref_img ) != get_pix_type ( test_img ) )
+  {
+   ERROR_RET ( "Images must be both grayscale or both color !", E_INVOBJ );
+  }
+
+ if ( get_num_rows ( ref_stats->ref_img ) != get_num_rows ( test_img ) ||
+      get_num_cols ( ref_stats->ref_img ) != get_num_cols ( test_img ) )
+  {
+   ERROR_RET ( "Image dimensions must be equal !", E_INVARG );
+  }
+
+ begin_perf_stage ( PERF_STAGE_METRICS );
+ ret_code = eval_ssim ( ref_stats->ssim, test_img, sm );
+ end_perf_stage ( PERF_STAGE_METRICS );
+ if ( ret_code )
+  {
+   ERROR_RET ( "Insufficient memory !", ret_code );
+  }
+
+ return E_SUCCESS;
+}
@@ -0,0 +1,263 @@
+/**
+ * @file tga_io.c
+ * Routines for reading/writing uncompressed TGA files
+ */
+
+#include "image.h"
+
+#define TGA_HEADER_SIZE 18
+
+#define TGA_COLOR_MAPPED 1	/* uncompressed, color-mapped */
+
+#define TGA_TRUE_COLOR 2	/* uncompressed, true-color */
+
+#define TGA_GRAY 3		/* uncompressed, black-and-white */
+
+#define TGA_TOP_TO_BOTTOM 0x20	/* image descriptor: origin at the top */
+
+#define TGA_RIGHT_TO_LEFT 0x10	/* image descriptor: origin at the right */
+
+/** @cond INTERNAL_FUNCTION */
+
+static int
+get_le_short ( const byte * buf )
+{
+ return buf[0] | ( buf[1] << 8 );
+}
+
+/** @endcond INTERNAL_FUNCTION */
+
+/**
+ * @brief Reads an uncompressed TGA file
+ *
+ * @param[in,out] file_ptr File pointer (positioned at the start of the file)
+ *
+ * @return Pointer to the image or NULL
+ *
+ * @note The following TGA files are supported: 1) 8-bit black-and-white
+ *       2) 24 or 32-bit true-color 3) 8-bit color-mapped with a 24 or 32-bit
+ *       map. Both bottom-up and top-down files are accepted; run-length
+ *       encoded files are not. The file is memory mapped and each row is
+ *       converted straight from the mapping.
+ * @ref http://www.fileformat.info/format/tga/egff.htm
+ *
+ * @author Damian Kusnik
+ */
+
+Image *
+read_tga ( FILE * file_ptr )
+{
+ SET_FUNC_NAME ( "read_tga" );
+ int ir, ic;
+ int img_type, descriptor;
+ int num_rows, num_cols;
+ int pix_bytes;
+ int map_first, map_len, map_bytes;
+ int is_top_down;
+ size_t data_offset, row_size;
+ const byte *hdr;
+ const byte *cmap;
+ FileMap map;
+ Image *img;
+
+ if ( map_file ( file_ptr, &map ) )
+  {
+   ERROR_RET ( "Cannot read file !", NULL );
+  }
+
+ hdr = map.data;
+ if ( map.size < TGA_HEADER_SIZE )
+  {
+   unmap_file ( &map );
+   ERROR_RET ( "Invalid TGA header !", NULL );
+  }
+
+ img_type = hdr[2];
+ map_first = get_le_short ( hdr + 3 );
+ map_len = get_le_short ( hdr + 5 );
+ map_bytes = ( hdr[1] ? ( hdr[7] + 7 ) / 8 : 0 );
+ num_cols = get_le_short ( hdr + 12 );
+ num_rows = get_le_short ( hdr + 14 );
+ pix_bytes = hdr[16] / 8;
+ descriptor = hdr[17];
+ is_top_down = ( descriptor & TGA_TOP_TO_BOTTOM ) != 0;
+
+ if ( !( ( img_type == TGA_GRAY && hdr[16] == 8 ) ||
+	 ( img_type == TGA_TRUE_COLOR && ( hdr[16] == 24 || hdr[16] == 32 ) ) ||
+	 ( img_type == TGA_COLOR_MAPPED && hdr[16] == 8 &&
+	   ( map_bytes == 3 || map_bytes == 4 ) ) ) ||
+      ( descriptor & TGA_RIGHT_TO_LEFT ) )
+  {
+   unmap_file ( &map );
+   ERROR ( "Cannot read TGA type %d with %d-bit pixels { %s } !",
+	   img_type, hdr[16], error_str ( E_UNIMPL ) );
+   return NULL;
+  }
+
+ if ( num_rows <= 0 || num_cols <= 0 )
+  {
+   unmap_file ( &map );
+   ERROR_RET ( "Invalid TGA dimensions !", NULL );
+  }
+
+ /* header, image id, color map, pixels */
+ cmap = hdr + TGA_HEADER_SIZE + hdr[0];
+ data_offset = TGA_HEADER_SIZE + hdr[0] + ( size_t ) map_len * map_bytes;
+ row_size = ( size_t ) num_cols * pix_bytes;
+ if ( data_offset + row_size * num_rows > map.size )
+  {
+   unmap_file ( &map );
+   ERROR_RET ( "Truncated TGA file !", NULL );
+  }
+
+ img = alloc_img ( img_type == TGA_GRAY ? PIX_GRAY : PIX_RGB, num_rows, num_cols );
+ if ( IS_NULL ( img ) )
+  {
+   unmap_file ( &map );
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ for ( ir = 0; ir < num_rows; ir++ )
+  {
+   const byte *src = map.data + data_offset +
+    row_size * ( is_top_down ? ir : num_rows - 1 - ir );
+
+   if ( img_type == TGA_GRAY )
+    {
+     memcpy ( img->data_nd.byte_data_1b[ir], src, row_size );
+    }
+   else if ( img_type == TGA_COLOR_MAPPED )
+    {
+     byte *dst = img->data_nd.byte_data_3b[ir][0];
+
+     for ( ic = 0; ic < num_cols; ic++ )
+      {
+       int index = src[ic] - map_first;
+
+       if ( index >= 0 && index < map_len )
+	{
+	 const byte *entry = cmap + index * map_bytes;
+
+	 dst[3 * ic] = entry[2];
+	 dst[3 * ic + 1] = entry[1];
+	 dst[3 * ic + 2] = entry[0];
+	}
+       else
+	{
+	 dst[3 * ic] = dst[3 * ic + 1] = dst[3 * ic + 2] = 0;
+	}
+      }
+    }
+   else
+    {
+     byte *dst = img->data_nd.byte_data_3b[ir][0];
+
+     /* pixels are stored B, G, R (, A) */
+     for ( ic = 0; ic < num_cols; ic++ )
+      {
+       dst[3 * ic] = src[pix_bytes * ic + 2];
+       dst[3 * ic + 1] = src[pix_bytes * ic + 1];
+       dst[3 * ic + 2] = src[pix_bytes * ic];
+      }
+    }
+  }
+
+ unmap_file ( &map );
+
+ return img;
+}
+
+/**
+ * @brief Writes an uncompressed TGA file
+ *
+ * @param[in] img Image pointer { binary, grayscale, rgb }
+ * @param[in,out] file_ptr File pointer
+ *
+ * @return E_SUCCESS or an appropriate error code
+ *
+ * @note Binary and grayscale images are written as 8-bit black-and-white
+ *       files (binary pixels scaled to 0/255), RGB images as 24-bit
+ *       true-color files. Rows are stored top-down, so grayscale rows
+ *       are written as they are.
+ * @ref http://www.fileformat.info/format/tga/egff.htm
+ *
+ * @author Damian Kusnik
+ */
+
+int
+write_tga ( const Image * img, FILE * file_ptr )
+{
+ int ir, ic;
+ int num_rows, num_cols;
+ int is_rgb;
+ size_t row_size;
+ byte header[TGA_HEADER_SIZE];
+ byte *row;
+
+ if ( !is_byte_img ( img ) )
+  {
+   return E_INVOBJ;
+  }
+
+ num_rows = get_num_rows ( img );
+ num_cols = get_num_cols ( img );
+ if ( num_rows > USHRT_MAX || num_cols > USHRT_MAX )
+  {
+   return E_INVARG;
+  }
+
+ is_rgb = is_rgb_img ( img );
+ row_size = ( size_t ) num_cols * ( is_rgb ? 3 : 1 );
+
+ memset ( header, 0, sizeof ( header ) );
+ header[2] = ( byte ) ( is_rgb ? TGA_TRUE_COLOR : TGA_GRAY );
+ header[12] = ( byte ) num_cols;
+ header[13] = ( byte ) ( num_cols >> 8 );
+ header[14] = ( byte ) num_rows;
+ header[15] = ( byte ) ( num_rows >> 8 );
+ header[16] = ( byte ) ( is_rgb ? 24 : 8 );
+ header[17] = TGA_TOP_TO_BOTTOM;
+ ( void ) fwrite ( header, 1, sizeof ( header ), file_ptr );
+
+ if ( is_gray_img ( img ) )
+  {
+   /* rows are contiguous, so the pixel data goes out in one piece */
+   ( void ) fwrite ( img->data_1d.byte_data, 1, row_size * num_rows, file_ptr );
+   return ferror ( file_ptr ) ? E_FAILURE : E_SUCCESS;
+  }
+
+ row = ( byte * ) malloc ( row_size );
+ if ( IS_NULL ( row ) )
+  {
+   return E_NOMEM;
+  }
+
+ for ( ir = 0; ir < num_rows; ir++ )
+  {
+   if ( is_rgb )
+    {
+     const byte *src = img->data_nd.byte_data_3b[ir][0];
+
+     for ( ic = 0; ic < num_cols; ic++ )
+      {
+       row[3 * ic] = src[3 * ic + 2];
+       row[3 * ic + 1] = src[3 * ic + 1];
+       row[3 * ic + 2] = src[3 * ic];
+      }
+    }
+   else
+    {
+     const byte *src = img->data_nd.byte_data_1b[ir];
+
+     for ( ic = 0; ic < num_cols; ic++ )
+      {
+       row[ic] = ( byte ) ( src[ic] ? MAX_GRAY : 0 );
+      }
+    }
+   ( void ) fwrite ( row, 1, row_size, file_ptr );
+  }
+
+ free ( row );
+
+ return ferror ( file_ptr ) ? E_FAILURE : E_SUCCESS;
+}
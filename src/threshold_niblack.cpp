@@ -0,0 +1,118 @@
+/**
+ * @file threshold_niblack.c
+ * Routines for local thresholding using Niblack's method
+ */
+
+#include "image.h"
+
+/**
+ * @brief Thresholds an image using Niblack's method
+ *
+ * @param[in] in_img Image pointer { grayscale }
+ * @param[in] win_size Dimension of the local window { positive-odd }
+ * @param[in] k_value Weight of the local standard deviation
+ *                    (usually -0.2 for dark objects)
+ *
+ * @return Pointer to the binary image or NULL
+ *
+ * @note Each pixel is compared with the threshold M + K_VALUE * S, where M
+ *       and S are the mean and standard deviation of the window centered on
+ *       it; pixels above it become OBJECT and the others BACKGROUND.
+ *       Windows are cut off at the image border. The local statistics come
+ *       from summed-area tables, so the cost per pixel does not depend on
+ *       WIN_SIZE.
+ * @ref Niblack W. (1986) An Introduction to Digital Image Processing,
+ *      Prentice Hall, 115-116
+ * @see #threshold_sauvola
+ * @see #calc_local_stats
+ *
+ * @author Damian Kusnik
+ */
+
+Image *
+threshold_niblack ( const Image * in_img, const int win_size,
+		    const double k_value )
+{
+ SET_FUNC_NAME ( "threshold_niblack" );
+ int num_rows, num_cols;
+ int iy;
+ int fail = 0;
+ byte *in_data, *out_data;
+ IntegralImage *int_img;
+ Image *out_img;
+
+ if ( !is_gray_img ( in_img ) )
+  {
+   ERROR_RET ( "Not a grayscale image !", NULL );
+  }
+
+ if ( !IS_POS_ODD ( win_size ) )
+  {
+   ERROR ( "Window size ( %d ) must be positive and odd !", win_size );
+   return NULL;
+  }
+
+ num_rows = get_num_rows ( in_img );
+ num_cols = get_num_cols ( in_img );
+
+ int_img = alloc_integral_img ( in_img, 1 );
+ if ( IS_NULL ( int_img ) )
+  {
+   return NULL;
+  }
+
+ out_img = alloc_img ( PIX_BIN, num_rows, num_cols );
+ if ( IS_NULL ( out_img ) )
+  {
+   free_integral_img ( int_img );
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ in_data = ( byte * ) get_img_data_1d ( in_img );
+ out_data = ( byte * ) get_img_data_1d ( out_img );
+
+#pragma omp parallel reduction(|:fail)
+ {
+  double *mean = ( double * ) malloc ( 2 * num_cols * sizeof ( double ) );
+  double *var = IS_NULL ( mean ) ? NULL : mean + num_cols;
+
+  if ( IS_NULL ( mean ) )
+   {
+    fail = 1;
+   }
+
+#pragma omp for schedule(static)
+  for ( iy = 0; iy < num_rows; iy++ )
+   {
+    const byte *in_row = in_data + ( size_t ) iy * num_cols;
+    byte *out_row = out_data + ( size_t ) iy * num_cols;
+    int ix;
+
+    if ( IS_NULL ( mean ) )
+     {
+      continue;
+     }
+
+    calc_local_stats ( int_img, win_size, iy, mean, var );
+    for ( ix = 0; ix < num_cols; ix++ )
+     {
+      double threshold = mean[ix] + k_value * sqrt ( var[ix] );
+
+      out_row[ix] = in_row[ix] > threshold ? OBJECT : BACKGROUND;
+     }
+   }
+
+  free ( mean );
+ }
+
+ free_integral_img ( int_img );
+
+ if ( fail )
+  {
+   free_img ( out_img );
+   free ( out_img );
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ return out_img;
+}
@@ -0,0 +1,128 @@
+/**
+ * @file threshold_sauvola.c
+ * Routines for local thresholding using Sauvola's method
+ */
+
+#include "image.h"
+
+/**
+ * @brief Thresholds an image using Sauvola's method
+ *
+ * @param[in] in_img Image pointer { grayscale }
+ * @param[in] win_size Dimension of the local window { positive-odd }
+ * @param[in] k_value Weight of the normalized standard deviation
+ *                    (usually 0.5)
+ * @param[in] R_value Dynamic range of the standard deviation (usually 128)
+ *                    [ > 0 ]
+ *
+ * @return Pointer to the binary image or NULL
+ *
+ * @note Each pixel is compared with the threshold
+ *       M * ( 1 + K_VALUE * ( S / R_VALUE - 1 ) ), where M and S are the
+ *       mean and standard deviation of the window centered on it; pixels
+ *       above it become OBJECT and the others BACKGROUND. Unlike Niblack's
+ *       threshold, this one drops well below the mean in flat areas, which
+ *       suppresses noise in the background of documents. Windows are cut
+ *       off at the image border. The local statistics come from summed-area
+ *       tables, so the cost per pixel does not depend on WIN_SIZE.
+ * @ref Sauvola J. and Pietikainen M. (2000) "Adaptive Document Image
+ *      Binarization," Pattern Recognition, 33(2): 225-236
+ * @see #threshold_niblack
+ * @see #calc_local_stats
+ *
+ * @author Damian Kusnik
+ */
+
+Image *
+threshold_sauvola ( const Image * in_img, const int win_size,
+		    const double k_value, const double R_value )
+{
+ SET_FUNC_NAME ( "threshold_sauvola" );
+ int num_rows, num_cols;
+ int iy;
+ int fail = 0;
+ byte *in_data, *out_data;
+ IntegralImage *int_img;
+ Image *out_img;
+
+ if ( !is_gray_img ( in_img ) )
+  {
+   ERROR_RET ( "Not a grayscale image !", NULL );
+  }
+
+ if ( !IS_POS_ODD ( win_size ) )
+  {
+   ERROR ( "Window size ( %d ) must be positive and odd !", win_size );
+   return NULL;
+  }
+
+ if ( !IS_POS ( R_value ) )
+  {
+   ERROR ( "R value ( %f ) must be positive !", R_value );
+   return NULL;
+  }
+
+ num_rows = get_num_rows ( in_img );
+ num_cols = get_num_cols ( in_img );
+
+ int_img = alloc_integral_img ( in_img, 1 );
+ if ( IS_NULL ( int_img ) )
+  {
+   return NULL;
+  }
+
+ out_img = alloc_img ( PIX_BIN, num_rows, num_cols );
+ if ( IS_NULL ( out_img ) )
+  {
+   free_integral_img ( int_img );
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ in_data = ( byte * ) get_img_data_1d ( in_img );
+ out_data = ( byte * ) get_img_data_1d ( out_img );
+
+#pragma omp parallel reduction(|:fail)
+ {
+  double *mean = ( double * ) malloc ( 2 * num_cols * sizeof ( double ) );
+  double *var = IS_NULL ( mean ) ? NULL : mean + num_cols;
+
+  if ( IS_NULL ( mean ) )
+   {
+    fail = 1;
+   }
+
+#pragma omp for schedule(static)
+  for ( iy = 0; iy < num_rows; iy++ )
+   {
+    const byte *in_row = in_data + ( size_t ) iy * num_cols;
+    byte *out_row = out_data + ( size_t ) iy * num_cols;
+    int ix;
+
+    if ( IS_NULL ( mean ) )
+     {
+      continue;
+     }
+
+    calc_local_stats ( int_img, win_size, iy, mean, var );
+    for ( ix = 0; ix < num_cols; ix++ )
+     {
+      double threshold = mean[ix] * ( 1.0 + k_value * ( sqrt ( var[ix] ) / R_value - 1.0 ) );
+
+      out_row[ix] = in_row[ix] > threshold ? OBJECT : BACKGROUND;
+     }
+   }
+
+  free ( mean );
+ }
+
+ free_integral_img ( int_img );
+
+ if ( fail )
+  {
+   free_img ( out_img );
+   free ( out_img );
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ return out_img;
+}
@@ -0,0 +1,1057 @@
+/**
+ * @file tiled_io.c
+ * Routines for reading/writing tiled RTI container files
+ *
+ * An RTI file stores a byte image as a grid of square tiles, each of which
+ * is kept raw or compressed on its own, so that any tile can be decoded (or
+ * replaced) without touching the others. All values are little-endian:
+ *
+ *   offset  size  field
+ *        0     4  magic "RTI\x1a"
+ *        4     1  format version (1)
+ *        5     1  pixel type { PIX_BIN, PIX_GRAY, PIX_RGB }
+ *        6     1  default tile codec
+ *        7     1  reserved (0)
+ *        8     4  number of rows
+ *       12     4  number of columns
+ *       16     4  tile size (width = height)
+ *       20     4  number of tiles
+ *       24  16*N  tile index, row-major: offset (8), stored size (4), codec (4)
+ *
+ * Tile payloads follow the index in any order. A tile with offset 0 has not
+ * been written yet and reads as zeros. The decoded payload of a tile is its
+ * rows packed without padding; the edge tiles are clipped to the image.
+ */
+
+#include <zlib.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "image.h"
+
+#define RTI_HEADER_SIZE 24
+
+#define RTI_ENTRY_SIZE 16	/* bytes per tile index entry */
+
+#define RTI_VERSION 1
+
+#define RTI_DEFAULT_LEVEL 1	/* fast deflate; the row predictor does most of the work */
+
+/** @cond INTERNAL_FUNCTION */
+
+static void
+put_le32 ( byte * buf, const unsigned long val )
+{
+ buf[0] = ( byte ) val;
+ buf[1] = ( byte ) ( val >> 8 );
+ buf[2] = ( byte ) ( val >> 16 );
+ buf[3] = ( byte ) ( val >> 24 );
+}
+
+static unsigned long
+get_le32 ( const byte * buf )
+{
+ return ( unsigned long ) buf[0] | ( ( unsigned long ) buf[1] << 8 ) |
+  ( ( unsigned long ) buf[2] << 16 ) | ( ( unsigned long ) buf[3] << 24 );
+}
+
+static int
+get_tile_rect ( const TiledImage * tiled, const int tile_row,
+		const int tile_col, int *row0, int *col0, int *height,
+		int *width )
+{
+ if ( tile_row < 0 || tile_row >= tiled->num_tile_rows ||
+      tile_col < 0 || tile_col >= tiled->num_tile_cols )
+  {
+   return E_INVARG;
+  }
+
+ *row0 = tile_row * tiled->tile_size;
+ *col0 = tile_col * tiled->tile_size;
+ *height = MIN_2 ( tiled->tile_size, tiled->num_rows - *row0 );
+ *width = MIN_2 ( tiled->tile_size, tiled->num_cols - *col0 );
+
+ return E_SUCCESS;
+}
+
+static byte *
+get_img_row ( const Image * img, const int row, const int col )
+{
+ if ( img->type == PIX_RGB )
+  {
+   return img->data_nd.byte_data_3b[row][col];
+  }
+
+ return img->data_nd.byte_data_1b[row] + col;
+}
+
+/*
+ * Packs the given rectangle of IMG into BUF. For the deflate codec every
+ * byte is replaced by its difference from the same band of the pixel on
+ * its left, which turns smooth image areas into long runs of small values.
+ */
+static void
+pack_tile ( const Image * img, const int row0, const int col0,
+	    const int height, const int width, const int codec, byte * buf )
+{
+ int ir, ic;
+ int bands = img->num_bands;
+ int row_bytes = width * bands;
+
+ for ( ir = 0; ir < height; ir++ )
+  {
+   const byte *src = get_img_row ( img, row0 + ir, col0 );
+   byte *dst = buf + ( size_t ) ir * row_bytes;
+
+   if ( codec == TILE_RAW )
+    {
+     memcpy ( dst, src, row_bytes );
+     continue;
+    }
+
+   for ( ic = 0; ic < bands; ic++ )
+    {
+     dst[ic] = src[ic];
+    }
+   for ( ic = bands; ic < row_bytes; ic++ )
+    {
+     dst[ic] = ( byte ) ( src[ic] - src[ic - bands] );
+    }
+  }
+}
+
+/* Reverses pack_tile */
+static void
+unpack_tile ( const byte * buf, const int codec, const int height,
+	      const int width, Image * img, const int row0, const int col0 )
+{
+ int ir, ic;
+ int bands = img->num_bands;
+ int row_bytes = width * bands;
+
+ for ( ir = 0; ir < height; ir++ )
+  {
+   const byte *src = buf + ( size_t ) ir * row_bytes;
+   byte *dst = get_img_row ( img, row0 + ir, col0 );
+
+   if ( codec == TILE_RAW )
+    {
+     memcpy ( dst, src, row_bytes );
+     continue;
+    }
+
+   for ( ic = 0; ic < bands; ic++ )
+    {
+     dst[ic] = src[ic];
+    }
+   for ( ic = bands; ic < row_bytes; ic++ )
+    {
+     dst[ic] = ( byte ) ( src[ic] + dst[ic - bands] );
+    }
+  }
+}
+
+/*
+ * Encodes a tile of IMG into *OUT (malloc'ed). Falls back to storing the
+ * tile raw when compression does not make it smaller.
+ */
+static int
+encode_tile ( const Image * img, const int row0, const int col0,
+	      const int height, const int width, const int codec,
+	      const int level, byte ** out, size_t * out_size, int *out_codec )
+{
+ size_t raw_size = ( size_t ) height * width * img->num_bands;
+ uLongf comp_size;
+ byte *packed;
+ byte *comp;
+
+ *out = NULL;
+ packed = ( byte * ) malloc ( raw_size );
+ if ( IS_NULL ( packed ) )
+  {
+   return E_NOMEM;
+  }
+
+ pack_tile ( img, row0, col0, height, width, codec, packed );
+ if ( codec == TILE_RAW )
+  {
+   *out = packed;
+   *out_size = raw_size;
+   *out_codec = TILE_RAW;
+   return E_SUCCESS;
+  }
+
+ comp_size = compressBound ( raw_size );
+ comp = ( byte * ) malloc ( comp_size );
+ if ( IS_NULL ( comp ) )
+  {
+   free ( packed );
+   return E_NOMEM;
+  }
+
+ if ( compress2 ( comp, &comp_size, packed, raw_size, level ) != Z_OK ||
+      comp_size >= raw_size )
+  {
+   /* incompressible: keep the tile raw */
+   free ( comp );
+   pack_tile ( img, row0, col0, height, width, TILE_RAW, packed );
+   *out = packed;
+   *out_size = raw_size;
+   *out_codec = TILE_RAW;
+   return E_SUCCESS;
+  }
+
+ free ( packed );
+ *out = comp;
+ *out_size = comp_size;
+ *out_codec = TILE_DEFLATE;
+
+ return E_SUCCESS;
+}
+
+/*
+ * Decodes SRC (the stored bytes of a tile) into the given rectangle of IMG.
+ * SCRATCH must hold a full tile when CODEC is TILE_DEFLATE.
+ */
+static int
+decode_tile ( const byte * src, const size_t src_size, const int codec,
+	      const int height, const int width, byte * scratch, Image * img,
+	      const int row0, const int col0 )
+{
+ uLongf raw_size = ( uLongf ) height * width * img->num_bands;
+
+ if ( codec == TILE_RAW )
+  {
+   if ( src_size != raw_size )
+    {
+     return E_INVARG;
+    }
+   unpack_tile ( src, TILE_RAW, height, width, img, row0, col0 );
+   return E_SUCCESS;
+  }
+
+ if ( codec != TILE_DEFLATE ||
+      uncompress ( scratch, &raw_size, src, src_size ) != Z_OK ||
+      raw_size != ( uLongf ) height * width * img->num_bands )
+  {
+   return E_INVARG;
+  }
+
+ unpack_tile ( scratch, TILE_DEFLATE, height, width, img, row0, col0 );
+
+ return E_SUCCESS;
+}
+
+static void
+zero_tile ( Image * img, const int row0, const int col0, const int height,
+	    const int width )
+{
+ int ir;
+
+ for ( ir = 0; ir < height; ir++ )
+  {
+   memset ( get_img_row ( img, row0 + ir, col0 ), 0,
+	    ( size_t ) width * img->num_bands );
+  }
+}
+
+/* Fills in the geometry fields and allocates the tile index. The whole
+   image and a whole tile must each fit in INT_MAX bytes, the limit of
+   alloc_img. */
+static int
+init_tiled_img ( TiledImage * tiled, const PixelType pix_type,
+		 const int num_rows, const int num_cols, const int tile_size )
+{
+ size_t num_bands;
+ size_t num_tiles;
+
+ if ( ( pix_type != PIX_BIN && pix_type != PIX_GRAY && pix_type != PIX_RGB ) ||
+      num_rows <= 0 || num_cols <= 0 || tile_size <= 0 )
+  {
+   return E_INVARG;
+  }
+
+ num_bands = pix_type == PIX_RGB ? 3 : 1;
+ if ( ( size_t ) num_rows * num_cols * num_bands > INT_MAX ||
+      ( size_t ) tile_size * tile_size * num_bands > INT_MAX )
+  {
+   return E_INVARG;
+  }
+
+ tiled->pix_type = pix_type;
+ tiled->num_rows = num_rows;
+ tiled->num_cols = num_cols;
+ tiled->tile_size = tile_size;
+ tiled->num_tile_rows = ( int ) ( ( ( size_t ) num_rows + tile_size - 1 ) / tile_size );
+ tiled->num_tile_cols = ( int ) ( ( ( size_t ) num_cols + tile_size - 1 ) / tile_size );
+
+ num_tiles = ( size_t ) tiled->num_tile_rows * tiled->num_tile_cols;
+ if ( num_tiles > ULONG_MAX / RTI_ENTRY_SIZE || num_tiles > 0xFFFFFFFFUL )
+  {
+   return E_INVARG;
+  }
+
+ tiled->tile_offsets = ( size_t * ) calloc ( num_tiles, sizeof ( size_t ) );
+ tiled->tile_sizes = ( size_t * ) calloc ( num_tiles, sizeof ( size_t ) );
+ tiled->tile_codecs = ( int * ) calloc ( num_tiles, sizeof ( int ) );
+ if ( IS_NULL ( tiled->tile_offsets ) || IS_NULL ( tiled->tile_sizes ) ||
+      IS_NULL ( tiled->tile_codecs ) )
+  {
+   return E_NOMEM;
+  }
+
+ return E_SUCCESS;
+}
+
+static size_t
+get_data_start ( const TiledImage * tiled )
+{
+ return RTI_HEADER_SIZE +
+  ( size_t ) tiled->num_tile_rows * tiled->num_tile_cols * RTI_ENTRY_SIZE;
+}
+
+/* Serializes the header and tile index into BUF */
+static void
+pack_index ( const TiledImage * tiled, byte * buf )
+{
+ int it;
+ int num_tiles = tiled->num_tile_rows * tiled->num_tile_cols;
+ byte *entry;
+
+ buf[0] = 'R';
+ buf[1] = 'T';
+ buf[2] = 'I';
+ buf[3] = 26;
+ buf[4] = RTI_VERSION;
+ buf[5] = ( byte ) tiled->pix_type;
+ buf[6] = ( byte ) tiled->codec;
+ buf[7] = 0;
+ put_le32 ( buf + 8, tiled->num_rows );
+ put_le32 ( buf + 12, tiled->num_cols );
+ put_le32 ( buf + 16, tiled->tile_size );
+ put_le32 ( buf + 20, num_tiles );
+
+ for ( it = 0; it < num_tiles; it++ )
+  {
+   entry = buf + RTI_HEADER_SIZE + ( size_t ) it * RTI_ENTRY_SIZE;
+   /* two halves so that a 32-bit size_t does not shift by its width */
+   put_le32 ( entry, tiled->tile_offsets[it] & 0xFFFFFFFFUL );
+   put_le32 ( entry + 4, ( tiled->tile_offsets[it] >> 16 ) >> 16 );
+   put_le32 ( entry + 8, tiled->tile_sizes[it] );
+   put_le32 ( entry + 12, tiled->tile_codecs[it] );
+  }
+}
+
+/*
+ * Parses the header and tile index in BUF (SIZE bytes available). On return
+ * *NEED holds the number of bytes the header and index occupy, so a caller
+ * reading from a stream can retry with a larger buffer.
+ */
+static int
+unpack_index ( const byte * buf, const size_t size, TiledImage * tiled,
+	       size_t * need )
+{
+ int it, ret_code;
+ int num_tiles;
+ size_t offset;
+ const byte *entry;
+
+ *need = RTI_HEADER_SIZE;
+ if ( size < RTI_HEADER_SIZE )
+  {
+   return E_FREAD;
+  }
+
+ if ( buf[0] != 'R' || buf[1] != 'T' || buf[2] != 'I' || buf[3] != 26 ||
+      buf[4] != RTI_VERSION || get_le32 ( buf + 8 ) > INT_MAX ||
+      get_le32 ( buf + 12 ) > INT_MAX || get_le32 ( buf + 16 ) > INT_MAX )
+  {
+   return E_UNFMT;
+  }
+
+ ret_code = init_tiled_img ( tiled, ( PixelType ) buf[5],
+			     ( int ) get_le32 ( buf + 8 ),
+			     ( int ) get_le32 ( buf + 12 ),
+			     ( int ) get_le32 ( buf + 16 ) );
+ if ( ret_code )
+  {
+   return ret_code;
+  }
+
+ tiled->codec = buf[6];
+ num_tiles = tiled->num_tile_rows * tiled->num_tile_cols;
+ if ( get_le32 ( buf + 20 ) != ( unsigned long ) num_tiles )
+  {
+   return E_UNFMT;
+  }
+
+ *need = get_data_start ( tiled );
+ if ( size < *need )
+  {
+   return E_FREAD;
+  }
+
+ for ( it = 0; it < num_tiles; it++ )
+  {
+   entry = buf + RTI_HEADER_SIZE + ( size_t ) it * RTI_ENTRY_SIZE;
+   offset = get_le32 ( entry );
+   if ( get_le32 ( entry + 4 ) )
+    {
+     if ( sizeof ( size_t ) <= 4 )
+      {
+       return E_UNIMPL;
+      }
+     offset |= ( ( size_t ) get_le32 ( entry + 4 ) << 16 ) << 16;
+    }
+   tiled->tile_offsets[it] = offset;
+   tiled->tile_sizes[it] = get_le32 ( entry + 8 );
+   tiled->tile_codecs[it] = ( int ) get_le32 ( entry + 12 );
+  }
+
+ return E_SUCCESS;
+}
+
+static TiledImage *
+new_tiled_img ( void )
+{
+ TiledImage *tiled = CALLOC_STRUCT ( TiledImage );
+
+ if ( !IS_NULL ( tiled ) )
+  {
+   tiled->codec = TILE_DEFLATE;
+   tiled->level = RTI_DEFAULT_LEVEL;
+  }
+
+ return tiled;
+}
+
+static void
+free_index ( TiledImage * tiled )
+{
+ free ( tiled->tile_offsets );
+ free ( tiled->tile_sizes );
+ free ( tiled->tile_codecs );
+ tiled->tile_offsets = NULL;
+ tiled->tile_sizes = NULL;
+ tiled->tile_codecs = NULL;
+}
+
+static void
+free_tiled_img ( TiledImage * tiled )
+{
+ unmap_file ( &tiled->map );
+ free_index ( tiled );
+ free ( tiled );
+}
+
+/* Returns the stored bytes of tile IT, reading them into *BUF if the file is not mapped */
+static const byte *
+get_tile_data ( const TiledImage * tiled, const int it, byte ** buf )
+{
+ size_t offset = tiled->tile_offsets[it];
+ size_t size = tiled->tile_sizes[it];
+
+ *buf = NULL;
+ if ( !IS_NULL ( tiled->map.data ) )
+  {
+   if ( offset > tiled->map.size || size > tiled->map.size - offset )
+    {
+     return NULL;
+    }
+   return tiled->map.data + offset;
+  }
+
+ *buf = ( byte * ) malloc ( size ? size : 1 );
+ if ( IS_NULL ( *buf ) ||
+      fseek ( tiled->file_ptr, ( long ) offset, SEEK_SET ) ||
+      fread ( *buf, 1, size, tiled->file_ptr ) != size )
+  {
+   free ( *buf );
+   *buf = NULL;
+   return NULL;
+  }
+
+ return *buf;
+}
+
+/** @endcond INTERNAL_FUNCTION */
+
+/**
+ * @brief Creates an empty RTI file whose tiles are written one at a time
+ *
+ * @param[in] file_name File name
+ * @param[in] pix_type Pixel type { PIX_BIN, PIX_GRAY, PIX_RGB }
+ * @param[in] num_rows Number of rows
+ * @param[in] num_cols Number of columns
+ * @param[in] tile_size Tile width and height [ 0 selects RTI_TILE_SIZE ]
+ * @param[in] codec Tile codec { TILE_RAW, TILE_DEFLATE }
+ *
+ * @return Pointer to the tiled image or NULL
+ *
+ * @note Tiles that are never written read back as zeros. The tile index is
+ *       only written by close_tiled_img.
+ * @see #write_tile
+ * @see #close_tiled_img
+ *
+ * @author Damian Kusnik
+ */
+
+TiledImage *
+create_tiled_img ( const char *file_name, const PixelType pix_type,
+		   const int num_rows, const int num_cols, const int tile_size,
+		   const TileCodec codec )
+{
+ SET_FUNC_NAME ( "create_tiled_img" );
+ int ret_code;
+ TiledImage *tiled;
+
+ if ( codec != TILE_RAW && codec != TILE_DEFLATE )
+  {
+   ERROR_RET ( "Invalid tile codec !", NULL );
+  }
+
+ tiled = new_tiled_img ( );
+ if ( IS_NULL ( tiled ) )
+  {
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ ret_code = init_tiled_img ( tiled, pix_type, num_rows, num_cols,
+			     tile_size > 0 ? tile_size : RTI_TILE_SIZE );
+ if ( ret_code )
+  {
+   free_tiled_img ( tiled );
+   ERROR ( "Cannot create tiled image { %s } !", error_str ( ret_code ) );
+   return NULL;
+  }
+ tiled->codec = codec;
+ tiled->is_writable = 1;
+
+ tiled->file_ptr = fopen ( file_name, "w+b" );
+ if ( IS_NULL ( tiled->file_ptr ) )
+  {
+   free_tiled_img ( tiled );
+   ERROR ( "Cannot open file ( %s ) !", file_name );
+   return NULL;
+  }
+ tiled->end_offset = get_data_start ( tiled );
+
+ return tiled;
+}
+
+/**
+ * @brief Opens an RTI file for random tile access
+ *
+ * @param[in] file_name File name
+ * @param[in] writable 1: tiles may be replaced with write_tile, 0: read-only
+ *
+ * @return Pointer to the tiled image or NULL
+ *
+ * @note Read-only files are memory mapped, which makes concurrent read_tile
+ *       calls safe. Writable files are accessed through stdio and must not
+ *       be shared between threads.
+ * @see #read_tile
+ * @see #close_tiled_img
+ *
+ * @author Damian Kusnik
+ */
+
+TiledImage *
+open_tiled_img ( const char *file_name, const int writable )
+{
+ SET_FUNC_NAME ( "open_tiled_img" );
+ int ret_code;
+ size_t need;
+ byte *buf;
+ TiledImage *tiled;
+
+ tiled = new_tiled_img ( );
+ if ( IS_NULL ( tiled ) )
+  {
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ tiled->file_ptr = fopen ( file_name, writable ? "r+b" : "rb" );
+ if ( IS_NULL ( tiled->file_ptr ) )
+  {
+   free_tiled_img ( tiled );
+   ERROR ( "Cannot open file ( %s ) !", file_name );
+   return NULL;
+  }
+ tiled->is_writable = writable;
+
+ if ( !writable )
+  {
+   ret_code = map_file ( tiled->file_ptr, &tiled->map );
+   if ( !ret_code )
+    {
+     ret_code = unpack_index ( tiled->map.data, tiled->map.size, tiled, &need );
+    }
+  }
+ else
+  {
+   /* read the header first to learn the size of the index */
+   buf = ( byte * ) malloc ( RTI_HEADER_SIZE );
+   ret_code = IS_NULL ( buf ) ? E_NOMEM : E_FREAD;
+   if ( !IS_NULL ( buf ) &&
+	fread ( buf, 1, RTI_HEADER_SIZE, tiled->file_ptr ) == RTI_HEADER_SIZE )
+    {
+     ret_code = unpack_index ( buf, RTI_HEADER_SIZE, tiled, &need );
+     if ( ret_code == E_FREAD )
+      {
+       free_index ( tiled );
+       free ( buf );
+       buf = ( byte * ) malloc ( need );
+       ret_code = E_NOMEM;
+       if ( !IS_NULL ( buf ) )
+	{
+	 rewind ( tiled->file_ptr );
+	 ret_code = fread ( buf, 1, need, tiled->file_ptr ) == need ?
+	  unpack_index ( buf, need, tiled, &need ) : E_FREAD;
+	}
+      }
+    }
+   free ( buf );
+
+   if ( !ret_code && fseek ( tiled->file_ptr, 0, SEEK_END ) )
+    {
+     ret_code = E_FREAD;
+    }
+   tiled->end_offset = ( size_t ) ftell ( tiled->file_ptr );
+  }
+
+ if ( ret_code )
+  {
+   free_tiled_img ( tiled );
+   ERROR ( "Cannot read tiled image ( %s ) { %s } !", file_name,
+	   error_str ( ret_code ) );
+   return NULL;
+  }
+
+ return tiled;
+}
+
+/**
+ * @brief Decodes a single tile of an RTI file
+ *
+ * @param[in] tiled Tiled image
+ * @param[in] tile_row Tile row [ 0, TILED->num_tile_rows )
+ * @param[in] tile_col Tile column [ 0, TILED->num_tile_cols )
+ *
+ * @return Pointer to the tile image or NULL
+ *
+ * @note Edge tiles are clipped to the image, so they may be smaller than
+ *       TILED->tile_size.
+ *
+ * @author Damian Kusnik
+ */
+
+Image *
+read_tile ( TiledImage * tiled, const int tile_row, const int tile_col )
+{
+ SET_FUNC_NAME ( "read_tile" );
+ int it, ret_code;
+ int row0, col0, height, width;
+ byte *buf, *scratch;
+ const byte *data;
+ Image *tile;
+
+ if ( IS_NULL ( tiled ) ||
+      get_tile_rect ( tiled, tile_row, tile_col, &row0, &col0, &height,
+		      &width ) )
+  {
+   ERROR_RET ( "Invalid tile !", NULL );
+  }
+
+ tile = alloc_img ( tiled->pix_type, height, width );
+ if ( IS_NULL ( tile ) )
+  {
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ it = tile_row * tiled->num_tile_cols + tile_col;
+ if ( !tiled->tile_offsets[it] )
+  {
+   zero_tile ( tile, 0, 0, height, width );
+   return tile;
+  }
+
+ ret_code = E_NOMEM;
+ scratch = ( byte * ) malloc ( ( size_t ) height * width * tile->num_bands );
+ data = get_tile_data ( tiled, it, &buf );
+ if ( !IS_NULL ( scratch ) )
+  {
+   ret_code = IS_NULL ( data ) ? E_FREAD :
+    decode_tile ( data, tiled->tile_sizes[it], tiled->tile_codecs[it], height,
+		  width, scratch, tile, 0, 0 );
+  }
+ free ( scratch );
+ free ( buf );
+
+ if ( ret_code )
+  {
+   free_img ( tile );
+   free ( tile );
+   ERROR ( "Cannot read tile ( %d, %d ) { %s } !", tile_row, tile_col,
+	   error_str ( ret_code ) );
+   return NULL;
+  }
+
+ return tile;
+}
+
+/**
+ * @brief Encodes a single tile of an RTI file
+ *
+ * @param[in,out] tiled Tiled image opened with create_tiled_img or as writable
+ * @param[in] tile_row Tile row [ 0, TILED->num_tile_rows )
+ * @param[in] tile_col Tile column [ 0, TILED->num_tile_cols )
+ * @param[in] tile Tile image of the file's pixel type and the tile's clipped size
+ *
+ * @return E_SUCCESS or an appropriate error code
+ *
+ * @note A tile that fits in the space of its previous version is rewritten
+ *       in place; otherwise it is appended to the end of the file.
+ *
+ * @author Damian Kusnik
+ */
+
+int
+write_tile ( TiledImage * tiled, const int tile_row, const int tile_col,
+	     const Image * tile )
+{
+ SET_FUNC_NAME ( "write_tile" );
+ int it, ret_code, codec;
+ int row0, col0, height, width;
+ size_t size, offset;
+ byte *data;
+
+ if ( IS_NULL ( tiled ) || !tiled->is_writable )
+  {
+   ERROR_RET ( "Tiled image is not writable !", E_INVARG );
+  }
+
+ if ( get_tile_rect ( tiled, tile_row, tile_col, &row0, &col0, &height,
+		      &width ) )
+  {
+   ERROR_RET ( "Invalid tile !", E_INVARG );
+  }
+
+ if ( !IS_VALID_OBJ ( tile ) || tile->type != tiled->pix_type ||
+      get_num_rows ( tile ) != height || get_num_cols ( tile ) != width )
+  {
+   ERROR_RET ( "Tile does not match the tiled image !", E_INVOBJ );
+  }
+
+ ret_code = encode_tile ( tile, 0, 0, height, width, tiled->codec,
+			  tiled->level, &data, &size, &codec );
+ if ( ret_code )
+  {
+   ERROR_RET ( "Insufficient memory !", ret_code );
+  }
+
+ it = tile_row * tiled->num_tile_cols + tile_col;
+ offset = ( tiled->tile_offsets[it] && size <= tiled->tile_sizes[it] ) ?
+  tiled->tile_offsets[it] : tiled->end_offset;
+
+ if ( fseek ( tiled->file_ptr, ( long ) offset, SEEK_SET ) ||
+      fwrite ( data, 1, size, tiled->file_ptr ) != size )
+  {
+   free ( data );
+   ERROR_RET ( "Cannot write tile !", E_FAILURE );
+  }
+ free ( data );
+
+ if ( offset == tiled->end_offset )
+  {
+   tiled->end_offset += size;
+  }
+ tiled->tile_offsets[it] = offset;
+ tiled->tile_sizes[it] = size;
+ tiled->tile_codecs[it] = codec;
+
+ return E_SUCCESS;
+}
+
+/**
+ * @brief Closes an RTI file, writing its tile index if it is writable
+ *
+ * @param[in,out] tiled Tiled image (freed on return)
+ *
+ * @return E_SUCCESS or an appropriate error code
+ *
+ * @author Damian Kusnik
+ */
+
+int
+close_tiled_img ( TiledImage * tiled )
+{
+ int ret_code = E_SUCCESS;
+ size_t index_size;
+ byte *buf;
+
+ if ( IS_NULL ( tiled ) )
+  {
+   return E_INVARG;
+  }
+
+ if ( tiled->is_writable )
+  {
+   index_size = get_data_start ( tiled );
+   buf = ( byte * ) malloc ( index_size );
+   if ( IS_NULL ( buf ) )
+    {
+     ret_code = E_NOMEM;
+    }
+   else
+    {
+     pack_index ( tiled, buf );
+     if ( fseek ( tiled->file_ptr, 0, SEEK_SET ) ||
+	  fwrite ( buf, 1, index_size, tiled->file_ptr ) != index_size )
+      {
+       ret_code = E_FAILURE;
+      }
+     free ( buf );
+    }
+  }
+
+ if ( !IS_NULL ( tiled->file_ptr ) && fclose ( tiled->file_ptr ) )
+  {
+   ret_code = E_FAILURE;
+  }
+ tiled->file_ptr = NULL;
+ free_tiled_img ( tiled );
+
+ return ret_code;
+}
+
+/**
+ * @brief Reads a whole RTI file
+ *
+ * @param[in,out] file_ptr File pointer (positioned at the start of the file)
+ *
+ * @return Pointer to the image or NULL
+ *
+ * @note The file is memory mapped and the tiles are decoded in parallel,
+ *       each straight into its place in the image.
+ *
+ * @author Damian Kusnik
+ */
+
+Image *
+read_tiled_img ( FILE * file_ptr )
+{
+ SET_FUNC_NAME ( "read_tiled_img" );
+ int it, num_tiles;
+ int fail;
+ size_t need;
+ TiledImage *tiled;
+ Image *img;
+
+ tiled = new_tiled_img ( );
+ if ( IS_NULL ( tiled ) )
+  {
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ fail = map_file ( file_ptr, &tiled->map );
+ if ( !fail )
+  {
+   fail = unpack_index ( tiled->map.data, tiled->map.size, tiled, &need );
+  }
+ if ( fail )
+  {
+   free_tiled_img ( tiled );
+   ERROR ( "Cannot read tiled image { %s } !", error_str ( fail ) );
+   return NULL;
+  }
+
+ img = alloc_img ( tiled->pix_type, tiled->num_rows, tiled->num_cols );
+ if ( IS_NULL ( img ) )
+  {
+   free_tiled_img ( tiled );
+   ERROR_RET ( "Insufficient memory !", NULL );
+  }
+
+ num_tiles = tiled->num_tile_rows * tiled->num_tile_cols;
+
+#pragma omp parallel reduction(|:fail)
+ {
+  byte *scratch = ( byte * ) malloc ( ( size_t ) tiled->tile_size *
+				      tiled->tile_size * img->num_bands );
+  byte *buf;
+  const byte *data;
+  int row0 = 0, col0 = 0, height = 0, width = 0;
+
+#pragma omp for schedule(dynamic)
+  for ( it = 0; it < num_tiles; it++ )
+   {
+    get_tile_rect ( tiled, it / tiled->num_tile_cols,
+		    it % tiled->num_tile_cols, &row0, &col0, &height, &width );
+    if ( !tiled->tile_offsets[it] )
+     {
+      zero_tile ( img, row0, col0, height, width );
+      continue;
+     }
+
+    data = get_tile_data ( tiled, it, &buf );
+    if ( IS_NULL ( scratch ) || IS_NULL ( data ) ||
+	 decode_tile ( data, tiled->tile_sizes[it], tiled->tile_codecs[it],
+		       height, width, scratch, img, row0, col0 ) )
+     {
+      fail = 1;
+     }
+   }
+
+  free ( scratch );
+ }
+
+ free_tiled_img ( tiled );
+
+ if ( fail )
+  {
+   free_img ( img );
+   free ( img );
+   ERROR_RET ( "Corrupt tiled image !", NULL );
+  }
+
+ return img;
+}
+
+/**
+ * @brief Writes a whole image as an RTI file
+ *
+ * @param[in] img Image pointer { binary, grayscale, rgb }
+ * @param[in,out] file_ptr File pointer
+ * @param[in] params Compression parameters or NULL for the defaults
+ *
+ * @return E_SUCCESS or an appropriate error code
+ *
+ * @note Tiles are RTI_TILE_SIZE pixels square and are compressed in
+ *       parallel. PARAMS->level 0 stores them raw, -1 (the default) selects
+ *       fast deflate; PARAMS->num_threads is honored as for PNG, except
+ *       that 0 and 1 mean one thread. NULL PARAMS uses all threads.
+ *
+ * @author Damian Kusnik
+ */
+
+int
+write_tiled_img ( const Image * img, FILE * file_ptr,
+		  const EncodeParams * params )
+{
+ SET_FUNC_NAME ( "write_tiled_img" );
+ int it, num_tiles;
+ int num_threads;
+ int fail;
+ size_t offset, index_size;
+ byte *index;
+ byte **tile_data;
+ TiledImage *tiled;
+
+ if ( !is_byte_img ( img ) )
+  {
+   ERROR_RET ( "Not a byte image !", E_INVOBJ );
+  }
+
+ tiled = new_tiled_img ( );
+ if ( IS_NULL ( tiled ) )
+  {
+   ERROR_RET ( "Insufficient memory !", E_NOMEM );
+  }
+
+ fail = init_tiled_img ( tiled, img->type, get_num_rows ( img ),
+			 get_num_cols ( img ), RTI_TILE_SIZE );
+ if ( fail )
+  {
+   free_tiled_img ( tiled );
+   ERROR_RET ( "Cannot create tiled image !", fail );
+  }
+
+ num_threads = ENC_THREADS_ALL;
+ if ( !IS_NULL ( params ) )
+  {
+   if ( params->level == 0 )
+    {
+     tiled->codec = TILE_RAW;
+    }
+   else if ( params->level > 0 )
+    {
+     tiled->level = MIN_2 ( params->level, 9 );
+    }
+   num_threads = params->num_threads;
+  }
+
+#ifdef _OPENMP
+ if ( num_threads == ENC_THREADS_ALL )
+  {
+   num_threads = omp_get_max_threads ( );
+  }
+ num_threads = MAX_2 ( num_threads, 1 );
+#else
+ num_threads = 1;
+#endif
+
+ num_tiles = tiled->num_tile_rows * tiled->num_tile_cols;
+ tile_data = ( byte ** ) calloc ( num_tiles, sizeof ( byte * ) );
+ if ( IS_NULL ( tile_data ) )
+  {
+   free_tiled_img ( tiled );
+   ERROR_RET ( "Insufficient memory !", E_NOMEM );
+  }
+
+ /* Compress every tile; the index is filled in below */
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads) reduction(|:fail)
+ for ( it = 0; it < num_tiles; it++ )
+  {
+   int row0 = 0, col0 = 0, height = 0, width = 0;
+
+   get_tile_rect ( tiled, it / tiled->num_tile_cols, it % tiled->num_tile_cols,
+		   &row0, &col0, &height, &width );
+   if ( encode_tile ( img, row0, col0, height, width, tiled->codec,
+		      tiled->level, &tile_data[it], &tiled->tile_sizes[it],
+		      &tiled->tile_codecs[it] ) )
+    {
+     fail = 1;
+    }
+  }
+
+ index_size = get_data_start ( tiled );
+ index = fail ? NULL : ( byte * ) malloc ( index_size );
+ if ( !IS_NULL ( index ) )
+  {
+   offset = index_size;
+   for ( it = 0; it < num_tiles; it++ )
+    {
+     tiled->tile_offsets[it] = offset;
+     offset += tiled->tile_sizes[it];
+    }
+
+   pack_index ( tiled, index );
+   fail = fwrite ( index, 1, index_size, file_ptr ) != index_size;
+   for ( it = 0; it < num_tiles && !fail; it++ )
+    {
+     fail = fwrite ( tile_data[it], 1, tiled->tile_sizes[it], file_ptr ) !=
+      tiled->tile_sizes[it];
+    }
+   fail = fail ? E_FAILURE : E_SUCCESS;
+   free ( index );
+  }
+ else
+  {
+   fail = E_NOMEM;
+  }
+
+ for ( it = 0; it < num_tiles; it++ )
+  {
+   free ( tile_data[it] );
+  }
+ free ( tile_data );
+ free_tiled_img ( tiled );
+
+ if ( fail )
+  {
+   ERROR_RET ( "Cannot write tiled image !", fail );
+  }
+
+ return E_SUCCESS;
+}
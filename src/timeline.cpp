@@ -0,0 +1,298 @@
+/**
+ * @file timeline.c
+ * Routines for recording a per-thread timeline of events
+ */
+
+#include "image.h"
+
+#define MAX_TIMELINE_THREADS 256
+
+#define MAX_TIMELINE_DEPTH 16	/* deeper events are not recorded */
+
+/** @cond INTERNAL_FUNCTION */
+
+typedef struct
+{
+ const char *name;
+ int arg;
+ double start_time;
+ double end_time;
+} TimelineEvent;
+
+/* Ring of events of one OS thread; only that thread writes its slot */
+typedef struct
+{
+ volatile long tid;		/* owner, 0 while the slot is free */
+ TimelineEvent *events;		/* NULL if the ring could not be allocated */
+ unsigned long num_events;	/* events recorded, including overwritten ones */
+ int depth;
+ TimelineEvent open[MAX_TIMELINE_DEPTH];
+} TimelineSlot;
+
+static TimelineSlot timeline_slots[MAX_TIMELINE_THREADS];
+
+static volatile int timeline_num_slots = 0;
+
+static volatile int timeline_enabled = 0;
+
+static int timeline_capacity = 0;
+
+static double timeline_origin = 0.0;
+
+/* Finds the slot of the calling thread, claiming one on first use */
+static TimelineSlot *
+get_timeline_slot ( void )
+{
+ long tid = get_thread_id (  );
+ TimelineSlot *slot = NULL;
+ int is;
+
+ for ( is = 0; is < timeline_num_slots; is++ )
+  {
+   if ( timeline_slots[is].tid == tid )
+    {
+     return timeline_slots + is;
+    }
+  }
+
+#pragma omp critical ( timeline_slots )
+ {
+  for ( is = 0; is < timeline_num_slots && IS_NULL ( slot ); is++ )
+   {
+    if ( timeline_slots[is].tid == tid )
+     {
+      slot = timeline_slots + is;
+     }
+   }
+
+  if ( IS_NULL ( slot ) && timeline_num_slots < MAX_TIMELINE_THREADS )
+   {
+    slot = timeline_slots + timeline_num_slots;
+    memset ( slot, 0, sizeof ( TimelineSlot ) );
+    slot->events = ( TimelineEvent * ) malloc ( timeline_capacity *
+						 sizeof ( TimelineEvent ) );
+    slot->tid = tid;
+    timeline_num_slots++;
+   }
+ }
+
+ return slot;
+}
+
+/** @endcond INTERNAL_FUNCTION */
+
+/**
+ * @brief Starts recording timeline events
+ *
+ * @param[in] capacity Number of events kept per thread [ >= 1 ]
+ *
+ * @return E_SUCCESS or an error code
+ *
+ * @note Until this is called begin_timeline_event and end_timeline_event
+ *       return at once. Each thread records into a ring of its own, so
+ *       recording takes no locks; once a ring is full its oldest events are
+ *       overwritten. Events recorded before are discarded. The pipeline
+ *       stages of begin_perf_stage are recorded as events too.
+ * @see #write_timeline_json
+ * @see #disable_timeline
+ *
+ * @author Damian Kusnik
+ */
+
+int
+enable_timeline ( const int capacity )
+{
+ SET_FUNC_NAME ( "enable_timeline" );
+
+ if ( capacity < 1 )
+  {
+   ERROR ( "Capacity ( %d ) must be positive !", capacity );
+   return E_INVARG;
+  }
+
+ disable_timeline (  );
+
+ timeline_capacity = capacity;
+ timeline_origin = get_wall_time (  );
+ timeline_enabled = 1;
+
+ return E_SUCCESS;
+}
+
+/**
+ * @brief Stops recording and discards the recorded events
+ *
+ * @return none
+ *
+ * @note Must not be called while other threads are recording.
+ *
+ * @author Damian Kusnik
+ */
+
+void
+disable_timeline ( void )
+{
+ int is;
+
+ timeline_enabled = 0;
+ for ( is = 0; is < timeline_num_slots; is++ )
+  {
+   free ( timeline_slots[is].events );
+   timeline_slots[is].events = NULL;
+  }
+ timeline_num_slots = 0;
+}
+
+/**
+ * @brief Marks the start of an event on the calling thread
+ *
+ * @param[in] name Name of the event; must stay valid until the timeline
+ *                 is written and must not need JSON escaping
+ * @param[in] arg Argument shown with the event (e.g. a row or tile index),
+ *                or -1 for none
+ *
+ * @return none
+ *
+ * @note Events of a thread must nest; each begin needs a matching
+ *       end_timeline_event on the same thread.
+ * @see #end_timeline_event
+ *
+ * @author Damian Kusnik
+ */
+
+void
+begin_timeline_event ( const char *name, const int arg )
+{
+ TimelineSlot *slot;
+
+ if ( !timeline_enabled || IS_NULL ( slot = get_timeline_slot (  ) ) )
+  {
+   return;
+  }
+
+ if ( slot->depth < MAX_TIMELINE_DEPTH )
+  {
+   TimelineEvent *event = slot->open + slot->depth;
+
+   event->name = name;
+   event->arg = arg;
+   event->start_time = get_wall_time (  );
+  }
+ slot->depth++;
+}
+
+/**
+ * @brief Marks the end of the innermost open event on the calling thread
+ *
+ * @return none
+ *
+ * @see #begin_timeline_event
+ *
+ * @author Damian Kusnik
+ */
+
+void
+end_timeline_event ( void )
+{
+ TimelineSlot *slot;
+
+ if ( !timeline_enabled || IS_NULL ( slot = get_timeline_slot (  ) ) ||
+      slot->depth <= 0 )
+  {
+   return;
+  }
+
+ if ( --slot->depth < MAX_TIMELINE_DEPTH && !IS_NULL ( slot->events ) )
+  {
+   TimelineEvent *event =
+    slot->events + slot->num_events % ( unsigned long ) timeline_capacity;
+
+   *event = slot->open[slot->depth];
+   event->end_time = get_wall_time (  );
+   slot->num_events++;
+  }
+}
+
+/**
+ * @brief Writes the recorded events as a Chrome trace
+ *
+ * @param[in] file_name Name of the output file
+ *
+ * @return E_SUCCESS or an error code
+ *
+ * @note The file is in the Trace Event format read by chrome://tracing and
+ *       the Perfetto UI: one complete ("X") event per recorded event, with
+ *       times in microseconds since enable_timeline and one track per OS
+ *       thread. Events still open are not written. Must not be called
+ *       while other threads are recording.
+ * @see #enable_timeline
+ *
+ * @author Damian Kusnik
+ */
+
+int
+write_timeline_json ( const char *file_name )
+{
+ SET_FUNC_NAME ( "write_timeline_json" );
+ unsigned long num_dropped = 0;
+ int is;
+ int is_first = 1;
+ FILE *fp;
+
+ fp = fopen ( file_name, "w" );
+ if ( IS_NULL ( fp ) )
+  {
+   ERROR ( "Cannot open file ( %s ) !", file_name );
+   return E_FOPEN;
+  }
+
+ fprintf ( fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n" );
+ for ( is = 0; is < timeline_num_slots; is++ )
+  {
+   const TimelineSlot *slot = timeline_slots + is;
+   unsigned long ie, first = 0;
+
+   fprintf ( fp, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+	     "\"tid\": %ld, \"args\": {\"name\": \"thread %d\"}}",
+	     is_first ? "" : ",\n", slot->tid, is );
+   is_first = 0;
+
+   if ( IS_NULL ( slot->events ) )
+    {
+     continue;
+    }
+
+   if ( slot->num_events > ( unsigned long ) timeline_capacity )
+    {
+     first = slot->num_events - timeline_capacity;
+     num_dropped += first;
+    }
+
+   for ( ie = first; ie < slot->num_events; ie++ )
+    {
+     const TimelineEvent *event =
+      slot->events + ie % ( unsigned long ) timeline_capacity;
+
+     fprintf ( fp, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, "
+	       "\"tid\": %ld, \"ts\": %.3f, \"dur\": %.3f", event->name,
+	       slot->tid, 1e6 * ( event->start_time - timeline_origin ),
+	       1e6 * ( event->end_time - event->start_time ) );
+     if ( event->arg >= 0 )
+      {
+       fprintf ( fp, ", \"args\": {\"index\": %d}", event->arg );
+      }
+     fprintf ( fp, "}" );
+    }
+  }
+ fprintf ( fp, "\n], \"otherData\": {\"dropped_events\": \"%lu\"}}\n",
+	   num_dropped );
+
+ if ( ferror ( fp ) )
+  {
+   fclose ( fp );
+   ERROR_RET ( "Cannot write the timeline !", E_FAILURE );
+  }
+ fclose ( fp );
+
+ return E_SUCCESS;
+}
@@ -4,6 +4,13 @@
  * Routines for miscellaneous tasks
  */
 
+#if defined ( __i386__ ) || defined ( __x86_64__ )
+#include <x86intrin.h>
+#endif
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
 #include "image.h"
 
 /** 
@@ -42,6 +49,71 @@ stop_timer ( const clock_t start_time )
  return ( ( double ) ( clock (  ) - start_time ) ) / CLOCKS_PER_SEC;
 }
 
+/**
+ * @brief Returns the elapsed wall-clock time in seconds
+ *
+ * @return Seconds since an arbitrary fixed point
+ *
+ * @note Unlike start_timer, which counts the CPU time of all threads, this
+ *       measures real time, so it is the one to use for multithreaded code.
+ *
+ * @author Damian Kusnik
+ */
+
+double
+get_wall_time ( void )
+{
+ struct timespec ts;
+
+ clock_gettime ( CLOCK_MONOTONIC, &ts );
+
+ return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/**
+ * @brief Returns an identifier of the calling OS thread
+ *
+ * @return Thread id [ > 0 ]
+ *
+ * @note Unlike omp_get_thread_num this tells apart threads of different
+ *       parallel regions and threads not started by OpenMP. Outside Linux
+ *       all threads get 1.
+ *
+ * @author Damian Kusnik
+ */
+
+long
+get_thread_id ( void )
+{
+#ifdef __linux__
+ return syscall ( SYS_gettid );
+#else
+ return 1;
+#endif
+}
+
+/**
+ * @brief Returns the value of the CPU cycle counter
+ *
+ * @return Cycle count, or 0 if the CPU has no counter this can read
+ *
+ * @note Reads the time-stamp counter on x86, which ticks at a constant
+ *       rate rather than at the current core clock; only differences
+ *       between two reads on the same core are meaningful.
+ *
+ * @author Damian Kusnik
+ */
+
+double
+get_cycle_count ( void )
+{
+#if defined ( __i386__ ) || defined ( __x86_64__ )
+ return ( double ) __rdtsc (  );
+#else
+ return 0.0;
+#endif
+}
+
 /** 
  * @brief Generates a 1D Gaussian mask
  *